@@ -20,7 +20,7 @@
 #include "malloc_monitor.h"
 
 #define DAEMON_HELLO_SIG "Malloc Monitor!"
-#define DAEMON_PROTOCOL_VERSION 1
+#define DAEMON_PROTOCOL_VERSION 2
 
 /* sizes are checked at runtime... */
 typedef unsigned int uint32;
@@ -83,6 +83,11 @@ typedef unsigned char uint8;
         /* !!! FIXME */
     } /* reset_tick_base */
 
+    static inline void get_tick_base(uint32 *sec, uint32 *usec)
+    {
+        *sec = *usec = 0;  /* !!! FIXME: "unknown" for now. */
+    } /* get_tick_base */
+
     static inline tick_t get_ticks(void)
     {
         /* !!! FIXME */
@@ -123,6 +128,13 @@ typedef unsigned char uint8;
         gettimeofday(&tickbase, NULL);
     } /* reset_tick_base */
 
+    /* wall clock time at tick zero, so dumps can be lined up later. */
+    static inline void get_tick_base(uint32 *sec, uint32 *usec)
+    {
+        *sec = (uint32) tickbase.tv_sec;
+        *usec = (uint32) tickbase.tv_usec;
+    } /* get_tick_base */
+
     static inline tick_t get_ticks(void)
     {
         struct timeval curtime;
@@ -334,7 +346,10 @@ static inline int daemon_write_handshake(const char *id)
     uint8 byteorder = (is_bigendian() ? 1 : 0);
     char fname[512];
     uint32 pid = (uint32) getpid();
+    uint32 sec, usec;
     get_process_filename(fname, sizeof (fname));
+    reset_tick_base();
+    get_tick_base(&sec, &usec);
 
     /* if the server drops us, daemon_write_* cleans up. */
     if (!daemon_write_asciz(DAEMON_HELLO_SIG)) return(0);
@@ -344,8 +359,8 @@ static inline int daemon_write_handshake(const char *id)
     if (!daemon_write_asciz(id)) return(0);
     if (!daemon_write_asciz(fname)) return(0);
     if (!daemon_write_ui32(pid)) return(0);
-
-    reset_tick_base();
+    if (!daemon_write_ui32(sec)) return(0);
+    if (!daemon_write_ui32(usec)) return(0);
 
     return(1);
 } /* daemon_write_handshake */
@@ -0,0 +1,591 @@
+/*
+ * Load generator for the Malloc Monitor daemon.
+ *
+ * This pretends to be a bunch of monitored processes at once: each
+ *  simulated client connects to the daemon, sends the same handshake that
+ *  malloc_monitor_client.c does, and then streams synthetic malloc,
+ *  realloc and free operations at a fixed rate (or as fast as the daemon
+ *  will take them). The callstacks come from a pool of fake call trees that
+ *  share common ancestry, like real programs do, and the pointers come from
+ *  a fake heap, so frees and reallocs refer to blocks that are actually
+ *  live.
+ *
+ * At the end it reports how many operations per second the daemon actually
+ *  absorbed, how far behind it fell, how much CPU it burned per million
+ *  operations (if you tell us its process id), and how many connections
+ *  were lost.
+ *
+ * Usage: malloc_monitor_loadgen [--host=127.0.0.1] [--port=22222]
+ *            [--clients=4] [--rate=10000] [--seconds=10]
+ *            [--stacks=256] [--daemon-pid=1234]
+ *
+ *  --rate is operations per second, per client. Zero means "don't throttle."
+ *
+ * Written by Ryan C. Gordon (icculus@icculus.org)
+ *
+ * Please see the file LICENSE in the source's root directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+
+#include "malloc_monitor.h"
+
+#define DAEMON_HELLO_SIG "Malloc Monitor!"
+#define DAEMON_PROTOCOL_VERSION 2
+
+/* sizes are checked at runtime... */
+typedef unsigned int uint32;
+typedef uint32 tick_t;  /* milliseconds since initial connect to daemon. */
+typedef unsigned char uint8;
+
+/* matches monitor_operation_t in malloc_monitor_client.c ... */
+#define MONITOR_OP_GOODBYE 1
+#define MONITOR_OP_MALLOC 2
+#define MONITOR_OP_REALLOC 3
+#define MONITOR_OP_FREE 5
+
+#define MAX_FRAMES 32
+#define MAX_LIVE_BLOCKS 8192
+#define SEND_BUFFER_SIZE (64 * 1024)
+
+static const char *host = "127.0.0.1";
+static int port = MALLOCMONITOR_DEFAULT_PORT;
+static int total_clients = 4;
+static double rate = 10000.0;
+static double seconds = 10.0;
+static int total_stacks = 256;
+static pid_t daemon_pid = 0;
+
+/* What each simulated client reports back to the parent process. */
+typedef struct
+{
+    double ops;
+    double bytes;
+    double send_seconds;   /* from first op until the last one was sent. */
+    double drain_seconds;  /* from last op sent until daemon hung up. */
+    double max_behind;     /* worst we fell behind schedule, in seconds. */
+    int connected;
+    int dropped;
+} ClientResult;
+
+
+static double now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return(((double) tv.tv_sec) + (((double) tv.tv_usec) / 1000000.0));
+} /* now */
+
+
+static inline int is_bigendian(void)
+{
+    uint32 x = 0x01000000;
+    return(*((unsigned char *) &x));
+} /* is_bigendian */
+
+
+/* cheap, decent, and the same sequence every run. */
+static uint32 rngstate = 0x12345678;
+static inline uint32 rng(void)
+{
+    rngstate ^= rngstate << 13;
+    rngstate ^= rngstate >> 17;
+    rngstate ^= rngstate << 5;
+    return(rngstate);
+} /* rng */
+
+
+/*
+ * Fake callstacks. Every stack is built by walking down a fake call tree
+ *  from "main", so stacks share their outer frames the way real ones do,
+ *  which is what the daemon and the visualizer's callstack dedup see in
+ *  practice. Stored innermost frame first, like backtrace() gives us.
+ */
+static void **stacks = NULL;
+static int *stack_depths = NULL;
+
+static void build_stacks(void)
+{
+    const size_t text_base = (size_t) 0x400000;
+    int i, j;
+
+    stacks = (void **) malloc(sizeof (void *) * MAX_FRAMES * total_stacks);
+    stack_depths = (int *) malloc(sizeof (int) * total_stacks);
+    if ((stacks == NULL) || (stack_depths == NULL))
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    } /* if */
+
+    for (i = 0; i < total_stacks; i++)
+    {
+        void **frames = stacks + (i * MAX_FRAMES);
+        int depth = 6 + (rng() % (MAX_FRAMES - 6));
+        size_t node = 0;
+        stack_depths[i] = depth;
+        for (j = depth - 1; j >= 0; j--)
+        {
+            /* few choices near main, more as we go deeper. */
+            node = (node * 4) + (rng() % (2 + (depth - j)));
+            frames[j] = (void *) (text_base + ((node * 0x9E37) & 0xFFFFF));
+        } /* for */
+    } /* for */
+} /* build_stacks */
+
+
+/* Popular stacks are much more popular than the rest, like in real life. */
+static inline int pick_stack(void)
+{
+    uint32 r = rng() % total_stacks;
+    return((int) ((r * r) / total_stacks));
+} /* pick_stack */
+
+
+typedef struct
+{
+    int fd;
+    char buf[SEND_BUFFER_SIZE];
+    size_t buflen;
+    double bytes;
+    struct timeval tickbase;  /* when tick zero was, for the handshake. */
+} Connection;
+
+static int flush_connection(Connection *c)
+{
+    char *ptr = c->buf;
+    while (c->buflen > 0)
+    {
+        ssize_t rc = send(c->fd, ptr, c->buflen, MSG_NOSIGNAL);
+        if (rc <= 0)
+        {
+            if ((rc == -1) && (errno == EINTR))
+                continue;
+            return(0);
+        } /* if */
+        c->bytes += (double) rc;
+        c->buflen -= rc;
+        ptr += rc;
+    } /* while */
+    return(1);
+} /* flush_connection */
+
+static inline int put(Connection *c, const void *data, size_t len)
+{
+    if ((c->buflen + len) > sizeof (c->buf))
+    {
+        if (!flush_connection(c))
+            return(0);
+    } /* if */
+
+    memcpy(c->buf + c->buflen, data, len);
+    c->buflen += len;
+    return(1);
+} /* put */
+
+static inline int put_ui8(Connection *c, uint8 ui8)
+{
+    return(put(c, &ui8, sizeof (ui8)));
+} /* put_ui8 */
+
+static inline int put_ui32(Connection *c, uint32 ui32)
+{
+    return(put(c, &ui32, sizeof (ui32)));
+} /* put_ui32 */
+
+static inline int put_ptr(Connection *c, const void *ptr)
+{
+    return(put(c, &ptr, sizeof (ptr)));
+} /* put_ptr */
+
+static inline int put_sizet(Connection *c, size_t s)
+{
+    return(put(c, &s, sizeof (s)));
+} /* put_sizet */
+
+static inline int put_callstack(Connection *c)
+{
+    int idx = pick_stack();
+    int depth = stack_depths[idx];
+    if (!put_ui32(c, (uint32) depth)) return(0);
+    return(put(c, stacks + (idx * MAX_FRAMES), depth * sizeof (void *)));
+} /* put_callstack */
+
+
+static int connect_to_daemon(Connection *c, int clientnum)
+{
+    struct sockaddr_in addr;
+    struct hostent *hostent;
+    char id[64];
+    int one = 1;
+
+    hostent = gethostbyname(host);
+    if (hostent == NULL)
+    {
+        fprintf(stderr, "gethostbyname('%s') failed\n", host);
+        return(0);
+    } /* if */
+
+    c->fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (c->fd == -1)
+        return(0);
+
+    memset(&addr, '\0', sizeof (addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short) port);
+    memcpy(&addr.sin_addr, hostent->h_addr_list[0], sizeof (addr.sin_addr));
+    if (connect(c->fd, (struct sockaddr *) &addr, sizeof (addr)) == -1)
+    {
+        int e = errno;
+        fprintf(stderr, "client %d: connect() failed: %s\n",
+                clientnum, strerror(e));
+        close(c->fd);
+        c->fd = -1;
+        return(0);
+    } /* if */
+
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof (one));
+
+    snprintf(id, sizeof (id), "loadgen%d", clientnum);
+    put(c, DAEMON_HELLO_SIG, strlen(DAEMON_HELLO_SIG) + 1);
+    put_ui8(c, DAEMON_PROTOCOL_VERSION);
+    put_ui8(c, (uint8) (is_bigendian() ? 1 : 0));
+    put_ui8(c, (uint8) sizeof (void *));
+    put(c, id, strlen(id) + 1);
+    put(c, "/usr/bin/loadgen", strlen("/usr/bin/loadgen") + 1);
+    put_ui32(c, (uint32) (getpid()));
+    gettimeofday(&c->tickbase, NULL);
+    put_ui32(c, (uint32) c->tickbase.tv_sec);
+    put_ui32(c, (uint32) c->tickbase.tv_usec);
+    return(flush_connection(c));
+} /* connect_to_daemon */
+
+
+static void run_client(int clientnum, ClientResult *result)
+{
+    static Connection conn;
+    static size_t live_ptr[MAX_LIVE_BLOCKS];
+    static size_t live_size[MAX_LIVE_BLOCKS];
+    Connection *c = &conn;
+    size_t heap = (size_t) 0x10000000;
+    int live = 0;
+    double start, behind;
+    double ops = 0.0;
+    int ok = 1;
+
+    memset(result, '\0', sizeof (*result));
+    rngstate ^= (uint32) (clientnum * 0x9E3779B9);
+    memset(c, '\0', sizeof (*c));
+
+    if (!connect_to_daemon(c, clientnum))
+    {
+        result->dropped = 1;
+        return;
+    } /* if */
+
+    result->connected = 1;
+    start = ((double) c->tickbase.tv_sec) +
+            (((double) c->tickbase.tv_usec) / 1000000.0);
+    while (ok)
+    {
+        double t = now();
+        double elapsed = t - start;
+        tick_t ticks = (tick_t) (elapsed * 1000.0);
+        uint32 r;
+
+        if (elapsed >= seconds)
+            break;
+
+        if (rate > 0.0)
+        {
+            double due = ops / rate;
+            if (due > elapsed)  /* ahead of schedule; let the daemon breathe. */
+            {
+                ok = flush_connection(c);
+                if (due - elapsed > 0.001)
+                    usleep((useconds_t) ((due - elapsed) * 1000000.0));
+                continue;
+            } /* if */
+
+            behind = elapsed - due;
+            if (behind > result->max_behind)
+                result->max_behind = behind;
+        } /* if */
+
+        r = rng() % 100;
+        if ((live == 0) || ((r < 50) && (live < MAX_LIVE_BLOCKS)))
+        {
+            size_t s = 16 + (rng() % 1024);
+            live_ptr[live] = heap;
+            live_size[live] = s;
+            heap += (s + 15) & ~((size_t) 15);
+            live++;
+            ok = ok && put_ui8(c, MONITOR_OP_MALLOC);
+            ok = ok && put_ui32(c, ticks);
+            ok = ok && put_sizet(c, s);
+            ok = ok && put_ptr(c, (void *) live_ptr[live-1]);
+            ok = ok && put_callstack(c);
+        } /* if */
+
+        else if (r < 60)
+        {
+            int i = rng() % live;
+            size_t s = 16 + (rng() % 4096);
+            size_t p = live_ptr[i];
+            if (s > live_size[i])  /* pretend it had to move. */
+            {
+                live_ptr[i] = heap;
+                heap += (s + 15) & ~((size_t) 15);
+            } /* if */
+            live_size[i] = s;
+            ok = ok && put_ui8(c, MONITOR_OP_REALLOC);
+            ok = ok && put_ui32(c, ticks);
+            ok = ok && put_ptr(c, (void *) p);
+            ok = ok && put_sizet(c, s);
+            ok = ok && put_ptr(c, (void *) live_ptr[i]);
+            ok = ok && put_callstack(c);
+        } /* else if */
+
+        else
+        {
+            int i = rng() % live;
+            ok = ok && put_ui8(c, MONITOR_OP_FREE);
+            ok = ok && put_ui32(c, ticks);
+            ok = ok && put_ptr(c, (void *) live_ptr[i]);
+            ok = ok && put_callstack(c);
+            live--;
+            live_ptr[i] = live_ptr[live];
+            live_size[i] = live_size[live];
+        } /* else */
+
+        ops += 1.0;
+    } /* while */
+
+    ok = ok && put_ui8(c, MONITOR_OP_GOODBYE);
+    ok = ok && flush_connection(c);
+    result->send_seconds = now() - start;
+    result->ops = ops;
+    result->bytes = c->bytes;
+
+    if (!ok)
+        result->dropped = 1;
+    else
+    {
+        /*
+         * The daemon hangs up after it has processed our GOODBYE, so the
+         *  time until then is how far behind us it was running.
+         */
+        double sent = now();
+        char ch;
+        shutdown(c->fd, SHUT_WR);
+        while (recv(c->fd, &ch, sizeof (ch), 0) > 0) { /* spin. */ }
+        result->drain_seconds = now() - sent;
+    } /* else */
+
+    close(c->fd);
+} /* run_client */
+
+
+/* user+system time, including reaped children, in seconds. */
+static double daemon_cpu_seconds(void)
+{
+    char fname[64];
+    char buf[1024];
+    unsigned long utime, stime;
+    long cutime, cstime;
+    FILE *io;
+    char *ptr;
+
+    if (daemon_pid == 0)
+        return(0.0);
+
+    snprintf(fname, sizeof (fname), "/proc/%d/stat", (int) daemon_pid);
+    io = fopen(fname, "r");
+    if (io == NULL)
+        return(0.0);
+    ptr = fgets(buf, sizeof (buf), io);
+    fclose(io);
+    if (ptr == NULL)
+        return(0.0);
+
+    /* skip "pid (comm) state"; comm may have spaces in it. */
+    ptr = strrchr(buf, ')');
+    if (ptr == NULL)
+        return(0.0);
+
+    if (sscanf(ptr + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+                        "%lu %lu %ld %ld",
+                        &utime, &stime, &cutime, &cstime) != 4)
+        return(0.0);
+
+    return(((double) (utime + stime + cutime + cstime)) /
+           ((double) sysconf(_SC_CLK_TCK)));
+} /* daemon_cpu_seconds */
+
+
+static void parse_cmdline(int argc, char **argv)
+{
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        if (strncmp(arg, "--host=", 7) == 0)
+            host = arg + 7;
+        else if (strncmp(arg, "--port=", 7) == 0)
+            port = atoi(arg + 7);
+        else if (strncmp(arg, "--clients=", 10) == 0)
+            total_clients = atoi(arg + 10);
+        else if (strncmp(arg, "--rate=", 7) == 0)
+            rate = atof(arg + 7);
+        else if (strncmp(arg, "--seconds=", 10) == 0)
+            seconds = atof(arg + 10);
+        else if (strncmp(arg, "--stacks=", 9) == 0)
+            total_stacks = atoi(arg + 9);
+        else if (strncmp(arg, "--daemon-pid=", 13) == 0)
+            daemon_pid = (pid_t) atoi(arg + 13);
+        else
+        {
+            fprintf(stderr, "Unknown command line \"%s\".\n", arg);
+            exit(1);
+        } /* else */
+    } /* for */
+
+    if ((total_clients <= 0) || (total_stacks <= 0) || (seconds <= 0.0))
+    {
+        fprintf(stderr, "--clients, --stacks and --seconds must be > 0\n");
+        exit(1);
+    } /* if */
+} /* parse_cmdline */
+
+
+int main(int argc, char **argv)
+{
+    ClientResult total;
+    double cpu_before, cpu_after, start, elapsed;
+    double max_drain = 0.0;
+    double max_behind = 0.0;
+    int *pipes;
+    int i;
+
+    parse_cmdline(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    build_stacks();
+
+    pipes = (int *) malloc(sizeof (int) * total_clients);
+    if (pipes == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return(1);
+    } /* if */
+
+    printf("Malloc Monitor load generator: %d clients, %s%.0f ops/sec each,"
+           " %.1f seconds, against %s:%d\n", total_clients,
+           (rate > 0.0) ? "" : "unthrottled, ", rate, seconds, host, port);
+
+    cpu_before = daemon_cpu_seconds();
+    start = now();
+
+    /* each simulated client gets its own process, like the real thing. */
+    for (i = 0; i < total_clients; i++)
+    {
+        int fds[2];
+        pid_t pid;
+
+        if (pipe(fds) == -1)
+        {
+            fprintf(stderr, "pipe() failed: %s\n", strerror(errno));
+            return(1);
+        } /* if */
+
+        pid = fork();
+        if (pid == -1)
+        {
+            fprintf(stderr, "fork() failed: %s\n", strerror(errno));
+            return(1);
+        } /* if */
+
+        if (pid == 0)  /* child. */
+        {
+            ClientResult result;
+            close(fds[0]);
+            run_client(i, &result);
+            if (write(fds[1], &result, sizeof (result)) != sizeof (result))
+                _exit(1);
+            _exit(0);
+        } /* if */
+
+        close(fds[1]);
+        pipes[i] = fds[0];
+    } /* for */
+
+    memset(&total, '\0', sizeof (total));
+    for (i = 0; i < total_clients; i++)
+    {
+        ClientResult result;
+        if (read(pipes[i], &result, sizeof (result)) != sizeof (result))
+        {
+            result.connected = 0;
+            result.dropped = 1;
+            result.ops = result.bytes = 0.0;
+            result.drain_seconds = result.max_behind = 0.0;
+        } /* if */
+        close(pipes[i]);
+
+        total.ops += result.ops;
+        total.bytes += result.bytes;
+        total.connected += result.connected;
+        total.dropped += result.dropped;
+        if (result.drain_seconds > max_drain)
+            max_drain = result.drain_seconds;
+        if (result.max_behind > max_behind)
+            max_behind = result.max_behind;
+    } /* for */
+
+    while (wait(NULL) > 0) { /* reap kids. */ }
+    elapsed = now() - start;
+
+    /* give the daemon a moment to reap its own kids, so their CPU counts. */
+    if (daemon_pid != 0)
+        sleep(1);
+    cpu_after = daemon_cpu_seconds();
+
+    printf("\n");
+    printf("  connections: %d made, %d dropped\n",
+            total.connected, total.dropped);
+    printf("  operations sent: %.0f (%.1f MB)\n",
+            total.ops, total.bytes / (1024.0 * 1024.0));
+    printf("  offered rate: %.0f ops/sec\n",
+            (rate > 0.0) ? rate * total_clients : total.ops / seconds);
+    printf("  sustained ingest rate: %.0f ops/sec (%.2f MB/sec)\n",
+            total.ops / elapsed, (total.bytes / (1024.0 * 1024.0)) / elapsed);
+    printf("  worst lag behind schedule: %.3f seconds\n", max_behind);
+    printf("  daemon lag at end of run: %.3f seconds\n", max_drain);
+
+    if (daemon_pid == 0)
+        printf("  daemon CPU: unknown (use --daemon-pid)\n");
+    else if (total.ops > 0.0)
+    {
+        double cpu = cpu_after - cpu_before;
+        printf("  daemon CPU: %.2f seconds, %.2f seconds per million ops\n",
+                cpu, cpu / (total.ops / 1000000.0));
+    } /* else if */
+
+    free(pipes);
+    return((total.dropped > 0) ? 2 : 0);
+} /* main */
+
+/* end of malloc_monitor_loadgen.c ... */
+
@@ -14,7 +14,7 @@ use warnings;           # don't touch this line, either.
 use IO::Select;         # bleh.
 
 my $version = '0.0.1';
-my $protocol_version = 1;
+my $protocol_version = 2;  # we still take version 1 clients, too.
 
 #-----------------------------------------------------------------------------#
 #             CONFIGURATION VARIABLES: Change to suit your needs...           #
@@ -84,6 +84,66 @@ my $max_request_size = 512;
 # You can screw up your output with this, if you like.
 my $debug = 0;
 
+# Set this to a directory to have the daemon store what clients send it.
+#  Each connection is written as a series of "segments," each a complete
+#  dumpfile on its own, plus a small text index that maps segments to their
+#  timestamp and operation ranges. The visualizer's DumpFile class can open
+#  that index and load just a range of time out of it. Set to undef to
+#  throw the data away (which is what the daemon used to do).
+my $dump_dir = undef;
+
+# A new segment is started when the current one gets this big (in bytes) or
+#  this old (in seconds), whichever comes first. Set either to undef to
+#  ignore that limit.
+my $segment_size = 64 * 1024 * 1024;
+my $segment_seconds = 60 * 60;
+
+# Old segments are deleted when everything in $dump_dir adds up to more than
+#  $disk_quota bytes, or when a segment is older than $retention_seconds.
+#  Set either to undef for no limit. A connection's current segment is never
+#  deleted out from under it.
+my $disk_quota = undef;
+my $retention_seconds = undef;
+
+# How often, in seconds, a connection rewrites its index file, so that
+#  people looking at a live capture see reasonably fresh ranges.
+my $index_update_seconds = 10;
+
+# Set this to a directory to have each connection keep live statistics
+#  (live bytes and blocks, allocation rate, callstacks holding the most
+#  memory) and answer questions about them on a Unix socket in $query_dir,
+#  named after the connection like its segments are: the client id, then
+#  the start time and the daemon's pid ("<clientid>-<time><pid>.sock").
+#  Connect to it, send one line, read the answer until the daemon hangs up:
+#
+#    stats              - live bytes/blocks, totals, recent allocation rate.
+#    top <n>            - the <n> callstacks holding the most live bytes.
+#    timeline <minutes> - live bytes once a second for the last <minutes>.
+#
+#  Set to undef to skip this; it costs a hash entry per live block.
+my $query_dir = undef;
+
+# A query that connects but hasn't sent its whole line after this many
+#  seconds gets an answer to whatever it did send. Queries are read without
+#  blocking, so a slow one never holds up the client in the meantime.
+my $query_timeout = 5;
+
+# How much live bytes history, in seconds, each connection keeps for
+#  "timeline" queries.
+my $timeline_seconds = 60 * 60;
+
+# Copy everything each client sends, byte for byte, somewhere else as it
+#  arrives: "file:/path", "fifo:/path", "unix:/path/to/socket" or
+#  "tcp:host:port" (another collector, say). "%c" in a path is replaced
+#  with the client's id, "%t" with the time the connection started. Each
+#  destination gets its own queue, so a slow one doesn't hold up the client
+#  or the others; one that falls more than $tee_buffer_limit bytes behind
+#  is cut off. When the client hangs up, we give the stragglers
+#  $tee_flush_seconds to catch up.
+my @tee_sinks = ();
+my $tee_buffer_limit = 16 * 1024 * 1024;
+my $tee_flush_seconds = 10;
+
 
 #-----------------------------------------------------------------------------#
 #     The rest is probably okay without you laying yer dirty mits on it.      #
@@ -106,6 +166,28 @@ sub debug {
     syslogwarn($str) if ($debug);
 }
 
+# Everything from the client goes through here, read in big chunks instead
+#  of a syscall per field. Each chunk is also handed, as-is, to any tee
+#  destinations (see tee_chunk()).
+my $inbuf = '';
+my $inbuf_pos = 0;
+
+sub inbuf_available {
+    return(length($inbuf) - $inbuf_pos);
+}
+
+sub fill_inbuf {
+    my $chunk;
+    my $rc = sysread(STDIN, $chunk, 64 * 1024);
+    return 0 if ((not defined $rc) or ($rc == 0));
+
+    substr($inbuf, 0, $inbuf_pos, '');  # drop what we've already used.
+    $inbuf_pos = 0;
+    $inbuf .= $chunk;
+    tee_chunk(\$chunk);
+    return 1;
+}
+
 sub read_block {
     my $maxchars = shift;
     my $terminator = shift;
@@ -123,15 +205,16 @@ sub read_block {
     }
 
     while (1) {
-        if (defined $read_timeout) {
-            my $ready = scalar($s->can_read($read_timeout - $elapsed));
-            return undef if (not $ready);
-            $elapsed = (time() - $starttime);
+        if (inbuf_available() == 0) {
+            if (defined $read_timeout) {
+                my $ready = scalar($s->can_read($read_timeout - $elapsed));
+                return undef if (not $ready);
+                $elapsed = (time() - $starttime);
+            }
+            return undef if (not fill_inbuf());
         }
 
-        my $ch;
-        my $rc = sysread(STDIN, $ch, 1);
-        return undef if ($rc != 1);
+        my $ch = substr($inbuf, $inbuf_pos++, 1);
         return $retval if ((defined $terminator) and ($ch eq $terminator));
         $retval .= $ch;
         $count++;
@@ -147,6 +230,10 @@ my $unpackui16 = 'v';
 my $unpackui32 = 'V';
 my $unpackui64 = 'Q';  # !!! FIXME!
 
+# Raw bytes of the operation currently being read, so we can write them
+#  to disk verbatim once the whole thing has arrived.
+my $opbytes = '';
+
 sub read_ui8_timeout {
     # respects predefined timeout, but is too slow for continual use.
     my $byte = read_block(1);
@@ -154,27 +241,38 @@ sub read_ui8_timeout {
     return(scalar(unpack('C', $byte)));
 }
 
+# Data can show up in dribs and drabs on a socket or pipe, so keep at it
+#  until we have everything or the other end goes away.
+sub read_exact {
+    my $len = shift;
+    return undef if (not wait_for_client($len));
+    my $bytes = substr($inbuf, $inbuf_pos, $len);
+    $inbuf_pos += $len;
+    $opbytes .= $bytes;
+    return $bytes;
+}
+
 sub read_ui8 {
-    my $byte;
-    return undef if (sysread(STDIN, $byte, 1) != 1);
+    my $byte = read_exact(1);
+    return undef if (not defined $byte);
     return(scalar(unpack('C', $byte)));
 }
 
 sub read_ui16 {
-    my $bytes;
-    return undef if (sysread(STDIN, $bytes, 2) != 2);
+    my $bytes = read_exact(2);
+    return undef if (not defined $bytes);
     return(scalar(unpack($unpackui16, $bytes)));
 }
 
 sub read_ui32 {
-    my $bytes;
-    return undef if (sysread(STDIN, $bytes, 4) != 4);
+    my $bytes = read_exact(4);
+    return undef if (not defined $bytes);
     return(scalar(unpack($unpackui32, $bytes)));
 }
 
 sub read_ui64 {
-    my $bytes;
-    return undef if (sysread(STDIN, $bytes, 8) != 8);
+    my $bytes = read_exact(8);
+    return undef if (not defined $bytes);
     return(scalar(unpack($unpackui64, $bytes)));
 }
 
@@ -252,7 +350,20 @@ my $bigendian = 0;
 my $sizeofptr = 0;
 my $monitor_client_fname = '';
 my $monitor_client_pid = 0;
+my $monitor_client_prot = 0;
+my $monitor_client_tickbase = '';  # packed wall clock time at tick zero.
 my $monitor_client_id = '';
+my $handshake_bytes = '';
+my $connection_started = 0;
+
+# What this connection's files are called: the client's id, then when the
+#  connection started. Two connections with the same id can start in the
+#  same second, so this child's pid goes after the start time, zero-padded
+#  to a fixed width (pid_max is never more than 2^22) so different times
+#  and pids can't run together into the same digits.
+sub connection_name {
+    return sprintf("%s-%d%07d", $monitor_client_id, $connection_started, $$);
+}
 
 sub read_handshake {
     my $hello = read_block(16, "\0");
@@ -260,7 +371,7 @@ sub read_handshake {
 
     my $prot = read_ui8_timeout();
     return 0 if (not defined $prot);
-    if ($prot != $protocol_version) {
+    if (($prot < 1) or ($prot > $protocol_version)) {
         syslogwarn("Protocol version $prot, wanted $protocol_version");
         return 0;
     }
@@ -282,24 +393,449 @@ sub read_handshake {
     # !!! TODO my $passwd = read_block(64, "\0");
     $monitor_client_id = read_block(64, "\0");
     return 0 if (not defined $monitor_client_id);
-    return 0 if (not $monitor_client_id =~ /\A[a-zA-Z0-9]+\Z/);
+    return 0 if (not $monitor_client_id =~ /\A([a-zA-Z0-9]+)\Z/);
+    $monitor_client_id = $1;  # untaint it, since it names files on disk.
     $monitor_client_fname = read_block(1024, "\0");
     return 0 if (not defined $monitor_client_fname);
     $monitor_client_pid = read_ui32();
     return 0 if (not defined $monitor_client_pid);
+
+    # version 2 adds the wall clock time (seconds, microseconds) that the
+    #  client's tick zero happened at, so dumps can be lined up later.
+    $monitor_client_tickbase = '';
+    if ($prot >= 2) {
+        $monitor_client_tickbase = read_exact(8);
+        return 0 if (not defined $monitor_client_tickbase);
+    }
+    $monitor_client_prot = $prot;
+
+    # keep a copy to put at the start of every segment we write.
+    $handshake_bytes = "Malloc Monitor!\0" .
+                       pack('CCC', $prot, $bigendian, $sizeofptr) .
+                       "$monitor_client_id\0$monitor_client_fname\0" .
+                       pack($unpackui32, $monitor_client_pid) .
+                       $monitor_client_tickbase;
     return 1;
 }
 
 
+# Returns a string that identifies the callstack if we're keeping live
+#  statistics (frames in hex, innermost first), an empty string otherwise.
 sub read_callstack {
     my $count = read_ui32();
-    syslogwarn("unexpected connection drop") if not defined $count;
+    if (not defined $count) {
+        syslogwarn("unexpected connection drop");
+        return undef;
+    }
 
+    my $key = '';
     while ($count) {
-        my $frame = read_ptr();
-        syslogwarn("unexpected connection drop") if not defined $frame;
+        my $frame = (($sizeofptr == 4) ? read_ui32() : read_ui64());
+        if (not defined $frame) {
+            syslogwarn("unexpected connection drop");
+            return undef;
+        }
+        $key .= sprintf('%x ', $frame) if (defined $query_dir);
         $count--;
     }
+    return $key;
+}
+
+
+# Live statistics. Every live block remembers its size and which callstack
+#  allocated it, so we can keep per-callstack totals as blocks come and go.
+my %live_block_size = ();
+my %live_block_stack = ();
+my %stack_live_bytes = ();
+my %stack_live_blocks = ();
+my $live_bytes = 0;
+my $live_blocks = 0;
+my $total_allocs = 0;
+my $total_frees = 0;
+my @timeline = ();  # [ time, live bytes, live blocks, allocations ]
+
+sub sample_timeline {
+    my $now = time();
+    if ((not @timeline) or ($timeline[-1]->[0] != $now)) {
+        push @timeline, [ $now, $live_bytes, $live_blocks, 0 ];
+        my $oldest = $now - $timeline_seconds;
+        shift @timeline while ($timeline[0]->[0] <= $oldest);
+    } else {
+        $timeline[-1]->[1] = $live_bytes;
+        $timeline[-1]->[2] = $live_blocks;
+    }
+}
+
+sub live_add_block {
+    my ($ptr, $size, $stack) = @_;
+    # already live? Then we missed its free (or the client did); don't
+    #  count a free we never saw, just stop counting the old block.
+    live_forget_block($ptr);
+    $live_block_size{$ptr} = $size;
+    $live_block_stack{$ptr} = $stack;
+    $stack_live_bytes{$stack} += $size;
+    $stack_live_blocks{$stack}++;
+    $live_bytes += $size;
+    $live_blocks++;
+    $total_allocs++;
+    sample_timeline();
+    $timeline[-1]->[3]++;
+}
+
+# Takes a block out of the live totals. Returns zero if it wasn't live.
+sub live_forget_block {
+    my $ptr = shift;
+    my $size = delete $live_block_size{$ptr};
+    return 0 if (not defined $size);  # we never saw this one allocated.
+    my $stack = delete $live_block_stack{$ptr};
+    $stack_live_bytes{$stack} -= $size;
+    if (--$stack_live_blocks{$stack} == 0) {
+        delete $stack_live_bytes{$stack};
+        delete $stack_live_blocks{$stack};
+    }
+    $live_bytes -= $size;
+    $live_blocks--;
+    return 1;
+}
+
+sub live_remove_block {
+    my $ptr = shift;
+    return if (not live_forget_block($ptr));
+    $total_frees++;
+    sample_timeline();
+}
+
+sub live_malloc {
+    my ($size, $rc, $stack) = @_;
+    live_add_block($rc, $size, $stack) if ($rc != 0);
+}
+
+sub live_realloc {
+    my ($ptr, $size, $rc, $stack) = @_;
+    return if (($size != 0) and ($rc == 0));  # failed; (ptr) is still live.
+    live_remove_block($ptr) if ($ptr != 0);
+    live_add_block($rc, $size, $stack) if ($size != 0);
+}
+
+sub live_free {
+    my $ptr = shift;
+    live_remove_block($ptr) if ($ptr != 0);
+}
+
+sub query_stats {
+    my $now = time();
+    my $recent = 0;
+    my $seconds = 60;
+    foreach (reverse @timeline) {
+        last if ($_->[0] <= ($now - $seconds));
+        $recent += $_->[3];
+    }
+
+    return "client\t$monitor_client_id\n" .
+           "pid\t$monitor_client_pid\n" .
+           "live_bytes\t$live_bytes\n" .
+           "live_blocks\t$live_blocks\n" .
+           "total_allocs\t$total_allocs\n" .
+           "total_frees\t$total_frees\n" .
+           "callstacks\t" . scalar(keys(%stack_live_bytes)) . "\n" .
+           sprintf("allocs_per_second\t%.2f\n", $recent / $seconds);
+}
+
+sub query_top {
+    my $count = shift;
+    my @stacks = sort {
+        $stack_live_bytes{$b} <=> $stack_live_bytes{$a}
+    } keys(%stack_live_bytes);
+    splice(@stacks, $count) if (scalar(@stacks) > $count);
+
+    my $retval = '';
+    foreach (@stacks) {
+        my $frames = $_;
+        $frames =~ s/\s+\Z//;
+        $retval .= "$stack_live_bytes{$_}\t$stack_live_blocks{$_}\t";
+        $retval .= "$frames\n";
+    }
+    return $retval;
+}
+
+sub query_timeline {
+    my $minutes = shift;
+    my $oldest = time() - ($minutes * 60);
+    sample_timeline();  # make sure "now" is in there.
+
+    my $retval = '';
+    foreach (@timeline) {
+        next if ($_->[0] < $oldest);
+        $retval .= join("\t", @$_) . "\n";
+    }
+    return $retval;
+}
+
+
+# Tee destinations. Every sink keeps a queue of references to the chunks
+#  read from the client, so the data is shared between all of them rather
+#  than copied, plus how far into the first chunk it has written so far.
+#  Data that arrives before the handshake is done waits in @tee_pending,
+#  since we can't name files after the client before we know who it is.
+my @sinks = ();
+my @tee_pending = ();
+my $tee_open = 0;
+
+sub open_sink {
+    my $spec = shift;
+    my $fh = undef;
+
+    $spec =~ s/%c/$monitor_client_id/g;
+    $spec =~ s/%t/$connection_started/g;
+
+    if ($spec =~ /\Afile:(.+)\Z/) {
+        open($fh, '>', $1) or $fh = undef;
+    } elsif ($spec =~ /\Afifo:(.+)\Z/) {
+        use Fcntl;
+        # fails with ENXIO if nobody is reading the fifo yet.
+        sysopen($fh, $1, O_WRONLY | O_NONBLOCK) or $fh = undef;
+    } elsif ($spec =~ /\Aunix:(.+)\Z/) {
+        use IO::Socket::UNIX;
+        $fh = IO::Socket::UNIX->new(Peer => $1, Type => SOCK_STREAM);
+    } elsif ($spec =~ /\Atcp:(.+):(\d+)\Z/) {
+        use IO::Socket::INET;
+        $fh = IO::Socket::INET->new(PeerAddr => $1, PeerPort => $2,
+                                    Type => SOCK_STREAM);
+    } else {
+        syslogwarn("Don't know how to tee to '$spec'");
+        return;
+    }
+
+    if (not $fh) {
+        syslogwarn("Can't tee to '$spec': $!");
+        return;
+    }
+
+    binmode($fh);
+    $fh->blocking(0);
+    push @sinks, { name => $spec, fh => $fh, queue => [],
+                   offset => 0, queued => 0 };
+    debug(" + teeing to $spec");
+}
+
+sub drop_sink {
+    my ($sink, $why) = @_;
+    syslogwarn("Dropping tee to '$sink->{name}': $why");
+    close($sink->{fh});
+    @sinks = grep { $_ != $sink } @sinks;
+}
+
+# Write as much of this sink's queue as it'll take without blocking.
+#  Returns zero if the sink had to be dropped.
+sub flush_sink {
+    my $sink = shift;
+    my $queue = $sink->{queue};
+    while (@$queue) {
+        my $chunk = $queue->[0];
+        my $len = length($$chunk) - $sink->{offset};
+        my $rc = syswrite($sink->{fh}, $$chunk, $len, $sink->{offset});
+        if (not defined $rc) {
+            return 1 if ($!{EAGAIN} or $!{EWOULDBLOCK} or $!{EINTR});
+            drop_sink($sink, "$!");
+            return 0;
+        }
+        $sink->{queued} -= $rc;
+        if ($rc < $len) {
+            $sink->{offset} += $rc;
+            return 1;  # it's full; try again later.
+        }
+        shift @$queue;
+        $sink->{offset} = 0;
+    }
+    return 1;
+}
+
+sub tee_chunk {
+    my $chunk = shift;
+    return if (not @tee_sinks);
+
+    if (not $tee_open) {
+        push @tee_pending, $chunk;
+        return;
+    }
+
+    my @current = @sinks;  # drop_sink() changes @sinks.
+    foreach my $sink (@current) {
+        push @{$sink->{queue}}, $chunk;
+        $sink->{queued} += length($$chunk);
+        next if (not flush_sink($sink));
+        drop_sink($sink, "fell more than $tee_buffer_limit bytes behind")
+            if ($sink->{queued} > $tee_buffer_limit);
+    }
+}
+
+sub start_tee {
+    return if (not @tee_sinks);
+    $SIG{PIPE} = 'IGNORE';  # we'll get EPIPE from syswrite instead.
+    open_sink($_) foreach (@tee_sinks);
+    $tee_open = 1;
+    tee_chunk($_) foreach (@tee_pending);
+    @tee_pending = ();
+}
+
+sub sinks_waiting {
+    return grep { $_->{queued} > 0 } @sinks;
+}
+
+sub finish_tee {
+    my $deadline = time() + $tee_flush_seconds;
+    while (sinks_waiting()) {
+        my $timeout = $deadline - time();
+        last if ($timeout <= 0);
+        my $writers = new IO::Select(map { $_->{fh} } sinks_waiting());
+        my (undef, $ready) = IO::Select->select(undef, $writers, undef,
+                                                $timeout);
+        next if (not $ready);
+        foreach my $fh (@$ready) {
+            foreach (grep { $_->{fh} == $fh } @sinks) {
+                flush_sink($_);
+            }
+        }
+    }
+
+    foreach (@sinks) {
+        syslogwarn("Tee to '$_->{name}' lost $_->{queued} bytes")
+            if ($_->{queued} > 0);
+        close($_->{fh});
+    }
+    @sinks = ();
+}
+
+my $query_listener = undef;
+my $query_socket_path = undef;
+my @queries = ();  # accepted, but still sending their request.
+
+sub start_query_listener {
+    return if (not defined $query_dir);
+
+    use IO::Socket::UNIX;
+    # one per connection, since several can have the same client id. If
+    #  it's there already, it isn't ours, so leave it alone.
+    $query_socket_path = "$query_dir/" . connection_name() . '.sock';
+    $query_listener = IO::Socket::UNIX->new(Local => $query_socket_path,
+                                            Type => SOCK_STREAM,
+                                            Listen => 5);
+    if (not $query_listener) {
+        syslogwarn("couldn't create query socket $query_socket_path: $!");
+        $query_socket_path = undef;
+        return;
+    }
+
+    debug(" + answering queries at $query_socket_path");
+}
+
+sub stop_query_listener {
+    return if (not defined $query_listener);
+    close($_->{fh}) foreach (@queries);
+    @queries = ();
+    close($query_listener);
+    unlink($query_socket_path);
+    $query_listener = undef;
+}
+
+sub accept_query {
+    my $s = $query_listener->accept();
+    return if (not $s);
+    $s->blocking(0);
+    push @queries, { fh => $s, req => '', started => time() };
+}
+
+sub answer_query {
+    my $query = shift;
+    @queries = grep { $_ != $query } @queries;
+
+    my $req = $query->{req};
+    my $answer = "unknown query\n";
+    if ($req eq '') {
+        $answer = "no query\n";
+    } elsif ($req =~ /\A\s*stats\s*\Z/) {
+        $answer = query_stats();
+    } elsif ($req =~ /\A\s*top\s+(\d+)\s*\Z/) {
+        $answer = query_top($1);
+    } elsif ($req =~ /\A\s*timeline\s+(\d+)\s*\Z/) {
+        $answer = query_timeline($1);
+    }
+
+    local $SIG{PIPE} = 'IGNORE';  # if they hung up already, so be it.
+    my $s = $query->{fh};
+    $s->blocking(1);
+    print $s $answer;
+    close($s);
+}
+
+# Take whatever a query has sent so far, and answer it once we have the
+#  whole line (or it hangs up, or sends more than a request can be).
+sub read_query {
+    my $query = shift;
+    my $have = length($query->{req});
+    my $rc = sysread($query->{fh}, $query->{req},
+                     $max_request_size - $have, $have);
+    if (not defined $rc) {
+        return if ($!{EAGAIN} or $!{EWOULDBLOCK} or $!{EINTR});
+        $rc = 0;  # treat it like a hangup.
+    }
+
+    return if (($rc > 0) and ($query->{req} !~ /\n/) and
+               (length($query->{req}) < $max_request_size));
+    answer_query($query);
+}
+
+# Answer queries that have been quiet too long with whatever they sent.
+#  Returns how long until the next one runs out of time, or undef if
+#  nobody's waiting.
+sub expire_queries {
+    my $now = time();
+    # answer_query() changes @queries.
+    my @expired = grep { ($now - $_->{started}) >= $query_timeout } @queries;
+    answer_query($_) foreach (@expired);
+    return undef if (not @queries);
+    return ($queries[0]->{started} + $query_timeout) - $now;  # oldest first.
+}
+
+# Block until at least $len bytes from the client are buffered, answering
+#  queries and feeding tee destinations that were full in the meantime.
+#  Queries are read as their data shows up, never waited on, so a quiet one
+#  doesn't hold up the client. Returns zero if the client went away first.
+sub wait_for_client {
+    my $len = shift;
+    while (inbuf_available() < $len) {
+        my @waiting = sinks_waiting();
+        if ((not defined $query_listener) and (not @waiting)) {
+            return 0 if (not fill_inbuf());  # nothing else to do; block.
+            next;
+        }
+
+        my $timeout = expire_queries();
+        my $readers = new IO::Select(\*STDIN);
+        $readers->add($query_listener) if (defined $query_listener);
+        $readers->add($_->{fh}) foreach (@queries);
+        my $writers = new IO::Select(map { $_->{fh} } @waiting);
+        my ($rd, $wr) = IO::Select->select($readers, $writers, undef,
+                                           $timeout);
+        next if (not defined $rd);  # timed out (or a signal).
+
+        foreach my $fh (@$wr) {
+            foreach (grep { $_->{fh} == $fh } @sinks) {
+                flush_sink($_);
+            }
+        }
+
+        foreach my $fh (@$rd) {
+            if ($fh == \*STDIN) {
+                return 0 if (not fill_inbuf());
+            } elsif ($fh == $query_listener) {
+                accept_query();
+            } else {
+                my @ready = grep { $_->{fh} == $fh } @queries;
+                read_query($_) foreach (@ready);  # this changes @queries.
+            }
+        }
+    }
     return 1;
 }
 
@@ -342,6 +878,197 @@ use constant MONITOR_OP_REALLOC  => 3;
 use constant MONITOR_OP_MEMALIGN => 4;
 use constant MONITOR_OP_FREE     => 5;
 
+
+# Segmented storage. Each segment is a complete dumpfile (handshake and
+#  all), so any one of them can be loaded by itself if need be. The index
+#  is plain text, one tab-separated record per line, and is rewritten
+#  whole (to a temp file that is then renamed over it) as things change.
+my $segment_base = undef;
+my $segment_num = 0;
+my $segment_fh = undef;
+my $segment_fname = undef;
+my $segment_bytes = 0;
+my $segment_started = 0;
+my $segment_first_tick = undef;
+my $segment_last_tick = undef;
+my $segment_first_op = 0;
+my $segment_ops = 0;
+my $total_ops = 0;
+my $index_written = 0;
+my @closed_segments = ();
+
+sub write_index {
+    my $closed = shift;
+    my $fname = "$dump_dir/$segment_base.index";
+    my $tmpfname = "$fname.tmp";
+    my $fh;
+
+    if (not open($fh, '>', $tmpfname)) {
+        syslogwarn("Can't write '$tmpfname': $!");
+        return;
+    }
+
+    print $fh "# Malloc Monitor segment index\n";
+    print $fh "version\t1\n";
+    print $fh "id\t$monitor_client_id\n";
+    print $fh "binary\t$monitor_client_fname\n";
+    print $fh "pid\t$monitor_client_pid\n";
+    print $fh "byteorder\t$bigendian\n";
+    print $fh "sizeofptr\t$sizeofptr\n";
+    print $fh "started\t$connection_started\n";
+    foreach (@closed_segments) {
+        print $fh "segment\t$_\n";
+    }
+    if (defined $segment_fh) {
+        my $first = defined $segment_first_tick ? $segment_first_tick : 0;
+        my $last = defined $segment_last_tick ? $segment_last_tick : 0;
+        print $fh "segment\t$segment_fname\t$first\t$last\t" .
+                  "$segment_first_op\t$segment_ops\t$segment_bytes\n";
+    }
+    print $fh "closed\t" . time() . "\n" if ($closed);
+    close($fh);
+
+    rename($tmpfname, $fname) or syslogwarn("Can't rename '$tmpfname': $!");
+    $index_written = time();
+}
+
+sub close_segment {
+    return if (not defined $segment_fh);
+    close($segment_fh);
+    $segment_fh = undef;
+
+    my $first = defined $segment_first_tick ? $segment_first_tick : 0;
+    my $last = defined $segment_last_tick ? $segment_last_tick : 0;
+    push @closed_segments, "$segment_fname\t$first\t$last\t" .
+                           "$segment_first_op\t$segment_ops\t$segment_bytes";
+}
+
+sub open_segment {
+    close_segment();
+
+    $segment_base = connection_name() if (not defined $segment_base);
+    $segment_fname = sprintf("%s.%05d.dump", $segment_base, $segment_num++);
+    my $path = "$dump_dir/$segment_fname";
+    if (not open($segment_fh, '>', $path)) {
+        syslogwarn("Can't write '$path': $!");
+        $segment_fh = undef;
+        return 0;
+    }
+    binmode($segment_fh);
+
+    print $segment_fh $handshake_bytes;
+    $segment_bytes = length($handshake_bytes);
+    $segment_started = time();
+    $segment_first_tick = undef;
+    $segment_last_tick = undef;
+    $segment_first_op = $total_ops;
+    $segment_ops = 0;
+
+    write_index(0);
+    enforce_retention();
+    return 1;
+}
+
+sub segment_is_full {
+    return 1 if ((defined $segment_size) and ($segment_bytes >= $segment_size));
+    return 1 if ((defined $segment_seconds) and
+                 ((time() - $segment_started) >= $segment_seconds));
+    return 0;
+}
+
+# Call this once a complete operation (sitting in $opbytes) has been read.
+sub store_operation {
+    my $ticks = shift;
+    return if (not defined $dump_dir);
+    open_segment() if ((not defined $segment_fh) or (segment_is_full()));
+    return if (not defined $segment_fh);
+
+    print $segment_fh $opbytes;
+    $segment_bytes += length($opbytes);
+    $segment_first_tick = $ticks if (not defined $segment_first_tick);
+    $segment_last_tick = $ticks;
+    $segment_ops++;
+    $total_ops++;
+
+    write_index(0) if ((time() - $index_written) >= $index_update_seconds);
+}
+
+sub finish_storage {
+    my $goodbye = shift;
+    return if (not defined $segment_fh);
+    if ($goodbye) {
+        print $segment_fh pack('C', MONITOR_OP_GOODBYE);
+        $segment_bytes++;
+    }
+    close_segment();
+    write_index(1);
+    enforce_retention();
+}
+
+# Delete segments past their retention time, then the oldest segments
+#  until we're under the disk quota. This looks at everything in $dump_dir,
+#  so it's safe to call from any process. The newest segment of a
+#  connection that hasn't closed its index yet is left alone, since
+#  someone is still writing to it.
+sub enforce_retention {
+    return if (not defined $dump_dir);
+    return if ((not defined $disk_quota) and (not defined $retention_seconds));
+
+    my $dh;
+    opendir($dh, $dump_dir) or return;
+    my @files = readdir($dh);
+    closedir($dh);
+
+    my %newest = ();
+    my %closed = ();
+    my @segments = ();
+    my $total = 0;
+    foreach (@files) {
+        if (/\A([a-zA-Z0-9]+-\d+)\.index\Z/) {
+            my $base = $1;
+            my $fh;
+            if (open($fh, '<', "$dump_dir/$_")) {
+                while (<$fh>) {
+                    $closed{$base} = 1, last if (/\Aclosed\t/);
+                }
+                close($fh);
+            }
+            next;
+        }
+        next if not /\A(([a-zA-Z0-9]+-\d+)\.(\d+)\.dump)\Z/;
+        my ($fname, $base, $num) = ($1, $2, $3);  # untainted.
+        my @st = stat("$dump_dir/$fname");
+        next if (not @st);
+        push @segments, [ $fname, $base, $num, $st[7], $st[9] ];
+        $total += $st[7];
+        $newest{$base} = $num if ((not defined $newest{$base}) or
+                                  ($num > $newest{$base}));
+    }
+
+    my $now = time();
+    # oldest first.
+    @segments = sort {
+        ($a->[4] <=> $b->[4]) or ($a->[0] cmp $b->[0])
+    } @segments;
+
+    foreach (@segments) {
+        my ($fname, $base, $num, $size, $mtime) = @$_;
+        next if (($num == $newest{$base}) and (not $closed{$base}));
+        next if ((defined $segment_fname) and ($fname eq $segment_fname));
+        my $expired = ((defined $retention_seconds) and
+                       (($now - $mtime) > $retention_seconds));
+        my $overquota = ((defined $disk_quota) and ($total > $disk_quota));
+        next if ((not $expired) and (not $overquota));
+        if (unlink("$dump_dir/$fname")) {
+            debug("Deleted old segment '$fname'");
+            $total -= $size;
+        } else {
+            syslogwarn("Can't delete '$dump_dir/$fname': $!");
+        }
+    }
+}
+
+
 sub do_noop_operation {
     debug(' + NOOP operation.');
     return 1;
@@ -349,6 +1076,7 @@ sub do_noop_operation {
 
 sub do_goodbye_operation {
     debug(' + GOODBYE operation.');
+    finish_storage(1);
     return 0;
 }
 
@@ -358,7 +1086,8 @@ sub do_malloc_operation {
     my $s = read_sizet(); return 0 if (not defined $s);
     my $rc = read_ptr(); return 0 if (not defined $rc);
     my $c = read_callstack(); return 0 if (not defined $c);
-    # !!! FIXME: do something.
+    store_operation($t);
+    live_malloc($s, $rc, $c) if (defined $query_dir);
     return 1;
 }
 
@@ -369,7 +1098,8 @@ sub do_realloc_operation {
     my $s = read_sizet(); return 0 if (not defined $s);
     my $rc = read_ptr(); return 0 if (not defined $rc);
     my $c = read_callstack(); return 0 if (not defined $c);
-    # !!! FIXME: do something.
+    store_operation($t);
+    live_realloc($p, $s, $rc, $c) if (defined $query_dir);
     return 1;
 }
 
@@ -378,11 +1108,13 @@ sub do_free_operation {
     my $t = read_ticks(); return 0 if (not defined $t);
     my $p = read_ptr(); return 0 if (not defined $p);
     my $c = read_callstack(); return 0 if (not defined $c);
-    # !!! FIXME: do something.
+    store_operation($t);
+    live_free($p) if (defined $query_dir);
     return 1;
 }
 
 sub do_operation {
+    $opbytes = '';
     my $op = read_ui8();
     return 0 if not defined $op;
 
@@ -404,7 +1136,7 @@ sub server_mainline {
     syslogwarn("bogus/incomplete handshake"), return 0 if not read_handshake();
 
     debug(' + handshake complete:');
-    debug("   - protocol version == $protocol_version");
+    debug("   - protocol version == $monitor_client_prot");
     debug("   - byteorder == " . (($bigendian) ? "bigendian":"littleendian"));
     debug("   - sizeofptr == $sizeofptr");
     debug("   - clientid == '$monitor_client_id'");
@@ -412,7 +1144,13 @@ sub server_mainline {
     # no longer care if client is quiet for long amounts of time.
     $read_timeout = undef;
 
+    $connection_started = time();
+    start_tee();
+    start_query_listener();
     1 while do_operation();
+    finish_storage(0);
+    stop_query_listener();
+    finish_tee();
 
     syslogwarn("Connection terminated");
     return(0);
@@ -420,7 +1158,7 @@ sub server_mainline {
 
 
 sub daemon_upkeep {
-    # no-op.
+    enforce_retention();
 }
 
 
@@ -452,6 +1190,15 @@ sub parse_cmdline {
         $onerun = 1, next if $_ eq '--onerun';
         $allowed_ips{$_} = 1, next if s/\A--allow-ip=(.*?)\Z/$1/;
         $server_port = $_, next if s/\A--port=(.*?)\Z/$1/;
+        $dump_dir = $1, next if /\A--dumpdir=(.+?)\Z/;  # untaints.
+        $segment_size = $1, next if /\A--segment-size=(\d+)\Z/;
+        $segment_seconds = $1, next if /\A--segment-seconds=(\d+)\Z/;
+        $disk_quota = $1, next if /\A--disk-quota=(\d+)\Z/;
+        $retention_seconds = $1, next if /\A--retention-seconds=(\d+)\Z/;
+        $query_dir = $1, next if /\A--querydir=(.+?)\Z/;  # untaints.
+        push(@tee_sinks, $1), next if /\A--tee=(.+?)\Z/;  # untaints.
+        $tee_buffer_limit = $1, next if /\A--tee-buffer-limit=(\d+)\Z/;
+        $timeline_seconds = $1, next if /\A--timeline-seconds=(\d+)\Z/;
         die("Unknown command line \"$_\".\n");
     }
 }
@@ -0,0 +1,52 @@
+/*
+ * Rewrites a dumpfile as a block container, so windows can be loaded out
+ *  of the middle of it without reading the whole thing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "dumpfile.h"
+
+class ProgressNotifyStdio : public ProgressNotify
+{
+public:
+    ProgressNotifyStdio() : lastpercent(-1) {}
+    virtual void update(const char *str, int percent)
+    {
+        if (percent != lastpercent)
+        {
+            lastpercent = percent;
+            printf("%s: %d%%\n", str, percent);
+        } // if
+    } // update
+
+protected:
+    int lastpercent;
+};
+
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "USAGE: %s <dumpfile> <blockfile>\n", argv[0]);
+        return(1);
+    } // if
+
+    try
+    {
+        ProgressNotifyStdio pn;
+        DumpFile::convertToBlocks(argv[1], argv[2], pn);
+    } // try
+
+    catch (const char *err)
+    {
+        fprintf(stderr, "Error converting %s: %s\n", argv[1], err);
+        return(1);
+    } // catch
+
+    return(0);
+} // main
+
+// end of dumpblocks.cpp ...
+
@@ -11,8 +11,11 @@
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <assert.h>
+#include <pthread.h>
 
 #include "dumpfile.h"
 
@@ -59,830 +62,6626 @@ inline void BYTESWAP64(uint64 &x)
     #endif
 } // BYTESWAP64
 
+inline void BYTESWAP(uint32 &x) { BYTESWAP32(x); }
+inline void BYTESWAP(uint64 &x) { BYTESWAP64(x); }
 
-CallstackManager::callstackid CallstackManager::add(dumpptr *ptrs, size_t framecount)
-{
-    CallstackNode *parent = &this->root;  // top of tree.
-    CallstackNode *node = parent->children;  // root node is placeholder.
-    CallstackNode *lastnode = NULL;
-    size_t origframecount = framecount;
-
-    // assume everything is coming from main(), so start from the back so
-    //  we put it at the top of the tree. This will result in less dupes,
-    //  as nodes that have common ancestry will share common nodes.
-    ptrs += (framecount - 1);
 
-    total_frames += framecount;
+/*
+ * Field decoding for one combination of the original platform's pointer
+ *  size and byte order. DumpFile::decode_operations() is instantiated once
+ *  for each combination and the right one is picked from the handshake, so
+ *  "is this a 64-bit dump? Does it need byteswapping?" gets answered once
+ *  per file instead of once per field. The caller is responsible for
+ *  making sure there's enough data left before decoding anything.
+ */
+template <class PtrType, bool Swap>
+class DumpFileDecoder
+{
+public:
+    enum { ptrsize = sizeof (PtrType) };
 
-    dumpptr ptr = *ptrs;  // local var so we don't deference on each sibling...
-    while ((node != NULL) && (framecount))
+    static inline uint32 ui32(const uint8 *&ptr)
     {
-        if (node->ptr != ptr)  // non-matching node; check siblings.
-        {
-            lastnode = node;
-            node = node->sibling;
-        } // if
-        else  // matches, check next level...
+        uint32 retval;
+        memcpy(&retval, ptr, sizeof (retval));
+        ptr += sizeof (retval);
+        if (Swap)
+            BYTESWAP(retval);
+        return(retval);
+    } // ui32
+
+    // Bytes between an operation's type and its callstack. Zero for
+    //  anything that isn't a real allocator operation.
+    static inline size_t fields_size(uint8 optype)
+    {
+        switch (optype)
         {
-            // Move this node to the start of the list so frequently-used
-            //  nodes bubble to the top...
-            if (lastnode != NULL)
-            {
-                lastnode->sibling = node->sibling;
-                node->sibling = parent->children;
-                parent->children = node;
-                lastnode = NULL;
-            } // if
-
-            ptrs--;
-            framecount--;
-            parent = node;
-            node = node->children;
-            ptr = *ptrs;
-        } // else
-    } // while
-
-    // (framecount == 0) here means a complete match with existing branch.
-
-    unique_frames += framecount;
+            case DUMPFILE_OP_MALLOC: return(sizeof (tick_t) + ptrsize * 2);
+            case DUMPFILE_OP_REALLOC: return(sizeof (tick_t) + ptrsize * 3);
+            case DUMPFILE_OP_FREE: return(sizeof (tick_t) + ptrsize);
+        } // switch
+        return(0);
+    } // fields_size
 
-    while (framecount)  // build any missing nodes...
+    static inline dumpptr word(const uint8 *&ptr)
     {
-        node = new CallstackNode(*ptrs, parent, (origframecount-framecount)+1);
-        node->sibling = parent->children;
-        parent->children = node;
-        parent = node;
-        ptrs--;
-        framecount--;
-    } // if
-
-    if (node == NULL)
-        return((callstackid) &root);
+        PtrType retval;
+        memcpy(&retval, ptr, sizeof (retval));
+        ptr += sizeof (retval);
+        if (Swap)
+            BYTESWAP(retval);
+        return((dumpptr) retval);
+    } // word
+}; // DumpFileDecoder
+
+
+// how many nodes a new CallstackManager has room for.
+#define CALLSTACKMANAGER_INITIAL_NODES 1024
+
+CallstackManager::CallstackManager()
+    : parents(NULL), frames(NULL), depths(NULL), total_nodes(1),
+      nodes_alloc(CALLSTACKMANAGER_INITIAL_NODES), table(NULL),
+      table_size(CALLSTACKMANAGER_INITIAL_NODES * 2), merged_ids(NULL),
+      total_frames(0)
+{
+    parents = (uint32 *) malloc(nodes_alloc * sizeof (uint32));
+    frames = (dumpptr *) malloc(nodes_alloc * sizeof (dumpptr));
+    depths = (uint32 *) malloc(nodes_alloc * sizeof (uint32));
+    table = (uint32 *) calloc(table_size, sizeof (uint32));
+    assert(parents && frames && depths && table);  // !!! FIXME: lame.
 
-    return((callstackid) node);   // bottom of the callstack ("main", etc).
-} // CallstackManager::add
+    // the root is the empty callstack, and never goes in the table.
+    parents[0] = 0;
+    frames[0] = 0;
+    depths[0] = 0;
+} // CallstackManager::CallstackManager
 
 
-void CallstackManager::done_adding(ProgressNotify &pn)
+CallstackManager::~CallstackManager()
 {
-    // no-op in this implementation
-} // CallstackManager::done_adding
+    ::free(parents);
+    ::free(frames);
+    ::free(depths);
+    ::free(table);
+    ::free(merged_ids);
+} // CallstackManager::~CallstackManager
 
 
-size_t CallstackManager::framecount(callstackid id) const
+static inline size_t callstack_hash(uint32 parent, dumpptr frame)
 {
-    return( ((CallstackNode *) id)->depth);
-} // CallstackManager::framecount
+    uint64 hash = ((uint64) parent) * 0x9E3779B97F4A7C15ULL;
+    hash = (hash ^ ((uint64) frame)) * 0xBF58476D1CE4E5B9ULL;
+    return((size_t) (hash >> 32));
+} // callstack_hash
 
 
-void CallstackManager::get(callstackid id, dumpptr *ptrs) const
+void CallstackManager::grow_table()
 {
-    CallstackNode *node = (CallstackNode *) id;
-    size_t depth = node->depth;
-    while (depth--)
+    ::free(table);
+    table_size *= 2;
+    table = (uint32 *) calloc(table_size, sizeof (uint32));
+    if (table == NULL)
+        throw("Out of memory");
+
+    const size_t mask = table_size - 1;
+    for (size_t id = 1; id < total_nodes; id++)
     {
-        *ptrs = node->ptr;
-        ptrs++;
-        node = node->parent;
-    } // while
-} // CallstackManager::get
+        size_t i = callstack_hash(parents[id], frames[id]) & mask;
+        while (table[i] != 0)
+            i = (i + 1) & mask;
+        table[i] = (uint32) id;
+    } // for
+} // CallstackManager::grow_table
 
 
-// CallstackManager automatically deletes the root node, which causes the
-//  whole tree to collapse.
-CallstackManager::CallstackNode::~CallstackNode()
+// Makes a node for (frame) called from (parent), without checking if
+//  there's one already.
+CallstackManager::callstackid CallstackManager::add_node(callstackid parent,
+                                                         dumpptr frame)
 {
-    CallstackNode *kid = this->children;
-    while (kid)
+    if (total_nodes == nodes_alloc)
     {
-        CallstackNode *next = kid->sibling;
-        delete kid;
-        kid = next;
-    } // while
-} // CallstackNode destructor
+        if (nodes_alloc >= 0x80000000)
+            throw("Too many callstacks");
+        const size_t alloc = nodes_alloc * 2;
+        uint32 *p = (uint32 *) realloc(parents, alloc * sizeof (uint32));
+        if (p == NULL)
+            throw("Out of memory");
+        parents = p;
+        dumpptr *f = (dumpptr *) realloc(frames, alloc * sizeof (dumpptr));
+        if (f == NULL)
+            throw("Out of memory");
+        frames = f;
+        uint32 *d = (uint32 *) realloc(depths, alloc * sizeof (uint32));
+        if (d == NULL)
+            throw("Out of memory");
+        depths = d;
+        nodes_alloc = alloc;
+    } // if
 
+    const callstackid id = (callstackid) total_nodes++;
+    parents[id] = parent;
+    frames[id] = frame;
+    depths[id] = depths[parent] + 1;
 
-FragMapSnapshot::FragMapSnapshot(uint32 nodecount, size_t opidx)
-    : total_nodes(nodecount), operation_index(opidx)
-{
-    nodes = new FragMapNode*[total_nodes];
-} // FragMapSnapshot::FragMapSnapshot
+    if ((total_nodes * 2) > table_size)
+        grow_table();  // puts the new node in, too.
+    else
+    {
+        const size_t mask = table_size - 1;
+        size_t i = callstack_hash(parent, frame) & mask;
+        while (table[i] != 0)
+            i = (i + 1) & mask;
+        table[i] = id;
+    } // else
 
+    return(id);
+} // CallstackManager::add_node
 
-FragMapSnapshot::~FragMapSnapshot()
+
+// Finds or makes the node for (frame) called from (parent).
+inline CallstackManager::callstackid CallstackManager::child(
+                                        callstackid parent, dumpptr frame)
 {
-    for (size_t i = 0; i < total_nodes; i++)
-        FragMapNodePool::put(nodes[i]);
-    delete[] nodes;
-} // FragMapSnapshot::~FragMapSnapshot
+    const size_t mask = table_size - 1;
+    size_t i = callstack_hash(parent, frame) & mask;
+    callstackid id;
+    while ((id = table[i]) != 0)
+    {
+        if ((frames[id] == frame) && (parents[id] == parent))
+            return(id);
+        i = (i + 1) & mask;
+    } // while
+
+    return(add_node(parent, frame));
+} // CallstackManager::child
 
 
-inline void FragMapManager::hash_snapshot(FragMapSnapshot *snapshot)
+CallstackManager::callstackid CallstackManager::intern(dumpptr *ptrs, size_t framecount)
 {
-    size_t max = snapshot->total_nodes;
-    FragMapNode **node = snapshot->nodes;
-    for (size_t i = 0; i < max; i++, node++)
-        insert_block((*node)->ptr, (*node)->size);
-} // FragMapManager::hash_snapshot
+    // assume everything is coming from main(), so start from the back so
+    //  we put it at the top of the tree. This will result in less dupes,
+    //  as nodes that have common ancestry will share common nodes.
+    callstackid id = 0;
+    while (framecount--)
+        id = child(id, ptrs[framecount]);
 
+    // (id) is the innermost frame's node, or the root if there weren't
+    //  any frames at all.
+    return(id);
+} // CallstackManager::intern
 
-void FragMapManager::walk_fragmap(DumpFile *df, size_t startop, size_t endop)
-{
-    if (endop >= df->getOperationCount())  // !!! FIXME: This is catching a bug...
-        endop = df->getOperationCount()-1;
 
-    for (size_t i = startop; i <= endop; i++)
+// Parents always have smaller ids than their children, so the other
+//  manager's nodes can be merged in one pass, in order.
+void CallstackManager::merge(CallstackManager &other)
+{
+    total_frames += other.total_frames;
+    ::free(other.merged_ids);
+    other.merged_ids = (uint32 *) malloc(other.total_nodes * sizeof (uint32));
+    if (other.merged_ids == NULL)
+        throw("Out of memory");
+
+    other.merged_ids[0] = 0;
+    for (size_t i = 1; i < other.total_nodes; i++)
     {
-        DumpFileOperation *op = df->getOperation(i);
-        switch (op->getOperationType())
-        {
-            case DUMPFILE_OP_MALLOC: hash_malloc(op); break;
-            case DUMPFILE_OP_REALLOC: hash_realloc(op); break;
-            case DUMPFILE_OP_FREE: hash_free(op); break;
-            default: assert(0 && "unknown dumpfile operation!"); break;
-        } // switch
+        const callstackid parent = other.merged_ids[other.parents[i]];
+        other.merged_ids[i] = child(parent, other.frames[i]);
     } // for
-} // FragMapManager::walk_fragmap
+} // CallstackManager::merge
 
 
-// !!! FIXME: this code sucks.
-FragMapNode **FragMapManager::get_fragmap(DumpFile *df, size_t op_index, size_t &nodecount)
+void CallstackManager::done_adding(ProgressNotify &pn)
 {
-    // Find the closest snapshot...
-    // !!! FIXME: Linear search is slow...
-    uint32 i;
-    FragMapSnapshot *ss = NULL;
-    size_t thisop = 0;
+    // no-op in this implementation
+} // CallstackManager::done_adding
 
-    // clamp the value if it's past the end of the dumpfile...
-    if (op_index >= df->getOperationCount())
-        op_index = df->getOperationCount()-1;
 
-    for (i = 0; i < total_snapshots; i++)
+void CallstackManager::get(callstackid id, dumpptr *ptrs) const
+{
+    size_t depth = depths[id];
+    while (depth--)
     {
-        ss = snapshots[i];
-        thisop = ss->operation_index;
-        if (thisop == op_index)  // exact match!
-        {
-            nodecount = ss->total_nodes;
-            return(ss->nodes);
-        } // if
+        *ptrs = frames[id];
+        ptrs++;
+        id = parents[id];
+    } // while
+} // CallstackManager::get
 
-        if (thisop > op_index)  // we passed it.
-            break;
-    } // for
 
-    // delete this snapshot, since we're going to replace it with a new
-    //  one based on the previous snapshot walked to the requested position.
-    delete ss;
-    empty_hashtable();  // clear out anything that's sitting around.
+void CallstackManager::leaves(const callstackid *ids, size_t count,
+                              dumpptr *out) const
+{
+    for (size_t i = 0; i < count; i++)
+        out[i] = frames[ids[i]];
+} // CallstackManager::leaves
 
-    // hash the closest previous snapshot so we can walk from there to the
-    //  requested position. If there isn't a previous, walk from operation 0.
-    if (i > 0)
-    {
-        hash_snapshot(snapshots[i-1]);
-        thisop = snapshots[i-1]->operation_index;
-    } // if
-    walk_fragmap(df, op_index, thisop);
-    ss = snapshots[i] = create_snapshot();  // turn hash into new snapshot.
-    nodecount = ss->total_nodes;
-    return(ss->nodes);
-} // FragMapManager::get_fragmap
 
+// The callstack (depth) frames out from (id), or the root if it's not
+//  that deep.
+inline CallstackManager::callstackid CallstackManager::ancestor(
+                                        callstackid id, size_t depth) const
+{
+    if (depths[id] <= depth)
+        return(0);
 
-#define FRAGMAPMANAGER_QUICKSORT_THRESHOLD 4
+    while (depth--)
+        id = parents[id];
+    return(id);
+} // CallstackManager::ancestor
 
-static inline int cmpfn(FragMapNode *a, FragMapNode *b)
-{
-    return(b->ptr - a->ptr);
-} // cmpfn
 
-static inline void swapfn(FragMapNode **a, uint32 e1, uint32 e2)
+// When there are more ids than nodes, it's cheaper to find every node's
+//  ancestor once, in a few passes straight through memory, than to chase
+//  parents all over the place for each id. The root is its own caller, so
+//  shallow callstacks end up there. Returns NULL if it isn't worth it (or
+//  we're out of memory, in which case we'll do it the slow way).
+uint32 *CallstackManager::ancestor_table(size_t count, size_t depth) const
 {
-    FragMapNode *tmp = a[e1];
-    a[e1] = a[e2];
-    a[e2] = tmp;
-} // swapfn
+    if ((depth < 2) || (count <= total_nodes))
+        return(NULL);
 
-void FragMapManager::bubble_sort(FragMapNode **a, uint32 lo, uint32 hi)
-{
-    uint32 i;
-    bool sorted;
+    uint32 *retval = (uint32 *) malloc(total_nodes * sizeof (uint32));
+    if (retval == NULL)
+        return(NULL);
 
-    do
+    memcpy(retval, parents, total_nodes * sizeof (uint32));
+    for (size_t d = 1; d < depth; d++)
     {
-        sorted = true;
-        for (i = lo; i < hi; i++)
-        {
-            if (cmpfn(a[i], a[i+1]) > 0)
-            {
-                swapfn(a, i, i+1);
-                sorted = false;
-            } /* if */
-        } /* for */
-    } while (!sorted);
-} // FragMapManager::bubble_sort
+        for (size_t i = 0; i < total_nodes; i++)
+            retval[i] = parents[retval[i]];
+    } // for
+
+    return(retval);
+} // CallstackManager::ancestor_table
 
 
-void FragMapManager::quick_sort(FragMapNode **a, uint32 lo, uint32 hi)
+void CallstackManager::ancestors(const callstackid *ids, size_t count,
+                                 size_t depth, callstackid *out) const
 {
-    uint32 i;
-    uint32 j;
-    uint32 v;
-
-    if ((hi - lo) <= FRAGMAPMANAGER_QUICKSORT_THRESHOLD)
-        bubble_sort(a, lo, hi);
+    uint32 *table = ancestor_table(count, depth);
+    if (table != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = table[ids[i]];
+        ::free(table);
+    } // if
     else
     {
-        i = (hi + lo) >> 1;
-        if (cmpfn(a[lo], a[i]) > 0) swapfn(a, i, lo);
-        if (cmpfn(a[lo], a[hi]) > 0) swapfn(a, lo, hi);
-        if (cmpfn(a[i], a[hi]) > 0) swapfn(a, i, hi);
-
-        j = hi - 1;
-        swapfn(a, j, i);
-        i = lo;
-        v = j;
-        while (1)
-        {
-            while (cmpfn(a[++i], a[v]) < 0) { /* do nothing */ }
-            while (cmpfn(a[--j], a[v]) > 0) { /* do nothing */ }
-            if (j < i) break;
-            swapfn(a, i, j);
-        } // while
-        swapfn(a, i, hi-1);
-        quick_sort(a, lo, j);
-        quick_sort(a, i+1, hi);
+        for (size_t i = 0; i < count; i++)
+            out[i] = ancestor(ids[i], depth);
     } // else
-} // FragMapManager::quick_sort
+} // CallstackManager::ancestors
 
 
-void FragMapManager::sort(FragMapNode **entries, uint32 max)
+void CallstackManager::frames_at(const callstackid *ids, size_t count,
+                                 size_t depth, dumpptr *out) const
 {
-    /*
-     * Quicksort w/ Bubblesort fallback algorithm inspired by code from here:
-     *   http://www.cs.ubc.ca/spider/harrison/Java/sorting-demo.html
-     */
-    quick_sort(entries, 0, max - 1);
-} // FragMapManager::sort
+    uint32 *table = ancestor_table(count, depth);
+    if (table != NULL)
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = frames[table[ids[i]]];
+        ::free(table);
+    } // if
+    else
+    {
+        for (size_t i = 0; i < count; i++)
+            out[i] = frames[ancestor(ids[i], depth)];
+    } // else
+} // CallstackManager::frames_at
 
 
-FragMapSnapshot *FragMapManager::create_snapshot()
+void CallstackManager::flatten(uint32 *_parents, dumpptr *_frames) const
 {
-    uint32 cnt = 0;
-    FragMapSnapshot *ss;
+    memcpy(_parents, parents, total_nodes * sizeof (uint32));
+    memcpy(_frames, frames, total_nodes * sizeof (dumpptr));
+} // CallstackManager::flatten
 
-    ss = new FragMapSnapshot(total_nodes, current_operation);
 
-    for (int i = 0; i <= 0xFFFF; i++)
+void CallstackManager::unflatten(const uint32 *_parents,
+                                 const dumpptr *_frames,
+                                 size_t count, size_t totalframes)
+{
+    assert(total_nodes == 1);
+    for (size_t i = 1; i < count; i++)
     {
-        FragMapNode *node = fragmap[i];
-        while (node != NULL)
-        {
-            ss->nodes[cnt++] = FragMapNodePool::get(node->ptr, node->size);
-            node = node->right;
-        } // while
+        // a parent always comes first; if not, the cache is garbage, but
+        //  at least don't crash.
+        const callstackid parent = (_parents[i] < i) ? _parents[i] : 0;
+        add_node(parent, _frames[i]);
     } // for
 
-    assert(total_nodes == cnt);
-    sort(ss->nodes, total_nodes);
-    return(ss);
-} // FragMapManager::create_snapshot
+    total_frames = totalframes;
+} // CallstackManager::unflatten
 
 
-void FragMapManager::add_snapshot()
+DumpFileColumns::DumpFileColumns()
+    : total(0), optypes(NULL), timestamps(NULL), ptrs(NULL), sizes(NULL),
+      retvals(NULL), callstacks(NULL), capacity(0)
 {
-    FragMapSnapshot *snapshot = create_snapshot();
+} // DumpFileColumns::DumpFileColumns
+
+
+DumpFileColumns::~DumpFileColumns()
+{
+    release();
+} // DumpFileColumns::~DumpFileColumns
 
-    // !!! FIXME: realloc? yuck!
-    total_snapshots++;
-    snapshots = (FragMapSnapshot **) realloc(snapshots,
-                    total_snapshots * sizeof (FragMapSnapshot *));
-    assert(snapshots != NULL);  // !!! FIXME: lame.
-    snapshots[total_snapshots-1] = snapshot;
-} // FragMapManager::add_snapshot
 
+void DumpFileColumns::release()
+{
+    ::free(optypes);
+    ::free(timestamps);
+    ::free(ptrs);
+    ::free(sizes);
+    ::free(retvals);
+    ::free(callstacks);
+    optypes = NULL;
+    timestamps = NULL;
+    ptrs = sizes = retvals = NULL;
+    callstacks = NULL;
+    total = capacity = 0;
+} // DumpFileColumns::release
+
+
+template <class T> static inline void resize_column(T *&column, size_t count)
+{
+    T *ptr = (T *) realloc(column, count * sizeof (T));
+    if ((ptr == NULL) && (count > 0))
+        throw("Out of memory");
+    column = ptr;
+} // resize_column
 
-FragMapNode *FragMapNodePool::freepool = NULL;
 
-inline void FragMapNodePool::put(FragMapNode *node)
+void DumpFileColumns::resize(size_t count)
 {
-    if (node != NULL)
-    {
-        node->right = FragMapNodePool::freepool;
-        FragMapNodePool::freepool = node;
-    } // if
-} // FragMapNodePool::put
+    resize_column(optypes, count);
+    resize_column(timestamps, count);
+    resize_column(ptrs, count);
+    resize_column(sizes, count);
+    resize_column(retvals, count);
+    resize_column(callstacks, count);
+    capacity = count;
+} // DumpFileColumns::resize
 
 
-void FragMapNodePool::putlist(FragMapNode *node)
+void DumpFileColumns::reserve(size_t count)
 {
-    if (node != NULL)
-    {
-        FragMapNode *prev = NULL;
-        while (node != NULL)
-        {
-            prev = node;
-            node = node->right;
-        } // while
+    if (count <= capacity)
+        return;
 
-        prev->right = FragMapNodePool::freepool;
-        FragMapNodePool::freepool = prev;
-    } // if
-} // FragMapNodePool::putlist
+    size_t newcap = (capacity < 1024) ? 1024 : (capacity * 2);
+    if (newcap < count)
+        newcap = count;
+    resize(newcap);
+} // DumpFileColumns::reserve
 
 
-inline FragMapNode *FragMapNodePool::get(dumpptr ptr, size_t size)
+// Gives back any space we reserved but didn't use.
+void DumpFileColumns::shrink()
 {
-    FragMapNode *retval = FragMapNodePool::freepool;
-    if (retval == NULL)
-        retval = new FragMapNode(ptr, size);
-    else
-    {
-        FragMapNodePool::freepool = retval->right;
-        retval->ptr = ptr;
-        retval->size = size;
-    } // else
-
-    return(retval);
-} // FragMapNodePool::get
+    if (total < capacity)
+        resize(total);
+} // DumpFileColumns::shrink
 
 
-void FragMapNodePool::flush()
+void DumpFileColumns::append(const DumpFileColumns &other)
 {
-    FragMapNode *node = FragMapNodePool::freepool;
-    while (node)
+    const size_t count = other.total;
+    reserve(total + count);
+    memcpy(optypes + total, other.optypes, count * sizeof (*optypes));
+    memcpy(timestamps + total, other.timestamps, count * sizeof (*timestamps));
+    memcpy(ptrs + total, other.ptrs, count * sizeof (*ptrs));
+    memcpy(sizes + total, other.sizes, count * sizeof (*sizes));
+    memcpy(retvals + total, other.retvals, count * sizeof (*retvals));
+    memcpy(callstacks + total, other.callstacks, count * sizeof (*callstacks));
+    total += count;
+} // DumpFileColumns::append
+
+
+static inline void put_varint(uint8 *&ptr, uint64 val)
+{
+    while (val >= 0x80)
     {
-        FragMapNode *next = node->right;
-        delete node;
-        node = next;
+        *(ptr++) = (uint8) (val | 0x80);
+        val >>= 7;
     } // while
+    *(ptr++) = (uint8) val;
+} // put_varint
 
-    FragMapNodePool::freepool = NULL;
-} // FragMapNodePool::flush
-
+static inline uint64 get_varint(const uint8 *&ptr)
+{
+    uint64 val = 0;
+    int shift = 0;
+    uint8 byte;
+    do
+    {
+        byte = *(ptr++);
+        val |= ((uint64) (byte & 0x7F)) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return(val);
+} // get_varint
+
+// Deltas go both ways, so fold the sign into the low bit to keep small
+//  negative numbers small.
+static inline void put_delta(uint8 *&ptr, uint64 val, uint64 &prev)
+{
+    const uint64 delta = val - prev;
+    prev = val;
+    put_varint(ptr, (delta << 1) ^ (((uint64) 0) - (delta >> 63)));
+} // put_delta
 
-FragMapManager::FragMapManager()
-    : snapshots(NULL),
-      total_snapshots(0),
-      fragmap(NULL),
-      total_nodes(0),
-      current_operation(0),
-      snapshot_operations(0)
+static inline uint64 get_delta(const uint8 *&ptr, uint64 &prev)
 {
-    fragmap = new FragMapNode*[0xFFFF + 1];
-    memset(fragmap, '\0', (0xFFFF + 1) * sizeof (FragMapNode *));
-} // FragMapManager::FragMapManager
+    const uint64 zz = get_varint(ptr);
+    prev += (zz >> 1) ^ (((uint64) 0) - (zz & 1));
+    return(prev);
+} // get_delta
 
+static void write_bytes(FILE *out, const void *ptr, size_t len)
+    throw (const char *)
+{
+    if ((len > 0) && (fwrite(ptr, len, 1, out) != 1))
+        throw((const char *) strerror(errno));
+} // write_bytes
+
+// Plain old CRC-32, as in zlib. Pass the last return value as (crc) to
+//  keep going; start with zero. The table is spelled out, instead of built
+//  on the first call, since blocks get checked on several threads at once.
+static const uint32 dumpfile_crc32_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA,
+    0x076DC419, 0x706AF48F, 0xE963A535, 0x9E6495A3,
+    0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91,
+    0x1DB71064, 0x6AB020F2, 0xF3B97148, 0x84BE41DE,
+    0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC,
+    0x14015C4F, 0x63066CD9, 0xFA0F3D63, 0x8D080DF5,
+    0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B,
+    0x35B5A8FA, 0x42B2986C, 0xDBBBC9D6, 0xACBCF940,
+    0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116,
+    0x21B4F4B5, 0x56B3C423, 0xCFBA9599, 0xB8BDA50F,
+    0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D,
+    0x76DC4190, 0x01DB7106, 0x98D220BC, 0xEFD5102A,
+    0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818,
+    0x7F6A0DBB, 0x086D3D2D, 0x91646C97, 0xE6635C01,
+    0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457,
+    0x65B0D9C6, 0x12B7E950, 0x8BBEB8EA, 0xFCB9887C,
+    0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2,
+    0x4ADFA541, 0x3DD895D7, 0xA4D1C46D, 0xD3D6F4FB,
+    0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9,
+    0x5005713C, 0x270241AA, 0xBE0B1010, 0xC90C2086,
+    0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4,
+    0x59B33D17, 0x2EB40D81, 0xB7BD5C3B, 0xC0BA6CAD,
+    0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683,
+    0xE3630B12, 0x94643B84, 0x0D6D6A3E, 0x7A6A5AA8,
+    0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE,
+    0xF762575D, 0x806567CB, 0x196C3671, 0x6E6B06E7,
+    0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5,
+    0xD6D6A3E8, 0xA1D1937E, 0x38D8C2C4, 0x4FDFF252,
+    0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60,
+    0xDF60EFC3, 0xA867DF55, 0x316E8EEF, 0x4669BE79,
+    0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F,
+    0xC5BA3BBE, 0xB2BD0B28, 0x2BB45A92, 0x5CB36A04,
+    0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A,
+    0x9C0906A9, 0xEB0E363F, 0x72076785, 0x05005713,
+    0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21,
+    0x86D3D2D4, 0xF1D4E242, 0x68DDB3F8, 0x1FDA836E,
+    0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C,
+    0x8F659EFF, 0xF862AE69, 0x616BFFD3, 0x166CCF45,
+    0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB,
+    0xAED16A4A, 0xD9D65ADC, 0x40DF0B66, 0x37D83BF0,
+    0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6,
+    0xBAD03605, 0xCDD70693, 0x54DE5729, 0x23D967BF,
+    0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+static uint32 dumpfile_crc32(uint32 crc, const uint8 *buf, size_t len)
+{
+    crc = ~crc;
+    while (len--)
+        crc = dumpfile_crc32_table[(crc ^ *(buf++)) & 0xFF] ^ (crc >> 8);
+    return(~crc);
+} // dumpfile_crc32
+
+// get_varint() for data we don't trust yet: returns false instead of
+//  reading past (end), or past what fits in 64 bits.
+static inline bool get_varint_checked(const uint8 *&ptr, const uint8 *end,
+                                      uint64 &val)
+{
+    val = 0;
+    for (int shift = 0; (shift < 64) && (ptr < end); shift += 7)
+    {
+        const uint8 byte = *(ptr++);
+        val |= ((uint64) (byte & 0x7F)) << shift;
+        if ((byte & 0x80) == 0)
+            return(true);
+    } // for
+    return(false);
+} // get_varint_checked
 
-FragMapManager::~FragMapManager()
+static inline bool get_delta_checked(const uint8 *&ptr, const uint8 *end,
+                                     uint64 &prev)
 {
+    uint64 zz;
+    if (!get_varint_checked(ptr, end, zz))
+        return(false);
+    prev += (zz >> 1) ^ (((uint64) 0) - (zz & 1));
+    return(true);
+} // get_delta_checked
 
-    for (size_t i = 0; i < total_snapshots; i++)
-        delete snapshots[i];
 
-    free(snapshots); // !!! FIXME: allocated with realloc()...
-    delete[] fragmap;
-    FragMapNodePool::flush();
-} // FragMapManager::~FragMapManager
+// worst case: a ten-byte varint for each of a timestamp, three fields and
+//  a callstack id.
+#define DUMPFILE_MAX_PACKED_OP (10 * 5)
 
 
-inline void FragMapManager::empty_hashtable()
+/*
+ * A scratch file for things that don't fit in the memory budget. It's
+ *  append-only; writers get an offset back and use it to read the data
+ *  later. Writes can come from several decoding threads at once.
+ */
+class DumpFileScratch
 {
-    for (size_t i = 0; i <= 0xFFFF; i++)
-        FragMapNodePool::putlist(fragmap[i]);
-
-    memset(fragmap, '\0', (0xFFFF + 1) * sizeof (FragMapNode *));
-    total_nodes = 0;
-} // FragMapManager::empty_hashtable
+public:
+    DumpFileScratch(const char *dir) throw (const char *);
+    ~DumpFileScratch();
+    uint64 write(const void *data, size_t len) throw (const char *);
+    void read(uint64 offset, void *data, size_t len) const
+        throw (const char *);
+
+private:
+    int fd;
+    uint64 used;
+    pthread_mutex_t mutex;
+};
+
+
+DumpFileScratch::DumpFileScratch(const char *dir) throw (const char *)
+    : fd(-1), used(0)
+{
+    if (dir == NULL)
+        dir = getenv("TMPDIR");
+    if ((dir == NULL) || (*dir == '\0'))
+        dir = "/tmp";
 
+    static const char *name = "/mallocmonitor-XXXXXX";
+    char *path = new char[strlen(dir) + strlen(name) + 1];
+    strcpy(path, dir);
+    strcat(path, name);
+    fd = mkstemp(path);
+    int e = errno;
+    if (fd != -1)
+        unlink(path);  // gone when we close it, or if we crash.
+    delete[] path;
 
-inline uint16 FragMapManager::calculate_hash(dumpptr ptr)
-{
-#if 0
-    uint16 retval = ((ptr & 0xFFFF) |
-                     ((ptr & (1 << 17)) >> 17) |
-                     ((ptr & (1 << 18)) >> 17));
-#elif 0
-    uint16 retval = (((ptr & 0x55555555) >> 1) ^ ptr) & 0xFFFF;
-#elif 1   // this seems to give the best distribution...
-    uint16 retval = (((ptr & 0xFFFF0000) >> 16) ^ ptr) & 0xFFFF;
-#else
-#error Please define a hash function...
-#endif
+    if (fd == -1)
+        throw ((const char *) strerror(e));
 
-    return(retval);
-} // calculate_hash
+    pthread_mutex_init(&mutex, NULL);
+} // DumpFileScratch::DumpFileScratch
 
 
-void FragMapManager::insert_block(dumpptr ptr, size_t size)
+DumpFileScratch::~DumpFileScratch()
 {
-    uint16 hashval = calculate_hash(ptr);
-    // !!! FIXME: check for dupes before inserting?
-    FragMapNode *node = FragMapNodePool::get(ptr, size);
-    node->right = fragmap[hashval];  // FIXME: do this in the constructor.
-    fragmap[hashval] = node;
-    total_nodes++;
-} // FragMapManager::insert_block
+    close(fd);
+    pthread_mutex_destroy(&mutex);
+} // DumpFileScratch::~DumpFileScratch
 
 
-void FragMapManager::remove_block(dumpptr ptr)
+uint64 DumpFileScratch::write(const void *data, size_t len)
+    throw (const char *)
 {
-    uint16 hashval = calculate_hash(ptr);
-    FragMapNode *node = fragmap[hashval];
-    FragMapNode *prev = NULL;
-    while ((node != NULL) && (node->ptr != ptr))
+    pthread_mutex_lock(&mutex);
+    const uint64 offset = used;
+    used += len;
+    pthread_mutex_unlock(&mutex);
+
+    const uint8 *ptr = (const uint8 *) data;
+    size_t done = 0;
+    while (done < len)
     {
-        prev = node;
-        node = node->right;
+        ssize_t rc = pwrite(fd, ptr + done, len - done,
+                            (off_t) (offset + done));
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            throw("Couldn't write to scratch file");
+        done += (size_t) rc;
     } // while
 
-    if (node != NULL)
-    {
-        if (prev != NULL)
-            prev->right = node->right;
-        else
-            fragmap[hashval] = node->right;
-        FragMapNodePool::put(node);
-        total_nodes--;
-    } // if
-} // FragMapManager::remove_block
+    return(offset);
+} // DumpFileScratch::write
 
 
-inline void FragMapManager::hash_malloc(DumpFileOperation *op)
+void DumpFileScratch::read(uint64 offset, void *data, size_t len) const
+    throw (const char *)
 {
-    insert_block(op->op_malloc.retval, op->op_malloc.size);
-} // FragMapManager::hash_malloc
-
+    uint8 *ptr = (uint8 *) data;
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t rc = pread(fd, ptr + done, len - done,
+                           (off_t) (offset + done));
+        if ((rc == -1) && (errno == EINTR))
+            continue;
+        else if (rc <= 0)
+            throw("Couldn't read from scratch file");
+        done += (size_t) rc;
+    } // while
+} // DumpFileScratch::read
 
-inline void FragMapManager::hash_realloc(DumpFileOperation *op)
-{
-    // !!! FIXME: Don't remove and reinsert if ptr == rc && size > 0...
-    if (op->op_realloc.ptr)
-        remove_block(op->op_realloc.ptr);
 
-    if (op->op_realloc.size)
-        insert_block(op->op_realloc.retval, op->op_realloc.size);
-} // FragMapManager::hash_realloc
+// this is about what an unpacked block costs us in the cache.
+#define DUMPFILE_UNPACKED_BLOCK_BYTES \
+    (DUMPFILE_BLOCK_SIZE * (sizeof (uint8) + sizeof (tick_t) + \
+                            (sizeof (dumpptr) * 3) + sizeof (uint64)))
 
+// how many unpacked blocks we keep if there's no budget to go by.
+#define DUMPFILE_DEFAULT_CACHE_BLOCKS 4
 
-inline void FragMapManager::hash_free(DumpFileOperation *op)
+DumpFileOpStore::DumpFileOpStore()
+    : total(0), scratch(NULL), packed(NULL), borrowed(false), packed_used(0),
+      packed_alloc(0), packed_bytes(0), blocks(NULL), total_blocks(0),
+      blocks_alloc(0), cache(NULL), cache_block(NULL), cache_used(NULL),
+      cache_slots(DUMPFILE_DEFAULT_CACHE_BLOCKS),
+      cache_last(0), cache_clock(0), readbuf(NULL), readbuf_len(0)
 {
-    remove_block(op->op_free.ptr);
-} // FragMapManager::hash_free
+} // DumpFileOpStore::DumpFileOpStore
 
 
-void FragMapManager::add_malloc(DumpFileOperation *op)
+DumpFileOpStore::~DumpFileOpStore()
 {
-    hash_malloc(op);
-    increment_operations();
-} // FragMapManager::add_malloc
+    release();
+} // DumpFileOpStore::~DumpFileOpStore
 
 
-void FragMapManager::add_realloc(DumpFileOperation *op)
+void DumpFileOpStore::spill_to(DumpFileScratch *_scratch, size_t cache_bytes)
 {
-    // !!! FIXME: Is realloc(NULL, 0) illegal?
-    hash_realloc(op);
-    increment_operations();
-} // FragMapManager::add_realloc
+    assert(total == 0);
+    scratch = _scratch;
+    free_cache();
+    cache_slots = cache_bytes / DUMPFILE_UNPACKED_BLOCK_BYTES;
+    if (cache_slots == 0)
+        cache_slots = 1;
+} // DumpFileOpStore::spill_to
 
 
-void FragMapManager::add_free(DumpFileOperation *op)
+void DumpFileOpStore::free_cache()
 {
-    hash_free(op);
-    increment_operations();
-} // FragMapManager::add_free
+    delete[] cache;
+    delete[] cache_block;
+    delete[] cache_used;
+    cache = NULL;
+    cache_block = cache_used = NULL;
+    cache_last = 0;
+    cache_clock = 0;
+} // DumpFileOpStore::free_cache
 
 
-void FragMapManager::done_adding(ProgressNotify &pn)
+void DumpFileOpStore::release()
 {
-    // flatten out final fragmap...
-    add_snapshot();
-    empty_hashtable();
-
-#if 0  // PROFILING_STATISTICS
-    int deepest = 0;
-    int totalnodes = 0;
-
-    #define MAXDEPTHS 16
-    int depths[MAXDEPTHS];
-    memset(depths, '\0', sizeof (depths));
+    if (!borrowed)
+        ::free(packed);
+    ::free(blocks);
+    ::free(readbuf);
+    packed = NULL;
+    borrowed = false;
+    blocks = NULL;
+    readbuf = NULL;
+    readbuf_len = 0;
+    packed_used = packed_alloc = 0;
+    packed_bytes = 0;
+    total_blocks = blocks_alloc = 0;
+    total = 0;
+    pending.release();
+    free_cache();
+} // DumpFileOpStore::release
+
+
+void DumpFileOpStore::append(const DumpFileColumns &cols)
+{
+    size_t i = 0;
 
-    for (size_t i = 0; i <= 0xFFFF; i++)
+    // top off a partial block first...
+    if (pending.total > 0)
     {
-        FragMapNode *node = fragmap[i];
-        int depth = 0;
-        while (node)
+        while ((i < cols.total) && (pending.total < DUMPFILE_BLOCK_SIZE))
         {
-            totalnodes++;
-            depth++;
-            node = node->right;
-        }
+            const size_t idx = pending.append(cols.optypes[i],
+                                              cols.timestamps[i],
+                                              cols.ptrs[i], cols.sizes[i],
+                                              cols.retvals[i]);
+            pending.callstacks[idx] = cols.callstacks[i];
+            i++;
+        } // while
 
-        if (depth < MAXDEPTHS)
-            depths[depth]++;
+        if (pending.total < DUMPFILE_BLOCK_SIZE)
+        {
+            total += i;
+            return;
+        } // if
 
-        if (depth > deepest)
-            deepest = depth;
-    }
+        pack_block(pending, 0, pending.total);
+        pending.clear();
+    } // if
 
-    fprintf(stderr, "fragmap total == %d, deepest == %d, empties == %d\n",
-            totalnodes, deepest, depths[0]);
+    // ...then pack whole blocks straight out of (cols)...
+    while ((cols.total - i) >= DUMPFILE_BLOCK_SIZE)
+    {
+        pack_block(cols, i, DUMPFILE_BLOCK_SIZE);
+        i += DUMPFILE_BLOCK_SIZE;
+    } // while
 
-    if (deepest >= MAXDEPTHS)
-        deepest = MAXDEPTHS - 1;
-    for (int i = 1; i <= deepest; i++)
-        fprintf(stderr, " %d: %d\n", i, depths[i]);
+    // ...and hold on to what's left until there's a block's worth.
+    for ( ; i < cols.total; i++)
+    {
+        const size_t idx = pending.append(cols.optypes[i], cols.timestamps[i],
+                                          cols.ptrs[i], cols.sizes[i],
+                                          cols.retvals[i]);
+        pending.callstacks[idx] = cols.callstacks[i];
+    } // for
 
-    printf("total_snapshots == %d\n", total_snapshots);
-#endif
-} // FragMapManager::done_adding
+    total += cols.total;
+} // DumpFileOpStore::append
 
 
-inline void FragMapManager::increment_operations()
+// Packs whatever's left into a short final block, and gives back any space
+//  we reserved but didn't use. Nothing can be appended after this.
+void DumpFileOpStore::finish()
 {
-    current_operation++;
-    if (++snapshot_operations >= FRAGMAP_SNAPSHOT_THRESHOLD)
+    if (pending.total > 0)
+        pack_block(pending, 0, pending.total);
+    pending.release();
+
+    if (scratch != NULL)  // (packed) was just staging space.
     {
-        add_snapshot();
-        snapshot_operations = 0;
+        ::free(packed);
+        packed = NULL;
+        packed_alloc = 0;
     } // if
-} // FragMapManager::increment_operations
+
+    else if (packed_used < packed_alloc)
+    {
+        uint8 *ptr = (uint8 *) realloc(packed, packed_used);
+        if ((ptr != NULL) || (packed_used == 0))
+        {
+            packed = ptr;
+            packed_alloc = packed_used;
+        } // if
+    } // else if
+} // DumpFileOpStore::finish
 
 
-void DumpFile::destruct(void)
+void DumpFileOpStore::pack_block(const DumpFileColumns &cols,
+                                 size_t first, size_t count)
 {
-    if (io != NULL)
-        fclose(io);
-    io = NULL;
-
-    delete[] id;
-    id = NULL;
+    const size_t needed = 16 + ((count + 3) / 4) +
+                          (count * DUMPFILE_MAX_PACKED_OP);
+    if ((packed_alloc - packed_used) < needed)
+    {
+        size_t newalloc = (packed_alloc < (1024 * 1024)) ?
+                            (1024 * 1024) : (packed_alloc * 2);
+        if (newalloc < (packed_used + needed))
+            newalloc = packed_used + needed;
+        uint8 *ptr = (uint8 *) realloc(packed, newalloc);
+        if (ptr == NULL)
+            throw("Out of memory");
+        packed = ptr;
+        packed_alloc = newalloc;
+    } // if
 
-    delete[] fname;
-    fname = NULL;
+    if (total_blocks == blocks_alloc)
+    {
+        const uint64 newalloc = (blocks_alloc == 0) ? 1024 : (blocks_alloc * 2);
+        PackedBlock *ptr = (PackedBlock *) realloc(blocks,
+                                          newalloc * sizeof (PackedBlock));
+        if (ptr == NULL)
+            throw("Out of memory");
+        blocks = ptr;
+        blocks_alloc = newalloc;
+    } // if
 
-    for (size_t i = 0; i < total_operations; i++)
-        delete operations[i];
-    delete[] operations;
-    operations = NULL;
-    total_operations = 0;
-} // DumpFile::Destruct
+    uint8 *start = packed + packed_used;
+    uint8 *ptr = start;
+    put_varint(ptr, count);
 
+    // op types, two bits apiece.
+    memset(ptr, '\0', (count + 3) / 4);
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8 type = cols.optypes[first + i] - DUMPFILE_OP_MALLOC;
+        ptr[i / 4] |= (type & 0x3) << ((i % 4) * 2);
+    } // for
+    ptr += (count + 3) / 4;
 
-DumpFile::~DumpFile(void)
-{
-    destruct();
-} // DumpFile::~DumpFile
+    // Everything else is a delta from the op before it, or a plain varint
+    //  for sizes. Which fields are stored depends on the op type; the others
+    //  are always zero.
+    uint64 prevtick = 0, prevaddr = 0, prevstack = 0;
+    for (size_t i = first; i < first + count; i++)
+    {
+        put_delta(ptr, cols.timestamps[i], prevtick);
+        switch (cols.optypes[i])
+        {
+            case DUMPFILE_OP_MALLOC:
+                put_varint(ptr, cols.sizes[i]);
+                put_delta(ptr, cols.retvals[i], prevaddr);
+                break;
+
+            case DUMPFILE_OP_FREE:
+                put_delta(ptr, cols.ptrs[i], prevaddr);
+                break;
+
+            default:
+                put_delta(ptr, cols.ptrs[i], prevaddr);
+                put_varint(ptr, cols.sizes[i]);
+                put_delta(ptr, cols.retvals[i], prevaddr);
+                break;
+        } // switch
+        put_delta(ptr, cols.callstacks[i], prevstack);
+    } // for
 
+    PackedBlock &block = blocks[total_blocks++];
+    block.length = (size_t) (ptr - start);
+    block.crc = dumpfile_crc32(0, start, block.length);
+    if (scratch != NULL)
+        block.offset = scratch->write(start, block.length);
+    else
+    {
+        block.offset = packed_used;
+        packed_used += block.length;
+    } // else
+    packed_bytes += block.length;
+} // DumpFileOpStore::pack_block
 
 
-inline void DumpFile::read_block(void *ptr, size_t size) throw (const char *)
+void DumpFileOpStore::unpack_block(const uint8 *ptr, DumpFileColumns &cols)
 {
-    if (fread(ptr, size, 1, io) != 1) throw(strerror(errno));
-} // DumpFile::read_block
+    const size_t count = (size_t) get_varint(ptr);
+    const uint8 *types = ptr;
+    ptr += (count + 3) / 4;
+
+    cols.clear();
+    cols.reserve(count);
+    uint64 prevtick = 0, prevaddr = 0, prevstack = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint8 optype = ((types[i / 4] >> ((i % 4) * 2)) & 0x3) +
+                             DUMPFILE_OP_MALLOC;
+        const tick_t timestamp = (tick_t) get_delta(ptr, prevtick);
+        dumpptr blockptr = 0, size = 0, retval = 0;
+        switch (optype)
+        {
+            case DUMPFILE_OP_MALLOC:
+                size = (dumpptr) get_varint(ptr);
+                retval = (dumpptr) get_delta(ptr, prevaddr);
+                break;
+
+            case DUMPFILE_OP_FREE:
+                blockptr = (dumpptr) get_delta(ptr, prevaddr);
+                break;
+
+            default:
+                blockptr = (dumpptr) get_delta(ptr, prevaddr);
+                size = (dumpptr) get_varint(ptr);
+                retval = (dumpptr) get_delta(ptr, prevaddr);
+                break;
+        } // switch
 
-void DumpFile::read_ui8(uint8 &ui8) throw (const char *)
-{
-    read_block(&ui8, sizeof (ui8));
-} // DumpFile::read_ui8
+        cols.append(optype, timestamp, blockptr, size, retval);
+        cols.callstacks[i] = get_delta(ptr, prevstack);
+    } // for
+} // DumpFileOpStore::unpack_block
 
-inline void DumpFile::read_ui32(uint32 &ui32) throw (const char *)
-{
-    read_block(&ui32, sizeof (ui32));
-    if (byte_order != platform_byteorder)
-        BYTESWAP32(ui32);
-} // DumpFile::read_ui32
 
-inline void DumpFile::read_ui64(uint64 &ui64) throw (const char *)
+// Walks a packed block from a cache without trusting anything in it: it
+//  has to decode to (count) ops, end right at (len) bytes, and only use
+//  callstack ids below (total_callstacks). Returns false if it doesn't.
+bool DumpFileOpStore::check_block(const uint8 *ptr, size_t len,
+                                  uint64 total_callstacks, uint64 &count)
 {
-    read_block(&ui64, sizeof (ui64));
-    if (byte_order != platform_byteorder)
-        BYTESWAP64(ui64);
-} // DumpFile::read_ui64
+    const uint8 *end = ptr + len;
+    if ((!get_varint_checked(ptr, end, count)) || (count == 0) ||
+        (count > DUMPFILE_BLOCK_SIZE) ||
+        (((size_t) (end - ptr)) < ((count + 3) / 4)))
+        return(false);
 
-inline void DumpFile::read_ptr(dumpptr &ptr) throw (const char *)
-{
-#if SUPPORT_64BIT_CLIENTS
-    if (sizeofptr == 4)
+    const uint8 *types = ptr;
+    ptr += (count + 3) / 4;
+
+    uint64 prevtick = 0, prevaddr = 0, prevstack = 0, val;
+    for (uint64 i = 0; i < count; i++)
     {
-        uint32 ui32;
+        const uint8 optype = ((types[i / 4] >> ((i % 4) * 2)) & 0x3) +
+                             DUMPFILE_OP_MALLOC;
+        if (!get_delta_checked(ptr, end, prevtick))
+            return(false);
+
+        bool ok;
+        switch (optype)
+        {
+            case DUMPFILE_OP_MALLOC:
+                ok = ((get_varint_checked(ptr, end, val)) &&
+                      (get_delta_checked(ptr, end, prevaddr)));
+                break;
+
+            case DUMPFILE_OP_FREE:
+                ok = get_delta_checked(ptr, end, prevaddr);
+                break;
+
+            default:
+                ok = ((get_delta_checked(ptr, end, prevaddr)) &&
+                      (get_varint_checked(ptr, end, val)) &&
+                      (get_delta_checked(ptr, end, prevaddr)));
+                break;
+        } // switch
+
+        if ((!ok) || (!get_delta_checked(ptr, end, prevstack)) ||
+            (prevstack >= total_callstacks))
+            return(false);
+    } // for
+
+    return(ptr == end);
+} // DumpFileOpStore::check_block
+
+
+// The op count, block count and total packed size, each block's length
+//  and CRC-32, then all the blocks back to back. Native byte order; it's
+//  a cache.
+void DumpFileOpStore::save(FILE *out) const throw (const char *)
+{
+    assert(pending.total == 0);  // call finish() first!
+    const uint64 header[3] = { total, total_blocks, packed_bytes };
+    write_bytes(out, header, sizeof (header));
+    for (uint64 i = 0; i < total_blocks; i++)
+    {
+        const uint64 table[2] = { (uint64) blocks[i].length, blocks[i].crc };
+        write_bytes(out, table, sizeof (table));
+    } // for
+
+    for (uint64 i = 0; i < total_blocks; i++)
+    {
+        const PackedBlock &info = blocks[i];
+        if (scratch == NULL)
+            write_bytes(out, packed + info.offset, info.length);
+        else
+            write_bytes(out, read_spilled(info), info.length);
+    } // for
+} // DumpFileOpStore::save
+
+
+// Everything is checked before anything changes: a cache that doesn't
+//  add up throws, and leaves the store just as it was.
+void DumpFileOpStore::load(const uint8 *data, size_t len,
+                           uint64 total_callstacks) throw (const char *)
+{
+    uint64 header[3];
+    if (len < sizeof (header))
+        throw("Cache file is corrupted");
+    memcpy(header, data, sizeof (header));
+
+    const uint64 count = header[1];
+    const uint64 tablelen = count * (sizeof (uint64) * 2);
+    if ((count > (len / (sizeof (uint64) * 2))) ||
+        ((len - sizeof (header)) < tablelen) ||
+        ((len - sizeof (header) - tablelen) != header[2]))
+        throw("Cache file is corrupted");
+
+    PackedBlock *newblocks = (PackedBlock *) malloc(
+                            (size_t) ((count > 0) ? count : 1) *
+                            sizeof (PackedBlock));
+    if (newblocks == NULL)
+        throw("Out of memory");
+
+    const uint8 *table = data + sizeof (header);
+    const uint8 *ptr = table + tablelen;
+    uint64 offset = 0;
+    uint64 ops = 0;
+    for (uint64 i = 0; i < count; i++, table += sizeof (uint64) * 2)
+    {
+        uint64 info[2];  // length, CRC-32.
+        uint64 blockops = 0;
+        memcpy(info, table, sizeof (info));
+        if ((info[0] > (header[2] - offset)) ||
+            (dumpfile_crc32(0, ptr + offset, (size_t) info[0]) != info[1]) ||
+            (!check_block(ptr + offset, (size_t) info[0], total_callstacks,
+                          blockops)) ||
+            ((i < (count - 1)) && (blockops != DUMPFILE_BLOCK_SIZE)))
+        {
+            ::free(newblocks);
+            throw("Cache file is corrupted");
+        } // if
+        newblocks[i].offset = offset;
+        newblocks[i].length = (size_t) info[0];
+        newblocks[i].crc = (uint32) info[1];
+        offset += info[0];
+        ops += blockops;
+    } // for
+
+    if (ops != header[0])
+    {
+        ::free(newblocks);
+        throw("Cache file is corrupted");
+    } // if
+
+    release();
+    scratch = NULL;  // it's all mapped already; nothing to spill.
+    packed = (uint8 *) ptr;
+    borrowed = true;
+    packed_used = packed_alloc = (size_t) header[2];
+    packed_bytes = header[2];
+    blocks = newblocks;
+    total_blocks = blocks_alloc = count;
+    total = header[0];
+} // DumpFileOpStore::load
+
+
+// Unpacks a block into (cols), without touching the cache. Unlike
+//  getBlock(), several threads can do this at once.
+void DumpFileOpStore::copyBlock(uint64 block, DumpFileColumns &cols) const
+{
+    if (block >= total_blocks)  // not packed yet; we're still parsing.
+    {
+        cols.clear();
+        cols.append(pending);
+        return;
+    } // if
+
+    const PackedBlock &info = blocks[block];
+    if (scratch == NULL)
+    {
+        unpack_block(packed + info.offset, cols);
+        return;
+    } // if
+
+    uint8 *buf = (uint8 *) malloc(info.length);
+    if (buf == NULL)
+        throw("Out of memory");
+
+    try
+    {
+        scratch->read(info.offset, buf, info.length);
+        unpack_block(buf, cols);
+    } // try
+    catch (const char *e)
+    {
+        ::free(buf);
+        throw(e);
+    } // catch
+    ::free(buf);
+} // DumpFileOpStore::copyBlock
+
+
+// Reads a spilled block back into (readbuf), and returns it.
+const uint8 *DumpFileOpStore::read_spilled(const PackedBlock &info) const
+{
+    if (readbuf_len < info.length)
+    {
+        uint8 *buf = (uint8 *) realloc(readbuf, info.length);
+        if (buf == NULL)
+            throw("Out of memory");
+        readbuf = buf;
+        readbuf_len = info.length;
+    } // if
+    scratch->read(info.offset, readbuf, info.length);
+    return(readbuf);
+} // DumpFileOpStore::read_spilled
+
+
+const DumpFileColumns &DumpFileOpStore::getBlock(uint64 block) const
+{
+    if (block >= total_blocks)
+        return(pending);  // not packed yet; we're still parsing.
+
+    if (cache == NULL)
+    {
+        cache = new DumpFileColumns[cache_slots];
+        cache_block = new uint64[cache_slots];
+        cache_used = new uint64[cache_slots];
+        for (size_t i = 0; i < cache_slots; i++)
+        {
+            cache_block[i] = (uint64) -1;
+            cache_used[i] = 0;
+        } // for
+    } // if
+
+    cache_clock++;
+    if (cache_block[cache_last] == block)  // usually: walking in order.
+    {
+        cache_used[cache_last] = cache_clock;
+        return(cache[cache_last]);
+    } // if
+
+    // !!! FIXME: Linear search is slow with a big budget, but it's nothing
+    // !!! FIXME:  next to unpacking a block, much less reading one.
+    size_t slot = 0;
+    for (size_t i = 0; i < cache_slots; i++)
+    {
+        if (cache_block[i] == block)
+        {
+            cache_used[i] = cache_clock;
+            cache_last = i;
+            return(cache[i]);
+        } // if
+        else if (cache_used[i] < cache_used[slot])
+            slot = i;
+    } // for
+
+    // not cached; evict the least recently used slot and unpack it there.
+    const PackedBlock &info = blocks[block];
+    const uint8 *ptr = packed + info.offset;
+    if (scratch != NULL)
+        ptr = read_spilled(info);
+
+    cache_block[slot] = (uint64) -1;  // in case unpacking throws.
+    unpack_block(ptr, cache[slot]);
+    cache_block[slot] = block;
+    cache_used[slot] = cache_clock;
+    cache_last = slot;
+    return(cache[slot]);
+} // DumpFileOpStore::getBlock
+
+
+void FragMapColumns::reserve(size_t count)
+{
+    if (count <= alloc)
+        return;
+
+    size_t newalloc = (alloc == 0) ? 1024 : alloc;
+    while (newalloc < count)
+        newalloc *= 2;
+
+    dumpptr *newptrs = new dumpptr[newalloc];
+    size_t *newsizes = new size_t[newalloc];
+    memcpy(newptrs, ptrs, total * sizeof (dumpptr));
+    memcpy(newsizes, sizes, total * sizeof (size_t));
+    delete[] ptrs;
+    delete[] sizes;
+    ptrs = newptrs;
+    sizes = newsizes;
+    alloc = newalloc;
+} // FragMapColumns::reserve
+
+
+void FragMapColumns::release()
+{
+    delete[] ptrs;
+    delete[] sizes;
+    ptrs = NULL;
+    sizes = NULL;
+    total = 0;
+    alloc = 0;
+} // FragMapColumns::release
+
+
+void FragMapColumns::swap(FragMapColumns &other)
+{
+    dumpptr *tmpptrs = ptrs;
+    size_t *tmpsizes = sizes;
+    const size_t tmptotal = total;
+    const size_t tmpalloc = alloc;
+    ptrs = other.ptrs;
+    sizes = other.sizes;
+    total = other.total;
+    alloc = other.alloc;
+    other.ptrs = tmpptrs;
+    other.sizes = tmpsizes;
+    other.total = tmptotal;
+    other.alloc = tmpalloc;
+} // FragMapColumns::swap
+
+
+FragMapSpan FragMapColumns::span() const
+{
+    FragMapSpan retval;
+    retval.ptrs = ptrs;
+    retval.sizes = sizes;
+    retval.total = total;
+    return(retval);
+} // FragMapColumns::span
+
+
+FragMapSnapshot::FragMapSnapshot(uint64 opidx, bool key, size_t blocks,
+                                 size_t removed, size_t added, size_t ops)
+    : data(NULL), ptrs(NULL), sizes(NULL), undo(NULL), operation_index(opidx),
+      keyframe(key), total_blocks(blocks), total_removed(removed),
+      total_added(added), total_undo(ops), spilled(false), spill_offset(0),
+      last_used(0)
+{
+} // FragMapSnapshot::FragMapSnapshot
+
+
+FragMapSnapshot::~FragMapSnapshot()
+{
+    free_data();
+} // FragMapSnapshot::~FragMapSnapshot
+
+
+// how many uint64s it takes to hold (count) things of (size) bytes.
+#define FRAGMAP_WORDS(count, size) ((((count) * (size)) + 7) / 8)
+
+size_t FragMapSnapshot::data_bytes() const
+{
+    return((FRAGMAP_WORDS(total_removed + total_added, sizeof (dumpptr)) +
+            FRAGMAP_WORDS(total_added, sizeof (size_t)) +
+            FRAGMAP_WORDS(total_undo, sizeof (size_t))) * sizeof (uint64));
+} // FragMapSnapshot::data_bytes
+
+
+void FragMapSnapshot::allocate()
+{
+    assert(data == NULL);
+    data = new uint64[data_bytes() / sizeof (uint64)];
+    ptrs = (dumpptr *) data;
+    sizes = (size_t *) (data + FRAGMAP_WORDS(total_removed + total_added,
+                                             sizeof (dumpptr)));
+    undo = (size_t *) (((uint64 *) sizes) +
+                       FRAGMAP_WORDS(total_added, sizeof (size_t)));
+} // FragMapSnapshot::allocate
+
+
+void FragMapSnapshot::free_data()
+{
+    delete[] data;
+    data = NULL;
+    ptrs = NULL;
+    sizes = NULL;
+    undo = NULL;
+} // FragMapSnapshot::free_data
+
+
+void FragMapManager::spill_to(DumpFileScratch *_scratch, size_t max_bytes)
+{
+    scratch = _scratch;
+    max_resident_bytes = max_bytes;
+    trim_snapshots(NULL);
+    if (max_bytes < max_view_bytes)
+        max_view_bytes = max_bytes;
+} // FragMapManager::spill_to
+
+
+// Writes a snapshot's data to the scratch file, if it isn't there
+//  already, and frees it. Snapshots never change once they're made,
+//  so a snapshot that has been spilled before doesn't need writing again.
+void FragMapManager::spill(FragMapSnapshot *ss)
+{
+    if (ss->data == NULL)
+        return;
+
+    const size_t len = ss->data_bytes();
+    if ((!ss->spilled) && (len > 0))
+        ss->spill_offset = scratch->write(ss->data, len);
+
+    ss->spilled = true;
+    resident_bytes -= len;
+    ss->free_data();
+} // FragMapManager::spill
+
+
+// The snapshot count, then for each one, its op index, whether it's a
+//  keyframe, its block, removed, added and undo counts, and its data, in
+//  the same layout as a spilled snapshot.
+void FragMapManager::save_snapshots(FILE *out) throw (const char *)
+{
+    const uint64 count = total_snapshots;
+    write_bytes(out, &count, sizeof (count));
+
+    uint64 *buf = NULL;
+    size_t buflen = 0;
+    try
+    {
+        for (uint32 i = 0; i < total_snapshots; i++)
+        {
+            const FragMapSnapshot *ss = snapshots[i];
+            const uint64 header[6] = {
+                ss->operation_index, (uint64) (ss->keyframe ? 1 : 0), ss->total_blocks,
+                ss->total_removed, ss->total_added, ss->total_undo
+            };
+            write_bytes(out, header, sizeof (header));
+
+            const size_t len = ss->data_bytes();
+            const uint64 *data = ss->data;
+            if (data == NULL)  // spilled; it's already in this layout.
+            {
+                if (len > buflen)
+                {
+                    delete[] buf;
+                    buf = NULL;  // in case new throws.
+                    buf = new uint64[len / sizeof (uint64)];
+                    buflen = len;
+                } // if
+                scratch->read(ss->spill_offset, buf, len);
+                data = buf;
+            } // if
+            write_bytes(out, data, len);
+        } // for
+    } // try
+
+    catch (const char *e)
+    {
+        delete[] buf;
+        throw(e);
+    } // catch
+
+    delete[] buf;
+} // FragMapManager::save_snapshots
+
+
+void FragMapManager::load_snapshots(const uint8 *data, size_t len,
+                                    uint64 total_ops) throw (const char *)
+{
+    assert(total_snapshots == 0);
+
+    // make sure it all adds up before we build anything: the first one
+    //  has to be a keyframe, each one has to fit on the last, and each one
+    //  has to be able to undo everything since the last.
+    uint64 count;
+    const uint8 *end = data + len;
+    const uint8 *ptr = data;
+    uint64 blocks = 0;
+    uint64 opidx = 0;
+    if (len < sizeof (count))
+        throw("Cache file is corrupted");
+    memcpy(&count, ptr, sizeof (count));
+    ptr += sizeof (count);
+    for (uint64 i = 0; i < count; i++)
+    {
+        uint64 header[6];
+        if (((size_t) (end - ptr)) < sizeof (header))
+            throw("Cache file is corrupted");
+        memcpy(header, ptr, sizeof (header));
+        ptr += sizeof (header);
+
+        // a keyframe doesn't build on anything.
+        const size_t avail = (size_t) (end - ptr);
+        const uint64 before = header[1] ? 0 : blocks;
+        if ((header[1] > 1) || ((i == 0) && (!header[1])) ||
+            (header[3] > avail) || (header[4] > avail) ||
+            (header[5] > avail) || (header[3] > before) ||
+            (header[2] != (before - header[3]) + header[4]) ||
+            (header[0] < opidx) || (header[0] - opidx != header[5]) ||
+            (header[0] > total_ops))
+            throw("Cache file is corrupted");
+
+        const FragMapSnapshot ss(header[0], header[1] != 0,
+                                 (size_t) header[2], (size_t) header[3],
+                                 (size_t) header[4], (size_t) header[5]);
+        if (ss.data_bytes() > avail)
+            throw("Cache file is corrupted");
+        ptr += ss.data_bytes();
+        blocks = header[2];
+        opidx = header[0];
+    } // for
+
+    if (ptr != end)
+        throw("Cache file is corrupted");
+
+    ptr = data + sizeof (count);
+    for (uint64 i = 0; i < count; i++)
+    {
+        uint64 header[6];
+        memcpy(header, ptr, sizeof (header));
+        ptr += sizeof (header);
+
+        FragMapSnapshot *ss = new FragMapSnapshot(header[0], header[1] != 0,
+                                                  (size_t) header[2],
+                                                  (size_t) header[3],
+                                                  (size_t) header[4],
+                                                  (size_t) header[5]);
+        ss->allocate();
+        memcpy(ss->data, ptr, ss->data_bytes());
+        ptr += ss->data_bytes();
+
+        // !!! FIXME: realloc? yuck!
+        total_snapshots++;
+        snapshots = (FragMapSnapshot **) realloc(snapshots,
+                        total_snapshots * sizeof (FragMapSnapshot *));
+        assert(snapshots != NULL);  // !!! FIXME: lame.
+        snapshots[total_snapshots-1] = ss;
+
+        resident_bytes += ss->data_bytes();
+        page_in(ss);
+    } // for
+
+    current_operation = total_ops;
+} // FragMapManager::load_snapshots
+
+
+// Makes sure a snapshot's data is in memory, reading it back from the
+//  scratch file if need be, and marks it as the most recently used.
+void FragMapManager::page_in(FragMapSnapshot *ss)
+{
+    ss->last_used = ++snapshot_clock;
+    if (ss->data == NULL)
+    {
+        ss->allocate();
+        try
+        {
+            scratch->read(ss->spill_offset, ss->data, ss->data_bytes());
+        } // try
+        catch (const char *e)
+        {
+            ss->free_data();
+            throw(e);
+        } // catch
+        resident_bytes += ss->data_bytes();
+    } // if
+
+    trim_snapshots(ss);
+} // FragMapManager::page_in
+
+
+// Spills the least recently used snapshots until we're under budget,
+//  leaving (keep) alone, since somebody's about to use it. The snapshot
+//  that pause_adding() made stays put, too: resume_adding() throws it
+//  away, and the scratch file has no way to give its space back, so a
+//  follower would grow the file on every poll.
+void FragMapManager::trim_snapshots(FragMapSnapshot *keep)
+{
+    if (scratch == NULL)
+        return;
+
+    while (resident_bytes > max_resident_bytes)
+    {
+        // !!! FIXME: Linear search is slow...
+        FragMapSnapshot *lru = NULL;
+        for (uint32 i = 0; i < total_snapshots; i++)
+        {
+            FragMapSnapshot *ss = snapshots[i];
+            if ((ss == keep) || (ss == pause_snapshot) || (ss->data == NULL))
+                continue;
+            if ((lru == NULL) || (ss->last_used < lru->last_used))
+                lru = ss;
+        } // for
+
+        if (lru == NULL)
+            break;  // what's left is bigger than the budget all by itself.
+        spill(lru);
+    } // while
+} // FragMapManager::trim_snapshots
+
+
+// How many snapshots are at or before operation (opidx). They're in order,
+//  so this is a binary search.
+uint32 FragMapManager::find_snapshot(uint64 opidx) const
+{
+    uint32 lo = 0;
+    uint32 hi = total_snapshots;
+    while (lo < hi)
+    {
+        const uint32 mid = lo + ((hi - lo) / 2);
+        if (snapshots[mid]->operation_index <= opidx)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return(lo);
+} // FragMapManager::find_snapshot
+
+
+static size_t view_bytes(const FragMapView *view)
+{
+    return(view->cols.alloc * (sizeof (dumpptr) + sizeof (size_t)));
+} // view_bytes
+
+
+// A view for the app's fragmap at (opidx), for the caller to fill in. If
+//  the cache is full, the least recently used one gets recycled.
+FragMapView *FragMapManager::add_view(uint64 opidx)
+{
+    FragMapView *view = NULL;
+    if (total_views < FRAGMAP_MAX_VIEWS)
+    {
+        view = new FragMapView;
+        const size_t len = sizeof (FragMapView *) * (total_views + 1);
+        views = (FragMapView **) realloc(views, len);
+        views[total_views++] = view;
+    } // if
+    else
+    {
+        view = views[0];
+        for (uint32 i = 1; i < total_views; i++)
+        {
+            if (views[i]->last_used < view->last_used)
+                view = views[i];
+        } // for
+    } // else
+
+    view->operation_index = opidx;
+    view->last_used = snapshot_clock++;
+    view->cols.clear();
+    return(view);
+} // FragMapManager::add_view
+
+
+// Throws out the least recently used views until we're under budget,
+//  leaving (keep) alone, since the app is about to use it.
+void FragMapManager::trim_views(FragMapView *keep)
+{
+    size_t bytes = 0;
+    for (uint32 i = 0; i < total_views; i++)
+        bytes += view_bytes(views[i]);
+
+    while (bytes > max_view_bytes)
+    {
+        uint32 lru = total_views;
+        for (uint32 i = 0; i < total_views; i++)
+        {
+            if (views[i] == keep)
+                continue;
+            if ((lru == total_views) ||
+                (views[i]->last_used < views[lru]->last_used))
+                lru = i;
+        } // for
+
+        if (lru == total_views)
+            break;  // (keep) is bigger than the budget all by itself.
+
+        bytes -= view_bytes(views[lru]);
+        delete views[lru];
+        views[lru] = views[--total_views];
+    } // while
+} // FragMapManager::trim_views
+
+
+void FragMapManager::free_views()
+{
+    for (uint32 i = 0; i < total_views; i++)
+        delete views[i];
+    free(views);
+    views = NULL;
+    total_views = 0;
+} // FragMapManager::free_views
+
+
+// Rebuilds snapshot (idx)'s blocks in (cols), starting from the keyframe
+//  before it and applying each snapshot's changes in turn.
+void FragMapManager::materialize(uint32 idx, FragMapColumns &cols)
+{
+    assert(&cols != &merged);
+    uint32 first = idx;
+    while (!snapshots[first]->keyframe)
+    {
+        assert(first > 0);
+        first--;
+    } // while
+
+    cols.clear();
+    for (uint32 i = first; i <= idx; i++)
+    {
+        FragMapSnapshot *ss = snapshots[i];
+        page_in(ss);
+
+        const dumpptr *removed = ss->ptrs;
+        const dumpptr *addptrs = ss->ptrs + ss->total_removed;
+        const size_t *addsizes = ss->sizes;
+        const size_t rmax = ss->total_removed;
+        const size_t amax = ss->total_added;
+        size_t r = 0;
+        size_t a = 0;
+        size_t out = 0;
+
+        merged.clear();
+        merged.reserve(cols.total + amax);
+        dumpptr *outptrs = merged.ptrs;
+        size_t *outsizes = merged.sizes;
+        for (size_t c = 0; c < cols.total; c++)
+        {
+            const dumpptr ptr = cols.ptrs[c];
+            while ((r < rmax) && (removed[r] < ptr))
+                r++;  // shouldn't happen, unless something's corrupted.
+            if ((r < rmax) && (removed[r] == ptr))
+            {
+                r++;
+                continue;
+            } // if
+
+            while ((a < amax) && (addptrs[a] < ptr))
+            {
+                outptrs[out] = addptrs[a];
+                outsizes[out++] = addsizes[a++];
+            } // while
+
+            outptrs[out] = ptr;
+            outsizes[out++] = cols.sizes[c];
+        } // for
+
+        while (a < amax)
+        {
+            outptrs[out] = addptrs[a];
+            outsizes[out++] = addsizes[a++];
+        } // while
+
+        assert(out == ss->total_blocks);
+        merged.total = out;
+        cols.swap(merged);
+    } // for
+} // FragMapManager::materialize
+
+
+// Fills an empty working set with (cols).
+inline void FragMapManager::hash_columns(const FragMapColumns &cols)
+{
+    assert(fragmap.total == 0);
+    const size_t max = cols.total;
+    fragmap.reserve(max);
+    for (size_t i = 0; i < max; i++)
+        fragmap.insert(cols.ptrs[i], cols.sizes[i]);
+    addresses.build(cols);
+} // FragMapManager::hash_columns
+
+
+void FragMapManager::walk_fragmap(DumpFile *df, uint64 startop, uint64 endop)
+{
+    if (endop >= df->getOperationCount())  // !!! FIXME: This is catching a bug...
+        endop = df->getOperationCount()-1;
+
+    for (uint64 i = startop; i <= endop; i++)
+    {
+        const DumpFileOperation op(df->getOperation(i));
+        switch (op.getOperationType())
+        {
+            case DUMPFILE_OP_MALLOC: hash_malloc(op); break;
+            case DUMPFILE_OP_REALLOC: hash_realloc(op); break;
+            case DUMPFILE_OP_FREE: hash_free(op); break;
+            default: assert(0 && "unknown dumpfile operation!"); break;
+        } // switch
+    } // for
+} // FragMapManager::walk_fragmap
+
+
+// Steps the working set back from having the first (startop) operations
+//  in it to having the first (endop), undoing them one at a time. Returns
+//  false if it hit one that can't be undone, in which case the working set
+//  is only good for throwing away.
+bool FragMapManager::unwalk_fragmap(DumpFile *df, uint64 startop, uint64 endop)
+{
+    uint64 i = startop;
+    while (i > endop)
+    {
+        // the snapshot after operation (i - 1) knows how to undo it.
+        const uint32 idx = find_snapshot(i - 1);
+        if (idx >= total_snapshots)
+            return(false);  // !!! FIXME: shouldn't happen.
+
+        FragMapSnapshot *ss = snapshots[idx];
+        const uint64 first = ss->operation_index - ss->total_undo;
+        if (first >= i)
+            return(false);  // !!! FIXME: shouldn't happen, either.
+
+        page_in(ss);
+        const size_t *undo = ss->undo;
+        while ((i > endop) && (i > first))
+        {
+            i--;
+            const DumpFileOperation op(df->getOperation(i));
+            if (!unhash_operation(op, undo[i - first]))
+                return(false);
+        } // while
+    } // while
+
+    return(true);
+} // FragMapManager::unwalk_fragmap
+
+
+// Snapshots are taken between operations: one with an operation_index of
+//  (x) has the first (x) operations in it, so the one we want for
+//  (op_index) is at (op_index + 1).
+FragMapSpan FragMapManager::get_fragmap(DumpFile *df, uint64 op_index)
+{
+    const uint64 opcount = df->getOperationCount();
+    if (opcount == 0)
+        return(FragMapSpan());
+
+    // clamp the value if it's past the end of the dumpfile...
+    if (op_index >= opcount)
+        op_index = opcount-1;
+    const uint64 target = op_index + 1;
+
+    // See if we made this one already, and which one we made is cheapest
+    //  to get to it from. Loading anything into the working set costs
+    //  about as much as walking one operation per block.
+    // !!! FIXME: Linear search, but there's never more than
+    // !!! FIXME:  FRAGMAP_MAX_VIEWS of them.
+    FragMapView *closest = NULL;
+    uint64 closest_cost = FRAGMAP_NO_OPERATION;
+    for (uint32 i = 0; i < total_views; i++)
+    {
+        FragMapView *view = views[i];
+        const uint64 opidx = view->operation_index;
+        if (opidx == target)
+        {
+            view->last_used = snapshot_clock++;
+            return(view->cols.span());
+        } // if
+
+        const uint64 cost = ((opidx < target) ? target - opidx : opidx - target)
+                            + view->cols.total;
+        if (cost < closest_cost)
+        {
+            closest = view;
+            closest_cost = cost;
+        } // if
+    } // for
+
+    // Find the closest snapshot at or before it. If it's an exact match,
+    //  that's all there is to it.
+    const uint32 ss = find_snapshot(target);
+    if ((ss > 0) && (snapshots[ss-1]->operation_index == target))
+    {
+        FragMapView *view = add_view(target);
+        materialize(ss - 1, view->cols);
+        trim_views(view);
+        return(view->cols.span());
+    } // if
+
+    // Otherwise, walk to the requested position from whatever's cheapest:
+    //  the snapshot before it (or operation 0, if there isn't one), the
+    //  snapshot after it, a view, or the working set, as we last left it.
+    uint64 from = 0;
+    uint64 cost = target;
+    uint32 load = 0;  // index+1 of the snapshot to load; zero for none.
+    if (ss > 0)
+    {
+        from = snapshots[ss-1]->operation_index;
+        cost = (target - from) + snapshots[ss-1]->total_blocks;
+        load = ss;
+    } // if
+
+    if (ss < total_snapshots)
+    {
+        const FragMapSnapshot *after = snapshots[ss];
+        const uint64 after_cost = (after->operation_index - target) +
+                                  after->total_blocks;
+        if (after_cost < cost)
+        {
+            from = after->operation_index;
+            cost = after_cost;
+            load = ss + 1;
+        } // if
+    } // if
+
+    if ((closest != NULL) && (closest_cost < cost))
+    {
+        from = closest->operation_index;
+        cost = closest_cost;
+        load = 0;
+    } // if
+    else
+    {
+        closest = NULL;
+    } // else
+
+    if (working_operation != FRAGMAP_NO_OPERATION)
+    {
+        const uint64 working_cost = (working_operation < target) ?
+                                        target - working_operation :
+                                        working_operation - target;
+        if (working_cost <= cost)
+        {
+            from = working_operation;
+            closest = NULL;
+            load = 0;
+        } // if
+        else
+        {
+            working_operation = FRAGMAP_NO_OPERATION;
+        } // else
+    } // if
+
+    if (working_operation == FRAGMAP_NO_OPERATION)
+    {
+        empty_hashtable();  // clear out anything that's sitting around.
+        if (closest != NULL)
+            hash_columns(closest->cols);
+        else if (load > 0)
+        {
+            materialize(load - 1, flat);
+            hash_columns(flat);
+        } // else if
+    } // if
+
+    if (from < target)
+        walk_fragmap(df, from, target - 1);
+    else if ((from > target) && (!unwalk_fragmap(df, from, target)))
+    {
+        // something in there can't be undone, so go the long way around.
+        empty_hashtable();
+        from = 0;
+        if (ss > 0)
+        {
+            materialize(ss - 1, flat);
+            hash_columns(flat);
+            from = snapshots[ss-1]->operation_index;
+        } // if
+        walk_fragmap(df, from, target - 1);
+    } // else if
+    working_operation = target;
+
+    FragMapView *view = add_view(target);
+    flatten_fragmap(view->cols);
+    trim_views(view);
+    return(view->cols.span());
+} // FragMapManager::get_fragmap
+
+
+void FragMapManager::flatten_fragmap(FragMapColumns &cols)
+{
+    assert(addresses.total == fragmap.total);
+    addresses.flatten(cols);
+} // FragMapManager::flatten_fragmap
+
+
+// Compares the sorted blocks in (prev) and (next), counting what went away
+//  and what showed up. If (ss) isn't NULL, they get filled in there, too.
+static void diff_columns(const FragMapColumns &prev,
+                         const FragMapColumns &next,
+                         size_t &removed, size_t &added, FragMapSnapshot *ss)
+{
+    dumpptr *rmptrs = (ss != NULL) ? ss->ptrs : NULL;
+    dumpptr *addptrs = (ss != NULL) ? (ss->ptrs + ss->total_removed) : NULL;
+    size_t *addsizes = (ss != NULL) ? ss->sizes : NULL;
+    size_t p = 0;
+    size_t n = 0;
+
+    removed = added = 0;
+    while ((p < prev.total) || (n < next.total))
+    {
+        const bool gone = (n == next.total) ||
+                ((p < prev.total) && (prev.ptrs[p] < next.ptrs[n]));
+        const bool shown = (!gone) && ((p == prev.total) ||
+                                       (next.ptrs[n] < prev.ptrs[p]));
+        const bool resized = (!gone) && (!shown) &&
+                             (prev.sizes[p] != next.sizes[n]);
+
+        if ((gone) || (resized))
+        {
+            if (rmptrs != NULL)
+                rmptrs[removed] = prev.ptrs[p];
+            removed++;
+        } // if
+
+        if ((shown) || (resized))
+        {
+            if (addptrs != NULL)
+            {
+                addptrs[added] = next.ptrs[n];
+                addsizes[added] = next.sizes[n];
+            } // if
+            added++;
+        } // if
+
+        if (!shown)
+            p++;
+        if (!gone)
+            n++;
+    } // while
+} // diff_columns
+
+
+// Unless (rebase) is false, the next snapshot will be stored as what
+//  changed since this one. A keyframe comes every so often, or sooner if
+//  the snapshots since the last one would take longer to replay.
+FragMapSnapshot *FragMapManager::create_snapshot(bool rebase)
+{
+    flatten_fragmap(flat);
+
+    size_t removed = 0;
+    size_t added = 0;
+    diff_columns(base, flat, removed, added, NULL);
+
+    const bool key = ((total_snapshots == 0) ||
+                      (since_keyframe >= FRAGMAP_KEYFRAME_INTERVAL - 1) ||
+                      ((chain_blocks + removed + added) > flat.total));
+
+    FragMapSnapshot *ss;
+    if (key)
+    {
+        ss = new FragMapSnapshot(current_operation, true, flat.total,
+                                 0, flat.total, snapshot_operations);
+        ss->allocate();
+        memcpy(ss->ptrs, flat.ptrs, flat.total * sizeof (dumpptr));
+        memcpy(ss->sizes, flat.sizes, flat.total * sizeof (size_t));
+    } // if
+    else
+    {
+        ss = new FragMapSnapshot(current_operation, false, flat.total,
+                                 removed, added, snapshot_operations);
+        ss->allocate();
+        diff_columns(base, flat, removed, added, ss);
+    } // else
+
+    memcpy(ss->undo, pending_undo, snapshot_operations * sizeof (size_t));
+
+    if (rebase)
+    {
+        base.swap(flat);
+        since_keyframe = key ? 0 : since_keyframe + 1;
+        chain_blocks = key ? 0 : chain_blocks + removed + added;
+    } // if
+
+    return(ss);
+} // FragMapManager::create_snapshot
+
+
+void FragMapManager::add_snapshot(bool rebase)
+{
+    FragMapSnapshot *snapshot = create_snapshot(rebase);
+
+    // !!! FIXME: realloc? yuck!
+    total_snapshots++;
+    snapshots = (FragMapSnapshot **) realloc(snapshots,
+                    total_snapshots * sizeof (FragMapSnapshot *));
+    assert(snapshots != NULL);  // !!! FIXME: lame.
+    snapshots[total_snapshots-1] = snapshot;
+
+    resident_bytes += snapshot->data_bytes();
+    page_in(snapshot);
+} // FragMapManager::add_snapshot
+
+
+// how many slots a new FragMapHashtable starts with.
+#define FRAGMAPHASHTABLE_INITIAL_SLOTS 1024
+
+FragMapHashtable::FragMapHashtable()
+    : slots(NULL), capacity(FRAGMAPHASHTABLE_INITIAL_SLOTS), total(0)
+{
+    slots = new Slot[capacity];
+    memset(slots, '\0', capacity * sizeof (Slot));
+} // FragMapHashtable::FragMapHashtable
+
+
+FragMapHashtable::~FragMapHashtable()
+{
+    delete[] slots;
+} // FragMapHashtable::~FragMapHashtable
+
+
+inline size_t FragMapHashtable::home(dumpptr ptr) const
+{
+    // fold the top half in, so 64-bit heaps don't all land together.
+    uint64 hash = (uint64) ptr;
+    hash = (hash ^ (hash >> 32)) * 0x9E3779B97F4A7C15ULL;
+    return(((size_t) (hash >> 32)) & (capacity - 1));
+} // FragMapHashtable::home
+
+
+// Returns (capacity) if (ptr) isn't there. Everything is at least as far
+//  from home as anything after it that hashes to the same place, so once
+//  we pass a slot that's closer to its own home than we are to ours,
+//  (ptr) can't be any further along.
+inline size_t FragMapHashtable::find(dumpptr ptr) const
+{
+    const size_t mask = capacity - 1;
+    size_t i = home(ptr);
+    size_t dist = 0;
+    while (slots[i].ptr != 0)
+    {
+        if (slots[i].ptr == ptr)
+            return(i);
+        else if (((i - home(slots[i].ptr)) & mask) < dist)
+            break;
+        i = (i + 1) & mask;
+        dist++;
+    } // while
+
+    return(capacity);
+} // FragMapHashtable::find
+
+
+// Puts a block that isn't in the table yet at slot (i), (dist) slots from
+//  its home, pushing whatever's closer to its own home further along.
+inline void FragMapHashtable::place(dumpptr ptr, size_t size,
+                                    size_t i, size_t dist)
+{
+    const size_t mask = capacity - 1;
+    while (slots[i].ptr != 0)
+    {
+        const size_t d = (i - home(slots[i].ptr)) & mask;
+        if (d < dist)
+        {
+            const Slot tmp = slots[i];
+            slots[i].ptr = ptr;
+            slots[i].size = size;
+            ptr = tmp.ptr;
+            size = tmp.size;
+            dist = d;
+        } // if
+        i = (i + 1) & mask;
+        dist++;
+    } // while
+
+    slots[i].ptr = ptr;
+    slots[i].size = size;
+} // FragMapHashtable::place
+
+
+void FragMapHashtable::grow(size_t newcapacity)
+{
+    Slot *oldslots = slots;
+    const size_t oldcapacity = capacity;
+    slots = new Slot[newcapacity];
+    memset(slots, '\0', newcapacity * sizeof (Slot));
+    capacity = newcapacity;
+
+    for (size_t i = 0; i < oldcapacity; i++)
+    {
+        if (oldslots[i].ptr != 0)
+            place(oldslots[i].ptr, oldslots[i].size, home(oldslots[i].ptr), 0);
+    } // for
+
+    delete[] oldslots;
+} // FragMapHashtable::grow
+
+
+// keep it no more than 3/4 full, so probes stay short.
+void FragMapHashtable::reserve(size_t count)
+{
+    size_t newcapacity = capacity;
+    while ((count * 4) > (newcapacity * 3))
+        newcapacity *= 2;
+
+    if (newcapacity != capacity)
+        grow(newcapacity);
+} // FragMapHashtable::reserve
+
+
+bool FragMapHashtable::insert(dumpptr ptr, size_t size, size_t *replaced)
+{
+    if (ptr == 0)
+        return(false);  // a failed allocation isn't a block.
+
+    const size_t mask = capacity - 1;
+    size_t i = home(ptr);
+    size_t dist = 0;
+    while (slots[i].ptr != 0)
+    {
+        if (slots[i].ptr == ptr)  // missed a free? This one's newer.
+        {
+            if (replaced != NULL)
+                *replaced = slots[i].size;
+            slots[i].size = size;
+            return(true);
+        } // if
+        else if (((i - home(slots[i].ptr)) & mask) < dist)
+            break;  // it's not here, and this is where it goes.
+        i = (i + 1) & mask;
+        dist++;
+    } // while
+
+    total++;
+    if ((total * 4) > (capacity * 3))
+    {
+        reserve(total);
+        i = home(ptr);  // start over in the new table.
+        dist = 0;
+    } // if
+    place(ptr, size, i, dist);
+    return(false);
+} // FragMapHashtable::insert
+
+
+bool FragMapHashtable::remove(dumpptr ptr, size_t *prior)
+{
+    size_t i = find(ptr);
+    if (i == capacity)
+        return(false);
+
+    if (prior != NULL)
+        *prior = slots[i].size;
+
+    // shift everything after it back a slot, until we hit a hole or
+    //  something that's already home.
+    const size_t mask = capacity - 1;
+    size_t next = (i + 1) & mask;
+    while ((slots[next].ptr != 0) && (home(slots[next].ptr) != next))
+    {
+        slots[i] = slots[next];
+        i = next;
+        next = (next + 1) & mask;
+    } // while
+
+    slots[i].ptr = 0;
+    total--;
+    return(true);
+} // FragMapHashtable::remove
+
+
+bool FragMapHashtable::resize_block(dumpptr ptr, size_t size, size_t *prior)
+{
+    const size_t i = find(ptr);
+    if (i == capacity)
+        return(false);
+    if (prior != NULL)
+        *prior = slots[i].size;
+    slots[i].size = size;
+    return(true);
+} // FragMapHashtable::resize_block
+
+
+void FragMapHashtable::clear()
+{
+    if (total > 0)
+    {
+        memset(slots, '\0', capacity * sizeof (Slot));
+        total = 0;
+    } // if
+} // FragMapHashtable::clear
+
+
+void FragMapHashtable::swap(FragMapHashtable &other)
+{
+    Slot *tmpslots = slots;
+    const size_t tmpcapacity = capacity;
+    const size_t tmptotal = total;
+    slots = other.slots;
+    capacity = other.capacity;
+    total = other.total;
+    other.slots = tmpslots;
+    other.capacity = tmpcapacity;
+    other.total = tmptotal;
+} // FragMapHashtable::swap
+
+
+// below this many entries, a node gets merged with or topped up from the
+//  one next to it.
+#define FRAGMAPTREE_MIN_FILL (FRAGMAPTREE_ORDER / 4)
+
+// how full build() makes nodes, so there's room to insert afterwards.
+#define FRAGMAPTREE_BUILD_FILL ((FRAGMAPTREE_ORDER * 3) / 4)
+
+FragMapTree::FragMapTree()
+    : total(0), root(NULL), height(0), first(NULL)
+{
+    first = new FragMapTreeLeaf;
+    first->total = 0;
+    first->next = NULL;
+    root = first;
+} // FragMapTree::FragMapTree
+
+
+FragMapTree::~FragMapTree()
+{
+    free_node(root, height);
+} // FragMapTree::~FragMapTree
+
+
+void FragMapTree::free_node(void *node, uint32 levels)
+{
+    if (levels == 0)
+        delete (FragMapTreeLeaf *) node;
+    else
+    {
+        FragMapTreeBranch *branch = (FragMapTreeBranch *) node;
+        for (uint32 i = 0; i < branch->total; i++)
+            free_node(branch->children[i], levels - 1);
+        delete branch;
+    } // else
+} // FragMapTree::free_node
+
+
+// the first slot in (leaf) at or after (ptr).
+static inline uint32 fragmaptree_leaf_slot(const FragMapTreeLeaf *leaf,
+                                           dumpptr ptr)
+{
+    uint32 lo = 0;
+    uint32 hi = leaf->total;
+    while (lo < hi)
+    {
+        const uint32 mid = (lo + hi) >> 1;
+        if (leaf->ptrs[mid] < ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return(lo);
+} // fragmaptree_leaf_slot
+
+
+// the child of (branch) that (ptr) belongs under. The first child gets
+//  everything lower than the second child's key, whatever its own key is.
+static inline uint32 fragmaptree_branch_slot(const FragMapTreeBranch *branch,
+                                             dumpptr ptr)
+{
+    uint32 lo = 1;
+    uint32 hi = branch->total;
+    while (lo < hi)
+    {
+        const uint32 mid = (lo + hi) >> 1;
+        if (branch->keys[mid] <= ptr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return(lo - 1);
+} // fragmaptree_branch_slot
+
+
+// Finds the leaf (ptr) belongs in, and which branch and child we went
+//  through at each level to get there; the root is at (path[0]).
+FragMapTreeLeaf *FragMapTree::descend(dumpptr ptr, FragMapTreeBranch **path,
+                                      uint32 *slots) const
+{
+    void *node = root;
+    for (uint32 level = 0; level < height; level++)
+    {
+        FragMapTreeBranch *branch = (FragMapTreeBranch *) node;
+        const uint32 slot = fragmaptree_branch_slot(branch, ptr);
+        path[level] = branch;
+        slots[level] = slot;
+        node = branch->children[slot];
+    } // for
+    return((FragMapTreeLeaf *) node);
+} // FragMapTree::descend
+
+
+// Puts (child), whose lowest address is (key), right after the child we
+//  went down through at the bottom of (path), splitting branches on the
+//  way up as they fill, and the root, too, if it comes to that.
+void FragMapTree::add_child(FragMapTreeBranch **path, uint32 *slots,
+                            dumpptr key, void *child)
+{
+    const uint32 half = FRAGMAPTREE_ORDER / 2;
+    uint32 level = height;
+    while (level-- > 0)
+    {
+        FragMapTreeBranch *branch = path[level];
+        const uint32 at = slots[level] + 1;
+        FragMapTreeBranch *into = branch;
+        uint32 pos = at;
+
+        FragMapTreeBranch *right = NULL;
+        if (branch->total == FRAGMAPTREE_ORDER)
+        {
+            right = new FragMapTreeBranch;
+            right->total = FRAGMAPTREE_ORDER - half;
+            memcpy(right->keys, branch->keys + half,
+                   right->total * sizeof (dumpptr));
+            memcpy(right->children, branch->children + half,
+                   right->total * sizeof (void *));
+            branch->total = half;
+            if (at > half)
+            {
+                into = right;
+                pos = at - half;
+            } // if
+        } // if
+
+        const uint32 move = into->total - pos;
+        memmove(into->keys + pos + 1, into->keys + pos,
+                move * sizeof (dumpptr));
+        memmove(into->children + pos + 1, into->children + pos,
+                move * sizeof (void *));
+        into->keys[pos] = key;
+        into->children[pos] = child;
+        into->total++;
+
+        if (right == NULL)
+            return;
+
+        key = right->keys[0];
+        child = right;
+    } // while
+
+    // the root split, so the tree gets taller.
+    assert(height < FRAGMAPTREE_MAX_HEIGHT);
+    FragMapTreeBranch *newroot = new FragMapTreeBranch;
+    newroot->total = 2;
+    newroot->keys[0] = 0;
+    newroot->keys[1] = key;
+    newroot->children[0] = root;
+    newroot->children[1] = child;
+    root = newroot;
+    height++;
+} // FragMapTree::add_child
+
+
+void FragMapTree::insert(dumpptr ptr, size_t size)
+{
+    if (ptr == 0)
+        return;  // a failed allocation isn't a block.
+
+    FragMapTreeBranch *path[FRAGMAPTREE_MAX_HEIGHT];
+    uint32 slots[FRAGMAPTREE_MAX_HEIGHT];
+    FragMapTreeLeaf *leaf = descend(ptr, path, slots);
+    uint32 pos = fragmaptree_leaf_slot(leaf, ptr);
+    if ((pos < leaf->total) && (leaf->ptrs[pos] == ptr))
+    {
+        leaf->sizes[pos] = size;  // missed a free? This one's newer.
+        return;
+    } // if
+
+    total++;
+
+    FragMapTreeLeaf *right = NULL;
+    if (leaf->total == FRAGMAPTREE_ORDER)
+    {
+        const uint32 half = FRAGMAPTREE_ORDER / 2;
+        right = new FragMapTreeLeaf;
+        right->total = FRAGMAPTREE_ORDER - half;
+        memcpy(right->ptrs, leaf->ptrs + half, right->total * sizeof (dumpptr));
+        memcpy(right->sizes, leaf->sizes + half, right->total * sizeof (size_t));
+        right->next = leaf->next;
+        leaf->next = right;
+        leaf->total = half;
+        if (pos > half)
+        {
+            leaf = right;
+            pos -= half;
+        } // if
+    } // if
+
+    const uint32 move = leaf->total - pos;
+    memmove(leaf->ptrs + pos + 1, leaf->ptrs + pos, move * sizeof (dumpptr));
+    memmove(leaf->sizes + pos + 1, leaf->sizes + pos, move * sizeof (size_t));
+    leaf->ptrs[pos] = ptr;
+    leaf->sizes[pos] = size;
+    leaf->total++;
+
+    if (right != NULL)
+        add_child(path, slots, right->ptrs[0], right);
+} // FragMapTree::insert
+
+
+// Takes child (slot) out of the branch at (level) of (path), after it was
+//  merged into the child before it. Then makes sure the branch isn't too
+//  empty, which might mean taking one of its siblings' children out of its
+//  parent, and so on up.
+void FragMapTree::remove_child(FragMapTreeBranch **path, uint32 *slots,
+                               uint32 level, uint32 slot)
+{
+    while (true)
+    {
+        FragMapTreeBranch *branch = path[level];
+        const uint32 move = branch->total - (slot + 1);
+        memmove(branch->keys + slot, branch->keys + slot + 1,
+                move * sizeof (dumpptr));
+        memmove(branch->children + slot, branch->children + slot + 1,
+                move * sizeof (void *));
+        branch->total--;
+
+        if (level == 0)  // the root; it just needs one child.
+        {
+            if (branch->total == 1)
+            {
+                root = branch->children[0];
+                height--;
+                delete branch;
+            } // if
+            return;
+        } // if
+
+        else if (branch->total >= FRAGMAPTREE_MIN_FILL)
+            return;
+
+        // pick a sibling; (sep) is the right one's slot in the parent.
+        FragMapTreeBranch *parent = path[level - 1];
+        const uint32 pslot = slots[level - 1];
+        const uint32 sep = (pslot > 0) ? pslot : 1;
+        FragMapTreeBranch *left = (FragMapTreeBranch *) parent->children[sep-1];
+        FragMapTreeBranch *right = (FragMapTreeBranch *) parent->children[sep];
+
+        // the right one's first key is only known to the parent.
+        right->keys[0] = parent->keys[sep];
+
+        if ((left->total + right->total) <= FRAGMAPTREE_ORDER)
+        {
+            memcpy(left->keys + left->total, right->keys,
+                   right->total * sizeof (dumpptr));
+            memcpy(left->children + left->total, right->children,
+                   right->total * sizeof (void *));
+            left->total += right->total;
+            delete right;
+            level--;
+            slot = sep;
+            continue;  // now take (right) out of the parent.
+        } // if
+
+        // too many to merge, so even them out instead.
+        const uint32 want = (left->total + right->total) / 2;
+        if (left->total < want)
+        {
+            const uint32 count = want - left->total;
+            memcpy(left->keys + left->total, right->keys,
+                   count * sizeof (dumpptr));
+            memcpy(left->children + left->total, right->children,
+                   count * sizeof (void *));
+            left->total += count;
+            right->total -= count;
+            memmove(right->keys, right->keys + count,
+                    right->total * sizeof (dumpptr));
+            memmove(right->children, right->children + count,
+                    right->total * sizeof (void *));
+        } // if
+        else
+        {
+            const uint32 count = left->total - want;
+            memmove(right->keys + count, right->keys,
+                    right->total * sizeof (dumpptr));
+            memmove(right->children + count, right->children,
+                    right->total * sizeof (void *));
+            left->total -= count;
+            right->total += count;
+            memcpy(right->keys, left->keys + left->total,
+                   count * sizeof (dumpptr));
+            memcpy(right->children, left->children + left->total,
+                   count * sizeof (void *));
+        } // else
+        parent->keys[sep] = right->keys[0];
+        return;
+    } // while
+} // FragMapTree::remove_child
+
+
+bool FragMapTree::remove(dumpptr ptr)
+{
+    FragMapTreeBranch *path[FRAGMAPTREE_MAX_HEIGHT];
+    uint32 slots[FRAGMAPTREE_MAX_HEIGHT];
+    FragMapTreeLeaf *leaf = descend(ptr, path, slots);
+    const uint32 pos = fragmaptree_leaf_slot(leaf, ptr);
+    if ((pos == leaf->total) || (leaf->ptrs[pos] != ptr))
+        return(false);
+
+    total--;
+    leaf->total--;
+    const uint32 move = leaf->total - pos;
+    memmove(leaf->ptrs + pos, leaf->ptrs + pos + 1, move * sizeof (dumpptr));
+    memmove(leaf->sizes + pos, leaf->sizes + pos + 1, move * sizeof (size_t));
+
+    if ((height == 0) || (leaf->total >= FRAGMAPTREE_MIN_FILL))
+        return(true);
+
+    // pick a sibling; (sep) is the right one's slot in the parent.
+    FragMapTreeBranch *parent = path[height - 1];
+    const uint32 pslot = slots[height - 1];
+    const uint32 sep = (pslot > 0) ? pslot : 1;
+    FragMapTreeLeaf *left = (FragMapTreeLeaf *) parent->children[sep - 1];
+    FragMapTreeLeaf *right = (FragMapTreeLeaf *) parent->children[sep];
+
+    if ((left->total + right->total) <= FRAGMAPTREE_ORDER)
+    {
+        memcpy(left->ptrs + left->total, right->ptrs,
+               right->total * sizeof (dumpptr));
+        memcpy(left->sizes + left->total, right->sizes,
+               right->total * sizeof (size_t));
+        left->total += right->total;
+        left->next = right->next;
+        delete right;
+        remove_child(path, slots, height - 1, sep);
+        return(true);
+    } // if
+
+    // too many to merge, so even them out instead.
+    const uint32 want = (left->total + right->total) / 2;
+    if (left->total < want)
+    {
+        const uint32 count = want - left->total;
+        memcpy(left->ptrs + left->total, right->ptrs, count * sizeof (dumpptr));
+        memcpy(left->sizes + left->total, right->sizes, count * sizeof (size_t));
+        left->total += count;
+        right->total -= count;
+        memmove(right->ptrs, right->ptrs + count,
+                right->total * sizeof (dumpptr));
+        memmove(right->sizes, right->sizes + count,
+                right->total * sizeof (size_t));
+    } // if
+    else
+    {
+        const uint32 count = left->total - want;
+        memmove(right->ptrs + count, right->ptrs,
+                right->total * sizeof (dumpptr));
+        memmove(right->sizes + count, right->sizes,
+                right->total * sizeof (size_t));
+        left->total -= count;
+        right->total += count;
+        memcpy(right->ptrs, left->ptrs + left->total, count * sizeof (dumpptr));
+        memcpy(right->sizes, left->sizes + left->total, count * sizeof (size_t));
+    } // else
+    parent->keys[sep] = right->ptrs[0];
+    return(true);
+} // FragMapTree::remove
+
+
+bool FragMapTree::resize_block(dumpptr ptr, size_t size)
+{
+    FragMapTreeBranch *path[FRAGMAPTREE_MAX_HEIGHT];
+    uint32 slots[FRAGMAPTREE_MAX_HEIGHT];
+    FragMapTreeLeaf *leaf = descend(ptr, path, slots);
+    const uint32 pos = fragmaptree_leaf_slot(leaf, ptr);
+    if ((pos == leaf->total) || (leaf->ptrs[pos] != ptr))
+        return(false);
+    leaf->sizes[pos] = size;
+    return(true);
+} // FragMapTree::resize_block
+
+
+void FragMapTree::clear()
+{
+    if ((height == 0) && (first->total == 0))
+        return;  // already empty.
+
+    free_node(root, height);
+    first = new FragMapTreeLeaf;
+    first->total = 0;
+    first->next = NULL;
+    root = first;
+    height = 0;
+    total = 0;
+} // FragMapTree::clear
+
+
+// Packs the leaves, then each level of branches over them, from the
+//  bottom up. Nodes are split as evenly as they can be, so none of them
+//  ends up too empty.
+void FragMapTree::build(const FragMapColumns &cols)
+{
+    clear();
+    if (cols.total == 0)
+        return;
+
+    const size_t fill = FRAGMAPTREE_BUILD_FILL;
+    size_t count = (cols.total + fill - 1) / fill;
+    void **nodes = new void*[count];
+    dumpptr *keys = new dumpptr[count];
+
+    size_t pos = 0;
+    FragMapTreeLeaf *prev = NULL;
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t n = (cols.total - pos) / (count - i);
+        FragMapTreeLeaf *leaf = (i == 0) ? first : new FragMapTreeLeaf;
+        memcpy(leaf->ptrs, cols.ptrs + pos, n * sizeof (dumpptr));
+        memcpy(leaf->sizes, cols.sizes + pos, n * sizeof (size_t));
+        leaf->total = (uint32) n;
+        leaf->next = NULL;
+        if (prev != NULL)
+            prev->next = leaf;
+        prev = leaf;
+        nodes[i] = leaf;
+        keys[i] = cols.ptrs[pos];
+        pos += n;
+    } // for
+
+    while (count > 1)
+    {
+        const size_t parents = (count + fill - 1) / fill;
+        pos = 0;
+        for (size_t i = 0; i < parents; i++)  // (i) never passes (pos).
+        {
+            const size_t n = (count - pos) / (parents - i);
+            FragMapTreeBranch *branch = new FragMapTreeBranch;
+            memcpy(branch->keys, keys + pos, n * sizeof (dumpptr));
+            memcpy(branch->children, nodes + pos, n * sizeof (void *));
+            branch->total = (uint32) n;
+            nodes[i] = branch;
+            keys[i] = keys[pos];
+            pos += n;
+        } // for
+        count = parents;
+        height++;
+    } // while
+
+    root = nodes[0];
+    total = cols.total;
+    delete[] nodes;
+    delete[] keys;
+} // FragMapTree::build
+
+
+void FragMapTree::flatten(FragMapColumns &cols) const
+{
+    cols.clear();
+    cols.reserve(total);
+
+    size_t pos = 0;
+    for (const FragMapTreeLeaf *leaf = first; leaf != NULL; leaf = leaf->next)
+    {
+        memcpy(cols.ptrs + pos, leaf->ptrs, leaf->total * sizeof (dumpptr));
+        memcpy(cols.sizes + pos, leaf->sizes, leaf->total * sizeof (size_t));
+        pos += leaf->total;
+    } // for
+
+    assert(pos == total);
+    cols.total = pos;
+} // FragMapTree::flatten
+
+
+void FragMapTree::swap(FragMapTree &other)
+{
+    const size_t tmptotal = total;
+    void *tmproot = root;
+    const uint32 tmpheight = height;
+    FragMapTreeLeaf *tmpfirst = first;
+    total = other.total;
+    root = other.root;
+    height = other.height;
+    first = other.first;
+    other.total = tmptotal;
+    other.root = tmproot;
+    other.height = tmpheight;
+    other.first = tmpfirst;
+} // FragMapTree::swap
+
+
+FragMapManager::FragMapManager()
+    : snapshots(NULL),
+      total_snapshots(0),
+      current_operation(0),
+      snapshot_operations(0),
+      scratch(NULL),
+      max_resident_bytes(0),
+      resident_bytes(0),
+      snapshot_clock(0),
+      is_paused(false),
+      pause_snapshot(NULL),
+      since_keyframe(0),
+      chain_blocks(0),
+      pending_undo(new size_t[FRAGMAP_SNAPSHOT_THRESHOLD]),
+      views(NULL),
+      total_views(0),
+      max_view_bytes(FRAGMAP_VIEW_CACHE_BYTES),
+      working_operation(FRAGMAP_NO_OPERATION)
+{
+} // FragMapManager::FragMapManager
+
+
+FragMapManager::~FragMapManager()
+{
+    resume_adding();
+
+    for (size_t i = 0; i < total_snapshots; i++)
+        delete snapshots[i];
+
+    free(snapshots); // !!! FIXME: allocated with realloc()...
+    free_views();
+    delete[] pending_undo;
+} // FragMapManager::~FragMapManager
+
+
+inline void FragMapManager::empty_hashtable()
+{
+    fragmap.clear();
+    addresses.clear();
+} // FragMapManager::empty_hashtable
+
+
+// These return the size of the block that was at (ptr) before, or
+//  FRAGMAP_UNDO_NOTHING if there wasn't one.
+size_t FragMapManager::insert_block(dumpptr ptr, size_t size)
+{
+    size_t replaced = FRAGMAP_UNDO_NOTHING;
+    fragmap.insert(ptr, size, &replaced);
+    addresses.insert(ptr, size);
+    return(replaced);
+} // FragMapManager::insert_block
+
+
+size_t FragMapManager::remove_block(dumpptr ptr)
+{
+    size_t prior = FRAGMAP_UNDO_NOTHING;
+    if (fragmap.remove(ptr, &prior))  // the hashtable knows faster if it's there.
+        addresses.remove(ptr);
+    return(prior);
+} // FragMapManager::remove_block
+
+
+inline size_t FragMapManager::hash_malloc(const DumpFileOperation &op)
+{
+    return(insert_block(op.getRetval(), op.getSize()));
+} // FragMapManager::hash_malloc
+
+
+inline size_t FragMapManager::hash_realloc(const DumpFileOperation &op)
+{
+    const dumpptr ptr = op.getPtr();
+    const dumpptr retval = op.getRetval();
+    const size_t size = op.getSize();
+    size_t prior = FRAGMAP_UNDO_NOTHING;
+
+    if (size == 0)  // realloc(ptr, 0) is free(ptr).
+        return(remove_block(ptr));
+    else if (retval == 0)  // failed, so (ptr) is still there, untouched.
+        return(FRAGMAP_UNDO_NOTHING);
+    else if ((ptr == retval) && (fragmap.resize_block(ptr, size, &prior)))
+        addresses.resize_block(ptr, size);  // grew or shrank where it was.
+    else
+    {
+        prior = remove_block(ptr);  // NULL is never there, so this is safe.
+        if (insert_block(retval, size) != FRAGMAP_UNDO_NOTHING)
+            return(FRAGMAP_UNDO_UNKNOWN);  // clobbered a second block, too.
+    } // else
+
+    return(prior);
+} // FragMapManager::hash_realloc
+
+
+inline size_t FragMapManager::hash_free(const DumpFileOperation &op)
+{
+    return(remove_block(op.getPtr()));
+} // FragMapManager::hash_free
+
+
+// Puts back what the hash_* function for (op) took away, given what it
+//  returned. Every operation only ever takes away the block at its pointer
+//  (or, for a malloc, its return value) and only ever adds the block at its
+//  return value, so that's all there is to it.
+inline bool FragMapManager::unhash_operation(const DumpFileOperation &op,
+                                             size_t undo)
+{
+    if (undo == FRAGMAP_UNDO_UNKNOWN)
+        return(false);
+
+    dumpptr ptr = op.getPtr();
+    dumpptr retval = op.getRetval();
+    switch (op.getOperationType())
+    {
+        case DUMPFILE_OP_MALLOC:
+            ptr = retval;
+            break;
+        case DUMPFILE_OP_REALLOC:
+            if (op.getSize() == 0)
+                retval = 0;  // it was a free.
+            break;
+        case DUMPFILE_OP_FREE:
+            retval = 0;
+            break;
+        default:
+            assert(0 && "unknown dumpfile operation!");
+            return(false);
+    } // switch
+
+    if ((retval == ptr) && (undo != FRAGMAP_UNDO_NOTHING) &&
+        (fragmap.resize_block(ptr, undo)))
+        addresses.resize_block(ptr, undo);  // put it back where it was.
+    else
+    {
+        if (retval != 0)
+            remove_block(retval);
+        if (undo != FRAGMAP_UNDO_NOTHING)
+            insert_block(ptr, undo);
+    } // else
+
+    return(true);
+} // FragMapManager::unhash_operation
+
+
+void FragMapManager::add_malloc(const DumpFileOperation &op)
+{
+    pending_undo[snapshot_operations] = hash_malloc(op);
+    increment_operations();
+} // FragMapManager::add_malloc
+
+
+void FragMapManager::add_realloc(const DumpFileOperation &op)
+{
+    // !!! FIXME: Is realloc(NULL, 0) illegal?
+    pending_undo[snapshot_operations] = hash_realloc(op);
+    increment_operations();
+} // FragMapManager::add_realloc
+
+
+void FragMapManager::add_free(const DumpFileOperation &op)
+{
+    pending_undo[snapshot_operations] = hash_free(op);
+    increment_operations();
+} // FragMapManager::add_free
+
+
+void FragMapManager::seed_block(dumpptr ptr, size_t size)
+{
+    insert_block(ptr, size);
+} // FragMapManager::seed_block
+
+
+void FragMapManager::seed_operation(const DumpFileOperation &op)
+{
+    switch (op.getOperationType())
+    {
+        case DUMPFILE_OP_MALLOC: hash_malloc(op); break;
+        case DUMPFILE_OP_REALLOC: hash_realloc(op); break;
+        case DUMPFILE_OP_FREE: hash_free(op); break;
+        default: assert(0 && "unknown dumpfile operation!"); break;
+    } // switch
+} // FragMapManager::seed_operation
+
+
+// The seeds become the snapshot that everything after them starts from.
+//  If there aren't any, starting from nothing is already the default.
+void FragMapManager::done_seeding()
+{
+    if (fragmap.total > 0)
+        add_snapshot();
+    snapshot_operations = 0;
+} // FragMapManager::done_seeding
+
+
+// Stops adding for now, but keeps the working set aside so that
+//  resume_adding() can carry on from here. There's a snapshot of where we
+//  stopped in the meantime, so get_fragmap() can see everything.
+void FragMapManager::pause_adding()
+{
+    if (is_paused)
+        return;
+
+    pause_snapshot = NULL;
+    if (snapshot_operations > 0)  // otherwise, there's one here already.
+    {
+        add_snapshot(false);  // we'll take it back in resume_adding().
+        pause_snapshot = snapshots[total_snapshots-1];
+    } // if
+
+    // get_fragmap() uses the hashtable, so give it a fresh one.
+    paused.clear();
+    paused.swap(fragmap);
+    paused_addresses.clear();
+    paused_addresses.swap(addresses);
+    is_paused = true;
+    working_operation = FRAGMAP_NO_OPERATION;
+} // FragMapManager::pause_adding
+
+
+void FragMapManager::resume_adding()
+{
+    if (!is_paused)
+        return;
+
+    fragmap.swap(paused);
+    paused.clear();
+    addresses.swap(paused_addresses);
+    paused_addresses.clear();
+    is_paused = false;
+    working_operation = FRAGMAP_NO_OPERATION;
+
+    // the snapshot pause_adding() made is about to be out of date, so
+    //  drop it. Nothing came after it, and nothing will be stored as
+    //  changes from it, so it can just go.
+    FragMapSnapshot *ss = pause_snapshot;
+    pause_snapshot = NULL;
+    if (ss != NULL)
+    {
+        assert(snapshots[total_snapshots-1] == ss);
+        if (ss->data != NULL)
+            resident_bytes -= ss->data_bytes();
+        delete ss;
+        total_snapshots--;
+    } // if
+} // FragMapManager::resume_adding
+
+
+void FragMapManager::done_adding(ProgressNotify &pn)
+{
+    resume_adding();
+
+    // flatten out final fragmap, unless there's a snapshot here already...
+    if ((snapshot_operations > 0) || (total_snapshots == 0))
+        add_snapshot();
+    empty_hashtable();
+    base.release();  // nothing else is getting added.
+    flat.release();
+
+#if 0  // PROFILING_STATISTICS
+    // (call this before empty_hashtable() up there.)
+    const size_t mask = fragmap.capacity - 1;
+    size_t longest = 0;
+    uint64 totalprobes = 0;
+    for (size_t i = 0; i < fragmap.capacity; i++)
+    {
+        const dumpptr ptr = fragmap.slots[i].ptr;
+        if (ptr != 0)
+        {
+            const size_t dist = (i - fragmap.home(ptr)) & mask;
+            totalprobes += dist + 1;
+            if (dist > longest)
+                longest = dist;
+        } // if
+    } // for
+
+    fprintf(stderr, "fragmap total == %d, capacity == %d, longest probe"
+            " == %d, average probe == %f\n", (int) fragmap.total,
+            (int) fragmap.capacity, (int) longest + 1,
+            fragmap.total ? ((double) totalprobes) / fragmap.total : 0.0);
+
+    printf("total_snapshots == %d\n", total_snapshots);
+#endif
+} // FragMapManager::done_adding
+
+
+inline void FragMapManager::increment_operations()
+{
+    current_operation++;
+    if (++snapshot_operations >= FRAGMAP_SNAPSHOT_THRESHOLD)
+    {
+        add_snapshot();
+        snapshot_operations = 0;
+    } // if
+} // FragMapManager::increment_operations
+
+
+// A file we're done parsing, but keeping around for lazy callstacks.
+class DumpFileMapping
+{
+public:
+    const uint8 *ptr;
+    size_t size;
+    uint64 offset;  /* where this file starts, as far as lazy ids go. */
+};
+
+
+void DumpFile::destruct(void)
+{
+    unmap_file();
+    unmap_kept_files();
+
+    delete[] id;
+    id = NULL;
+
+    delete[] fname;
+    fname = NULL;
+
+    delete[] follow_fname;
+    follow_fname = NULL;
+
+    free(listeners);  // !!! FIXME: allocated with realloc()...
+    listeners = NULL;
+    total_listeners = 0;
+
+    operations.release();
+
+    if (cache_map != NULL)
+        munmap((void *) cache_map, cache_map_size);
+    cache_map = NULL;
+    cache_map_size = 0;
+
+    delete scratch;
+    scratch = NULL;
+} // DumpFile::Destruct
+
+
+DumpFile::~DumpFile(void)
+{
+    destruct();
+} // DumpFile::~DumpFile
+
+
+
+// Maps (fn) from (start) to the end, and returns the file's total size.
+//  The mapping has to start on a page boundary, so (mapped) might be a
+//  little before (start); (cursor) is right on it.
+size_t DumpFile::map_file(const char *fn, uint64 start) throw (const char *)
+{
+    unmap_file();
+
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        throw ((const char *) strerror(errno));
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1)
+    {
+        int e = errno;
+        close(fd);
+        throw ((const char *) strerror(e));
+    } // if
+
+    if (statbuf.st_size == 0)
+    {
+        close(fd);
+        throw ("File is empty");
+    } // if
+
+    const size_t filesize = (size_t) statbuf.st_size;
+    const uint64 pagesize = (uint64) sysconf(_SC_PAGESIZE);
+    const uint64 filepos = start - (start % pagesize);
+    if (filepos >= filesize)
+    {
+        close(fd);
+        throw ("File is empty");
+    } // if
+
+    const size_t size = filesize - ((size_t) filepos);
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, (off_t) filepos);
+    int e = errno;
+    close(fd);  // the mapping keeps its own reference to the file.
+    if (ptr == MAP_FAILED)
+        throw ((const char *) strerror(e));
+
+    // we read front to back, once. Let the kernel read ahead aggressively.
+    madvise(ptr, size, MADV_SEQUENTIAL);
+
+    mapped = (const uint8 *) ptr;
+    cursor = mapped + ((size_t) (start - filepos));
+    mapped_end = mapped + size;
+    mapped_size = size;
+    mapped_filepos = filepos;
+
+    mapped_offset = 0;
+    if (total_kept_maps > 0)
+    {
+        const DumpFileMapping &prev = kept_maps[total_kept_maps-1];
+        mapped_offset = prev.offset + prev.size;
+    } // if
+
+    return(filesize);
+} // DumpFile::map_file
+
+
+void DumpFile::unmap_file()
+{
+    if (mapped != NULL)
+        munmap((void *) mapped, mapped_size);
+    mapped = mapped_end = cursor = NULL;
+    mapped_size = 0;
+    mapped_filepos = 0;
+} // DumpFile::unmap_file
+
+
+// Done parsing the mapped file. Lazy callstacks still point into it, so
+//  in that case it stays mapped until we're destroyed.
+void DumpFile::release_file()
+{
+    if ((!options.lazy_callstacks) || (mapped == NULL))
+    {
+        unmap_file();
+        return;
+    } // if
+
+    // !!! FIXME: realloc? yuck!
+    DumpFileMapping *maps = (DumpFileMapping *) realloc(kept_maps,
+                    (total_kept_maps + 1) * sizeof (DumpFileMapping));
+    if (maps == NULL)
+        throw("Out of memory");
+    kept_maps = maps;
+
+    DumpFileMapping &map = kept_maps[total_kept_maps++];
+    map.ptr = mapped;
+    map.size = mapped_size;
+    map.offset = mapped_offset;
+
+    // we'll be jumping around in it from now on.
+    madvise((void *) mapped, mapped_size, MADV_RANDOM);
+
+    mapped = mapped_end = cursor = NULL;
+    mapped_size = 0;
+    mapped_filepos = 0;
+} // DumpFile::release_file
+
+
+void DumpFile::unmap_kept_files()
+{
+    for (size_t i = 0; i < total_kept_maps; i++)
+        munmap((void *) kept_maps[i].ptr, kept_maps[i].size);
+    free(kept_maps);  // !!! FIXME: allocated with realloc()...
+    kept_maps = NULL;
+    total_kept_maps = 0;
+
+    delete[] lazy_framebuf;
+    lazy_framebuf = NULL;
+    lazy_framebuf_len = 0;
+} // DumpFile::unmap_kept_files
+
+
+// need_bytes() always throws this exact string, so handshake_written() can
+//  tell running out of file from anything else going wrong.
+static const char dumpfile_eof_error[] = "Unexpected end of file";
+
+inline void DumpFile::need_bytes(size_t size) throw (const char *)
+{
+    if (((size_t) (mapped_end - cursor)) < size)
+        throw((const char *) dumpfile_eof_error);
+} // DumpFile::need_bytes
+
+inline void DumpFile::read_block(void *ptr, size_t size) throw (const char *)
+{
+    need_bytes(size);
+    memcpy(ptr, cursor, size);
+    cursor += size;
+} // DumpFile::read_block
+
+void DumpFile::read_ui8(uint8 &ui8) throw (const char *)
+{
+    read_block(&ui8, sizeof (ui8));
+} // DumpFile::read_ui8
+
+inline void DumpFile::read_ui32(uint32 &ui32) throw (const char *)
+{
+    read_block(&ui32, sizeof (ui32));
+    if (byte_order != platform_byteorder)
+        BYTESWAP32(ui32);
+} // DumpFile::read_ui32
+
+inline void DumpFile::read_asciz(char *&str) throw (const char *)
+{
+    // inefficient, but who cares? It's only used twice in the header!
+    uint8 buf[1024];
+    size_t i;
+    for (i = 0; i < sizeof (buf); i++)
+    {
+        read_ui8(buf[i]);
+        if (buf[i] == 0)
+            break;
+    } // for
+
+    if (i >= sizeof (buf))
+        throw("Buffer overflow");
+
+    str = new char[i+1];
+    strcpy(str, (char *) buf);
+} // read_asciz
+
+
+DumpFile::DumpFile(const char *fn, ProgressNotify &pn,
+                   const DumpFileOptions &opts) throw (const char *)
+    : options(opts)
+{
+    parse(fn, DumpFileWindow(), pn);
+} // DumpFile constructor
+
+DumpFile::DumpFile(const char *fn) throw (const char *)
+{
+    ProgressNotifyDummy pnd;
+    parse(fn, DumpFileWindow(), pnd);
+} // DumpFile constructor
+
+DumpFile::DumpFile(const char *fn, const DumpFileWindow &window,
+                   ProgressNotify &pn, const DumpFileOptions &opts)
+    throw (const char *)
+    : options(opts)
+{
+    parse(fn, window, pn);
+} // DumpFile constructor
+
+DumpFile::DumpFile()
+{
+    init_state();
+} // DumpFile constructor
+
+DumpFile::DumpFile(const char *idxfn, tick_t starttick, tick_t endtick,
+                   ProgressNotify &pn, const DumpFileOptions &opts)
+    throw (const char *)
+    : options(opts)
+{
+    parse_index(idxfn, starttick, endtick, pn);
+} // DumpFile constructor
+
+
+void DumpFile::init_state()
+{
+    // set sane initial state...
+    fname = NULL;
+    id = NULL;
+    mapped = mapped_end = cursor = NULL;
+    mapped_size = 0;
+    mapped_filepos = 0;
+    mapped_offset = 0;
+    kept_maps = NULL;
+    total_kept_maps = 0;
+    lazy_framebuf = NULL;
+    lazy_framebuf_len = 0;
+    scratch = NULL;
+    follow_fname = NULL;
+    follow_pos = 0;
+    follow_handshake = false;
+    listeners = NULL;
+    total_listeners = 0;
+    window_start = 0;
+    skipped_blocks = 0;
+    cache_map = NULL;
+    cache_map_size = 0;
+    start_time = 0;
+
+    platform_byteorder = is_bigendian();
+} // DumpFile::init_state
+
+
+// If we have a memory budget, everything that can spill gets half of it.
+void DumpFile::init_scratch() throw (const char *)
+{
+    if (options.memory_budget == 0)
+        return;
+
+    scratch = new DumpFileScratch(options.scratch_dir);
+    operations.spill_to(scratch, options.memory_budget / 2);
+    fragmapManager.spill_to(scratch, options.memory_budget / 2);
+} // DumpFile::init_scratch
+
+
+// Chunks decoded out of order keep their ops in a private store until
+//  they're stitched in, which is a lot of ops for a big dump.
+DumpFileOpStore *DumpFile::create_chunk_store() const
+{
+    DumpFileOpStore *retval = new DumpFileOpStore;
+    if (scratch != NULL)
+        retval->spill_to(scratch, 0);  // read back once, in order.
+    return(retval);
+} // DumpFile::create_chunk_store
+
+
+// Reads the handshake from the start of the mapped file. The first file
+//  we look at fills in our fields; later segments of the same capture just
+//  have to agree with it.
+void DumpFile::read_header(bool first) throw (const char *)
+{
+    char sigbuf[16];
+    read_block(sigbuf, sizeof (sigbuf));
+    if (strcmp(sigbuf, "Malloc Monitor!") != 0)
+        throw("Not a Malloc Monitor dumpfile");
+
+    uint8 ver, order, ptrsize;
+    read_ui8(ver);
+    if ((ver < 1) || (ver > 2))
+        throw("Unknown dumpfile format version");
+
+    read_ui8(order);
+    read_ui8(ptrsize);
+
+    if (first)
+    {
+        protocol_version = ver;
+        byte_order = order;
+        sizeofptr = ptrsize;
+        read_asciz(id);
+        read_asciz(this->fname);
+        read_ui32(pid);
+        if (ver >= 2)  // wall clock time at tick zero.
+        {
+            uint32 sec, usec;
+            read_ui32(sec);
+            read_ui32(usec);
+            start_time = (((uint64) sec) * 1000000) + ((uint64) usec);
+        } // if
+    } // if
+    else
+    {
+        if ((order != byte_order) || (ptrsize != sizeofptr))
+            throw("Segments don't agree on byte order or pointer size");
+
+        char *str = NULL;
+        uint32 ui32;
+        read_asciz(str);  // the byte order is right, so these are safe.
+        delete[] str;
+        read_asciz(str);
+        delete[] str;
         read_ui32(ui32);
-        ptr = (dumpptr) ui32;
+        if (ver >= 2)
+        {
+            read_ui32(ui32);
+            read_ui32(ui32);
+        } // if
+    } // else
+
+    if ((sizeofptr != 4) && (sizeofptr != 8))
+        throw("Unsupported pointer size in dumpfile");
+
+    // rebuild with dumpptr defined to something bigger...
+    if (sizeofptr > sizeof (dumpptr))
+        throw("This build doesn't support this dumpfile's pointer size");
+} // DumpFile::read_header
+
+
+// Whether all of (fn)'s handshake is there yet, for a dumpfile that the
+//  daemon might have only just started writing. It's read and thrown
+//  away. Anything wrong with it besides being short counts as written, so
+//  the real parse can complain about it (or, for a block container, not).
+bool DumpFile::handshake_written(const char *fn)
+{
+    struct stat statbuf;
+    if (stat(fn, &statbuf) == -1)
+        return(true);
+    else if (statbuf.st_size == 0)
+        return(false);
+
+    bool retval = true;
+    try
+    {
+        map_file(fn);
+        read_header(true);
+    } // try
+
+    catch (const char *e)
+    {
+        retval = (e != dumpfile_eof_error);
+    } // catch
+
+    unmap_file();
+    delete[] id;  // read_header() reads these for real later.
+    id = NULL;
+    delete[] this->fname;
+    this->fname = NULL;
+    return(retval);
+} // DumpFile::handshake_written
+
+
+/*
+ * Parallel decoding...
+ *
+ * Records don't have sync markers and vary in size, so the only way to know
+ *  where one starts is to decode everything before it. For big dumps, we
+ *  split the rest of the mapped file into one chunk per thread, and each
+ *  thread guesses where the first record in its chunk starts by looking for
+ *  a run of records that decode sanely. It then decodes up to the first
+ *  record that starts past the end of its chunk, into a private list of
+ *  operations and a private callstack tree.
+ *
+ * Then we stitch the chunks together in order. A chunk is only kept if its
+ *  guess matches where the previous chunk really stopped; otherwise it gets
+ *  thrown out and decoded again from the right spot, so a bad guess costs
+ *  time but never correctness. The fragmap only makes sense in order, so it
+ *  gets fed here, too.
+ */
+
+#define DUMPFILE_MIN_CHUNK_SIZE (4 * 1024 * 1024)
+
+// see "Lazy callstacks," below.
+#define DUMPFILE_LAZY_CALLSTACK_BIT 0x8000000000000000ULL
+#define DUMPFILE_LAZY_CALLSTACK(offset) \
+    (((uint64) (offset)) | DUMPFILE_LAZY_CALLSTACK_BIT)
+#define DUMPFILE_IS_LAZY_CALLSTACK(id) \
+    ((((uint64) (id)) & DUMPFILE_LAZY_CALLSTACK_BIT) != 0)
+#define DUMPFILE_SYNC_RECORDS 16
+#define DUMPFILE_SYNC_MAX_FRAMES 4096
+
+class DumpFileChunk
+{
+public:
+    DumpFileChunk()
+        : df(NULL), start(NULL), end(NULL), stop(NULL), mintick(0),
+          maxtick(0), callstacks(NULL), packed(NULL),
+          status(DUMPFILE_CHUNK_END), threaded(false), framebuf(NULL),
+          framebuf_len(0) {}
+    ~DumpFileChunk()
+    {
+        if (packed != NULL)
+        {
+            delete callstacks;
+            delete packed;
+        } // if
+        delete[] framebuf;
+    } // destructor
+
+    DumpFile *df;
+    const uint8 *start;  /* first record, or NULL if we couldn't find one. */
+    const uint8 *end;    /* records starting here or later aren't ours. */
+    const uint8 *stop;   /* where decoding really stopped. */
+    tick_t mintick;
+    tick_t maxtick;
+    CallstackManager *callstacks;  /* the DumpFile's, or a private one. */
+    DumpFileOpStore *packed;  /* private ops, or NULL if decoding in order. */
+    DumpFileColumns ops;  /* ops that haven't been stored yet. */
+    dumpfile_chunk_status_t status;
+    pthread_t thread;
+    bool threaded;
+    dumpptr *framebuf;  /* scratch space for decoding callstacks. */
+    size_t framebuf_len;
+};
+
+
+size_t DumpFile::decode_thread_count() const
+{
+    if (options.decode_threads > 0)
+        return((size_t) options.decode_threads);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return((cpus > 0) ? ((size_t) cpus) : 1);
+} // DumpFile::decode_thread_count
+
+
+// Reads operations from the mapped file until EOF, a GOODBYE, or garbage,
+//  and appends them to (operations). Only operations with timestamps in the
+//  given range are kept. Returns why we stopped.
+dumpfile_chunk_status_t DumpFile::parse_operations(ProgressNotify &pn,
+                                tick_t mintick, tick_t maxtick,
+                                double basepos, double totalsize)
+{
+    if (byte_order != platform_byteorder)
+    {
+        if (sizeofptr == 4)
+            return(parse_chunks< DumpFileDecoder<uint32, true> >(
+                       pn, mintick, maxtick, basepos, totalsize));
+        return(parse_chunks< DumpFileDecoder<uint64, true> >(
+                   pn, mintick, maxtick, basepos, totalsize));
+    } // if
+
+    if (sizeofptr == 4)
+        return(parse_chunks< DumpFileDecoder<uint32, false> >(
+                   pn, mintick, maxtick, basepos, totalsize));
+    return(parse_chunks< DumpFileDecoder<uint64, false> >(
+               pn, mintick, maxtick, basepos, totalsize));
+} // DumpFile::parse_operations
+
+
+template <class Decoder>
+dumpfile_chunk_status_t DumpFile::parse_chunks(ProgressNotify &pn,
+                            tick_t mintick, tick_t maxtick,
+                            double basepos, double totalsize)
+{
+    const size_t avail = (size_t) (mapped_end - cursor);
+    const size_t total_threads = decode_thread_count();
+    size_t total_chunks = total_threads;
+    if (total_chunks > (avail / DUMPFILE_MIN_CHUNK_SIZE))
+        total_chunks = avail / DUMPFILE_MIN_CHUNK_SIZE;
+
+    if (total_chunks <= 1)  // not worth chunking; decode it in order.
+    {
+        DumpFileChunk chunk;
+        chunk.df = this;
+        chunk.start = cursor;
+        chunk.end = mapped_end;
+        chunk.mintick = mintick;
+        chunk.maxtick = maxtick;
+        chunk.callstacks = &callstackManager;
+        // lazy callstacks leave the pipeline's middle stage nothing to do.
+        if ((total_threads < 2) || (options.lazy_callstacks) ||
+            (!pipeline_chunk<Decoder>(chunk, pn, basepos, totalsize)))
+            decode_chunk<Decoder>(chunk, &pn, basepos, totalsize);
+        stitch_chunk(chunk);
+        cursor = chunk.stop;
+        return(chunk.status);
+    } // if
+
+    DumpFileChunk *chunks = new DumpFileChunk[total_chunks];
+    const size_t chunksize = avail / total_chunks;
+    for (size_t i = 0; i < total_chunks; i++)
+    {
+        DumpFileChunk &chunk = chunks[i];
+        const uint8 *pos = cursor + (i * chunksize);
+        chunk.df = this;
+        chunk.end = (i == total_chunks-1) ? mapped_end : (pos + chunksize);
+        chunk.start = (i == 0) ? pos : find_record<Decoder>(pos, chunk.end);
+        chunk.mintick = mintick;
+        chunk.maxtick = maxtick;
+        chunk.callstacks = new CallstackManager;
+        chunk.packed = create_chunk_store();
+        if (chunk.start != NULL)
+        {
+            // if this fails, the chunk just gets decoded during stitching.
+            chunk.threaded = (pthread_create(&chunk.thread, NULL,
+                                             decode_thread<Decoder>,
+                                             &chunk) == 0);
+        } // if
+    } // for
+
+    const uint8 *pos = cursor;  // where the last kept chunk really ended.
+    dumpfile_chunk_status_t status = DUMPFILE_CHUNK_END;
+    for (size_t i = 0; i < total_chunks; i++)
+    {
+        DumpFileChunk &chunk = chunks[i];
+        if (chunk.threaded)
+            pthread_join(chunk.thread, NULL);
+
+        if (status != DUMPFILE_CHUNK_END)  // an earlier chunk hit the end.
+        {
+            discard_chunk(chunk);
+            continue;
+        } // if
+
+        if ((!chunk.threaded) || (chunk.start != pos))  // guessed wrong.
+        {
+            discard_chunk(chunk);
+            chunk.callstacks = new CallstackManager;
+            chunk.packed = create_chunk_store();
+            chunk.start = pos;
+            decode_chunk<Decoder>(chunk, NULL, basepos, totalsize);
+        } // if
+
+        stitch_chunk(chunk);
+        pos = chunk.stop;
+        status = chunk.status;
+
+        const double chunkpos = basepos + ((double) (chunk.end - mapped));
+        pn.update("Parsing raw data", (int) ((chunkpos / totalsize) * 100.0));
+    } // for
+
+    delete[] chunks;
+    cursor = pos;
+    return(status);
+} // DumpFile::parse_chunks
+
+
+// Looks for the first spot in [pos, end) where DUMPFILE_SYNC_RECORDS
+//  records in a row decode to something plausible. This is just a guess;
+//  parse_chunks() checks it against where the previous chunk stopped.
+template <class Decoder>
+const uint8 *DumpFile::find_record(const uint8 *pos, const uint8 *end) const
+{
+    for ( ; pos < end; pos++)
+    {
+        const uint8 *ptr = pos;
+        tick_t lasttick = 0;
+        int found = 0;
+        while ((found < DUMPFILE_SYNC_RECORDS) && (ptr < mapped_end))
+        {
+            const uint8 optype = *(ptr++);
+            if ((optype == DUMPFILE_OP_NOOP) && (found > 0))
+                continue;
+
+            const size_t fieldsize = Decoder::fields_size(optype);
+            if (fieldsize == 0)
+                break;
+
+            if (((size_t) (mapped_end - ptr)) < fieldsize + sizeof (uint32))
+            {
+                found = DUMPFILE_SYNC_RECORDS;  // ran off the end; close enough.
+                break;
+            } // if
+
+            const uint8 *tickptr = ptr;
+            const tick_t tick = Decoder::ui32(tickptr);
+            if (tick < lasttick)
+                break;  // time doesn't run backwards.
+            lasttick = tick;
+
+            ptr += fieldsize;
+            const uint32 count = Decoder::ui32(ptr);
+            if ((count == 0) || (count > DUMPFILE_SYNC_MAX_FRAMES))
+                break;
+            ptr += count * Decoder::ptrsize;
+            found++;
+        } // while
+
+        if (found == DUMPFILE_SYNC_RECORDS)
+            return(pos);
+    } // for
+
+    return(NULL);
+} // DumpFile::find_record
+
+
+template <class Decoder>
+void *DumpFile::decode_thread(void *_chunk)
+{
+    DumpFileChunk *chunk = (DumpFileChunk *) _chunk;
+    chunk->df->decode_chunk<Decoder>(*chunk, NULL, 0.0, 0.0);
+    return(NULL);
+} // DumpFile::decode_thread
+
+
+// Decodes the record at (pos). If it's an operation in [mintick, maxtick],
+//  it's appended to (ops) without a callstack id, and its callstack is left
+//  undecoded in the mapped file: (frames) points at its first frame and
+//  (count) says how many there are. Otherwise (a NOOP, or out of the time
+//  window), (frames) is NULL. On success, (pos) moves past the record and
+//  DUMPFILE_CHUNK_END is returned; otherwise (pos) is left alone and the
+//  return value says why we had to stop.
+template <class Decoder>
+inline dumpfile_chunk_status_t DumpFile::decode_record(const uint8 *&pos,
+                                                  tick_t mintick,
+                                                  tick_t maxtick,
+                                                  DumpFileColumns &ops,
+                                                  const uint8 *&frames,
+                                                  uint32 &count) const
+{
+    const uint8 *ptr = pos;
+    const uint8 optype = *(ptr++);
+
+    frames = NULL;
+    if (optype == DUMPFILE_OP_NOOP)
+    {
+        pos = ptr;
+        return(DUMPFILE_CHUNK_END);
+    } // if
+
+    else if (optype == DUMPFILE_OP_GOODBYE)
+        return(DUMPFILE_CHUNK_GOODBYE);
+
+    const size_t fieldsize = Decoder::fields_size(optype);
+    if (fieldsize == 0)
+    {
+        //fprintf(stderr, "bogus opcode: %d\n", (int) optype);
+        return(DUMPFILE_CHUNK_BOGUS);
+    } // if
+
+    // half-written records are possible! If so, we're done.
+    if (((size_t) (mapped_end - ptr)) < fieldsize + sizeof (uint32))
+        return(DUMPFILE_CHUNK_TRUNCATED);
+
+    const uint8 *countptr = ptr + fieldsize;
+    const uint32 framecount = Decoder::ui32(countptr);
+    if ((((size_t) (mapped_end - countptr)) / Decoder::ptrsize) < framecount)
+        return(DUMPFILE_CHUNK_TRUNCATED);  // half-written callstack.
+
+    pos = countptr + (((size_t) framecount) * Decoder::ptrsize);
+
+    const tick_t timestamp = Decoder::ui32(ptr);
+    if ((timestamp < mintick) || (timestamp > maxtick))
+        return(DUMPFILE_CHUNK_END);  // not in the window we want.
+
+    dumpptr blockptr = 0, size = 0, retval = 0;
+    switch (optype)
+    {
+        case DUMPFILE_OP_MALLOC:
+            size = Decoder::word(ptr);
+            retval = Decoder::word(ptr);
+            break;
+
+        case DUMPFILE_OP_REALLOC:
+            blockptr = Decoder::word(ptr);
+            size = Decoder::word(ptr);
+            retval = Decoder::word(ptr);
+            break;
+
+        case DUMPFILE_OP_FREE:
+            blockptr = Decoder::word(ptr);
+            break;
+    } // switch
+
+    ops.append(optype, timestamp, blockptr, size, retval);
+    frames = countptr;
+    count = framecount;
+    return(DUMPFILE_CHUNK_END);
+} // DumpFile::decode_record
+
+
+// Turns a callstack that decode_record() left in the mapped file into an id,
+//  using the chunk's scratch buffer.
+template <class Decoder>
+inline uint64 DumpFile::intern_callstack(DumpFileChunk &chunk,
+                                         const uint8 *frames, uint32 count)
+{
+    if (options.lazy_callstacks)  // just remember where it is.
+    {
+        chunk.callstacks->count(count);
+        const uint8 *record = frames - sizeof (uint32);  // the frame count.
+        return(DUMPFILE_LAZY_CALLSTACK(mapped_offset +
+                                       ((uint64) (record - mapped))));
+    } // if
+
+    if (count > chunk.framebuf_len)
+    {
+        delete[] chunk.framebuf;
+        chunk.framebuf_len = count * 2;
+        chunk.framebuf = new dumpptr[chunk.framebuf_len];
+    } // if
+
+    for (uint32 i = 0; i < count; i++)
+        chunk.framebuf[i] = Decoder::word(frames);
+
+    return(chunk.callstacks->add(chunk.framebuf, count));
+} // DumpFile::intern_callstack
+
+
+// Decodes records starting at chunk.start until one starts at or past
+//  chunk.end, or we hit a GOODBYE, garbage, or the end of the mapped data.
+//  Only touches the chunk's own state, so several of these can run at once.
+//  Progress is only reported if (pn) isn't NULL.
+template <class Decoder>
+void DumpFile::decode_chunk(DumpFileChunk &chunk, ProgressNotify *pn,
+                            double basepos, double totalsize)
+{
+    DumpFileColumns &ops = chunk.ops;
+    const uint8 *pos = chunk.start;
+    const uint8 *frames;
+    uint32 count;
+
+    // Only bother working out a new percentage when it would change.
+    const double bytes_per_percent = totalsize / 100.0;
+    const uint8 *next_progress = pos;
+
+    chunk.status = DUMPFILE_CHUNK_END;
+    while (pos < chunk.end)
+    {
+        chunk.status = decode_record<Decoder>(pos, chunk.mintick,
+                                              chunk.maxtick, ops,
+                                              frames, count);
+        if (chunk.status != DUMPFILE_CHUNK_END)
+            break;
+        else if (frames == NULL)  // NOOP, or out of the time window.
+            continue;
+
+        const size_t idx = ops.total - 1;
+        ops.callstacks[idx] = intern_callstack<Decoder>(chunk, frames, count);
+        if (ops.total == DUMPFILE_BLOCK_SIZE)
+        {
+            if (chunk.packed == NULL)  // nothing to stitch; store them now.
+                store_operations(ops);
+            else
+                chunk.packed->append(ops);
+            ops.clear();
+        } // if
+
+        if ((pn != NULL) && (pos >= next_progress))
+        {
+            const double filepos = basepos + ((double) (pos - mapped));
+            const int percent = (int) ((filepos / totalsize) * 100.0);
+            pn->update("Parsing raw data", percent);
+            next_progress = mapped + (size_t) ((((double) (percent + 1)) *
+                                      bytes_per_percent) - basepos);
+        } // if
+    } // while
+
+    if (chunk.packed == NULL)
+        store_operations(ops);
+    else
+    {
+        chunk.packed->append(ops);
+        chunk.packed->finish();
+    } // else
+    ops.clear();
+
+    chunk.stop = pos;
+} // DumpFile::decode_chunk
+
+
+/*
+ * Pipelined decoding...
+ *
+ * When a stretch of the file has to be decoded in order on its own, the
+ *  work is split into three stages on three threads instead: one decodes
+ *  records, one turns their callstacks into ids, and the calling thread
+ *  feeds the fragmap (and the ProgressNotify, which might be a GUI that
+ *  doesn't want to hear from other threads). Operations move between the
+ *  stages in batches. There's a fixed number of batches, so a stage that
+ *  gets ahead just waits for an empty one to come back around, and memory
+ *  use doesn't depend on how lopsided the stages are.
+ */
+
+#define DUMPFILE_BATCH_SIZE 4096
+#define DUMPFILE_PIPELINE_DEPTH 8
+
+class DumpFileBatch
+{
+public:
+    DumpFileBatch() { ops.reserve(DUMPFILE_BATCH_SIZE); }
+    DumpFileColumns ops;
+    const uint8 *frames[DUMPFILE_BATCH_SIZE];  /* still in the mapped file. */
+    uint32 framecounts[DUMPFILE_BATCH_SIZE];
+    const uint8 *pos;  /* how far decoding got by the end of this batch. */
+    bool last;
+};
+
+// Only ever holds the pipeline's own batches, so put() never has to wait.
+class DumpFileBatchQueue
+{
+public:
+    DumpFileBatchQueue() : head(0), total(0)
+    {
+        pthread_mutex_init(&mutex, NULL);
+        pthread_cond_init(&cond, NULL);
+    } // constructor
+
+    ~DumpFileBatchQueue()
+    {
+        pthread_cond_destroy(&cond);
+        pthread_mutex_destroy(&mutex);
+    } // destructor
+
+    void put(DumpFileBatch *batch)
+    {
+        pthread_mutex_lock(&mutex);
+        assert(total < DUMPFILE_PIPELINE_DEPTH);
+        batches[(head + total) % DUMPFILE_PIPELINE_DEPTH] = batch;
+        total++;
+        pthread_cond_signal(&cond);
+        pthread_mutex_unlock(&mutex);
+    } // put
+
+    DumpFileBatch *get()
+    {
+        pthread_mutex_lock(&mutex);
+        while (total == 0)
+            pthread_cond_wait(&cond, &mutex);
+        DumpFileBatch *retval = batches[head];
+        head = (head + 1) % DUMPFILE_PIPELINE_DEPTH;
+        total--;
+        pthread_mutex_unlock(&mutex);
+        return(retval);
+    } // get
+
+private:
+    DumpFileBatch *batches[DUMPFILE_PIPELINE_DEPTH];
+    size_t head;
+    size_t total;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+class DumpFilePipeline
+{
+public:
+    DumpFilePipeline(DumpFile *_df, DumpFileChunk *_chunk)
+        : df(_df), chunk(_chunk)
+    {
+        for (size_t i = 0; i < DUMPFILE_PIPELINE_DEPTH; i++)
+            empty.put(&batches[i]);
+    } // constructor
+
+    DumpFile *df;
+    DumpFileChunk *chunk;
+    DumpFileBatch batches[DUMPFILE_PIPELINE_DEPTH];
+    DumpFileBatchQueue empty;     /* decode stage takes batches from here, */
+    DumpFileBatchQueue decoded;   /*  callstack stage from here, */
+    DumpFileBatchQueue interned;  /*  and fragmap stage from here. */
+};
+
+
+template <class Decoder>
+void *DumpFile::decode_stage(void *_pipeline)
+{
+    DumpFilePipeline *pipeline = (DumpFilePipeline *) _pipeline;
+    DumpFileChunk &chunk = *pipeline->chunk;
+    const DumpFile *df = pipeline->df;
+    const uint8 *pos = chunk.start;
+    DumpFileBatch *batch = pipeline->empty.get();
+    const uint8 *frames;
+    uint32 count;
+
+    batch->ops.clear();
+    chunk.status = DUMPFILE_CHUNK_END;
+    while (pos < chunk.end)
+    {
+        chunk.status = df->decode_record<Decoder>(pos, chunk.mintick,
+                                                  chunk.maxtick, batch->ops,
+                                                  frames, count);
+        if (chunk.status != DUMPFILE_CHUNK_END)
+            break;
+        else if (frames == NULL)  // NOOP, or out of the time window.
+            continue;
+
+        const size_t i = batch->ops.total - 1;
+        batch->frames[i] = frames;
+        batch->framecounts[i] = count;
+        if (batch->ops.total == DUMPFILE_BATCH_SIZE)
+        {
+            batch->pos = pos;
+            batch->last = false;
+            pipeline->decoded.put(batch);
+            batch = pipeline->empty.get();
+            batch->ops.clear();
+        } // if
+    } // while
+
+    chunk.stop = pos;
+    batch->pos = pos;
+    batch->last = true;
+    pipeline->decoded.put(batch);
+    return(NULL);
+} // DumpFile::decode_stage
+
+
+template <class Decoder>
+void *DumpFile::intern_stage(void *_pipeline)
+{
+    DumpFilePipeline *pipeline = (DumpFilePipeline *) _pipeline;
+    DumpFile *df = pipeline->df;
+    DumpFileChunk &chunk = *pipeline->chunk;
+    bool last = false;
+
+    while (!last)
+    {
+        DumpFileBatch *batch = pipeline->decoded.get();
+        DumpFileColumns &ops = batch->ops;
+        for (size_t i = 0; i < ops.total; i++)
+        {
+            ops.callstacks[i] = df->intern_callstack<Decoder>(chunk,
+                                            batch->frames[i],
+                                            batch->framecounts[i]);
+        } // for
+        last = batch->last;
+        pipeline->interned.put(batch);
+    } // while
+
+    return(NULL);
+} // DumpFile::intern_stage
+
+
+// Same results as decode_chunk(), but spread over three threads. Returns
+//  false without doing anything if the threads couldn't be started.
+template <class Decoder>
+bool DumpFile::pipeline_chunk(DumpFileChunk &chunk, ProgressNotify &pn,
+                              double basepos, double totalsize)
+{
+    DumpFilePipeline *pipeline = new DumpFilePipeline(this, &chunk);
+    pthread_t decoder, interner;
+
+    if (pthread_create(&interner, NULL, intern_stage<Decoder>, pipeline) != 0)
+    {
+        delete pipeline;
+        return(false);
+    } // if
+
+    if (pthread_create(&decoder, NULL, decode_stage<Decoder>, pipeline) != 0)
+    {
+        DumpFileBatch *batch = pipeline->empty.get();  // shut down interner.
+        batch->ops.clear();
+        batch->last = true;
+        pipeline->decoded.put(batch);
+        pthread_join(interner, NULL);
+        delete pipeline;
+        return(false);
+    } // if
+
+    int lastpercent = -1;
+    bool last = false;
+    while (!last)
+    {
+        DumpFileBatch *batch = pipeline->interned.get();
+        store_operations(batch->ops);
+        last = batch->last;
+
+        const double filepos = basepos + ((double) (batch->pos - mapped));
+        const int percent = (int) ((filepos / totalsize) * 100.0);
+        if (percent != lastpercent)
+        {
+            pn.update("Parsing raw data", percent);
+            lastpercent = percent;
+        } // if
+
+        pipeline->empty.put(batch);
+    } // while
+
+    pthread_join(decoder, NULL);
+    pthread_join(interner, NULL);
+    delete pipeline;
+    return(true);
+} // DumpFile::pipeline_chunk
+
+
+// Feeds decoded operations to the fragmap and packs them away for good.
+void DumpFile::store_operations(const DumpFileColumns &ops)
+{
+    const uint64 first = operations.getTotal();
+    for (size_t i = 0; i < ops.total; i++)
+    {
+        const DumpFileOperation op(ops, i, first + i);
+        switch (op.getOperationType())
+        {
+            case DUMPFILE_OP_MALLOC: fragmapManager.add_malloc(op); break;
+            case DUMPFILE_OP_REALLOC: fragmapManager.add_realloc(op); break;
+            case DUMPFILE_OP_FREE: fragmapManager.add_free(op); break;
+            default: assert(0 && "unknown dumpfile operation!"); break;
+        } // switch
+    } // for
+
+    operations.append(ops);
+} // DumpFile::store_operations
+
+
+// Moves a decoded chunk's operations onto the end of ours. If it was
+//  decoded out of order, its callstacks get folded into ours first.
+void DumpFile::stitch_chunk(DumpFileChunk &chunk)
+{
+    if (chunk.packed == NULL)
+        return;  // decoded in place.
+
+    callstackManager.merge(*chunk.callstacks);
+
+    DumpFileColumns &ops = chunk.ops;
+    const uint64 total_blocks = chunk.packed->getTotalBlocks();
+    for (uint64 block = 0; block < total_blocks; block++)
+    {
+        ops.clear();
+        ops.append(chunk.packed->getBlock(block));
+        if (!options.lazy_callstacks)  // lazy ones don't need remapping.
+        {
+            CallstackManager *cm = chunk.callstacks;
+            for (size_t i = 0; i < ops.total; i++)
+                ops.callstacks[i] = cm->merged_id(ops.callstacks[i]);
+        } // if
+        store_operations(ops);
+    } // for
+    ops.clear();
+
+    discard_chunk(chunk);
+} // DumpFile::stitch_chunk
+
+
+// Throws away everything a chunk decoded.
+void DumpFile::discard_chunk(DumpFileChunk &chunk)
+{
+    if (chunk.packed != NULL)
+    {
+        delete chunk.callstacks;
+        delete chunk.packed;
+    } // if
+
+    chunk.callstacks = NULL;
+    chunk.packed = NULL;
+    chunk.ops.clear();
+} // DumpFile::discard_chunk
+
+
+void DumpFile::finish_parse(ProgressNotify &pn)
+{
+    if (follow_fname != NULL)  // there's more to come.
+    {
+        fragmapManager.pause_adding();
+        return;
+    } // if
+
+    callstackManager.done_adding(pn);
+    fragmapManager.done_adding(pn);
+    operations.finish();
+} // DumpFile::finish_parse
+
+
+const DumpFileColumns &DumpFile::getOperationBlock(uint64 idx,
+                                                   uint64 &first) const
+{
+    const uint64 block = idx / DUMPFILE_BLOCK_SIZE;
+    first = block * DUMPFILE_BLOCK_SIZE;
+    return(operations.getBlock(block));
+} // DumpFile::getOperationBlock
+
+
+void DumpFile::copyOperationBlock(uint64 idx, uint64 &first,
+                                  DumpFileColumns &cols) const
+{
+    const uint64 block = idx / DUMPFILE_BLOCK_SIZE;
+    first = block * DUMPFILE_BLOCK_SIZE;
+    operations.copyBlock(block, cols);
+} // DumpFile::copyOperationBlock
+
+
+DumpFileOperation DumpFile::getOperation(uint64 idx) const
+{
+    uint64 first;
+    const DumpFileColumns &cols = getOperationBlock(idx, first);
+    return(DumpFileOperation(cols, (size_t) (idx - first), idx,
+                             options.lazy_callstacks ? this : NULL));
+} // DumpFile::getOperation
+
+
+/*
+ * Lazy callstacks...
+ *
+ * Instead of an id, a lazy callstack is stored as where its frame count
+ *  is in the dumpfile(s), with the top bit set. Real ids are only 32 bits,
+ *  so we can tell the two apart. Looking one up is the same work we'd
+ *  have done while parsing; we just put it off until somebody asks.
+ */
+
+template <class Decoder>
+uint32 DumpFile::read_frames(const uint8 *ptr, dumpptr *&framebuf,
+                             size_t &framebuf_len)
+{
+    const uint32 count = Decoder::ui32(ptr);
+    if (count > framebuf_len)
+    {
+        delete[] framebuf;
+        framebuf_len = count * 2;
+        framebuf = new dumpptr[framebuf_len];
+    } // if
+
+    for (uint32 i = 0; i < count; i++)
+        framebuf[i] = Decoder::word(ptr);
+    return(count);
+} // DumpFile::read_frames
+
+
+CallstackManager::callstackid DumpFile::intern_lazy(CallstackManager &cm,
+                                        uint64 id, dumpptr *&framebuf,
+                                        size_t &framebuf_len) const
+{
+    if (!DUMPFILE_IS_LAZY_CALLSTACK(id))
+        return((CallstackManager::callstackid) id);
+
+    const uint64 offset = id & ~DUMPFILE_LAZY_CALLSTACK_BIT;
+    assert(total_kept_maps > 0);
+
+    // find the file it's in; there's usually only one.
+    size_t lo = 0;
+    size_t hi = total_kept_maps;
+    while ((hi - lo) > 1)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (kept_maps[mid].offset <= offset)
+            lo = mid;
+        else
+            hi = mid;
+    } // while
+
+    const DumpFileMapping &map = kept_maps[lo];
+    const uint8 *ptr = map.ptr + ((size_t) (offset - map.offset));
+    uint32 count;
+    if (byte_order != platform_byteorder)
+    {
+        if (sizeofptr == 4)
+            count = read_frames< DumpFileDecoder<uint32, true> >(
+                        ptr, framebuf, framebuf_len);
+        else
+            count = read_frames< DumpFileDecoder<uint64, true> >(
+                        ptr, framebuf, framebuf_len);
+    } // if
+    else
+    {
+        if (sizeofptr == 4)
+            count = read_frames< DumpFileDecoder<uint32, false> >(
+                        ptr, framebuf, framebuf_len);
+        else
+            count = read_frames< DumpFileDecoder<uint64, false> >(
+                        ptr, framebuf, framebuf_len);
+    } // else
+
+    return(cm.intern(framebuf, count));
+} // DumpFile::intern_lazy
+
+
+// Looking up a callstack for the app is a cache fill as far as it's
+//  concerned, so this is const, even though callstackManager grows.
+CallstackManager::callstackid DumpFile::resolveCallstack(uint64 id) const
+{
+    CallstackManager &cm = const_cast<CallstackManager &>(callstackManager);
+    return(intern_lazy(cm, id, lazy_framebuf, lazy_framebuf_len));
+} // DumpFile::resolveCallstack
+
+
+void DumpFile::getCallstackIds(uint64 first, uint64 count,
+                               CallstackManager::callstackid *out) const
+{
+    assert((first + count) <= getOperationCount());
+    while (count > 0)
+    {
+        uint64 blockstart;
+        const DumpFileColumns &cols = getOperationBlock(first, blockstart);
+        const size_t start = (size_t) (first - blockstart);
+        size_t total = cols.total - start;
+        if (total > count)
+            total = (size_t) count;
+
+        const uint64 *ids = cols.callstacks + start;
+        if (!options.lazy_callstacks)
+        {
+            for (size_t i = 0; i < total; i++)
+                out[i] = (CallstackManager::callstackid) ids[i];
+        } // if
+        else
+        {
+            for (size_t i = 0; i < total; i++)
+                out[i] = resolveCallstack(ids[i]);
+        } // else
+
+        out += total;
+        first += total;
+        count -= total;
+    } // while
+} // DumpFile::getCallstackIds
+
+
+// One thread's share of internCallstacks(): a run of blocks, looked up
+//  into a private CallstackManager, just like a chunk in parse_chunks().
+class DumpFileInternJob
+{
+public:
+    DumpFileInternJob()
+        : df(NULL), first_block(0), end_block(0), callstacks(NULL),
+          packed(NULL), framebuf(NULL), framebuf_len(0), threaded(false),
+          error(NULL) {}
+    ~DumpFileInternJob()
+    {
+        delete callstacks;
+        delete packed;
+        delete[] framebuf;
+    } // destructor
+
+    DumpFile *df;
+    uint64 first_block;
+    uint64 end_block;
+    CallstackManager *callstacks;
+    DumpFileOpStore *packed;
+    DumpFileColumns ops;
+    dumpptr *framebuf;
+    size_t framebuf_len;
+    pthread_t thread;
+    bool threaded;
+    const char *error;  /* what went wrong, since threads can't throw. */
+};
+
+
+void *DumpFile::intern_thread(void *_job)
+{
+    DumpFileInternJob *job = (DumpFileInternJob *) _job;
+    DumpFile *df = job->df;
+    DumpFileColumns &ops = job->ops;
+
+    try
+    {
+        for (uint64 block = job->first_block; block < job->end_block; block++)
+        {
+            df->operations.copyBlock(block, ops);
+            for (size_t i = 0; i < ops.total; i++)
+            {
+                ops.callstacks[i] = df->intern_lazy(*job->callstacks,
+                                                    ops.callstacks[i],
+                                                    job->framebuf,
+                                                    job->framebuf_len);
+            } // for
+            job->packed->append(ops);
+        } // for
+        job->packed->finish();
+    } // try
+
+    catch (const char *e)
+    {
+        job->error = e;
+    } // catch
+
+    ops.release();
+    return(NULL);
+} // DumpFile::intern_thread
+
+
+void DumpFile::internCallstacks(ProgressNotify &pn) throw (const char *)
+{
+    if (!options.lazy_callstacks)
+        return;
+
+    const uint64 total_blocks = operations.getTotalBlocks();
+    size_t total_jobs = decode_thread_count();
+    if (total_jobs > total_blocks)
+        total_jobs = (total_blocks > 0) ? ((size_t) total_blocks) : 1;
+
+    DumpFileInternJob *jobs = new DumpFileInternJob[total_jobs];
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        DumpFileInternJob &job = jobs[i];
+        job.df = this;
+        job.first_block = (total_blocks * i) / total_jobs;
+        job.end_block = (total_blocks * (i + 1)) / total_jobs;
+        job.callstacks = new CallstackManager;
+        job.packed = create_chunk_store();
+        if (i > 0)  // the first one runs on this thread.
+        {
+            job.threaded = (pthread_create(&job.thread, NULL,
+                                           intern_thread, &job) == 0);
+        } // if
+    } // for
+
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        DumpFileInternJob &job = jobs[i];
+        if (job.threaded)
+            pthread_join(job.thread, NULL);
+        else
+            intern_thread(&job);
+    } // for
+
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        if (jobs[i].error != NULL)
+        {
+            const char *e = jobs[i].error;
+            delete[] jobs;
+            throw(e);
+        } // if
+    } // for
+
+    // Every op is in one of the jobs now, so start the store over and fill
+    //  it back up with real ids, in order.
+    operations.release();
+    if (scratch != NULL)
+        operations.spill_to(scratch, options.memory_budget / 2);
+
+    uint64 done = 0;
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        DumpFileInternJob &job = jobs[i];
+        DumpFileColumns &ops = job.ops;
+        callstackManager.merge(*job.callstacks);
+
+        const uint64 blocks = job.packed->getTotalBlocks();
+        for (uint64 block = 0; block < blocks; block++)
+        {
+            ops.clear();
+            ops.append(job.packed->getBlock(block));
+            CallstackManager *cm = job.callstacks;
+            for (size_t j = 0; j < ops.total; j++)
+                ops.callstacks[j] = cm->merged_id(ops.callstacks[j]);
+            operations.append(ops);
+
+            const double pct = ((double) ++done) / ((double) total_blocks);
+            pn.update("Looking up callstacks", (int) (pct * 100.0));
+        } // for
+        ops.release();
+    } // for
+
+    operations.finish();
+    delete[] jobs;
+
+    // lazy ids that the app already has still work; we keep the files
+    //  mapped for those.
+    options.lazy_callstacks = false;
+} // DumpFile::internCallstacks
+
+
+/*
+ * Block containers...
+ *
+ * A plain dumpfile has to be read from the start to find anything in it.
+ *  convertToBlocks() rewrites one so it doesn't have to be:
+ *
+ *  - "Malloc Monitor Blocks\0", a ui8 format version (1), a ui32 length,
+ *    and then the original handshake, byte for byte.
+ *  - Blocks of up to DUMPFILE_BLOCK_SIZE operations. Each has a header:
+ *    "MMBK", ui32 flags, ui64 index of its first op in the capture, ui32
+ *    op count, ui32 lowest and highest timestamps, ui32 count of live
+ *    allocations, ui32 payload length, and a ui32 CRC-32 of the payload.
+ *    The payload is the live allocations at the start of the block, as
+ *    ui64 pointer/size pairs (only in checkpoint blocks; the first block
+ *    and every DUMPFILE_CHECKPOINT_INTERVAL'th after it), and then the
+ *    block's records, exactly as they were in the dumpfile, minus NOOPs.
+ *  - An index: for each block, ui64 file offset, ui64 first op, ui32 op
+ *    count, ui32 lowest and highest timestamps, and ui32 flags.
+ *  - A footer: ui64 offset of the index, ui32 block count, ui32 CRC-32 of
+ *    the index, and "MMBLKIDX".
+ *
+ * Integers the container adds are always littleendian; the records keep
+ *  whatever the handshake says. If the footer or index is damaged (say,
+ *  the conversion didn't finish), we find the blocks by scanning for
+ *  their headers instead, which means reading the whole file.
+ *
+ * Loading a window means finding the blocks that overlap it in the index,
+ *  then going back to the nearest checkpoint. Its live allocations, and
+ *  the ops between it and the window, seed the fragmap; only ops in the
+ *  window are kept.
+ */
+
+#define DUMPFILE_BLOCKS_SIGNATURE "Malloc Monitor Blocks"
+#define DUMPFILE_BLOCKS_VERSION 1
+#define DUMPFILE_BLOCK_MAGIC "MMBK"
+#define DUMPFILE_BLOCKS_FOOTER_MAGIC "MMBLKIDX"
+#define DUMPFILE_BLOCK_HEADER_SIZE 40
+#define DUMPFILE_BLOCK_INDEX_ENTRY_SIZE 32
+#define DUMPFILE_BLOCKS_FOOTER_SIZE 24
+#define DUMPFILE_BLOCK_LIVE_SIZE 16
+#define DUMPFILE_BLOCK_FLAG_CHECKPOINT (1 << 0)
+#define DUMPFILE_CHECKPOINT_INTERVAL 16
+
+class DumpFileBlockInfo
+{
+public:
+    uint64 offset;  /* of the block's header, from the start of the file. */
+    uint64 first_op;
+    uint32 total_ops;
+    tick_t first_tick;
+    tick_t last_tick;
+    uint32 flags;
+    uint32 live_count;  /* these three are only in the block's header. */
+    uint32 payload_length;
+    uint32 crc;
+};
+
+
+static inline void put_le32(uint8 *&ptr, uint32 val)
+{
+    for (int i = 0; i < 4; i++, val >>= 8)
+        *(ptr++) = (uint8) (val & 0xFF);
+} // put_le32
+
+static inline void put_le64(uint8 *&ptr, uint64 val)
+{
+    for (int i = 0; i < 8; i++, val >>= 8)
+        *(ptr++) = (uint8) (val & 0xFF);
+} // put_le64
+
+static inline uint32 get_le32(const uint8 *&ptr)
+{
+    uint32 val = 0;
+    for (int i = 0; i < 4; i++)
+        val |= ((uint32) *(ptr++)) << (i * 8);
+    return(val);
+} // get_le32
+
+static inline uint64 get_le64(const uint8 *&ptr)
+{
+    uint64 val = 0;
+    for (int i = 0; i < 8; i++)
+        val |= ((uint64) *(ptr++)) << (i * 8);
+    return(val);
+} // get_le64
+
+
+static void read_block_header(const uint8 *ptr, DumpFileBlockInfo &block)
+{
+    ptr += 4;  // magic.
+    block.flags = get_le32(ptr);
+    block.first_op = get_le64(ptr);
+    block.total_ops = get_le32(ptr);
+    block.first_tick = (tick_t) get_le32(ptr);
+    block.last_tick = (tick_t) get_le32(ptr);
+    block.live_count = get_le32(ptr);
+    block.payload_length = get_le32(ptr);
+    block.crc = get_le32(ptr);
+} // read_block_header
+
+
+/*
+ * What's allocated, while converting or merging, or building a calling
+ *  context tree. This is just open addressing: NULL marks an empty slot,
+ *  and removing an entry moves the ones that collided with it back, so
+ *  lookups never have to skip over holes. Each block can carry a tag,
+ *  like the callstack that allocated it.
+ */
+class DumpFileLiveSet
+{
+public:
+    DumpFileLiveSet()
+        : ptrs(NULL), sizes(NULL), tags(NULL), capacity(0), total(0),
+          bytes(0)
+    {
+        resize(1024);
+    } // constructor
+
+    ~DumpFileLiveSet()
+    {
+        delete[] ptrs;
+        delete[] sizes;
+        delete[] tags;
+    } // destructor
+
+    // Returns true if (ptr) was already there, and got replaced.
+    bool insert(dumpptr ptr, dumpptr size, uint32 tag=0)
+    {
+        if (ptr == 0)
+            return(false);
+        else if ((total + 1) * 2 > capacity)
+            resize(capacity * 2);
+
+        size_t i = find(ptr);
+        const bool replaced = (ptrs[i] != 0);
+        if (!replaced)
+            total++;
+        else
+            bytes -= (uint64) sizes[i];
+        ptrs[i] = ptr;
+        sizes[i] = size;
+        tags[i] = tag;
+        bytes += (uint64) size;
+        return(replaced);
+    } // insert
+
+    // Returns false if (ptr) wasn't there.
+    bool remove(dumpptr ptr)
+    {
+        if (ptr == 0)
+            return(false);
+
+        size_t i = find(ptr);
+        if (ptrs[i] == 0)
+            return(false);  // freeing something we didn't see allocated.
+
+        total--;
+        bytes -= (uint64) sizes[i];
+        const size_t mask = capacity - 1;
+        size_t j = i;
+        while (true)
+        {
+            ptrs[i] = 0;
+            do
+            {
+                j = (j + 1) & mask;
+                if (ptrs[j] == 0)
+                    return(true);
+                const size_t home = slot(ptrs[j]);
+                // can (j) move back to (i) without ending up before home?
+                if (((j - home) & mask) >= ((j - i) & mask))
+                    break;
+            } while (true);
+
+            ptrs[i] = ptrs[j];
+            sizes[i] = sizes[j];
+            tags[i] = tags[j];
+            i = j;
+        } // while
+    } // remove
+
+    void apply(const DumpFileColumns &ops, size_t i)
+    {
+        switch (ops.optypes[i])
+        {
+            case DUMPFILE_OP_MALLOC:
+                insert(ops.retvals[i], ops.sizes[i]);
+                break;
+
+            case DUMPFILE_OP_REALLOC:
+                if ((ops.sizes[i]) && (!ops.retvals[i]))
+                    break;  // failed, so (ptr) is still there, untouched.
+                remove(ops.ptrs[i]);
+                if (ops.sizes[i])
+                    insert(ops.retvals[i], ops.sizes[i]);
+                break;
+
+            case DUMPFILE_OP_FREE:
+                remove(ops.ptrs[i]);
+                break;
+        } // switch
+    } // apply
+
+    void clear()
+    {
+        memset(ptrs, '\0', capacity * sizeof (dumpptr));
+        total = 0;
+        bytes = 0;
+    } // clear
+
+    dumpptr *ptrs;
+    dumpptr *sizes;
+    uint32 *tags;
+    size_t capacity;  /* always a power of two. */
+    size_t total;
+    uint64 bytes;  /* sizes of everything in (total). */
+
+private:
+    size_t slot(dumpptr ptr) const
+    {
+        // allocations are aligned, so the low bits don't say much.
+        const uint64 hash = ((uint64) (ptr >> 4)) * 0x9E3779B97F4A7C15ULL;
+        return(((size_t) (hash >> 32)) & (capacity - 1));
+    } // slot
+
+    size_t find(dumpptr ptr) const
+    {
+        size_t i = slot(ptr);
+        while ((ptrs[i] != 0) && (ptrs[i] != ptr))
+            i = (i + 1) & (capacity - 1);
+        return(i);
+    } // find
+
+    void resize(size_t newcapacity)
+    {
+        dumpptr *oldptrs = ptrs;
+        dumpptr *oldsizes = sizes;
+        uint32 *oldtags = tags;
+        const size_t oldcapacity = capacity;
+
+        ptrs = new dumpptr[newcapacity];
+        sizes = new dumpptr[newcapacity];
+        tags = new uint32[newcapacity];
+        memset(ptrs, '\0', newcapacity * sizeof (dumpptr));
+        capacity = newcapacity;
+
+        for (size_t i = 0; i < oldcapacity; i++)
+        {
+            if (oldptrs[i] != 0)
+            {
+                const size_t j = find(oldptrs[i]);
+                ptrs[j] = oldptrs[i];
+                sizes[j] = oldsizes[i];
+                tags[j] = oldtags[i];
+            } // if
+        } // for
+
+        delete[] oldptrs;
+        delete[] oldsizes;
+        delete[] oldtags;
+    } // resize
+
+    DumpFileLiveSet(const DumpFileLiveSet &);  // no copying.
+    DumpFileLiveSet &operator =(const DumpFileLiveSet &);
+};
+
+
+void DumpFile::convertToBlocks(const char *fn, const char *outfn,
+                               ProgressNotify &pn) throw (const char *)
+{
+    DumpFile df;
+    df.write_blocks(fn, outfn, pn);
+} // DumpFile::convertToBlocks
+
+
+void DumpFile::write_blocks(const char *fn, const char *outfn,
+                            ProgressNotify &pn) throw (const char *)
+{
+    const double fsize = (double) map_file(fn);
+    read_header(true);
+
+    FILE *out = fopen(outfn, "wb");
+    if (out == NULL)
+        throw((const char *) strerror(errno));
+
+    dumpfile_chunk_status_t status = DUMPFILE_CHUNK_END;
+    try
+    {
+        const size_t handshake = (size_t) (cursor - mapped);
+        uint8 buf[5];
+        uint8 *ptr = buf;
+        *(ptr++) = DUMPFILE_BLOCKS_VERSION;
+        put_le32(ptr, (uint32) handshake);
+        write_bytes(out, DUMPFILE_BLOCKS_SIGNATURE,
+                    sizeof (DUMPFILE_BLOCKS_SIGNATURE));
+        write_bytes(out, buf, sizeof (buf));
+        write_bytes(out, mapped, handshake);
+
+        const uint64 filepos = sizeof (DUMPFILE_BLOCKS_SIGNATURE) +
+                               sizeof (buf) + handshake;
+        if (byte_order != platform_byteorder)
+        {
+            if (sizeofptr == 4)
+                status = write_blocks_with< DumpFileDecoder<uint32, true> >(
+                                                out, filepos, pn, fsize);
+            else
+                status = write_blocks_with< DumpFileDecoder<uint64, true> >(
+                                                out, filepos, pn, fsize);
+        } // if
+        else
+        {
+            if (sizeofptr == 4)
+                status = write_blocks_with< DumpFileDecoder<uint32, false> >(
+                                                out, filepos, pn, fsize);
+            else
+                status = write_blocks_with< DumpFileDecoder<uint64, false> >(
+                                                out, filepos, pn, fsize);
+        } // else
+
+        if (fflush(out) != 0)
+            throw((const char *) strerror(errno));
+    } // try
+
+    catch (const char *e)
+    {
+        fclose(out);
+        remove(outfn);
+        throw(e);
+    } // catch
+
+    if (fclose(out) != 0)
+        throw((const char *) strerror(errno));
+
+    // everything up to the garbage made it into the container, anyhow.
+    if (status == DUMPFILE_CHUNK_BOGUS)
+        throw("Unexpected or corrupted data in dumpfile!");
+} // DumpFile::write_blocks
+
+
+// Writes blocks for everything after the handshake, then the index and
+//  footer, and returns why we stopped reading.
+template <class Decoder>
+dumpfile_chunk_status_t DumpFile::write_blocks_with(FILE *out,
+                                                    uint64 filepos,
+                                                    ProgressNotify &pn,
+                                                    double totalsize)
+    throw (const char *)
+{
+    DumpFileLiveSet live;
+    DumpFileColumns ops;  // decode_record() wants somewhere to put things.
+    DumpFileBlockInfo *blocks = NULL;
+    size_t total_blocks = 0;
+    uint8 *records = NULL;
+    size_t records_alloc = 0;
+    uint8 *checkpoint = NULL;
+    size_t checkpoint_alloc = 0;
+    uint64 opidx = 0;
+
+    dumpfile_chunk_status_t status = DUMPFILE_CHUNK_END;
+    const uint8 *pos = cursor;
+    const uint8 *frames;
+    uint32 count;
+
+    try
+    {
+        while ((status == DUMPFILE_CHUNK_END) && (pos < mapped_end))
+        {
+            DumpFileBlockInfo block;
+            block.offset = filepos;
+            block.first_op = opidx;
+            block.total_ops = 0;
+            block.first_tick = (tick_t) -1;
+            block.last_tick = 0;
+            block.flags = 0;
+            block.live_count = 0;
+
+            if ((total_blocks % DUMPFILE_CHECKPOINT_INTERVAL) == 0)
+            {
+                block.flags |= DUMPFILE_BLOCK_FLAG_CHECKPOINT;
+                block.live_count = (uint32) live.total;
+                const size_t len = live.total * DUMPFILE_BLOCK_LIVE_SIZE;
+                if (len > checkpoint_alloc)
+                {
+                    delete[] checkpoint;
+                    checkpoint_alloc = len * 2;
+                    checkpoint = new uint8[checkpoint_alloc];
+                } // if
+
+                uint8 *ptr = checkpoint;
+                for (size_t i = 0; i < live.capacity; i++)
+                {
+                    if (live.ptrs[i] != 0)
+                    {
+                        put_le64(ptr, (uint64) live.ptrs[i]);
+                        put_le64(ptr, (uint64) live.sizes[i]);
+                    } // if
+                } // for
+            } // if
+
+            size_t records_len = 0;
+            while ((block.total_ops < DUMPFILE_BLOCK_SIZE) &&
+                   (pos < mapped_end))
+            {
+                const uint8 *start = pos;
+                status = decode_record<Decoder>(pos, 0, (tick_t) -1, ops,
+                                                frames, count);
+                if (status != DUMPFILE_CHUNK_END)
+                    break;
+                else if (frames == NULL)  // NOOP; not worth keeping.
+                    continue;
+
+                const size_t len = (size_t) (pos - start);
+                if (records_len + len > records_alloc)
+                {
+                    records_alloc = (records_len + len) * 2;
+                    uint8 *newrecords = new uint8[records_alloc];
+                    memcpy(newrecords, records, records_len);
+                    delete[] records;
+                    records = newrecords;
+                } // if
+                memcpy(records + records_len, start, len);
+                records_len += len;
+
+                const tick_t tick = ops.timestamps[0];
+                if (tick < block.first_tick)
+                    block.first_tick = tick;
+                if (tick > block.last_tick)
+                    block.last_tick = tick;
+                live.apply(ops, 0);
+                ops.clear();
+                block.total_ops++;
+            } // while
+
+            if (block.total_ops == 0)
+                break;
+
+            const size_t checkpoint_len = ((size_t) block.live_count) *
+                                          DUMPFILE_BLOCK_LIVE_SIZE;
+            block.payload_length = (uint32) (checkpoint_len + records_len);
+            block.crc = dumpfile_crc32(0, checkpoint, checkpoint_len);
+            block.crc = dumpfile_crc32(block.crc, records, records_len);
+
+            uint8 header[DUMPFILE_BLOCK_HEADER_SIZE];
+            uint8 *ptr = header;
+            memcpy(ptr, DUMPFILE_BLOCK_MAGIC, 4);
+            ptr += 4;
+            put_le32(ptr, block.flags);
+            put_le64(ptr, block.first_op);
+            put_le32(ptr, block.total_ops);
+            put_le32(ptr, (uint32) block.first_tick);
+            put_le32(ptr, (uint32) block.last_tick);
+            put_le32(ptr, block.live_count);
+            put_le32(ptr, block.payload_length);
+            put_le32(ptr, block.crc);
+            write_bytes(out, header, sizeof (header));
+            write_bytes(out, checkpoint, checkpoint_len);
+            write_bytes(out, records, records_len);
+            filepos += sizeof (header) + block.payload_length;
+            opidx += block.total_ops;
+
+            // !!! FIXME: realloc? yuck!
+            total_blocks++;
+            blocks = (DumpFileBlockInfo *) realloc(blocks,
+                            total_blocks * sizeof (DumpFileBlockInfo));
+            if (blocks == NULL)
+                throw("Out of memory");
+            blocks[total_blocks-1] = block;
+
+            const double filepct = (double) (pos - mapped) / totalsize;
+            pn.update("Converting to blocks", (int) (filepct * 100.0));
+        } // while
+
+        const size_t index_len = total_blocks *
+                                 DUMPFILE_BLOCK_INDEX_ENTRY_SIZE;
+        uint8 *index = new uint8[index_len + DUMPFILE_BLOCKS_FOOTER_SIZE];
+        uint8 *ptr = index;
+        for (size_t i = 0; i < total_blocks; i++)
+        {
+            put_le64(ptr, blocks[i].offset);
+            put_le64(ptr, blocks[i].first_op);
+            put_le32(ptr, blocks[i].total_ops);
+            put_le32(ptr, (uint32) blocks[i].first_tick);
+            put_le32(ptr, (uint32) blocks[i].last_tick);
+            put_le32(ptr, blocks[i].flags);
+        } // for
+
+        put_le64(ptr, filepos);
+        put_le32(ptr, (uint32) total_blocks);
+        put_le32(ptr, dumpfile_crc32(0, index, index_len));
+        memcpy(ptr, DUMPFILE_BLOCKS_FOOTER_MAGIC, 8);
+
+        try
+        {
+            write_bytes(out, index, index_len + DUMPFILE_BLOCKS_FOOTER_SIZE);
+        } // try
+
+        catch (const char *e)
+        {
+            delete[] index;
+            throw(e);
+        } // catch
+        delete[] index;
+    } // try
+
+    catch (const char *e)
+    {
+        free(blocks);  // !!! FIXME: allocated with realloc()...
+        delete[] records;
+        delete[] checkpoint;
+        throw(e);
+    } // catch
+
+    free(blocks);  // !!! FIXME: allocated with realloc()...
+    delete[] records;
+    delete[] checkpoint;
+    cursor = pos;
+    return(status);
+} // DumpFile::write_blocks_with
+
+
+// Makes sure a block is all there and passes its checksum, and fills in
+//  the parts of (block) that only its header has.
+bool DumpFile::check_block(DumpFileBlockInfo &block) const
+{
+    if ((block.offset > mapped_size) ||
+        ((mapped_size - block.offset) < DUMPFILE_BLOCK_HEADER_SIZE))
+        return(false);
+
+    const uint8 *ptr = mapped + block.offset;
+    if (memcmp(ptr, DUMPFILE_BLOCK_MAGIC, 4) != 0)
+        return(false);
+
+    DumpFileBlockInfo header;
+    read_block_header(ptr, header);
+    if ((header.first_op != block.first_op) ||
+        (header.total_ops != block.total_ops))
+        return(false);  // the index and the block don't agree.
+
+    const uint64 avail = mapped_size - block.offset -
+                         DUMPFILE_BLOCK_HEADER_SIZE;
+    if ((avail < header.payload_length) ||
+        ((header.payload_length / DUMPFILE_BLOCK_LIVE_SIZE) <
+            header.live_count))
+        return(false);
+
+    ptr += DUMPFILE_BLOCK_HEADER_SIZE;
+    if (dumpfile_crc32(0, ptr, header.payload_length) != header.crc)
+        return(false);
+
+    block.live_count = header.live_count;
+    block.payload_length = header.payload_length;
+    block.crc = header.crc;
+    return(true);
+} // DumpFile::check_block
+
+
+void DumpFile::parse_blocks(const DumpFileWindow &window, ProgressNotify &pn)
+    throw (const char *)
+{
+    uint8 ver;
+    uint32 handshake;
+    cursor += sizeof (DUMPFILE_BLOCKS_SIGNATURE);
+    read_ui8(ver);
+    if (ver != DUMPFILE_BLOCKS_VERSION)
+        throw("Unknown block container format version");
+
+    need_bytes(sizeof (handshake));
+    handshake = get_le32(cursor);
+    need_bytes(handshake);
+    const uint8 *data = cursor + handshake;
+    read_header(true);
+    if (cursor != data)
+        throw("Unexpected or corrupted data in dumpfile!");
+
+    // Find the blocks, from the index if we can.
+    DumpFileBlockInfo *blocks = NULL;
+    size_t total_blocks = 0;
+    const size_t avail = (size_t) (mapped_end - data);
+    if (avail >= DUMPFILE_BLOCKS_FOOTER_SIZE)
+    {
+        const uint8 *ptr = mapped_end - DUMPFILE_BLOCKS_FOOTER_SIZE;
+        const uint64 index_offset = get_le64(ptr);
+        const uint64 count = get_le32(ptr);
+        const uint32 crc = get_le32(ptr);
+        const uint64 index_end = mapped_size - DUMPFILE_BLOCKS_FOOTER_SIZE;
+        if ((memcmp(ptr, DUMPFILE_BLOCKS_FOOTER_MAGIC, 8) == 0) &&
+            (index_offset >= ((uint64) (data - mapped))) &&
+            (index_offset <= index_end) &&
+            ((index_end - index_offset) ==
+                count * DUMPFILE_BLOCK_INDEX_ENTRY_SIZE) &&
+            (dumpfile_crc32(0, mapped + index_offset,
+                            (size_t) (index_end - index_offset)) == crc))
+        {
+            total_blocks = (size_t) count;
+            blocks = new DumpFileBlockInfo[total_blocks];
+            ptr = mapped + index_offset;
+            for (size_t i = 0; i < total_blocks; i++)
+            {
+                DumpFileBlockInfo &block = blocks[i];
+                block.offset = get_le64(ptr);
+                block.first_op = get_le64(ptr);
+                block.total_ops = get_le32(ptr);
+                block.first_tick = (tick_t) get_le32(ptr);
+                block.last_tick = (tick_t) get_le32(ptr);
+                block.flags = get_le32(ptr);
+                block.live_count = block.payload_length = block.crc = 0;
+            } // for
+        } // if
+    } // if
+
+    if (blocks == NULL)  // no usable index; go looking for the blocks.
+    {
+        size_t blocks_alloc = 0;
+        const uint8 *ptr = data;
+        while (((size_t) (mapped_end - ptr)) >= DUMPFILE_BLOCK_HEADER_SIZE)
+        {
+            if (memcmp(ptr, DUMPFILE_BLOCK_MAGIC, 4) != 0)
+            {
+                ptr++;
+                continue;
+            } // if
+
+            DumpFileBlockInfo block;
+            read_block_header(ptr, block);
+            block.offset = (uint64) (ptr - mapped);
+            if (!check_block(block))
+            {
+                skipped_blocks++;
+                ptr++;
+                continue;
+            } // if
+
+            if (total_blocks == blocks_alloc)
+            {
+                blocks_alloc = (blocks_alloc == 0) ? 64 : blocks_alloc * 2;
+                DumpFileBlockInfo *newblocks =
+                                    new DumpFileBlockInfo[blocks_alloc];
+                if (total_blocks > 0)
+                {
+                    memcpy(newblocks, blocks,
+                           total_blocks * sizeof (DumpFileBlockInfo));
+                } // if
+                delete[] blocks;
+                blocks = newblocks;
+            } // if
+            blocks[total_blocks++] = block;
+            ptr += DUMPFILE_BLOCK_HEADER_SIZE + block.payload_length;
+        } // while
+    } // if
+
+    // Which blocks overlap the window?
+    size_t first = total_blocks;
+    size_t last = 0;
+    if (window.by_ticks)
+    {
+        for (size_t i = 0; i < total_blocks; i++)
+        {
+            if ((blocks[i].last_tick >= window.first) &&
+                (blocks[i].first_tick <= window.last))
+            {
+                if (first == total_blocks)
+                    first = i;
+                last = i;
+            } // if
+        } // for
+    } // if
+    else
+    {
+        size_t lo = 0;
+        size_t hi = total_blocks;
+        while (lo < hi)  // first block that ends past window.first.
+        {
+            const size_t mid = lo + ((hi - lo) / 2);
+            const DumpFileBlockInfo &block = blocks[mid];
+            if (block.first_op + block.total_ops <= window.first)
+                lo = mid + 1;
+            else
+                hi = mid;
+        } // while
+
+        first = lo;
+        for (last = first; last + 1 < total_blocks; last++)
+        {
+            if (blocks[last+1].first_op > window.last)
+                break;
+        } // for
+    } // else
+
+    if ((first >= total_blocks) ||
+        ((!window.by_ticks) && (blocks[first].first_op > window.last)))
+    {
+        delete[] blocks;
+        throw("No blocks cover the requested window");
+    } // if
+
+    size_t checkpoint = first;
+    while ((checkpoint > 0) &&
+           ((blocks[checkpoint].flags & DUMPFILE_BLOCK_FLAG_CHECKPOINT) == 0))
+        checkpoint--;
+
+    try
+    {
+        if (byte_order != platform_byteorder)
+        {
+            if (sizeofptr == 4)
+                load_blocks< DumpFileDecoder<uint32, true> >(
+                                blocks, checkpoint, first, last, window, pn);
+            else
+                load_blocks< DumpFileDecoder<uint64, true> >(
+                                blocks, checkpoint, first, last, window, pn);
+        } // if
+        else
+        {
+            if (sizeofptr == 4)
+                load_blocks< DumpFileDecoder<uint32, false> >(
+                                blocks, checkpoint, first, last, window, pn);
+            else
+                load_blocks< DumpFileDecoder<uint64, false> >(
+                                blocks, checkpoint, first, last, window, pn);
+        } // else
+    } // try
+
+    catch (const char *e)
+    {
+        delete[] blocks;
+        throw(e);
+    } // catch
+
+    delete[] blocks;
+} // DumpFile::parse_blocks
+
+
+// Seeds the fragmap from blocks[checkpoint] up to the window, and keeps
+//  the ops in the window, which ends somewhere in blocks[last].
+template <class Decoder>
+void DumpFile::load_blocks(DumpFileBlockInfo *blocks, size_t checkpoint,
+                           size_t first, size_t last,
+                           const DumpFileWindow &window, ProgressNotify &pn)
+{
+    DumpFileChunk chunk;
+    chunk.df = this;
+    chunk.callstacks = &callstackManager;
+    DumpFileColumns &ops = chunk.ops;
+    bool started = false;  // seen the first op in the window yet?
+    const uint8 *frames;
+    uint32 count;
+
+    for (size_t b = checkpoint; b <= last; b++)
+    {
+        DumpFileBlockInfo &block = blocks[b];
+        if (!check_block(block))
+        {
+            skipped_blocks++;
+            continue;
+        } // if
+
+        const uint8 *ptr = mapped + block.offset + DUMPFILE_BLOCK_HEADER_SIZE;
+        const uint8 *end = ptr + block.payload_length;
+        if ((b == checkpoint) && (!started))
+        {
+            for (uint32 i = 0; i < block.live_count; i++)
+            {
+                const dumpptr blockptr = (dumpptr) get_le64(ptr);
+                const dumpptr size = (dumpptr) get_le64(ptr);
+                fragmapManager.seed_block(blockptr, (size_t) size);
+            } // for
+        } // if
+        else
+        {
+            ptr += ((size_t) block.live_count) * DUMPFILE_BLOCK_LIVE_SIZE;
+        } // else
+
+        uint64 opidx = block.first_op;
+        while (ptr < end)
+        {
+            if (decode_record<Decoder>(ptr, 0, (tick_t) -1, ops, frames,
+                                       count) != DUMPFILE_CHUNK_END)
+                break;  // it passed its checksum, so this shouldn't happen.
+            else if (frames == NULL)
+                continue;
+
+            const size_t idx = ops.total - 1;
+            const uint64 thisop = opidx++;
+            const uint64 where = window.by_ticks ?
+                                    (uint64) ops.timestamps[idx] : thisop;
+            if ((where < window.first) || (where > window.last))
+            {
+                // before the window, it's still part of what's allocated.
+                if (!started)
+                {
+                    const DumpFileOperation op(ops, idx, thisop);
+                    fragmapManager.seed_operation(op);
+                } // if
+                ops.total--;  // either way, it's not one of ours.
+                continue;
+            } // if
+
+            if (!started)
+            {
+                started = true;
+                window_start = thisop;
+                fragmapManager.done_seeding();
+            } // if
+
+            ops.callstacks[idx] = intern_callstack<Decoder>(chunk, frames,
+                                                            count);
+            if (ops.total == DUMPFILE_BLOCK_SIZE)
+            {
+                store_operations(ops);
+                ops.clear();
+            } // if
+        } // while
+
+        if (b >= first)
+        {
+            const int percent = (int) ((((double) (b - first + 1)) /
+                                ((double) (last - first + 1))) * 100.0);
+            pn.update("Loading blocks", percent);
+        } // if
+    } // for
+
+    store_operations(ops);
+    ops.clear();
+
+    if (!started)
+        throw("No operations in the requested window");
+} // DumpFile::load_blocks
+
+
+/*
+ * Caching...
+ *
+ * Loading a big dumpfile is mostly decoding it, looking up callstacks and
+ *  building fragmap snapshots, and the answers are the same every time.
+ *  So after a whole dumpfile is loaded, we write them to "dumpfile.mmcache"
+ *  (see DumpFileOptions::cache), and next time, map that instead:
+ *
+ *  - DUMPFILE_CACHE_SIGNATURE, padded to 24 bytes.
+ *  - ui64s: format version, what this build's types look like, the
+ *    dumpfile's size, modification time and a hash of its first and last
+ *    DUMPFILE_CACHE_SAMPLE bytes, then where each section is, and how
+ *    big, in this order:
+ *  - the handshake: protocol version, byte order, pointer size, a byte of
+ *    padding, the pid, the start time, and the id and binary filename as
+ *    asciz strings.
+ *  - callstacks: the total frame count, the node count, and the nodes from
+ *    CallstackManager::flatten(): all the parents, then all the frames.
+ *    Callstack ids are just positions in those, so they come back the same.
+ *  - operations, from DumpFileOpStore::save().
+ *  - fragmap snapshots, from FragMapManager::save_snapshots().
+ *
+ * Everything is in this machine's byte order; it's a cache, not an
+ *  interchange format. Hashing the whole dumpfile to see if it changed
+ *  would take about as long as parsing it, so we don't.
+ */
+
+#define DUMPFILE_CACHE_SIGNATURE "Malloc Monitor Cache"
+#define DUMPFILE_CACHE_SIGNATURE_SIZE 24
+#define DUMPFILE_CACHE_VERSION 6
+#define DUMPFILE_CACHE_EXTENSION ".mmcache"
+#define DUMPFILE_CACHE_SAMPLE (64 * 1024)
+#define DUMPFILE_CACHE_SECTIONS 4
+#define DUMPFILE_CACHE_HEADER_FIELDS (5 + (DUMPFILE_CACHE_SECTIONS * 2))
+#define DUMPFILE_CACHE_HEADER_SIZE \
+    (DUMPFILE_CACHE_SIGNATURE_SIZE + (DUMPFILE_CACHE_HEADER_FIELDS * 8))
+
+// what a cache written by this build has in its second header field.
+#define DUMPFILE_CACHE_PLATFORM \
+    ((uint64) (platform_byteorder | (sizeof (dumpptr) << 8) | \
+               (sizeof (tick_t) << 16) | (sizeof (size_t) << 24)))
+
+// Fills in (info) with the size, modification time and sampled hash that
+//  a cache for (fn) has to match. Returns false if (fn) can't be read.
+static bool dumpfile_fingerprint(const char *fn, uint64 *info)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return(false);
+
+    struct stat statbuf;
+    if (fstat(fd, &statbuf) == -1)
+    {
+        close(fd);
+        return(false);
+    } // if
+
+    const uint64 size = (uint64) statbuf.st_size;
+    uint64 hash = 14695981039346656037ULL;  // FNV-1a.
+    uint8 *buf = new uint8[DUMPFILE_CACHE_SAMPLE];
+    for (int i = 0; i < 2; i++)
+    {
+        uint64 offset = 0;
+        size_t len = DUMPFILE_CACHE_SAMPLE;
+        if (size < len)
+            len = (size_t) size;
+        if (i == 1)
+            offset = size - len;
+
+        if (pread(fd, buf, len, (off_t) offset) != (ssize_t) len)
+        {
+            delete[] buf;
+            close(fd);
+            return(false);
+        } // if
+
+        for (size_t j = 0; j < len; j++)
+        {
+            hash ^= buf[j];
+            hash *= 1099511628211ULL;
+        } // for
+    } // for
+
+    delete[] buf;
+    close(fd);
+
+    info[0] = size;
+    info[1] = (uint64) statbuf.st_mtime;
+    info[2] = hash;
+    return(true);
+} // dumpfile_fingerprint
+
+
+static char *dumpfile_cache_filename(const char *fn, const char *suffix)
+{
+    char *retval = new char[strlen(fn) + strlen(DUMPFILE_CACHE_EXTENSION) +
+                            strlen(suffix) + 1];
+    strcpy(retval, fn);
+    strcat(retval, DUMPFILE_CACHE_EXTENSION);
+    strcat(retval, suffix);
+    return(retval);
+} // dumpfile_cache_filename
+
+
+// Loads everything from (fn)'s cache, if it has a good one. Returns false
+//  without changing anything if it doesn't, damaged or not, so the caller
+//  just parses the dumpfile instead (and writes a new cache over it).
+bool DumpFile::read_cache(const char *fn) throw (const char *)
+{
+    char *cachefn = dumpfile_cache_filename(fn, "");
+    int fd = open(cachefn, O_RDONLY);
+    delete[] cachefn;
+    if (fd == -1)
+        return(false);
+
+    struct stat statbuf;
+    if ((fstat(fd, &statbuf) == -1) ||
+        (statbuf.st_size < DUMPFILE_CACHE_HEADER_SIZE))
+    {
+        close(fd);
+        return(false);
+    } // if
+
+    const size_t size = (size_t) statbuf.st_size;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return(false);
+
+    const uint8 *map = (const uint8 *) ptr;
+    uint64 header[DUMPFILE_CACHE_HEADER_FIELDS];
+    memcpy(header, map + DUMPFILE_CACHE_SIGNATURE_SIZE, sizeof (header));
+    const uint64 *sections = header + 5;
+
+    uint64 info[3];
+    bool valid = ((memcmp(map, DUMPFILE_CACHE_SIGNATURE,
+                          sizeof (DUMPFILE_CACHE_SIGNATURE)) == 0) &&
+                  (header[0] == DUMPFILE_CACHE_VERSION) &&
+                  (header[1] == DUMPFILE_CACHE_PLATFORM) &&
+                  (dumpfile_fingerprint(fn, info)) &&
+                  (memcmp(info, header + 2, sizeof (info)) == 0));
+
+    for (int i = 0; (valid) && (i < DUMPFILE_CACHE_SECTIONS); i++)
+    {
+        const uint64 offset = sections[i * 2];
+        const uint64 len = sections[(i * 2) + 1];
+        valid = ((offset <= size) && (len <= (size - offset)));
+    } // for
+
+    if (!valid)
+    {
+        munmap(ptr, size);
+        return(false);
+    } // if
+
+    // Everything gets checked before we keep any of it; the fingerprint
+    //  only says the cache was made for this dumpfile, not that it's
+    //  still intact.
+    const char *str = NULL;
+    const char *str2 = NULL;
+    const uint8 *stacks = NULL;
+    size_t total = 0;
+    uint64 counts[2];
+    const size_t nodesize = sizeof (uint32) + sizeof (dumpptr);
+
+    try
+    {
+        // the handshake...
+        const uint8 *data = map + sections[0];
+        size_t len = (size_t) sections[1];
+        if (len < 16)
+            throw("Cache file is corrupted");
+        const char *strend = (const char *) (data + len);
+        str = (const char *) (data + 16);
+        str2 = (const char *) memchr(str, '\0', strend - str);
+        if (str2 != NULL)
+            str2++;
+        if ((str2 == NULL) || (memchr(str2, '\0', strend - str2) == NULL))
+            throw("Cache file is corrupted");
+
+        // ...the callstacks, whose parents always come first...
+        stacks = map + sections[2];
+        len = (size_t) sections[3];
+        if (len < sizeof (counts))
+            throw("Cache file is corrupted");
+        memcpy(counts, stacks, sizeof (counts));
+        total = (size_t) counts[1];
+        if ((total == 0) || (total > (len / nodesize)) ||
+            ((len - sizeof (counts)) != (total * nodesize)))
+            throw("Cache file is corrupted");
+        stacks += sizeof (counts);
+        for (size_t i = 1; i < total; i++)
+        {
+            uint32 parent;
+            memcpy(&parent, stacks + (i * sizeof (uint32)), sizeof (parent));
+            if (parent >= i)
+                throw("Cache file is corrupted");
+        } // for
+
+        // ...the operations, which get unpacked straight from the cache...
+        operations.load(map + sections[4], (size_t) sections[5], total);
+
+        // ...and the fragmap. This is the last thing that can fail.
+        try
+        {
+            fragmapManager.load_snapshots(map + sections[6],
+                                          (size_t) sections[7],
+                                          operations.getTotal());
+        } // try
+        catch (const char *e)
+        {
+            operations.release();
+            if (scratch != NULL)  // put it back the way init_scratch() had it.
+                operations.spill_to(scratch, options.memory_budget / 2);
+            throw(e);
+        } // catch
+    } // try
+
+    catch (const char *e)
+    {
+        munmap(ptr, size);
+        return(false);
+    } // catch
+
+    cache_map = map;
+    cache_map_size = size;
+
+    const uint8 *data = map + sections[0];
+    protocol_version = data[0];
+    byte_order = data[1];
+    sizeofptr = data[2];
+    memcpy(&pid, data + 4, sizeof (pid));
+    memcpy(&start_time, data + 8, sizeof (start_time));
+    id = new char[strlen(str) + 1];
+    strcpy(id, str);
+    this->fname = new char[strlen(str2) + 1];
+    strcpy(this->fname, str2);
+
+    uint32 *parents = new uint32[total];
+    dumpptr *frames = new dumpptr[total];
+    memcpy(parents, stacks, total * sizeof (uint32));
+    memcpy(frames, stacks + (total * sizeof (uint32)),
+           total * sizeof (dumpptr));
+    callstackManager.unflatten(parents, frames, total, (size_t) counts[0]);
+    delete[] parents;
+    delete[] frames;
+
+    options.lazy_callstacks = false;  // they're all looked up already.
+    return(true);
+} // DumpFile::read_cache
+
+
+// Writes to a temp file and renames it over the cache when it's done, so
+//  nobody ever sees half a cache.
+void DumpFile::write_cache(const char *fn) throw (const char *)
+{
+    uint64 header[DUMPFILE_CACHE_HEADER_FIELDS];
+    memset(header, '\0', sizeof (header));
+    header[0] = DUMPFILE_CACHE_VERSION;
+    header[1] = DUMPFILE_CACHE_PLATFORM;
+    if (!dumpfile_fingerprint(fn, header + 2))
+        return;
+    uint64 *sections = header + 5;
+
+    char *cachefn = dumpfile_cache_filename(fn, "");
+    char *tmpfn = dumpfile_cache_filename(fn, "-XXXXXX");
+    int fd = mkstemp(tmpfn);
+    FILE *out = (fd == -1) ? NULL : fdopen(fd, "wb");
+    if (out == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmpfn);
+        } // if
+        delete[] cachefn;
+        delete[] tmpfn;
+        return;
+    } // if
+
+    const size_t total = callstackManager.getUniqueCallstackFrames() + 1;
+    uint32 *parents = NULL;
+    dumpptr *frames = NULL;
+
+    try
+    {
+        char sig[DUMPFILE_CACHE_SIGNATURE_SIZE];
+        memset(sig, '\0', sizeof (sig));
+        strcpy(sig, DUMPFILE_CACHE_SIGNATURE);
+        write_bytes(out, sig, sizeof (sig));
+        write_bytes(out, header, sizeof (header));  // filled in later.
+        uint64 pos = DUMPFILE_CACHE_HEADER_SIZE;
+
+        // the handshake...
+        uint8 bytes[4] = { protocol_version, byte_order, sizeofptr, 0 };
+        write_bytes(out, bytes, sizeof (bytes));
+        write_bytes(out, &pid, sizeof (pid));
+        write_bytes(out, &start_time, sizeof (start_time));
+        write_bytes(out, id, strlen(id) + 1);
+        write_bytes(out, this->fname, strlen(this->fname) + 1);
+        sections[0] = pos;
+        sections[1] = 16 + strlen(id) + 1 + strlen(this->fname) + 1;
+        pos += sections[1];
+
+        // ...the callstacks...
+        parents = new uint32[total];
+        frames = new dumpptr[total];
+        callstackManager.flatten(parents, frames);
+        const uint64 counts[2] = {
+            callstackManager.getTotalCallstackFrames(), total
+        };
+        write_bytes(out, counts, sizeof (counts));
+        write_bytes(out, parents, total * sizeof (uint32));
+        write_bytes(out, frames, total * sizeof (dumpptr));
+        sections[2] = pos;
+        sections[3] = sizeof (counts) +
+                      (total * (sizeof (uint32) + sizeof (dumpptr)));
+        pos += sections[3];
+
+        // ...the operations...
+        operations.save(out);
+        sections[4] = pos;
+        sections[5] = (3 + (operations.getTotalBlocks() * 2)) *
+                      sizeof (uint64) + operations.getPackedSize();
+        pos += sections[5];
+
+        // ...and the fragmap.
+        fragmapManager.save_snapshots(out);
+        const off_t end = ftello(out);
+        if (end == -1)
+            throw((const char *) strerror(errno));
+        sections[6] = pos;
+        sections[7] = ((uint64) end) - pos;
+
+        if (fseeko(out, DUMPFILE_CACHE_SIGNATURE_SIZE, SEEK_SET) == -1)
+            throw((const char *) strerror(errno));
+        write_bytes(out, header, sizeof (header));
+        if (fflush(out) != 0)
+            throw((const char *) strerror(errno));
+    } // try
+
+    catch (const char *e)
+    {
+        fclose(out);
+        unlink(tmpfn);
+        delete[] cachefn;
+        delete[] tmpfn;
+        delete[] parents;
+        delete[] frames;
+        throw(e);
+    } // catch
+
+    delete[] parents;
+    delete[] frames;
+
+    if ((fclose(out) != 0) || (rename(tmpfn, cachefn) == -1))
+        unlink(tmpfn);
+    delete[] cachefn;
+    delete[] tmpfn;
+} // DumpFile::write_cache
+
+
+void DumpFile::parse(const char *fn, const DumpFileWindow &window,
+                     ProgressNotify &pn) throw (const char *)
+{
+    init_state();
+    init_scratch();
+
+    const bool whole = ((!window.by_ticks) && (window.first == 0) &&
+                        (window.last == (uint64) -1));
+    const bool cacheable = ((options.cache) && (whole) && (!options.follow));
+
+    try
+    {
+        if ((cacheable) && (read_cache(fn)))
+            return;
+
+        if ((options.follow) && (!handshake_written(fn)))
+        {
+            // the daemon only just started on it. Wait for the rest, the
+            //  same as we would for a record that isn't all there yet.
+            follow_fname = new char[strlen(fn) + 1];
+            strcpy(follow_fname, fn);
+            follow_pos = 0;
+            follow_handshake = true;
+            finish_parse(pn);
+            return;
+        } // if
+
+        double fsize = (double) map_file(fn);
+        dumpfile_chunk_status_t status = DUMPFILE_CHUNK_END;
+        if ((mapped_size >= sizeof (DUMPFILE_BLOCKS_SIGNATURE)) &&
+            (memcmp(mapped, DUMPFILE_BLOCKS_SIGNATURE,
+                    sizeof (DUMPFILE_BLOCKS_SIGNATURE)) == 0))
+        {
+            parse_blocks(window, pn);
+        } // if
+        else
+        {
+            tick_t mintick = 0;
+            tick_t maxtick = (tick_t) -1;
+            if (window.by_ticks)
+            {
+                if (window.first < maxtick)
+                    mintick = (tick_t) window.first;
+                if (window.last < maxtick)
+                    maxtick = (tick_t) window.last;
+            } // if
+            else if (!whole)
+                throw("Loading a range of operations needs a block container");
+
+            read_header(true);
+
+            status = parse_operations(pn, mintick, maxtick, 0.0, fsize);
+            if ((options.follow) && (status != DUMPFILE_CHUNK_GOODBYE) &&
+                (status != DUMPFILE_CHUNK_BOGUS))
+            {
+                follow_fname = new char[strlen(fn) + 1];
+                strcpy(follow_fname, fn);
+                follow_pos = mapped_filepos + ((uint64) (cursor - mapped));
+            } // if
+        } // else
+
+        finish_parse(pn);
+
+        if (status == DUMPFILE_CHUNK_BOGUS)
+            throw("Unexpected or corrupted data in dumpfile!");
+    } // try
+
+    catch (const char *e)
+    {
+        destruct();
+        throw(e);
+    } // catch
+
+    release_file();
+
+    if ((cacheable) && (!options.lazy_callstacks))
+    {
+        try
+        {
+            write_cache(fn);
+        } // try
+        catch (const char *e)
+        {
+            // no cache this time, then. It's not worth failing over.
+        } // catch
+    } // if
+} // DumpFile::parse
+
+
+void DumpFile::parse_index(const char *idxfn, tick_t starttick,
+                           tick_t endtick, ProgressNotify &pn)
+    throw (const char *)
+{
+    char **segments = NULL;
+    size_t total_segments = 0;
+
+    init_state();
+    init_scratch();
+
+    try
+    {
+        FILE *idx = fopen(idxfn, "r");
+        if (idx == NULL)
+            throw ((const char *) strerror(errno));
+
+        // segment filenames are relative to the index file.
+        const char *dirsep = strrchr(idxfn, '/');
+        size_t dirlen = (dirsep == NULL) ? 0 : ((dirsep - idxfn) + 1);
+
+        char line[2048];
+        char segfname[1024];
+        unsigned int first, last;
+        while (fgets(line, sizeof (line), idx) != NULL)
+        {
+            if (sscanf(line, "segment\t%1023s\t%u\t%u",
+                       segfname, &first, &last) != 3)
+                continue;  // metadata we don't need, comments, etc.
+
+            if ((last < starttick) || (first > endtick))
+                continue;  // doesn't overlap the window.
+
+            // !!! FIXME: realloc? yuck!
+            total_segments++;
+            segments = (char **) realloc(segments,
+                            total_segments * sizeof (char *));
+            assert(segments != NULL);  // !!! FIXME: lame.
+            char *str = new char[dirlen + strlen(segfname) + 1];
+            memcpy(str, idxfn, dirlen);
+            strcpy(str + dirlen, segfname);
+            segments[total_segments-1] = str;
+        } // while
+        fclose(idx);
+
+        // the daemon may have deleted some for being over quota.
+        double totalsize = 0.0;
+        struct stat statbuf;
+        for (size_t i = 0; i < total_segments; i++)
+        {
+            if (stat(segments[i], &statbuf) == -1)
+            {
+                delete[] segments[i];
+                segments[i] = NULL;
+            } // if
+            else
+            {
+                totalsize += (double) statbuf.st_size;
+            } // else
+        } // for
+
+        if (totalsize == 0.0)
+            throw("No segments cover the requested time range");
+
+        double basepos = 0.0;
+        bool first_segment = true;
+        bool bogus_data = false;
+        for (size_t i = 0; (i < total_segments) && (!bogus_data); i++)
+        {
+            if (segments[i] == NULL)
+                continue;
+
+            try
+            {
+                map_file(segments[i]);
+                read_header(first_segment);
+            } // try
+
+            catch (const char *e)
+            {
+                // deleted since we looked, or a fresh segment that doesn't
+                //  have its handshake yet?
+                const bool missing = (mapped == NULL);
+                const bool truncated = (cursor == mapped_end);
+                unmap_file();
+                if ((missing) || ((!first_segment) && (truncated)))
+                    continue;
+
+                throw(e);
+            } // catch
+
+            first_segment = false;
+            bogus_data = (parse_operations(pn, starttick, endtick,
+                                           basepos, totalsize) ==
+                                                DUMPFILE_CHUNK_BOGUS);
+            basepos += (double) mapped_size;
+            release_file();
+        } // for
+
+        if (first_segment)
+            throw("No segments cover the requested time range");
+
+        finish_parse(pn);
+
+        if (bogus_data)
+            throw("Unexpected or corrupted data in dumpfile!");
+    } // try
+
+    catch (const char *e)
+    {
+        for (size_t i = 0; i < total_segments; i++)
+            delete[] segments[i];
+        free(segments);  // !!! FIXME: allocated with realloc()...
+        destruct();
+        throw(e);
+    } // catch
+
+    for (size_t i = 0; i < total_segments; i++)
+        delete[] segments[i];
+    free(segments);  // !!! FIXME: allocated with realloc()...
+} // DumpFile::parse_index
+
+/*
+ * Following a growing dumpfile...
+ *
+ * A dumpfile that's still being written just ends in the middle of a
+ *  record now and then, and parsing already stops cleanly there. So
+ *  following one is just remembering where we stopped, and picking up
+ *  from there when the file gets bigger. In between, the op store keeps
+ *  its last partial block unpacked and the fragmap keeps its working set,
+ *  so new ops go on the end as if we'd never stopped.
+ */
+
+uint64 DumpFile::poll(ProgressNotify &pn) throw (const char *)
+{
+    if (follow_fname == NULL)
+        return(0);
+
+    struct stat statbuf;
+    if (stat(follow_fname, &statbuf) == -1)
+        return(0);  // maybe it's being replaced; try again later.
+    else if (((uint64) statbuf.st_size) <= follow_pos)
+        return(0);  // nothing new.
+
+    const uint64 first = operations.getTotal();
+    dumpfile_chunk_status_t status;
+    try
+    {
+        if ((follow_handshake) && (!handshake_written(follow_fname)))
+            return(0);  // still not all there.
+
+        fragmapManager.resume_adding();
+        const double fsize = (double) map_file(follow_fname, follow_pos);
+        if (follow_handshake)
+        {
+            read_header(true);
+            follow_handshake = false;
+        } // if
+        status = parse_operations(pn, 0, (tick_t) -1,
+                                  (double) mapped_filepos, fsize);
+        follow_pos = mapped_filepos + ((uint64) (cursor - mapped));
+        release_file();
+    } // try
+
+    catch (const char *e)
+    {
+        unmap_file();
+        stopFollowing(pn);
+        throw(e);
+    } // catch
+
+    if ((status == DUMPFILE_CHUNK_GOODBYE) || (status == DUMPFILE_CHUNK_BOGUS))
+    {
+        delete[] follow_fname;  // that's all there is.
+        follow_fname = NULL;
     } // if
-    else
+    finish_parse(pn);  // pauses the fragmap again, or wraps everything up.
+
+    const uint64 count = operations.getTotal() - first;
+    if (count > 0)
     {
-        read_ui64(ptr);
-    } // else
-#else
-    uint32 ui32;
-    read_ui32(ui32);
-    ptr = (dumpptr) ui32;
-#endif
-} // DumpFile::read_ptr
+        for (size_t i = 0; i < total_listeners; i++)
+            listeners[i]->operationsAdded(*this, first, count);
+    } // if
+
+    if (status == DUMPFILE_CHUNK_BOGUS)
+        throw("Unexpected or corrupted data in dumpfile!");
+
+    return(count);
+} // DumpFile::poll
 
-inline void DumpFile::read_sizet(dumpptr &sizet) throw (const char *)
+
+void DumpFile::stopFollowing(ProgressNotify &pn)
 {
-    read_ptr(sizet);
-} // DumpFile::read_sizet
+    if (follow_fname != NULL)
+    {
+        delete[] follow_fname;
+        follow_fname = NULL;
+        finish_parse(pn);
+    } // if
+} // DumpFile::stopFollowing
+
 
-inline void DumpFile::read_timestamp(tick_t &t) throw (const char *)
+void DumpFile::addListener(DumpFileListener *listener)
 {
-    read_ui32(t);
-} // DumpFile::read_timestamp
+    // !!! FIXME: realloc? yuck!
+    DumpFileListener **ptr = (DumpFileListener **) realloc(listeners,
+                    (total_listeners + 1) * sizeof (DumpFileListener *));
+    assert(ptr != NULL);  // !!! FIXME: lame.
+    listeners = ptr;
+    listeners[total_listeners++] = listener;
+} // DumpFile::addListener
 
-inline void DumpFile::read_callstack(CallstackManager::callstackid &id)
-    throw (const char *)
+
+void DumpFile::removeListener(DumpFileListener *listener)
 {
-    dumpptr *buf = NULL;
-    uint32 count;
+    for (size_t i = 0; i < total_listeners; i++)
+    {
+        if (listeners[i] == listener)
+        {
+            total_listeners--;
+            memmove(&listeners[i], &listeners[i+1],
+                    (total_listeners - i) * sizeof (DumpFileListener *));
+            return;
+        } // if
+    } // for
+} // DumpFile::removeListener
+
+
+/*
+ * Multiple dumpfiles...
+ *
+ * Opening is just a DumpFile for each source, several at once on their own
+ *  threads. Then the sources' ops are merged with a heap that holds the
+ *  next op from each source, ordered by merged tick (and source, to break
+ *  ties). All we keep from the merge is each op's source, plus, every
+ *  DUMPFILE_BLOCK_SIZE merged ops, how many ops had been taken from each
+ *  source so far. That's enough to find any merged op by counting forward
+ *  from the checkpoint before it.
+ */
+
+#define MULTIDUMPFILE_MAX_SOURCES 65535  // source ids are uint16.
+
+class MultiDumpFileOpenJob
+{
+public:
+    MultiDumpFileOpenJob()
+        : fnames(NULL), files(NULL), first(0), stride(1), total(0),
+          threaded(false), error(NULL) {}
+    const char * const *fnames;
+    DumpFile **files;
+    size_t first;  /* this job opens (first), (first+stride), etc. */
+    size_t stride;
+    size_t total;
+    DumpFileOptions options;
+    pthread_t thread;
+    bool threaded;
+    const char *error;  /* what went wrong, since threads can't throw. */
+};
+
+
+void *MultiDumpFile::open_thread(void *_job)
+{
+    MultiDumpFileOpenJob *job = (MultiDumpFileOpenJob *) _job;
+    ProgressNotifyDummy pnd;  // several of us at once would be gibberish.
+
+    try
+    {
+        for (size_t i = job->first; i < job->total; i += job->stride)
+            job->files[i] = new DumpFile(job->fnames[i], pnd, job->options);
+    } // try
+
+    catch (const char *e)
+    {
+        job->error = e;
+    } // catch
+
+    return(NULL);
+} // MultiDumpFile::open_thread
 
-    read_ui32(count);
-    if (count)
+
+MultiDumpFile::MultiDumpFile(const char * const *fnames, size_t count,
+                             ProgressNotify &pn,
+                             const DumpFileOptions &opts)
+    throw (const char *)
+    : sources(NULL), total_sources(0), offsets(NULL), start_time(0),
+      total_operations(0), sourceids(NULL), checkpoints(NULL),
+      cursor_idx(0), cursor_ops(NULL)
+{
+    if (count == 0)
+        throw("No dumpfiles to merge");
+    else if (count > MULTIDUMPFILE_MAX_SOURCES)
+        throw("Too many dumpfiles to merge");
+
+    // Share the threads and memory budget out between the sources, so
+    //  opening a lot of them at once doesn't swamp the machine.
+    size_t total_threads = (size_t) opts.decode_threads;
+    if (total_threads == 0)
     {
-        buf = (dumpptr *) alloca(sizeof (dumpptr)/*sizeofptr*/ * count);
-//        read_block(buf, count * sizeofptr);
-        for (uint32 i = 0; i < count; i++)
-            read_ptr(buf[i]);
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        total_threads = (cpus > 0) ? ((size_t) cpus) : 1;
     } // if
 
-    id = callstackManager.add(buf, count);
-} // read_callstack
+    const size_t total_jobs = (total_threads < count) ? total_threads : count;
+    DumpFileOptions srcopts(opts);
+    srcopts.decode_threads = (int) (total_threads / total_jobs);
+    srcopts.memory_budget = opts.memory_budget / count;
+    if ((opts.memory_budget > 0) && (srcopts.memory_budget == 0))
+        srcopts.memory_budget = 1;  // zero would mean "no budget at all."
+    srcopts.follow = false;  // can't merge what isn't finished.
+
+    sources = new DumpFile*[count];
+    memset(sources, '\0', count * sizeof (DumpFile *));
+    total_sources = count;
+
+    pn.update("Opening dumpfiles", 0);
+    MultiDumpFileOpenJob *jobs = new MultiDumpFileOpenJob[total_jobs];
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        MultiDumpFileOpenJob &job = jobs[i];
+        job.fnames = fnames;
+        job.files = sources;
+        job.first = i;
+        job.stride = total_jobs;
+        job.total = count;
+        job.options = srcopts;
+        if (i > 0)  // the first one runs on this thread.
+        {
+            job.threaded = (pthread_create(&job.thread, NULL,
+                                           open_thread, &job) == 0);
+        } // if
+    } // for
 
-inline void DumpFile::read_asciz(char *&str) throw (const char *)
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        MultiDumpFileOpenJob &job = jobs[i];
+        if (job.threaded)
+            pthread_join(job.thread, NULL);
+        else
+            open_thread(&job);
+    } // for
+
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        if (jobs[i].error != NULL)
+        {
+            const char *e = jobs[i].error;
+            delete[] jobs;
+            destruct();
+            throw(e);
+        } // if
+    } // for
+    delete[] jobs;
+    pn.update("Opening dumpfiles", 100);
+
+    // Line up the sources' ticks by when they started.
+    offsets = new uint64[count];
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint64 t = sources[i]->getStartTime();
+        if ((t != 0) && ((start_time == 0) || (t < start_time)))
+            start_time = t;
+    } // for
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const uint64 t = sources[i]->getStartTime();
+        offsets[i] = (t == 0) ? 0 : ((t - start_time) / 1000);
+    } // for
+
+    try
+    {
+        merge(pn);
+    } // try
+
+    catch (const char *e)
+    {
+        destruct();
+        throw(e);
+    } // catch
+} // MultiDumpFile::MultiDumpFile
+
+
+MultiDumpFile::~MultiDumpFile()
 {
-    // inefficient, but who cares? It's only used twice in the header!
-    uint8 buf[1024];
-    size_t i;
-    for (i = 0; i < sizeof (buf); i++)
+    destruct();
+} // MultiDumpFile::~MultiDumpFile
+
+
+void MultiDumpFile::destruct()
+{
+    for (size_t i = 0; i < total_sources; i++)
+        delete sources[i];
+    delete[] sources;
+    delete[] offsets;
+    delete[] sourceids;
+    delete[] checkpoints;
+    delete[] cursor_ops;
+    sources = NULL;
+    offsets = NULL;
+    sourceids = NULL;
+    checkpoints = NULL;
+    cursor_ops = NULL;
+    total_sources = 0;
+    total_operations = 0;
+} // MultiDumpFile::destruct
+
+
+// Where the merge is in one source.
+class MultiDumpFileSource
+{
+public:
+    MultiDumpFileSource() : ops(NULL), first(0), next(0), total(0), tick(0) {}
+    const DumpFileColumns *ops;  /* the block that (next) is in. */
+    uint64 first;  /* index of (ops)'s first op. */
+    uint64 next;  /* next op to merge; also how many we've taken. */
+    uint64 total;
+    uint64 tick;  /* (next)'s merged tick. */
+    DumpFileLiveSet live;
+};
+
+
+static inline bool merges_before(const MultiDumpFileSource *state,
+                                 size_t a, size_t b)
+{
+    if (state[a].tick != state[b].tick)
+        return(state[a].tick < state[b].tick);
+    return(a < b);
+} // merges_before
+
+
+static void merge_sift_up(size_t *heap, size_t i,
+                          const MultiDumpFileSource *state)
+{
+    while (i > 0)
     {
-        read_ui8(buf[i]);
-        if (buf[i] == 0)
+        const size_t parent = (i - 1) / 2;
+        if (!merges_before(state, heap[i], heap[parent]))
+            break;
+        const size_t tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    } // while
+} // merge_sift_up
+
+
+static void merge_sift_down(size_t *heap, size_t total,
+                            const MultiDumpFileSource *state)
+{
+    size_t i = 0;
+    while (true)
+    {
+        size_t first = i;
+        const size_t left = (i * 2) + 1;
+        const size_t right = left + 1;
+        if ((left < total) && merges_before(state, heap[left], heap[first]))
+            first = left;
+        if ((right < total) && merges_before(state, heap[right], heap[first]))
+            first = right;
+        if (first == i)
             break;
+        const size_t tmp = heap[i];
+        heap[i] = heap[first];
+        heap[first] = tmp;
+        i = first;
+    } // while
+} // merge_sift_down
+
+
+void MultiDumpFile::merge(ProgressNotify &pn)
+{
+    const size_t n = total_sources;
+    for (size_t i = 0; i < n; i++)
+    {
+        total_operations += sources[i]->getOperationCount();
+        totals.callstack_frames +=
+            sources[i]->callstackManager.getTotalCallstackFrames();
     } // for
 
-    if (i >= sizeof (buf))
-        throw("Buffer overflow");
+    const uint64 total_checkpoints =
+        (total_operations + DUMPFILE_BLOCK_SIZE - 1) / DUMPFILE_BLOCK_SIZE;
+    sourceids = new uint16[total_operations];
+    checkpoints = new uint64[total_checkpoints * n];
+    cursor_ops = new uint64[n];
+    memset(cursor_ops, '\0', n * sizeof (uint64));
+    cursor_idx = 0;
+
+    MultiDumpFileSource *state = new MultiDumpFileSource[n];
+    size_t *heap = new size_t[n];
+    size_t heapsize = 0;
+    for (size_t i = 0; i < n; i++)
+    {
+        MultiDumpFileSource &s = state[i];
+        s.total = sources[i]->getOperationCount();
+        if (s.total == 0)
+            continue;
+        s.ops = &sources[i]->getOperationBlock(0, s.first);
+        s.tick = offsets[i] + (uint64) s.ops->timestamps[0];
+        heap[heapsize] = i;
+        merge_sift_up(heap, heapsize++, state);
+    } // for
 
-    str = new char[i+1];
-    strcpy(str, (char *) buf);
-} // read_asciz
+    const double total = (double) total_operations;
+    for (uint64 idx = 0; heapsize > 0; idx++)
+    {
+        if ((idx % DUMPFILE_BLOCK_SIZE) == 0)
+        {
+            uint64 *checkpoint = checkpoints +
+                                 ((idx / DUMPFILE_BLOCK_SIZE) * n);
+            for (size_t i = 0; i < n; i++)
+                checkpoint[i] = state[i].next;
+            const double pct = ((double) idx) / total;
+            pn.update("Merging operations", (int) (pct * 100.0));
+        } // if
+
+        const size_t src = heap[0];
+        MultiDumpFileSource &s = state[src];
+        const DumpFileColumns &ops = *s.ops;
+        const size_t i = (size_t) (s.next - s.first);
+        sourceids[idx] = (uint16) src;
 
+        switch (ops.optypes[i])
+        {
+            case DUMPFILE_OP_MALLOC:
+                totals.mallocs++;
+                break;
+
+            case DUMPFILE_OP_REALLOC:
+                totals.reallocs++;
+                break;
+
+            case DUMPFILE_OP_FREE:
+                totals.frees++;
+                break;
+        } // switch
+
+        // host-wide totals move by however much this source's did.
+        const uint64 bytes = s.live.bytes;
+        const uint64 blocks = (uint64) s.live.total;
+        s.live.apply(ops, i);
+        totals.live_bytes += s.live.bytes - bytes;
+        totals.live_blocks += ((uint64) s.live.total) - blocks;
+        totals.last_tick = s.tick;
+        if (totals.live_bytes > totals.peak_bytes)
+        {
+            totals.peak_bytes = totals.live_bytes;
+            totals.peak_blocks = totals.live_blocks;
+            totals.peak_operation = idx;
+            totals.peak_tick = s.tick;
+        } // if
+
+        if (++s.next == s.total)  // this source is done.
+            heap[0] = heap[--heapsize];
+        else
+        {
+            if ((s.next - s.first) >= (uint64) ops.total)
+                s.ops = &sources[src]->getOperationBlock(s.next, s.first);
+            s.tick = offsets[src] +
+                     (uint64) s.ops->timestamps[(size_t) (s.next - s.first)];
+        } // else
+        merge_sift_down(heap, heapsize, state);
+    } // for
 
-DumpFile::DumpFile(const char *fn, ProgressNotify &pn) throw (const char *)
+    delete[] heap;
+    delete[] state;
+    pn.update("Merging operations", 100);
+} // MultiDumpFile::merge
+
+
+DumpFileOperation MultiDumpFile::getOperation(uint64 idx, size_t &src) const
 {
-    parse(fn, pn);
-} // DumpFile constructor
+    // Count forward from the last op we looked up, unless it's easier to
+    //  start from the checkpoint before this one.
+    const uint64 block = idx / DUMPFILE_BLOCK_SIZE;
+    if ((idx < cursor_idx) || (block != (cursor_idx / DUMPFILE_BLOCK_SIZE)))
+    {
+        cursor_idx = block * DUMPFILE_BLOCK_SIZE;
+        memcpy(cursor_ops, checkpoints + (block * total_sources),
+               total_sources * sizeof (uint64));
+    } // if
 
-DumpFile::DumpFile(const char *fn) throw (const char *)
+    while (cursor_idx < idx)
+        cursor_ops[sourceids[cursor_idx++]]++;
+
+    src = sourceids[idx];
+    return(sources[src]->getOperation(cursor_ops[src]));
+} // MultiDumpFile::getOperation
+
+
+/*
+ * Calling context trees...
+ */
+
+// Every build() job counts into a whole tree of its own, so don't use so
+//  many threads that those get out of hand.
+#define CALLINGCONTEXT_PARTIAL_BYTES (256 * 1024 * 1024)
+
+CallingContextTree::CallingContextTree()
+    : total_nodes(0), parents(NULL), callstacks(NULL), exclusive(NULL),
+      inclusive(NULL), child_index(NULL), children(NULL), live_op(0)
 {
-    ProgressNotifyDummy pnd;
-    parse(fn, pnd);
-} // DumpFile constructor
+    // an empty tree is still just a root.
+    allocate(1);
+    parents[0] = 0;
+    callstacks[0] = 0;
+    total_nodes = 1;
+    finish();
+} // CallingContextTree::CallingContextTree
 
 
-void DumpFile::parse(const char *fn, ProgressNotify &pn) throw (const char *)
+CallingContextTree::~CallingContextTree()
 {
-    // set sane initial state...
-    fname = NULL;
-    id = NULL;
-    total_operations = 0;
-    operations = NULL;
-    io = NULL;
+    release();
+} // CallingContextTree::~CallingContextTree
 
-    platform_byteorder = is_bigendian();
 
-    try
-    {
-        io = fopen(fn, "rb");
-        if (io == NULL)
-            throw ((const char *) strerror(errno));
+void CallingContextTree::release()
+{
+    delete[] parents;
+    delete[] callstacks;
+    delete[] exclusive;
+    delete[] inclusive;
+    delete[] child_index;
+    delete[] children;
+    parents = callstacks = child_index = children = NULL;
+    exclusive = inclusive = NULL;
+    total_nodes = 0;
+} // CallingContextTree::release
 
-        double fsize;
-        struct stat statbuf;
-        if (fstat(fileno(io), &statbuf) == -1)
-            throw ((const char *) strerror(errno));
 
-        if (statbuf.st_size == 0)
-            throw ("File is empty");
+// Room for (count) nodes, with zeroed exclusive stats.
+void CallingContextTree::allocate(size_t count) throw (const char *)
+{
+    release();
+    parents = new uint32[count];
+    callstacks = new uint32[count];
+    exclusive = new CallingContextStats[count];
+} // CallingContextTree::allocate
 
-        fsize = (double) statbuf.st_size;
 
-        char sigbuf[16];
-        read_block(sigbuf, sizeof (sigbuf));
-        if (strcmp(sigbuf, "Malloc Monitor!") != 0)
-            throw("Not a Malloc Monitor dumpfile");
-        read_ui8(protocol_version);
-        if (protocol_version != 1)
-            throw("Unknown dumpfile format version");
+// Adds up inclusive stats and finds everyone's children. Parents always
+//  come before their children, so walking backwards adds each node into
+//  its parent after everything below it was added into it.
+void CallingContextTree::finish() throw (const char *)
+{
+    inclusive = new CallingContextStats[total_nodes];
+    for (size_t i = 0; i < total_nodes; i++)
+        inclusive[i] = exclusive[i];
+    for (size_t i = total_nodes - 1; i > 0; i--)
+        inclusive[parents[i]].add(inclusive[i]);
+
+    child_index = new uint32[total_nodes + 1];
+    children = new uint32[total_nodes];
+    memset(child_index, '\0', (total_nodes + 1) * sizeof (uint32));
+    for (size_t i = 1; i < total_nodes; i++)
+        child_index[parents[i] + 1]++;
+    for (size_t i = 0; i < total_nodes; i++)
+        child_index[i + 1] += child_index[i];
+
+    // (child_index) is where each node's children go; fill them in,
+    //  then put it back, since filling moved everyone along by one list.
+    for (size_t i = 1; i < total_nodes; i++)
+        children[child_index[parents[i]]++] = (uint32) i;
+    for (size_t i = total_nodes; i > 0; i--)
+        child_index[i] = child_index[i - 1];
+    child_index[0] = 0;
+} // CallingContextTree::finish
+
+
+// One thread's share of CallingContextTree::build(): a run of blocks,
+//  counted into its own (stats). Frees of blocks that it didn't see being
+//  allocated were allocated before its first block, so they're kept in
+//  (unmatched), in order, for the merge to sort out. So are allocations
+//  it didn't see freed first: a block from before its first one might
+//  still be at that address, and this one replaces it.
+class CallingContextJob
+{
+public:
+    CallingContextJob()
+        : df(NULL), first_block(0), end_block(0), live_op(0),
+          total_nodes(0), stats(NULL), unmatched(NULL), total_unmatched(0),
+          unmatched_alloc(0), pn(NULL), threaded(false), error(NULL) {}
+    ~CallingContextJob()
+    {
+        delete[] stats;
+        ::free(unmatched);
+    } // destructor
+
+    const DumpFile *df;
+    uint64 first_block;
+    uint64 end_block;
+    uint64 live_op;
+    size_t total_nodes;
+    CallingContextStats *stats;
+    DumpFileLiveSet live;  /* tagged with the allocating callstack. */
+    dumpptr *unmatched;
+    size_t total_unmatched;
+    size_t unmatched_alloc;
+    DumpFileColumns ops;
+    ProgressNotify *pn;  /* only the job on the main thread gets one. */
+    pthread_t thread;
+    bool threaded;
+    const char *error;  /* what went wrong, since threads can't throw. */
+
+    void alloc_block(dumpptr ptr, dumpptr size, uint32 tag)
+        throw (const char *)
+    {
+        if (!live.insert(ptr, size, tag))
+            add_unmatched(ptr);
+    } // alloc_block
 
-        read_ui8(byte_order);
-        read_ui8(sizeofptr);
-        read_asciz(id);
-        read_asciz(this->fname);
-        read_ui32(pid);
+    void free_block(dumpptr ptr) throw (const char *)
+    {
+        if (!live.remove(ptr))
+            add_unmatched(ptr);
+    } // free_block
+
+    void add_unmatched(dumpptr ptr) throw (const char *)
+    {
+        if (total_unmatched == unmatched_alloc)
+        {
+            const size_t newalloc = (unmatched_alloc == 0) ? 1024 :
+                                    (unmatched_alloc * 2);
+            void *p = realloc(unmatched, newalloc * sizeof (dumpptr));
+            if (p == NULL)
+                throw("Out of memory");
+            unmatched = (dumpptr *) p;
+            unmatched_alloc = newalloc;
+        } // if
+        unmatched[total_unmatched++] = ptr;
+    } // add_unmatched
+};
 
-        // rebuild with dumpptr defined to something bigger...
-        if (sizeofptr > sizeof (dumpptr))
-            throw("This build doesn't support this dumpfile's pointer size");
 
-        uint8 optype;
-        DumpFileOperation dummyop;
-        DumpFileOperation *op;
-        DumpFileOperation *prevop = &dummyop;
-        bool bogus_data = false;
+static void *callingcontext_thread(void *_job)
+{
+    CallingContextJob *job = (CallingContextJob *) _job;
+    const uint64 total_blocks = job->end_block - job->first_block;
 
-        while (!bogus_data)
+    try
+    {
+        for (uint64 block = job->first_block; block < job->end_block; block++)
         {
-            op = NULL;
-            try
-            {
-                read_ui8(optype);
-                if (optype == DUMPFILE_OP_GOODBYE)
-                    break;
-                else if (optype == DUMPFILE_OP_NOOP)
-                    continue;
+            uint64 first;
+            job->df->copyOperationBlock(block * DUMPFILE_BLOCK_SIZE, first,
+                                        job->ops);
 
-                op = new DumpFileOperation;
-                op->optype = (dumpfile_operation_t) optype;
-                read_timestamp(op->timestamp);
-                switch (optype)
+            const DumpFileColumns &ops = job->ops;
+            for (size_t i = 0; i < ops.total; i++)
+            {
+                uint64 id = ops.callstacks[i];
+                if (id >= job->total_nodes)
+                    id = 0;  // shouldn't happen, but don't crash.
+
+                CallingContextStats &stats = job->stats[id];
+                const bool tracking = ((first + i) <= job->live_op);
+                const dumpptr ptr = ops.ptrs[i];
+                const dumpptr size = ops.sizes[i];
+                const dumpptr retval = ops.retvals[i];
+                switch (ops.optypes[i])
                 {
                     case DUMPFILE_OP_MALLOC:
-                        //printf("malloc\n");
-                        read_sizet(op->op_malloc.size);
-                        read_ptr(op->op_malloc.retval);
-                        fragmapManager.add_malloc(op);
+                    case DUMPFILE_OP_MEMALIGN:
+                        if (retval == 0)
+                            break;  // failed; nothing happened.
+                        stats.allocs++;
+                        stats.bytes += (uint64) size;
+                        if (tracking)
+                            job->alloc_block(retval, size, (uint32) id);
                         break;
 
                     case DUMPFILE_OP_REALLOC:
-                        //printf("realloc\n");
-                        read_ptr(op->op_realloc.ptr);
-                        read_sizet(op->op_realloc.size);
-                        read_ptr(op->op_realloc.retval);
-                        fragmapManager.add_realloc(op);
+                        if ((size != 0) && (retval == 0))
+                            break;  // failed; (ptr) is still allocated.
+                        if (ptr != 0)
+                        {
+                            stats.frees++;
+                            if (tracking)
+                                job->free_block(ptr);
+                        } // if
+                        if (size != 0)
+                        {
+                            stats.allocs++;
+                            stats.bytes += (uint64) size;
+                            if (tracking)
+                                job->alloc_block(retval, size, (uint32) id);
+                        } // if
                         break;
 
                     case DUMPFILE_OP_FREE:
-                        //printf("free\n");
-                        read_sizet(op->op_free.ptr);
-                        fragmapManager.add_free(op);
-                        break;
-
-                    default:
-                        //fprintf(stderr, "bogus opcode: %d\n", (int) optype);
-                        bogus_data = true;
+                        if (ptr == 0)
+                            break;
+                        stats.frees++;
+                        if (tracking)
+                            job->free_block(ptr);
                         break;
                 } // switch
+            } // for
 
-                read_callstack(op->callstack);
-            } // try
-
-            catch (const char *e)  // half-written records are possible!
+            if (job->pn != NULL)
             {
-                delete op;  // nuke what was half-written, if anything.
-                break;  // break loop, we're done.
-            } // catch
+                const uint64 done = (block - job->first_block) + 1;
+                const int pct = (int) ((((double) done) /
+                                        ((double) total_blocks)) * 100.0);
+                job->pn->update("Building calling context tree", pct);
+            } // if
+        } // for
+    } // try
+
+    catch (const char *e)
+    {
+        job->error = e;
+    } // catch
 
-            prevop->next = op;
-            prevop = op;
-            total_operations++;
+    job->ops.release();
+    return(NULL);
+} // callingcontext_thread
 
-            pn.update( "Parsing raw data",
-                       (int) ((((double) ftell(io)) / fsize) * 100.0) );
-        } // while
 
-        callstackManager.done_adding(pn);
-        fragmapManager.done_adding(pn);
+void CallingContextTree::build(DumpFile &df, ProgressNotify &pn,
+                               uint64 liveop, int threads)
+    throw (const char *)
+{
+    df.internCallstacks(pn);
+
+    const CallstackManager &cm = df.callstackManager;
+    const size_t count = cm.getUniqueCallstackFrames() + 1;
+    const uint64 total_ops = df.getOperationCount();
+    const uint64 total_blocks = (total_ops + DUMPFILE_BLOCK_SIZE - 1) /
+                                DUMPFILE_BLOCK_SIZE;
+
+    size_t total_jobs = (size_t) threads;
+    if (threads <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        total_jobs = (cpus > 0) ? ((size_t) cpus) : 1;
+    } // if
 
-        if (op != NULL)
-            op->next = NULL;
+    const size_t most = CALLINGCONTEXT_PARTIAL_BYTES /
+                        (count * sizeof (CallingContextStats));
+    if (total_jobs > most)
+        total_jobs = (most > 0) ? most : 1;
+    if (total_jobs > total_blocks)
+        total_jobs = (total_blocks > 0) ? ((size_t) total_blocks) : 1;
+
+    allocate(count);
+    total_nodes = count;
+    live_op = liveop;
+    for (size_t i = 0; i < count; i++)
+    {
+        parents[i] = cm.caller((CallstackManager::callstackid) i);
+        callstacks[i] = (uint32) i;
+    } // for
 
-        op = dummyop.next;
-        operations = new DumpFileOperation*[total_operations];
-        for (size_t i = 0; i < total_operations; i++)
+    CallingContextJob *jobs = new CallingContextJob[total_jobs];
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        CallingContextJob &job = jobs[i];
+        job.df = &df;
+        job.first_block = (total_blocks * i) / total_jobs;
+        job.end_block = (total_blocks * (i + 1)) / total_jobs;
+        job.live_op = liveop;
+        job.total_nodes = count;
+        job.stats = (i == 0) ? exclusive : new CallingContextStats[count];
+        if (i == 0)  // the first one runs on this thread.
+            job.pn = &pn;
+        else
         {
-            operations[i] = op;
-            op = op->next;
-        } // for
+            job.threaded = (pthread_create(&job.thread, NULL,
+                                           callingcontext_thread, &job) == 0);
+        } // else
+    } // for
 
-        if (bogus_data)
-            throw("Unexpected or corrupted data in dumpfile!");
-    } // try
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        CallingContextJob &job = jobs[i];
+        if (job.threaded)
+            pthread_join(job.thread, NULL);
+        else
+            callingcontext_thread(&job);
+    } // for
 
-    catch (const char *e)
+    jobs[0].stats = NULL;  // that's (exclusive); don't delete it.
+    for (size_t i = 0; i < total_jobs; i++)
     {
-        destruct();
-        throw(e);
-    } // catch
+        if (jobs[i].error != NULL)
+        {
+            const char *e = jobs[i].error;
+            delete[] jobs;
+            throw(e);
+        } // if
+    } // for
 
-    if (io != NULL)
+    // Add up the partial trees, and play each job's frees of earlier
+    //  blocks (and allocations on top of them) against what was live
+    //  before it started. The first job's unmatched frees are for blocks
+    //  from before the dump started.
+    DumpFileLiveSet &live = jobs[0].live;
+    for (size_t i = 1; i < total_jobs; i++)
     {
-        fclose(io);
-        io = NULL;
-    } // if
-} // DumpFile::construct
+        CallingContextJob &job = jobs[i];
+        for (size_t j = 0; j < count; j++)
+            exclusive[j].add(job.stats[j]);
+        for (size_t j = 0; j < job.total_unmatched; j++)
+            live.remove(job.unmatched[j]);
+        for (size_t j = 0; j < job.live.capacity; j++)
+        {
+            if (job.live.ptrs[j] != 0)
+                live.insert(job.live.ptrs[j], job.live.sizes[j],
+                            job.live.tags[j]);
+        } // for
+        job.live.clear();
+    } // for
+
+    for (size_t i = 0; i < live.capacity; i++)
+    {
+        if (live.ptrs[i] != 0)
+        {
+            CallingContextStats &stats = exclusive[live.tags[i]];
+            stats.live_blocks++;
+            stats.live_bytes += (uint64) live.sizes[i];
+        } // if
+    } // for
+
+    delete[] jobs;
+    finish();
+    pn.update("Building calling context tree", 100);
+} // CallingContextTree::build
+
+
+void CallingContextTree::collapse(const CallingContextTree &tree,
+                                  const uint32 *keys) throw (const char *)
+{
+    if (&tree == this)
+        throw("Can't collapse a tree into itself");
+
+    // at worst, nothing collapses.
+    const size_t count = tree.total_nodes;
+    allocate(count);
+    live_op = tree.live_op;
+
+    uint32 *mapped = new uint32[count];  /* (tree)'s nodes to ours. */
+    uint32 *nodekeys = new uint32[count];
+    size_t table_size = 1024;
+    while (table_size < (count * 2))
+        table_size *= 2;
+    uint32 *table = new uint32[table_size];  /* ours, by (parent, key). */
+    memset(table, '\0', table_size * sizeof (uint32));
+    const size_t mask = table_size - 1;
+
+    mapped[0] = 0;
+    parents[0] = 0;
+    callstacks[0] = tree.callstacks[0];
+    nodekeys[0] = 0;
+    exclusive[0] = tree.exclusive[0];
+    total_nodes = 1;
+
+    for (size_t i = 1; i < count; i++)
+    {
+        const uint32 parent = mapped[tree.parents[i]];
+        const uint32 key = keys[i];
+        uint32 node = 0;
+        size_t slot = 0;
+        if (key == 0)
+            node = 0;  // don't know what it is; it gets a node to itself.
+        else if ((parent != 0) && (nodekeys[parent] == key))
+            node = parent;  // still in the same place as its caller.
+        else
+        {
+            slot = callstack_hash(parent, (dumpptr) key) & mask;
+            while ((node = table[slot]) != 0)
+            {
+                if ((parents[node] == parent) && (nodekeys[node] == key))
+                    break;
+                slot = (slot + 1) & mask;
+            } // while
+        } // else
+
+        if (node == 0)  // a new one.
+        {
+            node = (uint32) total_nodes++;
+            parents[node] = parent;
+            callstacks[node] = tree.callstacks[i];
+            nodekeys[node] = key;
+            if (key != 0)
+                table[slot] = node;
+        } // if
+
+        mapped[i] = node;
+        exclusive[node].add(tree.exclusive[i]);
+    } // for
+
+    delete[] mapped;
+    delete[] nodekeys;
+    delete[] table;
+    finish();
+} // CallingContextTree::collapse
+
 
 // end of dumpfile.cpp ...
 
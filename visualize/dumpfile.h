@@ -44,46 +44,139 @@ class ProgressNotifyDummy : public ProgressNotify
  *  ID that represents that callstack. The original callstack data can be
  *  recovered via this ID. If a callstack has already been seen by the
  *  CallstackManager, it'll feed back the original ID.
+ *
+ * Ids are small integers: zero is the empty callstack, and the rest are
+ *  handed out in order, so an array with getUniqueCallstackFrames() + 1
+ *  elements has room for something about every callstack. Each frame
+ *  seen is one node, holding the frame and its caller's id, and a
+ *  callstack's id is the id of its innermost frame's node. Nodes are found
+ *  by hashing (caller id, frame), which is about all intern() does.
  */
+class CallstackFrames;
 class CallstackManager
 {
 public:
-    typedef void *callstackid;  // Consider this opaque.
+    typedef uint32 callstackid;
+
+    CallstackManager();
+    ~CallstackManager();
+    callstackid add(dumpptr *ptrs, size_t framecount)
+        { count(framecount); return(intern(ptrs, framecount)); }
+
+    /*
+     * add() in two halves, for callstacks that get counted when they're
+     *  read but looked up later (see DumpFileOptions::lazy_callstacks).
+     *  count() adds to getTotalCallstackFrames(); intern() finds or makes
+     *  the id, and can be called for the same callstack as often as you
+     *  like.
+     */
+    void count(size_t framecount) { total_frames += framecount; }
+    callstackid intern(dumpptr *ptrs, size_t framecount);
 
-    CallstackManager() : total_frames(0), unique_frames(0) {}
-    callstackid add(dumpptr *ptrs, size_t framecount);
+    /*
+     * Fold every callstack in (other) into this one. Afterwards, ids that
+     *  (other) handed out can be turned into ids for this manager with
+     *  other.merged_id(), and (other) is good for nothing else but that
+     *  and being deleted.
+     */
+    void merge(CallstackManager &other);
+    callstackid merged_id(callstackid id) const { return(merged_ids[id]); }
     void done_adding(ProgressNotify &pn);
-    size_t framecount(callstackid id) const;
+    size_t framecount(callstackid id) const { return(depths[id]); }
     void get(callstackid id, dumpptr *ptrs) const;
+    inline CallstackFrames walk(callstackid id) const;
     size_t getTotalCallstackFrames() const { return(total_frames); }
-    size_t getUniqueCallstackFrames() const { return(unique_frames); }
+    size_t getUniqueCallstackFrames() const { return(total_nodes - 1); }
+
+    // The innermost frame of a callstack, and the callstack that called it.
+    dumpptr leaf(callstackid id) const { return(frames[id]); }
+    callstackid caller(callstackid id) const { return(parents[id]); }
 
-protected:
     /*
-     * This is what the CallstackManager::callstackid type really is; an
-     *  opaque pointer to a CallstackNode. The guts aren't accessible to
-     *  the application, though: they get the pertinent data via
-     *  CallstackManager.
+     * The same, for lots of callstacks at once: (out) gets something for
+     *  each of the (count) ids. "Depth" counts out from the innermost
+     *  frame, so depth zero is leaf(), depth one is the immediate caller,
+     *  and so on. ancestors() gives the callstack at that depth, and
+     *  frames_at() its frame; callstacks that aren't that deep get the
+     *  root and a zero frame, respectively. These are much faster than
+     *  walking each id when there are more ids than unique frames, which
+     *  is the usual case for a whole dumpfile's worth of ops.
      */
-    class CallstackNode
-    {
-    public:
-        CallstackNode(dumpptr _ptr=0, CallstackNode *p=NULL, size_t d=0)
-            : ptr(_ptr), depth(d), parent(p), children(NULL), sibling(NULL) {}
-        ~CallstackNode();
-        dumpptr ptr;
-        size_t depth;
-        CallstackNode *parent;
-        CallstackNode *children;
-        CallstackNode *sibling;
-    }; // CallstackNode
+    void leaves(const callstackid *ids, size_t count, dumpptr *out) const;
+    void ancestors(const callstackid *ids, size_t count, size_t depth,
+                   callstackid *out) const;
+    void frames_at(const callstackid *ids, size_t count, size_t depth,
+                   dumpptr *out) const;
+
+    /*
+     * For DumpFile's cache. flatten() copies out every node's caller and
+     *  frame, in id order; the root comes first, and is its own caller.
+     *  Both arrays need room for getUniqueCallstackFrames() + 1 entries.
+     *  unflatten() builds the same ids back up in an empty manager.
+     */
+    void flatten(uint32 *parents, dumpptr *frames) const;
+    void unflatten(const uint32 *parents, const dumpptr *frames,
+                   size_t count, size_t totalframes);
 
-    CallstackNode root;
+protected:
+    uint32 *parents;  /* each node's caller; the root is its own. */
+    dumpptr *frames;  /* each node's frame. */
+    uint32 *depths;  /* how many frames are in each node's callstack. */
+    size_t total_nodes;  /* including the root. */
+    size_t nodes_alloc;
+    uint32 *table;  /* node ids, hashed by (caller, frame); zero is empty. */
+    size_t table_size;  /* always a power of two. */
+    uint32 *merged_ids;  /* set by merge(), on the manager merged from. */
     size_t total_frames;
-    size_t unique_frames;
+
+private:
+    inline callstackid child(callstackid parent, dumpptr frame);
+    inline callstackid ancestor(callstackid id, size_t depth) const;
+    uint32 *ancestor_table(size_t count, size_t depth) const;
+    callstackid add_node(callstackid parent, dumpptr frame);
+    void grow_table();
+    CallstackManager(const CallstackManager &);  // no copying.
+    CallstackManager &operator =(const CallstackManager &);
 }; // CallstackManager
 
 
+/*
+ * Walks a callstack's frames from the innermost out, without copying
+ *  them anywhere. Get one from CallstackManager::walk(); it's good as long
+ *  as the manager is, and nothing gets added to it.
+ *
+ *   for (CallstackFrames f(cm.walk(id)); !f.done(); f.next())
+ *       printf("#%d: %p\n", (int) f.frames_left(), (void *) f.frame());
+ */
+class CallstackFrames
+{
+public:
+    bool done() const { return(remaining == 0); }
+    dumpptr frame() const { return(frames[id]); }
+    CallstackManager::callstackid callstack() const { return(id); }
+    // frames from here out to the outermost, counting this one.
+    size_t frames_left() const { return(remaining); }
+    void next() { id = parents[id]; remaining--; }
+
+private:
+    friend class CallstackManager;
+    CallstackFrames(const uint32 *_parents, const dumpptr *_frames,
+                    CallstackManager::callstackid _id, size_t _remaining)
+        : parents(_parents), frames(_frames), id(_id),
+          remaining(_remaining) {}
+    const uint32 *parents;
+    const dumpptr *frames;
+    CallstackManager::callstackid id;
+    size_t remaining;
+}; // CallstackFrames
+
+
+inline CallstackFrames CallstackManager::walk(callstackid id) const
+{
+    return(CallstackFrames(parents, frames, id, depths[id]));
+} // CallstackManager::walk
+
+
 typedef enum
 {
     DUMPFILE_OP_NOOP = 0,   /* never shows up in DumpFileOperations */
@@ -98,47 +191,203 @@ typedef enum
 
 class DumpFile;
 
+/*
+ * A run of decoded operations, stored column by column: the Nth operation
+ *  is optypes[N], timestamps[N], etc. The parser builds these up before
+ *  packing them into a DumpFileOpStore, and DumpFile::getOperationBlock()
+ *  hands them back out so analysis code can scan just the fields it cares
+ *  about.
+ *
+ * The columns are:
+ *  optypes: a dumpfile_operation_t for each op.
+ *  timestamps: when the op happened.
+ *  ptrs: the block passed to realloc() or free(). Zero for malloc().
+ *  sizes: the size passed to malloc() or realloc(). Zero for free().
+ *  retvals: the block returned by malloc() or realloc(). Zero for free().
+ *  callstacks: where the op was called from; a CallstackManager id, unless
+ *   callstacks are loading lazily, when it might be a placeholder for one
+ *   (see DumpFile::resolveCallstack()).
+ *
+ * As far as your application is concerned, this entire class is READ-ONLY!
+ */
+class DumpFileColumns
+{
+public:
+    DumpFileColumns();
+    ~DumpFileColumns();
+    inline size_t append(uint8 optype, tick_t timestamp, dumpptr ptr,
+                         dumpptr size, dumpptr retval);
+    void append(const DumpFileColumns &other);
+    void reserve(size_t count);
+    void shrink();
+    void clear() { total = 0; }
+    void release();
+
+    size_t total;
+    uint8 *optypes;
+    tick_t *timestamps;
+    dumpptr *ptrs;
+    dumpptr *sizes;
+    dumpptr *retvals;
+    uint64 *callstacks;
+
+private:
+    size_t capacity;
+    void resize(size_t count);
+    DumpFileColumns(const DumpFileColumns &);  // no copying.
+    DumpFileColumns &operator =(const DumpFileColumns &);
+};
+
+
+inline size_t DumpFileColumns::append(uint8 optype, tick_t timestamp,
+                                      dumpptr ptr, dumpptr size,
+                                      dumpptr retval)
+{
+    if (total == capacity)
+        reserve(total + 1);
+
+    const size_t i = total++;
+    optypes[i] = optype;
+    timestamps[i] = timestamp;
+    ptrs[i] = ptr;
+    sizes[i] = size;
+    retvals[i] = retval;
+    callstacks[i] = 0;
+    return(i);
+} // DumpFileColumns::append
+
+
+/*
+ * This is where a DumpFile keeps its operations. They're packed in blocks
+ *  of DUMPFILE_BLOCK_SIZE: each block stores its timestamps and addresses
+ *  as deltas from the previous op, everything as variable-length integers,
+ *  and the op types two bits apiece. Ops from one program tend to look a
+ *  lot like the ops right before them, so this takes a small fraction of
+ *  the space of the plain columns.
+ *
+ * Getting at an operation means unpacking its whole block, which is cheap,
+ *  and the last few blocks unpacked are kept around, so walking through ops
+ *  in order costs about the same as walking an array. This makes reads NOT
+ *  THREAD SAFE, though.
+ *
+ * If you call spill_to() before appending anything, packed blocks are
+ *  written to a scratch file instead of being kept in memory, and read back
+ *  as needed; then the only ops in memory are the unpacked blocks in the
+ *  cache, and spill_to() says how many of those to keep.
+ */
+#define DUMPFILE_BLOCK_SIZE 4096
+
+class DumpFileScratch;
+
+class DumpFileOpStore
+{
+public:
+    DumpFileOpStore();
+    ~DumpFileOpStore();
+    void spill_to(DumpFileScratch *scratch, size_t cache_bytes);
+    void append(const DumpFileColumns &cols);
+    void finish();
+    void release();
+    uint64 getTotal() const { return(total); }
+    uint64 getTotalBlocks() const { return(total_blocks); }
+    const DumpFileColumns &getBlock(uint64 block) const;
+    void copyBlock(uint64 block, DumpFileColumns &cols) const;
+    uint64 getPackedSize() const { return(packed_bytes); }
+
+    /*
+     * For DumpFile's cache. save() writes the packed blocks out after
+     *  finish(); load() takes them back from (data), which has to stay put
+     *  until the store is released, since blocks are unpacked straight out
+     *  of it. load() checks every block first (callstack ids have to be
+     *  below (total_callstacks)), and throws without changing anything if
+     *  they don't add up.
+     */
+    void save(FILE *out) const throw (const char *);
+    void load(const uint8 *data, size_t len, uint64 total_callstacks)
+        throw (const char *);
+
+private:
+    class PackedBlock
+    {
+    public:
+        uint64 offset;  /* into (packed), or into the scratch file. */
+        size_t length;
+        uint32 crc;  /* for the cache, so it can tell if it's damaged. */
+    };
+
+    uint64 total;
+    DumpFileColumns pending;  /* ops that don't fill a block yet. */
+    DumpFileScratch *scratch;  /* NULL if everything stays in memory. */
+    uint8 *packed;  /* all the blocks, or staging space if spilling. */
+    bool borrowed;  /* (packed) came from load(), and isn't ours to free. */
+    size_t packed_used;
+    size_t packed_alloc;
+    uint64 packed_bytes;
+    PackedBlock *blocks;
+    uint64 total_blocks;
+    uint64 blocks_alloc;
+
+    // an LRU cache of unpacked blocks.
+    mutable DumpFileColumns *cache;
+    mutable uint64 *cache_block;  /* which block each slot holds. */
+    mutable uint64 *cache_used;  /* when each slot was last used. */
+    size_t cache_slots;
+    mutable size_t cache_last;  /* slot we hit last time; a quick check. */
+    mutable uint64 cache_clock;
+    mutable uint8 *readbuf;  /* a spilled block, read back from disk. */
+    mutable size_t readbuf_len;
+
+    void pack_block(const DumpFileColumns &cols, size_t first, size_t count);
+    static void unpack_block(const uint8 *ptr, DumpFileColumns &cols);
+    static bool check_block(const uint8 *ptr, size_t len,
+                            uint64 total_callstacks, uint64 &count);
+    const uint8 *read_spilled(const PackedBlock &info) const;
+    void free_cache();
+    DumpFileOpStore(const DumpFileOpStore &);  // no copying.
+    DumpFileOpStore &operator =(const DumpFileOpStore &);
+};
+
+
 /*
  * This class represents one operation (malloc, realloc, free, etc) in
  *  the dumpfile. Basically the end result of parsing a dumpfile is
  *  several views of a collection of operations.
  *
- * As far as your application is concerned, this entire class is READ-ONLY!
+ * This is a copy of the operation's fields, so it's cheap to pass around by
+ *  value and stays valid as long as you like. If you're going to look at a
+ *  lot of operations, scanning whole blocks from
+ *  DumpFile::getOperationBlock() is faster.
+ *
+ * If the DumpFile is loading callstacks lazily, getCallstackId() is where
+ *  the callstack gets looked up, so don't call it if you don't need it.
  */
+class DumpFile;
+
 class DumpFileOperation
 {
 public:
+    DumpFileOperation(const DumpFileColumns &c, size_t i, uint64 index,
+                      const DumpFile *df=NULL)
+        : idx(index), optype((dumpfile_operation_t) c.optypes[i]),
+          timestamp(c.timestamps[i]), ptr(c.ptrs[i]), size(c.sizes[i]),
+          retval(c.retvals[i]), callstack(c.callstacks[i]), owner(df) {}
+    uint64 getIndex() const { return idx; }
     dumpfile_operation_t getOperationType() const { return optype; }
     tick_t getTimestamp() const { return timestamp; }
-    CallstackManager::callstackid getCallstackId() const { return callstack; }
+    inline CallstackManager::callstackid getCallstackId() const;
+    dumpptr getPtr() const { return ptr; }
+    dumpptr getSize() const { return size; }
+    dumpptr getRetval() const { return retval; }
 
-    union  /* read only! */
-    {
-        struct
-        {
-            dumpptr size;
-            dumpptr retval;
-        } op_malloc;
-
-        struct
-        {
-            dumpptr ptr;
-            dumpptr size;
-            dumpptr retval;
-        } op_realloc;
-
-        struct
-        {
-            dumpptr ptr;
-        } op_free;
-    };
-
-protected:
-    friend class DumpFile;
-    DumpFileOperation *next;
+private:
+    uint64 idx;
     dumpfile_operation_t optype;
     tick_t timestamp;
-    CallstackManager::callstackid callstack;
+    dumpptr ptr;
+    dumpptr size;
+    dumpptr retval;
+    uint64 callstack;
+    const DumpFile *owner;  /* to look up lazy callstacks. */
 };
 
 
@@ -156,124 +405,443 @@ public:
  * How this works:
  *  We build up "snapshots" that represent the fragmentation map every X
  *  memory operations. We use these sort of like MPEG "I-Frames"...a
- *  snapshot is a complete representation of the memory usage at that moment,
- *  then you can iterate through the memory operations from there to find
- *  a moment's accurate representation fairly efficiently.
+ *  keyframe snapshot is a complete representation of the memory usage at
+ *  that moment, and the snapshots between keyframes only hold what changed
+ *  since the one before them, like P-Frames. From the closest snapshot,
+ *  you can iterate through the memory operations to find a moment's
+ *  accurate representation fairly efficiently.
  *
- * Snapshots move back and forth as needed; if you request a snapshot, the
- *  FragMapManager will find the closest snapsnot and update it to the
- *  timestamp requested. Over time, the snapshots will be in variable
- *  positions instead of every X operations, but this implementation detail
- *  is hidden from the application.
+ * Snapshots never change once they're made; if you request a moment, the
+ *  FragMapManager will rebuild the closest snapshot before it and update a
+ *  copy of that to the operation requested.
  *
  * The DumpFile class maintains an instance of FragMapManager. The application
- *  talks to this FragMapManager and requests a snapshot; this is given to the
- *  app as a READ ONLY linked list of FragMapNode objects, ordered by
- *  address of allocated block, lowest to highest. This list is not to be
- *  deallocated or modified by the app, and is guaranteed to be valid until
- *  a new snapshot is requested.
+ *  talks to this FragMapManager and requests a fragmap; this is given to the
+ *  app as a READ ONLY FragMapSpan, ordered by address of allocated block,
+ *  lowest to highest. This is not to be deallocated or modified by the app,
+ *  and is guaranteed to be valid until a new fragmap is requested.
  */
 
 
 /*
- * These nodes are actually used in two ways; internally, when updating a
- *  snapshot, they represent a B-tree, and "left" and "right" are pointers
- *  to children. When these are used in snapshots for the application, the
- *  tree is flattened into a doubly linked list, in which case "left" and
- *  "right" are used to iterate the linear data set.
+ * Every live block at some moment, as two columns sorted by address.
  */
-class FragMapNode
+class FragMapSpan
 {
 public:
-    FragMapNode(dumpptr p=0x00000000, size_t s=0) :
-        ptr(p), size(s), left(NULL), right(NULL) {}
-    // !!! FIXME: ~FragMapNode();
-    dumpptr ptr;
-    size_t size;
-    FragMapNode *left;
-    FragMapNode *right;
+    FragMapSpan() : ptrs(NULL), sizes(NULL), total(0) {}
+    const dumpptr *ptrs;
+    const size_t *sizes;
+    size_t total;
 };
 
+
 /*
- * Allocates nodes, and pools them for reuse. NOT THREAD SAFE.
+ * Growable, sorted ptr/size columns, for building snapshots and spans.
+ *  reserve() keeps what's there; clear() keeps the memory around.
  */
-class FragMapNodePool
+class FragMapColumns
 {
 public:
-    static inline FragMapNode *get(dumpptr ptr, size_t size);
-    static inline void put(FragMapNode *node);
-    static void putlist(FragMapNode *node);
-    static void flush();
-    static FragMapNode *freepool;
+    FragMapColumns() : ptrs(NULL), sizes(NULL), total(0), alloc(0) {}
+    ~FragMapColumns() { release(); }
+    void reserve(size_t count);
+    void clear() { total = 0; }
+    void release();
+    void swap(FragMapColumns &other);
+    FragMapSpan span() const;
+    dumpptr *ptrs;
+    size_t *sizes;
+    size_t total;
+    size_t alloc;
+
+private:
+    FragMapColumns(const FragMapColumns &);  // no copying.
+    FragMapColumns &operator =(const FragMapColumns &);
 };
 
+
 /*
  * This is used internally by the FragMapManager to keep track of created
- *  snapshots.
+ *  snapshots. A keyframe has every live block. Any other snapshot only has
+ *  what changed since the snapshot before it: the pointers of the blocks
+ *  that went away, then the blocks that showed up (a block that changed
+ *  size is both). Each list is sorted by address. A keyframe is just a
+ *  snapshot with nothing removed that doesn't need the ones before it.
+ *
+ * Each snapshot also has what it takes to undo the operations between the
+ *  snapshot before it and this one, so the working set can be walked
+ *  backwards: (undo) has, for each operation, the size of the block it
+ *  freed, shrank, grew or moved, as it was before that.
+ *
+ * It's all in one allocation, so it can be written out and read back in
+ *  one piece: (ptrs) is removed then added pointers, (sizes) goes with
+ *  the added ones, and (undo) comes last.
  */
 class FragMapSnapshot
 {
 public:
-    FragMapSnapshot(uint32 nodecount, size_t opidx);
+    FragMapSnapshot(uint64 opidx, bool key, size_t blocks,
+                    size_t removed, size_t added, size_t ops);
     ~FragMapSnapshot();
-    FragMapNode **nodes;
-    size_t total_nodes;
-    size_t operation_index;
+    void allocate();
+    void free_data();
+    size_t data_bytes() const;
+    uint64 *data;  /* NULL if it only lives in the scratch file. */
+    dumpptr *ptrs;
+    size_t *sizes;
+    size_t *undo;
+    uint64 operation_index;
+    bool keyframe;
+    size_t total_blocks;  /* live blocks, once this snapshot is applied. */
+    size_t total_removed;
+    size_t total_added;
+    size_t total_undo;  /* operations since the last snapshot. */
+    bool spilled;  /* true if it has a copy in the scratch file. */
+    uint64 spill_offset;
+    uint64 last_used;
+};
+
+
+/*
+ * A fragmap that get_fragmap() already built, kept in case the app asks
+ *  for it again, or for somewhere close by. Unlike snapshots, these are
+ *  just a cache: they can be thrown away at any time.
+ */
+class FragMapView
+{
+public:
+    FragMapView() : operation_index(0), last_used(0) {}
+    uint64 operation_index;  /* same meaning as a snapshot's. */
+    uint64 last_used;
+    FragMapColumns cols;
+};
+
+
+/*
+ * The FragMapManager's working set: every live block, in an open-addressed
+ *  hashtable keyed on the whole pointer, with each block's size right there
+ *  in its slot. It's a Robin Hood table, so nothing ends up far from where
+ *  it hashes to, even with millions of blocks. NULL is never a live block,
+ *  so a NULL slot is an empty one.
+ */
+class FragMapHashtable
+{
+public:
+    FragMapHashtable();
+    ~FragMapHashtable();
+
+    // Replaces (ptr)'s size if it's already there, and returns true.
+    bool insert(dumpptr ptr, size_t size, size_t *replaced = NULL);
+    // These return false if (ptr) wasn't there. If it was, and (prior)
+    //  isn't NULL, it gets the size (ptr) had.
+    bool remove(dumpptr ptr, size_t *prior = NULL);
+    bool resize_block(dumpptr ptr, size_t size, size_t *prior = NULL);
+    // Makes room for (count) blocks without growing again.
+    void reserve(size_t count);
+    void clear();
+    void swap(FragMapHashtable &other);
+    // Where (ptr) would be, if nothing else were in the way.
+    inline size_t home(dumpptr ptr) const;
+
+    class Slot
+    {
+    public:
+        dumpptr ptr;
+        size_t size;
+    };
+
+    Slot *slots;
+    size_t capacity;  /* always a power of two. */
+    size_t total;
+
+private:
+    inline size_t find(dumpptr ptr) const;
+    inline void place(dumpptr ptr, size_t size, size_t i, size_t dist);
+    void grow(size_t newcapacity);
+
+    FragMapHashtable(const FragMapHashtable &);  // no copying.
+    FragMapHashtable &operator =(const FragMapHashtable &);
+};
+
+
+/*
+ * The FragMapManager's working set again, in address order: a B+tree with
+ *  wide nodes, so a snapshot is just a walk along the leaves, and nothing
+ *  ever needs sorting. Branches know how high up they are from the tree's
+ *  height, so neither kind of node needs to say what it is.
+ */
+#define FRAGMAPTREE_ORDER 64
+
+class FragMapTreeLeaf
+{
+public:
+    uint32 total;
+    dumpptr ptrs[FRAGMAPTREE_ORDER];
+    size_t sizes[FRAGMAPTREE_ORDER];
+    FragMapTreeLeaf *next;  /* the leaf with the next higher addresses. */
+};
+
+class FragMapTreeBranch
+{
+public:
+    uint32 total;  /* children, not keys. */
+    dumpptr keys[FRAGMAPTREE_ORDER];  /* lowest address under each child. */
+    void *children[FRAGMAPTREE_ORDER];
+};
+
+class FragMapTree
+{
+public:
+    FragMapTree();
+    ~FragMapTree();
+
+    // Replaces (ptr)'s size if it's already there.
+    void insert(dumpptr ptr, size_t size);
+    // These return false if (ptr) wasn't there.
+    bool remove(dumpptr ptr);
+    bool resize_block(dumpptr ptr, size_t size);
+    // Replaces everything with (cols), which has to be sorted.
+    void build(const FragMapColumns &cols);
+    // Every block, in order.
+    void flatten(FragMapColumns &cols) const;
+    void clear();
+    void swap(FragMapTree &other);
+    size_t total;
+
+private:
+    #define FRAGMAPTREE_MAX_HEIGHT 16
+    FragMapTreeLeaf *descend(dumpptr ptr, FragMapTreeBranch **path,
+                             uint32 *slots) const;
+    void add_child(FragMapTreeBranch **path, uint32 *slots,
+                   dumpptr key, void *child);
+    void remove_child(FragMapTreeBranch **path, uint32 *slots,
+                      uint32 level, uint32 slot);
+    void free_node(void *node, uint32 levels);
+
+    void *root;
+    uint32 height;  /* how many levels of branches are over the leaves. */
+    FragMapTreeLeaf *first;  /* the leaf with the lowest addresses. */
+
+    FragMapTree(const FragMapTree &);  // no copying.
+    FragMapTree &operator =(const FragMapTree &);
 };
 
 
 /*
  * The FragMapManager keeps an ongoing working set of the memory space,
  *  stored as a hashtable...this lets us insert and remove allocated blocks
- *  into the FragMap with really good efficiency. We flatten and sort the
- *  hashtable when creating snapshots.
+ *  into the FragMap with really good efficiency. A FragMapTree keeps the
+ *  same blocks in address order, so snapshots come straight out of it.
+ *  The last snapshot's blocks stay around so the next one can be stored as
+ *  just what changed.
  *
- * The app requests snapshots from the FragMapManager, which, to the app,
- *  is just a linear linked list, sorted by the allocations' pointers.
+ * The app requests fragmaps from the FragMapManager, which, to the app,
+ *  are just a span of blocks, sorted by the allocations' pointers.
+ *
+ * After spill_to(), snapshots are written out to a scratch file and their
+ *  data freed once they add up to more than the given number of bytes,
+ *  least recently used first. They're read back in when needed.
+ *
+ * Fragmaps that get_fragmap() hands out are cached, too, up to
+ *  FRAGMAP_VIEW_CACHE_BYTES (or the spill_to() budget, if that's smaller),
+ *  and the working set is left where the last one was. A request is
+ *  served from whichever of those, or of the snapshots, is the fewest
+ *  operations away from it, so scrubbing only walks what's new. Snapshots
+ *  know how to undo the operations before them, so that's true backwards,
+ *  too.
  */
 class FragMapManager
 {
 public:
     FragMapManager();
     ~FragMapManager();
-    void add_malloc(DumpFileOperation *op);
-    void add_realloc(DumpFileOperation *op);
-    void add_free(DumpFileOperation *op);
+    void add_malloc(const DumpFileOperation &op);
+    void add_realloc(const DumpFileOperation &op);
+    void add_free(const DumpFileOperation &op);
     void done_adding(ProgressNotify &pn);
-    FragMapNode **get_fragmap(DumpFile *df, size_t operation_index, size_t &nodecount);
+    void pause_adding();
+    void resume_adding();
+
+    // For loading a window out of the middle of a capture: what was
+    //  already allocated when the window starts. Seeding doesn't count as
+    //  an operation; call done_seeding() before adding the window's ops.
+    void seed_block(dumpptr ptr, size_t size);
+    void seed_operation(const DumpFileOperation &op);
+    void done_seeding();
+
+    void spill_to(DumpFileScratch *scratch, size_t max_bytes);
+
+    // For DumpFile's cache: every snapshot, after done_adding().
+    void save_snapshots(FILE *out) throw (const char *);
+    void load_snapshots(const uint8 *data, size_t len, uint64 total_ops)
+        throw (const char *);
+
+    // Every block that's live right after operation (operation_index).
+    //  The span is good until the next call.
+    FragMapSpan get_fragmap(DumpFile *df, uint64 operation_index);
 
 protected:
     FragMapSnapshot **snapshots;
     uint32 total_snapshots;
-    void insert_block(dumpptr ptr, size_t s);
-    void remove_block(dumpptr ptr);
-    FragMapSnapshot *create_snapshot();
-    void add_snapshot();
+    size_t insert_block(dumpptr ptr, size_t s);
+    size_t remove_block(dumpptr ptr);
+    FragMapSnapshot *create_snapshot(bool rebase);
+    void add_snapshot(bool rebase=true);
     inline void empty_hashtable();
+    void flatten_fragmap(FragMapColumns &cols);
+    void materialize(uint32 idx, FragMapColumns &cols);
+    void page_in(FragMapSnapshot *snapshot);
+    void spill(FragMapSnapshot *snapshot);
+    void trim_snapshots(FragMapSnapshot *keep);
+    uint32 find_snapshot(uint64 opidx) const;
+    FragMapView *add_view(uint64 opidx);
+    void trim_views(FragMapView *keep);
+    void free_views();
 
     // These deal with the hashtable directly with no check for bad behaviour.
-    inline void hash_snapshot(FragMapSnapshot *snapshot);
-    inline void hash_malloc(DumpFileOperation *op);
-    inline void hash_realloc(DumpFileOperation *op);
-    inline void hash_free(DumpFileOperation *op);
-    void walk_fragmap(DumpFile *df, size_t startop, size_t endop);
+    //  The hash_* ones return what it takes to undo the operation.
+    inline void hash_columns(const FragMapColumns &cols);
+    inline size_t hash_malloc(const DumpFileOperation &op);
+    inline size_t hash_realloc(const DumpFileOperation &op);
+    inline size_t hash_free(const DumpFileOperation &op);
+    inline bool unhash_operation(const DumpFileOperation &op, size_t undo);
+    void walk_fragmap(DumpFile *df, uint64 startop, uint64 endop);
+    bool unwalk_fragmap(DumpFile *df, uint64 startop, uint64 endop);
 
 private:
-    FragMapNode **fragmap;
-    size_t total_nodes;
-    size_t current_operation;
+    FragMapHashtable fragmap;
+    FragMapTree addresses;  /* (fragmap), in order. */
+    uint64 current_operation;
     size_t snapshot_operations;
-
-    static void bubble_sort(FragMapNode **a, uint32 lo, uint32 hi);
-    static void quick_sort(FragMapNode **a, uint32 lo, uint32 hi);
-    static void sort(FragMapNode **entries, uint32 max);
+    DumpFileScratch *scratch;
+    size_t max_resident_bytes;
+    size_t resident_bytes;
+    uint64 snapshot_clock;
+    bool is_paused;
+    FragMapHashtable paused;  /* the working set, while get_fragmap() runs. */
+    FragMapTree paused_addresses;
+    FragMapSnapshot *pause_snapshot;
+    FragMapColumns base;  /* the last snapshot's blocks. */
+    FragMapColumns flat;  /* scratch space for the hashtable, flattened. */
+    FragMapColumns merged;  /* scratch space for materialize(). */
+    uint32 since_keyframe;  /* snapshots since the last keyframe. */
+    size_t chain_blocks;  /* blocks in all of those snapshots. */
+    size_t *pending_undo;  /* for the next snapshot's (undo). */
+    FragMapView **views;
+    uint32 total_views;
+    size_t max_view_bytes;
+    uint64 working_operation;  /* where get_fragmap() left the working set. */
 
     #define FRAGMAP_SNAPSHOT_THRESHOLD 5000
+    #define FRAGMAP_KEYFRAME_INTERVAL 16
+    #define FRAGMAP_VIEW_CACHE_BYTES (64 * 1024 * 1024)
+    #define FRAGMAP_MAX_VIEWS 64
+    #define FRAGMAP_NO_OPERATION ((uint64) -1)
+    #define FRAGMAP_UNDO_NOTHING ((size_t) -1)  /* no block was there. */
+    #define FRAGMAP_UNDO_UNKNOWN ((size_t) -2)  /* can't be undone. */
     inline void increment_operations();
-    static inline uint16 calculate_hash(dumpptr val);
 };
 
 
+/*
+ * Knobs for how a DumpFile gets loaded. The defaults are sane; you only
+ *  need one of these if you want to override something.
+ *
+ *  decode_threads: number of threads to decode operations with. Big dumps
+ *   are split into chunks that are decoded side by side and then stitched
+ *   back together in order. Zero means "one per CPU", one means "don't
+ *   start any threads at all".
+ *
+ *  memory_budget: roughly how many bytes of operations and fragmap
+ *   snapshots to keep in memory. Past that, they're written to a scratch
+ *   file and read back when needed, so you can look at dumps that are
+ *   bigger than RAM; cold data just gets slower. Zero means "keep it all
+ *   in memory". Callstacks and the fragmap's working set aren't counted.
+ *
+ *  scratch_dir: where to put the scratch file. NULL means $TMPDIR, or /tmp
+ *   if that isn't set. The file is deleted as soon as it's created, so it
+ *   doesn't outlive the DumpFile, even if we crash.
+ *
+ *  lazy_callstacks: don't look up callstacks while loading; just remember
+ *   where each one is in the file, and look it up the first time somebody
+ *   asks for it (or all at once, with DumpFile::internCallstacks()).
+ *   Loading is a lot faster if you only want fragmentation or timeline
+ *   numbers, but the dumpfile stays mapped until the DumpFile goes away,
+ *   and getUniqueCallstackFrames() only counts what's been looked up.
+ *
+ *  follow: the dumpfile is still being written. Parse what's there now,
+ *   then keep picking up new operations every time DumpFile::poll() is
+ *   called, until the capture ends or DumpFile::stopFollowing(). Only for
+ *   plain dumpfiles, not segmented captures or block containers. If the
+ *   daemon hasn't even written the whole handshake yet, that's waited for
+ *   too: until it shows up, there are no ops, and getId() and
+ *   getBinaryFilename() are NULL.
+ *
+ *  cache: after loading a whole dumpfile, save what we worked out next to
+ *   it (as "dumpfile.mmcache"), and next time, load that instead if the
+ *   dumpfile hasn't changed. This skips decoding, callstack lookups and
+ *   building the fragmap, which is most of the time a load takes. If the
+ *   cache can't be written, we just carry on without it. Caches aren't
+ *   used for windows or following, and aren't written with lazy
+ *   callstacks, but one that's already there is used in that case, too.
+ */
+class DumpFileOptions
+{
+public:
+    DumpFileOptions()
+        : decode_threads(0), memory_budget(0), scratch_dir(NULL),
+          lazy_callstacks(false), follow(false), cache(true) {}
+    int decode_threads;
+    size_t memory_budget;
+    const char *scratch_dir;
+    bool lazy_callstacks;
+    bool follow;
+    bool cache;
+};
+
+
+/* Why DumpFile stopped decoding a stretch of operations. Internal. */
+typedef enum
+{
+    DUMPFILE_CHUNK_END,        /* decoded up to the end of the chunk. */
+    DUMPFILE_CHUNK_GOODBYE,    /* found the end of the capture. */
+    DUMPFILE_CHUNK_TRUNCATED,  /* ran out of data mid-record. */
+    DUMPFILE_CHUNK_BOGUS       /* hit garbage. */
+} dumpfile_chunk_status_t;
+
+/*
+ * Which part of a capture to load. By default, everything. If (by_ticks)
+ *  is set, (first) and (last) are timestamps, otherwise they're operation
+ *  indexes. Both ends are inclusive.
+ */
+class DumpFileWindow
+{
+public:
+    DumpFileWindow() : by_ticks(false), first(0), last((uint64) -1) {}
+    bool by_ticks;
+    uint64 first;
+    uint64 last;
+};
+
+
+/*
+ * Gets told when DumpFile::poll() picks up new operations from a dumpfile
+ *  that's still growing (see DumpFileOptions::follow). The new ops are
+ *  (count) ops starting at (first), and the callstacks and fragmap already
+ *  know about them by the time you hear about it.
+ */
+class DumpFileListener
+{
+public:
+    virtual void operationsAdded(DumpFile &df, uint64 first, uint64 count) = 0;
+};
+
+class DumpFileChunk;
+class DumpFilePipeline;
+class DumpFileMapping;
+class DumpFileBlockInfo;
+
 /*
  * This is the application's interface to all the data in a dumpfile.
  *
@@ -284,8 +852,58 @@ private:
 class DumpFile
 {
 public:
-    DumpFile(const char *fname, ProgressNotify &pn) throw (const char *);
+    DumpFile(const char *fname, ProgressNotify &pn,
+             const DumpFileOptions &opts=DumpFileOptions())
+        throw (const char *);
     DumpFile(const char *fname) throw (const char *);
+
+    /*
+     * Load a range of time out of a segmented capture written by the
+     *  monitor daemon (see --dumpdir in malloc_monitor_daemon.pl). "idxfname"
+     *  is the capture's .index file; only segments that overlap the range
+     *  are read, and only operations with timestamps between "starttick" and
+     *  "endtick" (inclusive) are kept. Segments that the daemon has deleted
+     *  to stay under its disk quota are silently skipped.
+     *
+     * Blocks that were allocated before the range and freed during it don't
+     *  show up in the fragmap at all, so the fragmap only reflects activity
+     *  inside the window.
+     */
+    DumpFile(const char *idxfname, tick_t starttick, tick_t endtick,
+             ProgressNotify &pn,
+             const DumpFileOptions &opts=DumpFileOptions())
+        throw (const char *);
+
+    /*
+     * Load a window out of a capture. This is meant for block containers
+     *  (see convertToBlocks()), where only the blocks that overlap the
+     *  window get read, plus the ones between it and the checkpoint before
+     *  it, which just tell us what was already allocated when the window
+     *  starts. Unlike with the .index constructor, those allocations show
+     *  up in the fragmap. A block that fails its checksum is skipped
+     *  instead of ending the parse; see getSkippedBlocks().
+     *
+     * The first op in the window is op zero here; getWindowStart() says
+     *  where it was in the whole capture. Plain dumpfiles work too, if the
+     *  window is in ticks, but they're parsed from the start, and, like
+     *  with the .index constructor, only the window's own ops are seen.
+     */
+    DumpFile(const char *fname, const DumpFileWindow &window,
+             ProgressNotify &pn,
+             const DumpFileOptions &opts=DumpFileOptions())
+        throw (const char *);
+
+    /*
+     * Rewrite a plain dumpfile as a block container. Operations are
+     *  grouped into blocks, each with a header that has its op and time
+     *  range, length and checksum, and every few blocks carries a list of
+     *  what's allocated when it starts. An index of the blocks goes at the
+     *  end, so a window can be found without reading anything else.
+     *  The other constructors can load containers as well as dumpfiles.
+     */
+    static void convertToBlocks(const char *fname, const char *outfname,
+                                ProgressNotify &pn) throw (const char *);
+
     ~DumpFile();
     uint8 getFormatVersion() const { return protocol_version; }
     uint8 platformIsBigendian() const { return (byte_order == 1); }
@@ -294,8 +912,64 @@ public:
     const char *getId() const { return id; }
     const char *getBinaryFilename() const { return fname; }
     uint32 getProcessId() const { return pid; }
-    uint32 getOperationCount() const { return total_operations; }
-    DumpFileOperation *getOperation(size_t idx) const { return operations[idx]; }
+    uint64 getStartTime() const { return start_time; }
+    uint64 getOperationCount() const { return operations.getTotal(); }
+    uint64 getWindowStart() const { return window_start; }
+    uint64 getSkippedBlocks() const { return skipped_blocks; }
+    DumpFileOperation getOperation(uint64 idx) const;
+
+    /*
+     * Unpacks the block of operations that (idx) is in, for scanning lots
+     *  of ops quickly. (first) is set to the index of the block's first op;
+     *  the block has DUMPFILE_BLOCK_SIZE ops, except maybe the last one.
+     *  The columns are good until the next call to getOperation*().
+     *  Callstack ids in the columns need to go through resolveCallstack()
+     *  if callstacks are loading lazily.
+     */
+    const DumpFileColumns &getOperationBlock(uint64 idx, uint64 &first) const;
+
+    /*
+     * Same as getOperationBlock(), but unpacks into your own (cols), which
+     *  is slower, but safe to do on several threads at once.
+     */
+    void copyOperationBlock(uint64 idx, uint64 &first,
+                            DumpFileColumns &cols) const;
+
+    /*
+     * With DumpFileOptions::lazy_callstacks, the callstack ids that we
+     *  store are really just placeholders; this turns one into a real id
+     *  that callstackManager understands. Real ids are passed through, so
+     *  it's always safe to call.
+     */
+    CallstackManager::callstackid resolveCallstack(uint64 id) const;
+
+    /*
+     * Fills (out) with the callstack ids of (count) ops, starting with op
+     *  (first), already run through resolveCallstack(). Feed the result to
+     *  CallstackManager::leaves() and friends to group a range of ops by
+     *  where they were called from.
+     */
+    void getCallstackIds(uint64 first, uint64 count,
+                         CallstackManager::callstackid *out) const;
+
+    /*
+     * Looks up every lazy callstack now, using several threads, so later
+     *  lookups are free. Does nothing if callstacks weren't loaded lazily.
+     */
+    void internCallstacks(ProgressNotify &pn) throw (const char *);
+
+    /*
+     * If we're following a dumpfile (see DumpFileOptions::follow), this
+     *  parses whatever has been added to it since last time, tells the
+     *  listeners, and returns how many new ops there were. It's cheap if
+     *  there's nothing new, so call it as often as you like. Once the
+     *  capture ends, isFollowing() goes false and this does nothing.
+     */
+    uint64 poll(ProgressNotify &pn) throw (const char *);
+    bool isFollowing() const { return(follow_fname != NULL); }
+    void stopFollowing(ProgressNotify &pn);
+    void addListener(DumpFileListener *listener);
+    void removeListener(DumpFileListener *listener);
     CallstackManager callstackManager;
     FragMapManager fragmapManager;
 
@@ -306,24 +980,337 @@ protected:
     char *id;  /* arbitrary id associated with dump: asciz string. */
     char *fname;  /* filename of dump's binary: asciz string. */
     uint32 pid;   /* process ID associated with dump. */
-    uint32 total_operations; /* number of Operation objects in this dump. */
-    DumpFileOperation **operations; /* the ops in chronological order. */
+    uint64 start_time;  /* wall clock at tick zero, usecs; 0 if unknown. */
+    DumpFileOpStore operations; /* the ops in chronological order. */
+    DumpFileOptions options;  /* how we were asked to load. */
+    DumpFileScratch *scratch;  /* where things spill, if over budget. */
+    uint64 window_start;  /* index of our op zero in the whole capture. */
+    uint64 skipped_blocks;  /* failed their checksums. */
 
 private:
-    void parse(const char *fname, ProgressNotify &pn) throw (const char *);
+    DumpFile();  // for convertToBlocks(); doesn't parse anything.
+    void parse(const char *fname, const DumpFileWindow &window,
+               ProgressNotify &pn) throw (const char *);
+    void parse_blocks(const DumpFileWindow &window, ProgressNotify &pn)
+        throw (const char *);
+    template <class Decoder>
+    void load_blocks(DumpFileBlockInfo *blocks, size_t checkpoint,
+                     size_t first, size_t last, const DumpFileWindow &window,
+                     ProgressNotify &pn);
+    bool check_block(DumpFileBlockInfo &block) const;
+    void write_blocks(const char *fname, const char *outfname,
+                      ProgressNotify &pn) throw (const char *);
+    template <class Decoder>
+    dumpfile_chunk_status_t write_blocks_with(FILE *out, uint64 filepos,
+                                              ProgressNotify &pn,
+                                              double totalsize)
+        throw (const char *);
+    void parse_index(const char *idxfname, tick_t starttick, tick_t endtick,
+                     ProgressNotify &pn) throw (const char *);
+    void init_state();
+    void init_scratch() throw (const char *);
+    bool read_cache(const char *fname) throw (const char *);
+    void write_cache(const char *fname) throw (const char *);
+    DumpFileOpStore *create_chunk_store() const;
+    void release_file();
+    void unmap_kept_files();
+    template <class Decoder>
+    static uint32 read_frames(const uint8 *ptr, dumpptr *&framebuf,
+                              size_t &framebuf_len);
+    CallstackManager::callstackid intern_lazy(CallstackManager &cm,
+                                    uint64 id,
+                                    dumpptr *&framebuf,
+                                    size_t &framebuf_len) const;
+    static void *intern_thread(void *_job);
+    void read_header(bool first) throw (const char *);
+    bool handshake_written(const char *fn);
+    dumpfile_chunk_status_t parse_operations(ProgressNotify &pn,
+                                             tick_t mintick, tick_t maxtick,
+                                             double basepos, double totalsize);
+    template <class Decoder>
+    dumpfile_chunk_status_t parse_chunks(ProgressNotify &pn,
+                                         tick_t mintick, tick_t maxtick,
+                                         double basepos, double totalsize);
+    template <class Decoder>
+    const uint8 *find_record(const uint8 *pos, const uint8 *end) const;
+    template <class Decoder>
+    inline dumpfile_chunk_status_t decode_record(const uint8 *&pos,
+                                                 tick_t mintick,
+                                                 tick_t maxtick,
+                                                 DumpFileColumns &ops,
+                                                 const uint8 *&frames,
+                                                 uint32 &count) const;
+    template <class Decoder>
+    inline uint64 intern_callstack(DumpFileChunk &chunk,
+                                   const uint8 *frames, uint32 count);
+    template <class Decoder>
+    void decode_chunk(DumpFileChunk &chunk, ProgressNotify *pn,
+                      double basepos, double totalsize);
+    template <class Decoder>
+    bool pipeline_chunk(DumpFileChunk &chunk, ProgressNotify &pn,
+                        double basepos, double totalsize);
+    template <class Decoder>
+    static void *decode_stage(void *_pipeline);
+    template <class Decoder>
+    static void *intern_stage(void *_pipeline);
+    template <class Decoder>
+    static void *decode_thread(void *_chunk);
+    void stitch_chunk(DumpFileChunk &chunk);
+    void store_operations(const DumpFileColumns &ops);
+    void discard_chunk(DumpFileChunk &chunk);
+    size_t decode_thread_count() const;
+    void finish_parse(ProgressNotify &pn);
     void destruct();
+    size_t map_file(const char *fname, uint64 start=0) throw (const char *);
+    void unmap_file();
+    inline void need_bytes(size_t size) throw (const char *);
     inline void read_block(void *ptr, size_t size) throw (const char *);
     inline void read_ui8(uint8 &ui8) throw (const char *);
     inline void read_ui32(uint32 &ui32) throw (const char *);
-    inline void read_ui64(uint64 &ui64) throw (const char *);
-    inline void read_ptr(dumpptr &ptr) throw (const char *);
-    inline void read_sizet(dumpptr &sizet) throw (const char *);
-    inline void read_timestamp(tick_t &t) throw (const char *);
-    inline void read_callstack(CallstackManager::callstackid &id) throw (const char *);
     inline void read_asciz(char *&str) throw (const char *);
-    FILE *io;  // used during parsing...
+
+    // The file being parsed is mmap()'d, and we decode straight out of it.
+    const uint8 *mapped;
+    const uint8 *mapped_end;
+    const uint8 *cursor;
+    size_t mapped_size;
+    uint64 mapped_filepos;  /* where (mapped) is in the file. */
+
+    // Following a growing dumpfile.
+    char *follow_fname;  /* NULL if we're not following. */
+    uint64 follow_pos;  /* where to pick up parsing next time. */
+    bool follow_handshake;  /* true until we've seen the whole handshake. */
+    DumpFileListener **listeners;
+    size_t total_listeners;
+
+    // With lazy callstacks, files stay mapped after parsing, and we hand
+    //  out their positions as if they were all one big file.
+    uint64 mapped_offset;  /* where (mapped) starts in that big file. */
+    DumpFileMapping *kept_maps;
+    size_t total_kept_maps;
+    mutable dumpptr *lazy_framebuf;
+    mutable size_t lazy_framebuf_len;
+
+    // Loaded from a cache: the ops are unpacked straight out of it.
+    const uint8 *cache_map;
+    size_t cache_map_size;
+};
+
+
+/*
+ * What the ops called from somewhere added up to. Allocations are
+ *  malloc()s and realloc()s that returned a block, and (bytes) is their
+ *  sizes; frees are free()s and realloc()s that let go of a block. Those
+ *  count wherever the op was called from. Live blocks are the ones still
+ *  allocated after a chosen op, counted where they were allocated.
+ */
+class CallingContextStats
+{
+public:
+    CallingContextStats()
+        : allocs(0), bytes(0), frees(0), live_blocks(0), live_bytes(0) {}
+    uint64 allocs;
+    uint64 bytes;
+    uint64 frees;
+    uint64 live_blocks;
+    uint64 live_bytes;
+
+    void add(const CallingContextStats &other)
+    {
+        allocs += other.allocs;
+        bytes += other.bytes;
+        frees += other.frees;
+        live_blocks += other.live_blocks;
+        live_bytes += other.live_bytes;
+    } // add
+};
+
+/*
+ * A calling context tree is the CallstackManager's tree with counters on
+ *  it: each node's exclusive stats are for ops called from exactly there,
+ *  and its inclusive stats add in everything it called, too. Starting at
+ *  the root and following the biggest inclusive numbers down is how you
+ *  find which part of a program is churning through memory.
+ *
+ * build() makes one node for each callstack, with the same ids, so
+ *  getCallstack(node) == node, and node zero is the root. It's one pass
+ *  over the ops, split up between several threads, that each count into
+ *  their own copy of the tree, and the copies are added up at the end.
+ *  Lazy callstacks get looked up first (see DumpFile::internCallstacks()).
+ *
+ * collapse() makes a smaller tree out of a built one, by giving each node
+ *  a key, like the function or module that its frame is in (see
+ *  Symbolizer::getFunctionKey()). Children of a node that have the same
+ *  key become one node, and so does a child with the same key as its
+ *  parent, so a module calling around inside itself is just that module.
+ *  A key of zero means "don't know," and those nodes are left alone.
+ *  getCallstack() is the first callstack that went into a collapsed node.
+ *
+ * Either way, a parent's id is always smaller than its children's.
+ */
+class CallingContextTree
+{
+public:
+    CallingContextTree();
+    ~CallingContextTree();
+
+    /*
+     * Counts up every op in (df). Live blocks are the ones still allocated
+     *  after op (liveop); the default is after the last op. (threads) is
+     *  how many threads to use; zero means one per CPU.
+     */
+    void build(DumpFile &df, ProgressNotify &pn, uint64 liveop=(uint64) -1,
+               int threads=0) throw (const char *);
+
+    // Replaces this tree with (tree), collapsed by (keys), one per node.
+    void collapse(const CallingContextTree &tree, const uint32 *keys)
+        throw (const char *);
+
+    size_t getNodeCount() const { return(total_nodes); }
+    uint32 getParent(uint32 node) const { return(parents[node]); }
+    uint32 getCallstack(uint32 node) const { return(callstacks[node]); }
+    uint64 getLiveOperation() const { return(live_op); }
+
+    const CallingContextStats &getExclusive(uint32 node) const
+    {
+        return(exclusive[node]);
+    } // getExclusive
+
+    const CallingContextStats &getInclusive(uint32 node) const
+    {
+        return(inclusive[node]);
+    } // getInclusive
+
+    // Sets (count), and returns (node)'s children, in order of their ids.
+    const uint32 *getChildren(uint32 node, size_t &count) const
+    {
+        count = child_index[node + 1] - child_index[node];
+        return(children + child_index[node]);
+    } // getChildren
+
+private:
+    void release();
+    void allocate(size_t count) throw (const char *);
+    void finish() throw (const char *);
+
+    size_t total_nodes;
+    uint32 *parents;
+    uint32 *callstacks;
+    CallingContextStats *exclusive;
+    CallingContextStats *inclusive;
+    uint32 *child_index;  /* node N's children start at children[N]. */
+    uint32 *children;
+    uint64 live_op;
+
+    CallingContextTree(const CallingContextTree &);  // no copying.
+    CallingContextTree &operator =(const CallingContextTree &);
 };
 
+
+/*
+ * Totals across every dumpfile in a MultiDumpFile, worked out while the
+ *  ops are merged. Live bytes and blocks are what the whole host had
+ *  allocated; the peak is the most it ever had at once, and when, as an
+ *  op index and tick on the merged timeline.
+ */
+class MultiDumpFileTotals
+{
+public:
+    MultiDumpFileTotals()
+        : mallocs(0), reallocs(0), frees(0), callstack_frames(0),
+          live_bytes(0), live_blocks(0), peak_bytes(0), peak_blocks(0),
+          peak_operation(0), peak_tick(0), last_tick(0) {}
+    uint64 mallocs;
+    uint64 reallocs;
+    uint64 frees;
+    uint64 callstack_frames;
+    uint64 live_bytes;  /* at the end. */
+    uint64 live_blocks;
+    uint64 peak_bytes;
+    uint64 peak_blocks;  /* live when peak_bytes happened. */
+    uint64 peak_operation;
+    uint64 peak_tick;
+    uint64 last_tick;
+};
+
+/*
+ * Several dumpfiles on one timeline, say, one from each worker of a
+ *  prefork server. The dumpfiles are opened in parallel, then their ops
+ *  are merged in timestamp order, and the merged ops are numbered from
+ *  zero like a DumpFile's. Each merged op remembers which dumpfile (its
+ *  "source") it came from.
+ *
+ * Each dumpfile's ticks start when its process connected, so they're
+ *  lined up using the wall clock time in the handshake (protocol version 2
+ *  and later). Merged ticks are milliseconds since the earliest source
+ *  started. Older dumpfiles don't say when they started; they're assumed
+ *  to have started with the earliest one. Ops with the same merged tick
+ *  keep the order of their sources.
+ *
+ * Each source keeps its own callstacks and fragmap (a pointer in one
+ *  process means nothing in another), so use getSource() for those; the
+ *  totals are for all of them together. DumpFileOptions apply to every
+ *  source, except that the memory budget and decode threads are shared
+ *  out between them.
+ */
+class MultiDumpFile
+{
+public:
+    MultiDumpFile(const char * const *fnames, size_t count,
+                  ProgressNotify &pn,
+                  const DumpFileOptions &opts=DumpFileOptions())
+        throw (const char *);
+    ~MultiDumpFile();
+    size_t getSourceCount() const { return total_sources; }
+    DumpFile &getSource(size_t src) { return *sources[src]; }
+    const DumpFile &getSource(size_t src) const { return *sources[src]; }
+    uint64 getSourceOffset(size_t src) const { return offsets[src]; }
+    uint64 getStartTime() const { return start_time; }
+    uint64 getOperationCount() const { return total_operations; }
+    size_t getOperationSource(uint64 idx) const { return sourceids[idx]; }
+    const MultiDumpFileTotals &getTotals() const { return totals; }
+
+    /*
+     * Merged op (idx), as its source sees it: getIndex() is where it is in
+     *  that source, and getTimestamp() is in that source's ticks (see
+     *  getTimestamp() below). (src) is set to the source. Walking the ops
+     *  in order is cheap; jumping around costs a little more.
+     */
+    DumpFileOperation getOperation(uint64 idx, size_t &src) const;
+
+    // An op's tick on the merged timeline.
+    uint64 getTimestamp(const DumpFileOperation &op, size_t src) const
+    {
+        return(offsets[src] + (uint64) op.getTimestamp());
+    } // getTimestamp
+
+private:
+    static void *open_thread(void *_job);
+    void merge(ProgressNotify &pn);
+    void destruct();
+
+    DumpFile **sources;
+    size_t total_sources;
+    uint64 *offsets;  /* each source's tick zero on the merged timeline. */
+    uint64 start_time;  /* wall clock at merged tick zero; 0 if unknown. */
+    uint64 total_operations;
+    uint16 *sourceids;  /* which source each merged op came from. */
+    uint64 *checkpoints;  /* ops taken from each source, every block. */
+    MultiDumpFileTotals totals;
+
+    // where the last getOperation() was, so walking in order is cheap.
+    mutable uint64 cursor_idx;
+    mutable uint64 *cursor_ops;
+};
+
+
+inline CallstackManager::callstackid DumpFileOperation::getCallstackId() const
+{
+    if (owner == NULL)
+        return((CallstackManager::callstackid) callstack);
+    return(owner->resolveCallstack(callstack));
+} // DumpFileOperation::getCallstackId
+
 #endif
 
 /* end of dumpfile.h ... */
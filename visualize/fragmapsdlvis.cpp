@@ -75,7 +75,7 @@ static inline bool pump_queue(void)
 static void render_loop(const char *fname, DumpFile &df)
 {
     printf("dumpfile %s\n", fname);
-    float opcount = (float) df.getOperationCount();
+    double opcount = (double) df.getOperationCount();
     Uint32 black = SDL_MapRGB(screen, 0, 0, 0);
     Uint32 red = SDL_MapRGB(screen, 0xFF, 0, 0);
     Uint32 green = SDL_MapRGB(screen, 0, 0xFF, 0);
@@ -85,9 +85,8 @@ static void render_loop(const char *fname, DumpFile &df)
 
     while (pump_queue())
     {
-        size_t nc = 0;
-        uint32 op = (uint32) (opcount * scrubber);
-        FragMapNode **nodes = df.fragmapManager.get_fragmap(&df, op, nc);
+        uint64 op = (uint64) (opcount * scrubber);
+        const FragMapSpan fragmap = df.fragmapManager.get_fragmap(&df, op);
 
 
     } // while
@@ -43,10 +43,11 @@ static inline tick_t get_ticks(void)
 static void jump_around(const char *filename, DumpFile &df)
 {
     const uint32 ITERATIONS = 3;
-    uint32 opcount = df.getOperationCount();
+    uint64 opcount = df.getOperationCount();
     tick_t ticks = 0;
 
-    printf("%s: %u operations total.\n", filename, (unsigned int) opcount);
+    printf("%s: %llu operations total.\n", filename,
+           (unsigned long long) opcount);
 
     #if DO_LINEAR_SEEK_TEST
     ticks = 0;
@@ -54,10 +55,9 @@ static void jump_around(const char *filename, DumpFile &df)
     {
         printf(" + linear fragmap seek iteration #%d...\n", (int) iter);
         reset_tick_base();
-        for (uint32 i = 0; i < opcount; i++)
+        for (uint64 i = 0; i < opcount; i++)
         {
-            size_t nc = 0;
-            df.fragmapManager.get_fragmap(&df, i, nc);
+            df.fragmapManager.get_fragmap(&df, i);
         } // for
         ticks += get_ticks();
     } // for
@@ -72,10 +72,9 @@ static void jump_around(const char *filename, DumpFile &df)
     {
         printf(" + reverse linear fragmap seek iteration #%d...\n", (int) iter);
         reset_tick_base();
-        for (uint32 i = opcount-1; i >= 0; i--)
+        for (uint64 i = opcount; i-- > 0; )
         {
-            size_t nc = 0;
-            df.fragmapManager.get_fragmap(&df, i, nc);
+            df.fragmapManager.get_fragmap(&df, i);
         } // for
         ticks += get_ticks();
     } // for
@@ -90,11 +89,12 @@ static void jump_around(const char *filename, DumpFile &df)
     {
         printf(" + sequential skip fragmap seek iteration #%d...\n", (int) iter);
         reset_tick_base();
-        uint32 skip = (uint32) (((float) opcount) * 0.05f);
-        for (uint32 i = 0; i < opcount; i += skip)
+        uint64 skip = (uint64) (((double) opcount) * 0.05);
+        if (skip == 0)
+            skip = 1;
+        for (uint64 i = 0; i < opcount; i += skip)
         {
-            size_t nc = 0;
-            df.fragmapManager.get_fragmap(&df, i, nc);
+            df.fragmapManager.get_fragmap(&df, i);
         } // for
         ticks += get_ticks();
     } // for
@@ -109,12 +109,13 @@ static void jump_around(const char *filename, DumpFile &df)
     {
         printf(" + random skip fragmap seek iteration #%d...\n", (int) iter);
         reset_tick_base();
-        uint32 skip = (uint32) (((float) opcount) * 0.05f);
-        for (uint32 i = 0; i < opcount; i += skip)
+        uint64 skip = (uint64) (((double) opcount) * 0.05);
+        if (skip == 0)
+            skip = 1;
+        for (uint64 i = 0; i < opcount; i += skip)
         {
-            int op = rand() % opcount;
-            size_t nc = 0;
-            df.fragmapManager.get_fragmap(&df, op, nc);
+            uint64 op = ((uint64) rand()) % opcount;
+            df.fragmapManager.get_fragmap(&df, op);
         } // for
         ticks += get_ticks();
     } // for
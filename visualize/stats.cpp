@@ -1,7 +1,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "dumpfile.h"
+#include "symbolizer.h"
 
 class ProgressNotifyStdio : public ProgressNotify
 {
@@ -21,19 +23,93 @@ protected:
 };
 
 
-static void print_callstack(CallstackManager &cm,
+static void print_callstack(CallstackManager &cm, const Symbolizer &sym,
                             CallstackManager::callstackid id)
 {
-    size_t count = cm.framecount(id);
-    dumpptr *frames = (dumpptr *) alloca(sizeof (dumpptr) * count);
-    cm.get(id, frames);
-
     printf("      Callstack:\n");
-    for (size_t i = 0; i < count; i++)
-        printf("        #%d: 0x%X\n", (int) ((count-i)-1), (int) frames[i]);
+    for (CallstackFrames f(cm.walk(id)); !f.done(); f.next())
+    {
+        SymbolizedFrame frames[16];
+        size_t total = sym.lookup(f.frame(), frames, 16);
+        if (total > 16)
+            total = 16;
+
+        printf("        #%d: 0x%llX", (int) (f.frames_left() - 1),
+               (unsigned long long) f.frame());
+        for (size_t i = 0; i < total; i++)
+        {
+            const SymbolizedFrame &frame = frames[i];
+            if (i > 0)
+                printf("\n           ");
+            printf(" in %s", frame.function ? frame.function : "??");
+            if (frame.file != NULL)
+                printf(" at %s:%u", frame.file, (unsigned int) frame.line);
+            if (frame.inlined)
+                printf(" (inlined)");
+        } // for
+        printf("\n");
+    } // for
 } // print_callstack
 
 
+// Top down, skipping anything under 1% of all the bytes allocated.
+static void print_calling_context_tree(CallstackManager &cm,
+                                       const Symbolizer &sym,
+                                       const CallingContextTree &cct)
+{
+    const size_t total = cct.getNodeCount();
+    const uint64 bytes = cct.getInclusive(0).bytes;
+    uint32 *stack = new uint32[total];
+    int *depths = new int[total];
+    size_t pos = 0;
+    stack[pos] = 0;
+    depths[pos++] = 0;
+
+    printf("\n  Calling context tree (1%% of bytes or more)...\n");
+    while (pos > 0)
+    {
+        pos--;
+        const uint32 node = stack[pos];
+        const int depth = depths[pos];
+        const CallingContextStats &stats = cct.getInclusive(node);
+        if ((node != 0) && ((stats.bytes * 100) < bytes))
+            continue;
+
+        printf("    %*s%5.1f%%: %llu bytes in %llu allocs, %llu frees,"
+               " %llu bytes live: ", depth * 2, "",
+               (bytes == 0) ? 100.0 : ((((double) stats.bytes) /
+                                        ((double) bytes)) * 100.0),
+               (unsigned long long) stats.bytes,
+               (unsigned long long) stats.allocs,
+               (unsigned long long) stats.frees,
+               (unsigned long long) stats.live_bytes);
+
+        SymbolizedFrame frames[16];
+        const dumpptr frame = cm.leaf(cct.getCallstack(node));
+        size_t count = sym.lookup(frame, frames, 16);
+        if (count > 16)
+            count = 16;
+        if (node == 0)
+            printf("(everything)\n");
+        else if ((count > 0) && (frames[count - 1].function != NULL))
+            printf("%s\n", frames[count - 1].function);
+        else
+            printf("0x%llX\n", (unsigned long long) frame);
+
+        size_t kids = 0;
+        const uint32 *children = cct.getChildren(node, kids);
+        while (kids--)  // backwards, so they come off the stack in order.
+        {
+            stack[pos] = children[kids];
+            depths[pos++] = depth + 1;
+        } // while
+    } // while
+
+    delete[] stack;
+    delete[] depths;
+} // print_calling_context_tree
+
+
 int main(int argc, char **argv)
 {
     for (int i = 1; i < argc; i++)
@@ -56,38 +132,69 @@ int main(int argc, char **argv)
             printf("  id: %s\n", df.getId());
             printf("  binary filename: %s\n", df.getBinaryFilename());
             printf("  process id: %d\n", (int) df.getProcessId());
-            printf("  total operations: %d\n", (int) df.getOperationCount());
+            printf("  total operations: %llu\n",
+                   (unsigned long long) df.getOperationCount());
             printf("  total callstack frames: %d\n", (int) totalframes);
             printf("  unique callstack frames: %d\n", (int) uniqueframes);
             printf("  unique/total ratio: %f\n", frameratio);
 
+            // !!! FIXME: dumps don't say where shared libraries were
+            // !!! FIXME:  loaded, so we can only do the main binary.
+            char *symfn = new char[strlen(argv[i]) + 8];
+            sprintf(symfn, "%s.mmsyms", argv[i]);
+            Symbolizer sym(symfn);
+            delete[] symfn;
+            try
+            {
+                sym.addModule(df.getBinaryFilename());
+                sym.symbolize(cm, pn);
+            } // try
+
+            catch (const char *err)
+            {
+                printf("  (can't symbolize %s: %s)\n",
+                       df.getBinaryFilename(), err);
+            } // catch
+
+            CallingContextTree tree;
+            tree.build(df, pn);
+            const size_t nodes = tree.getNodeCount();
+            uint32 *keys = new uint32[nodes];
+            keys[0] = 0;
+            for (size_t i = 1; i < nodes; i++)
+                keys[i] = sym.getFunctionKey(cm.leaf((uint32) i));
+            CallingContextTree byfunction;
+            byfunction.collapse(tree, keys);
+            delete[] keys;
+            print_calling_context_tree(cm, sym, byfunction);
+
             printf("\n  Operations...\n");
-            uint32 max = df.getOperationCount();
-            for (uint32 i = 0; i < max; i++)
+            uint64 max = df.getOperationCount();
+            for (uint64 i = 0; i < max; i++)
             {
-                DumpFileOperation *op = df.getOperation(i);
-                printf("    op %d, timestamp %d: ",
-                        (int) i, (int) op->getTimestamp());
+                const DumpFileOperation op(df.getOperation(i));
+                printf("    op %llu, timestamp %d: ",
+                        (unsigned long long) i, (int) op.getTimestamp());
 
-                dumpfile_operation_t optype = op->getOperationType();
+                dumpfile_operation_t optype = op.getOperationType();
                 switch (optype)
                 {
                     case DUMPFILE_OP_MALLOC:
-                        printf("malloc(%d), returned 0x%X\n",
-                               (int) op->op_malloc.size,
-                               (int) op->op_malloc.retval);
+                        printf("malloc(%llu), returned 0x%llX\n",
+                               (unsigned long long) op.getSize(),
+                               (unsigned long long) op.getRetval());
                         break;
 
                     case DUMPFILE_OP_REALLOC:
-                        printf("realloc(0x%X, %d), returned 0x%X\n",
-                               (int) op->op_realloc.ptr,
-                               (int) op->op_realloc.size,
-                               (int) op->op_realloc.retval);
+                        printf("realloc(0x%llX, %llu), returned 0x%llX\n",
+                               (unsigned long long) op.getPtr(),
+                               (unsigned long long) op.getSize(),
+                               (unsigned long long) op.getRetval());
                         break;
 
                     case DUMPFILE_OP_FREE:
-                        printf("free(0x%X)\n",
-                               (int) op->op_free.ptr);
+                        printf("free(0x%llX)\n",
+                               (unsigned long long) op.getPtr());
                         break;
 
                     default:
@@ -95,7 +202,7 @@ int main(int argc, char **argv)
                         break;
                 } // switch
 
-                print_callstack(cm, op->getCallstackId());
+                print_callstack(cm, sym, op.getCallstackId());
             } // for
         } // try
 
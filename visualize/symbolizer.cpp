@@ -0,0 +1,3406 @@
+/*
+ * Turning callstack addresses into functions, files and lines.
+ *
+ * Written by Ryan C. Gordon (icculus@icculus.org)
+ *
+ * Please see the file LICENSE in the source's root directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <assert.h>
+#include <pthread.h>
+#include <cxxabi.h>
+
+#include "symbolizer.h"
+
+// realloc() for arrays that grow by doubling, which throws if it can't.
+template <class T> static void symbolizer_grow(T *&array, size_t &alloc,
+                                               size_t needed)
+    throw (const char *)
+{
+    if (needed <= alloc)
+        return;
+
+    size_t newalloc = (alloc == 0) ? 64 : (alloc * 2);
+    while (newalloc < needed)
+        newalloc *= 2;
+
+    T *ptr = (T *) realloc(array, newalloc * sizeof (T));
+    if (ptr == NULL)
+        throw("Out of memory");
+    array = ptr;
+    alloc = newalloc;
+} // symbolizer_grow
+
+
+/*
+ * Reads ELF and DWARF data, which is in the module's byte order, not
+ *  necessarily ours. Reading past the end gets zeros and sets (overflow),
+ *  so a corrupt file just means we give up on it, instead of crashing.
+ */
+class SymbolizerReader
+{
+public:
+    SymbolizerReader(const uint8 *_ptr, const uint8 *_end, bool _swap)
+        : ptr(_ptr), end(_end), swap(_swap), overflow(false) {}
+    const uint8 *ptr;
+    const uint8 *end;
+    bool swap;
+    bool overflow;
+
+    bool has(uint64 len)
+    {
+        if (((uint64) (end - ptr)) >= len)
+            return(true);
+        overflow = true;
+        ptr = end;
+        return(false);
+    } // has
+
+    void skip(uint64 len)
+    {
+        if (has(len))
+            ptr += (size_t) len;
+    } // skip
+
+    // an unsigned int of (size) bytes; anything from one to eight.
+    uint64 uint(size_t size)
+    {
+        if ((size == 0) || (size > 8) || (!has(size)))
+            return(0);
+
+        uint64 retval = 0;
+        if (swap)  // big endian file, or a little endian one on a Mac.
+        {
+            for (size_t i = 0; i < size; i++)
+                retval |= ((uint64) ptr[i]) << ((size - i - 1) * 8);
+        } // if
+        else
+        {
+            for (size_t i = 0; i < size; i++)
+                retval |= ((uint64) ptr[i]) << (i * 8);
+        } // else
+
+        ptr += size;
+        return(retval);
+    } // uint
+
+    uint8 u8() { return((uint8) uint(1)); }
+    uint16 u16() { return((uint16) uint(2)); }
+    uint32 u32() { return((uint32) uint(4)); }
+    uint64 u64() { return(uint(8)); }
+
+    uint64 uleb()
+    {
+        uint64 retval = 0;
+        uint32 shift = 0;
+        while (has(1))
+        {
+            const uint8 byte = *(ptr++);
+            if (shift < 64)
+                retval |= ((uint64) (byte & 0x7F)) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0)
+                break;
+        } // while
+        return(retval);
+    } // uleb
+
+    // signed, but handed back as two's complement.
+    uint64 sleb()
+    {
+        uint64 retval = 0;
+        uint32 shift = 0;
+        uint8 byte = 0;
+        while (has(1))
+        {
+            byte = *(ptr++);
+            if (shift < 64)
+                retval |= ((uint64) (byte & 0x7F)) << shift;
+            shift += 7;
+            if ((byte & 0x80) == 0)
+                break;
+        } // while
+
+        if ((shift < 64) && (byte & 0x40))
+            retval |= ((uint64) -1) << shift;
+        return(retval);
+    } // sleb
+
+    const char *str()
+    {
+        const uint8 *nul = (const uint8 *) memchr(ptr, '\0', end - ptr);
+        if (nul == NULL)
+        {
+            has(((uint64) (end - ptr)) + 1);
+            return(NULL);
+        } // if
+
+        const char *retval = (const char *) ptr;
+        ptr = nul + 1;
+        return(retval);
+    } // str
+}; // SymbolizerReader
+
+
+/*
+ * Strings that a job makes up as it goes, like demangled names and file
+ *  paths, which have to last until its results are merged. They're never
+ *  freed one at a time, so they just get packed into big blocks.
+ */
+#define SYMBOLIZER_ARENA_BLOCK (64 * 1024)
+
+class SymbolizerArena
+{
+public:
+    SymbolizerArena() : blocks(NULL), next(NULL), avail(0) {}
+    ~SymbolizerArena()
+    {
+        while (blocks != NULL)
+        {
+            void *prev = *((void **) blocks);
+            ::free(blocks);
+            blocks = prev;
+        } // while
+    } // destructor
+
+    char *alloc(size_t len) throw (const char *)
+    {
+        if (len > avail)
+        {
+            // big strings get a block of their own.
+            size_t blocklen = sizeof (void *) + len;
+            if (blocklen < SYMBOLIZER_ARENA_BLOCK)
+                blocklen = SYMBOLIZER_ARENA_BLOCK;
+            void *block = malloc(blocklen);
+            if (block == NULL)
+                throw("Out of memory");
+            *((void **) block) = blocks;
+            blocks = block;
+            next = ((char *) block) + sizeof (void *);
+            avail = blocklen - sizeof (void *);
+        } // if
+
+        char *retval = next;
+        next += len;
+        avail -= len;
+        return(retval);
+    } // alloc
+
+    char *copy(const char *str) throw (const char *)
+    {
+        const size_t len = strlen(str) + 1;
+        char *retval = alloc(len);
+        memcpy(retval, str, len);
+        return(retval);
+    } // copy
+
+private:
+    void *blocks;  /* each block starts with a pointer to the last one. */
+    char *next;
+    size_t avail;
+}; // SymbolizerArena
+
+
+/*
+ * DWARF constants that we care about. See the DWARF 5 spec, section 7.
+ */
+#define DW_TAG_class_type 0x02
+#define DW_TAG_enumeration_type 0x04
+#define DW_TAG_structure_type 0x13
+#define DW_TAG_union_type 0x17
+#define DW_TAG_inlined_subroutine 0x1d
+#define DW_TAG_subprogram 0x2e
+
+#define DW_AT_sibling 0x01
+#define DW_AT_name 0x03
+#define DW_AT_stmt_list 0x10
+#define DW_AT_low_pc 0x11
+#define DW_AT_high_pc 0x12
+#define DW_AT_comp_dir 0x1b
+#define DW_AT_abstract_origin 0x31
+#define DW_AT_specification 0x47
+#define DW_AT_ranges 0x55
+#define DW_AT_call_file 0x58
+#define DW_AT_call_line 0x59
+#define DW_AT_linkage_name 0x6e
+#define DW_AT_str_offsets_base 0x72
+#define DW_AT_addr_base 0x73
+#define DW_AT_rnglists_base 0x74
+#define DW_AT_MIPS_linkage_name 0x2007
+#define DW_AT_GNU_ranges_base 0x2132
+#define DW_AT_GNU_addr_base 0x2133
+
+#define DW_FORM_addr 0x01
+#define DW_FORM_block2 0x03
+#define DW_FORM_block4 0x04
+#define DW_FORM_data2 0x05
+#define DW_FORM_data4 0x06
+#define DW_FORM_data8 0x07
+#define DW_FORM_string 0x08
+#define DW_FORM_block 0x09
+#define DW_FORM_block1 0x0a
+#define DW_FORM_data1 0x0b
+#define DW_FORM_flag 0x0c
+#define DW_FORM_sdata 0x0d
+#define DW_FORM_strp 0x0e
+#define DW_FORM_udata 0x0f
+#define DW_FORM_ref_addr 0x10
+#define DW_FORM_ref1 0x11
+#define DW_FORM_ref2 0x12
+#define DW_FORM_ref4 0x13
+#define DW_FORM_ref8 0x14
+#define DW_FORM_ref_udata 0x15
+#define DW_FORM_indirect 0x16
+#define DW_FORM_sec_offset 0x17
+#define DW_FORM_exprloc 0x18
+#define DW_FORM_flag_present 0x19
+#define DW_FORM_strx 0x1a
+#define DW_FORM_addrx 0x1b
+#define DW_FORM_ref_sup4 0x1c
+#define DW_FORM_strp_sup 0x1d
+#define DW_FORM_data16 0x1e
+#define DW_FORM_line_strp 0x1f
+#define DW_FORM_ref_sig8 0x20
+#define DW_FORM_implicit_const 0x21
+#define DW_FORM_loclistx 0x22
+#define DW_FORM_rnglistx 0x23
+#define DW_FORM_ref_sup8 0x24
+#define DW_FORM_strx1 0x25
+#define DW_FORM_strx2 0x26
+#define DW_FORM_strx3 0x27
+#define DW_FORM_strx4 0x28
+#define DW_FORM_addrx1 0x29
+#define DW_FORM_addrx2 0x2a
+#define DW_FORM_addrx3 0x2b
+#define DW_FORM_addrx4 0x2c
+#define DW_FORM_GNU_addr_index 0x1f01
+#define DW_FORM_GNU_str_index 0x1f02
+#define DW_FORM_GNU_ref_alt 0x1f20
+#define DW_FORM_GNU_strp_alt 0x1f21
+
+#define DW_UT_type 0x02
+#define DW_UT_skeleton 0x04
+#define DW_UT_split_compile 0x05
+#define DW_UT_split_type 0x06
+
+#define DW_RLE_end_of_list 0x00
+#define DW_RLE_base_addressx 0x01
+#define DW_RLE_startx_endx 0x02
+#define DW_RLE_startx_length 0x03
+#define DW_RLE_offset_pair 0x04
+#define DW_RLE_base_address 0x05
+#define DW_RLE_start_end 0x06
+#define DW_RLE_start_length 0x07
+
+#define DW_LNS_copy 0x01
+#define DW_LNS_advance_pc 0x02
+#define DW_LNS_advance_line 0x03
+#define DW_LNS_set_file 0x04
+#define DW_LNS_const_add_pc 0x08
+#define DW_LNS_fixed_advance_pc 0x09
+#define DW_LNE_end_sequence 0x01
+#define DW_LNE_set_address 0x02
+
+#define DW_LNCT_path 0x1
+#define DW_LNCT_directory_index 0x2
+
+
+class SymbolizerSection
+{
+public:
+    SymbolizerSection() : data(NULL), size(0) {}
+    const uint8 *data;
+    size_t size;
+
+    // an asciz string (offset) bytes in, or NULL if that's not one.
+    const char *string(uint64 offset) const
+    {
+        if (offset >= size)
+            return(NULL);
+        const uint8 *str = data + ((size_t) offset);
+        if (memchr(str, '\0', size - ((size_t) offset)) == NULL)
+            return(NULL);
+        return((const char *) str);
+    } // string
+};
+
+
+class SymbolizerSymbol
+{
+public:
+    uint64 addr;
+    uint64 size;
+    const char *name;
+};
+
+
+// [lo, hi) of a compile unit or a function, and which one.
+class SymbolizerRange
+{
+public:
+    uint64 lo;
+    uint64 hi;
+    uint32 index;
+};
+
+
+/*
+ * Ranges are sorted by (lo), and each one's (maxhi) is the biggest (hi)
+ *  of it and everything before it. To find everything that has (pc) in
+ *  it, start at the last range that starts at or before (pc), and look
+ *  back until (maxhi) says nothing earlier could reach that far. Code is
+ *  laid out one function after another, so that's usually only a few.
+ */
+static int symbolizer_rangecmp(const void *_a, const void *_b)
+{
+    const SymbolizerRange *a = (const SymbolizerRange *) _a;
+    const SymbolizerRange *b = (const SymbolizerRange *) _b;
+    if (a->lo != b->lo)
+        return((a->lo < b->lo) ? -1 : 1);
+    else if (a->hi != b->hi)
+        return((a->hi > b->hi) ? -1 : 1);  // outer ones first.
+    else if (a->index != b->index)
+        return((a->index < b->index) ? -1 : 1);
+    return(0);
+} // symbolizer_rangecmp
+
+static void sort_ranges(SymbolizerRange *ranges, uint64 *maxhi, size_t total)
+{
+    qsort(ranges, total, sizeof (SymbolizerRange), symbolizer_rangecmp);
+    uint64 max = 0;
+    for (size_t i = 0; i < total; i++)
+    {
+        if (ranges[i].hi > max)
+            max = ranges[i].hi;
+        maxhi[i] = max;
+    } // for
+} // sort_ranges
+
+// Returns one past the last range that might have (pc) in it; look back
+//  from there while maxhi[i-1] > pc.
+static size_t find_ranges(const SymbolizerRange *ranges, size_t total,
+                          uint64 pc)
+{
+    size_t lo = 0;
+    size_t hi = total;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (ranges[mid].lo <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+    return(lo);
+} // find_ranges
+
+
+// What we learn about a compile unit from its header and first DIE.
+class SymbolizerUnit
+{
+public:
+    uint64 offset;  /* of the unit header, in .debug_info. */
+    const uint8 *dies;  /* the first DIE. */
+    const uint8 *end;
+    uint16 version;
+    uint8 addr_size;
+    uint8 offset_size;
+    uint64 abbrev_offset;
+    uint64 str_offsets_base;
+    uint64 addr_base;
+    uint64 rnglists_base;
+    uint64 base_address;  /* for DW_AT_ranges; the unit's low_pc. */
+    uint64 stmt_list;
+    bool has_lines;
+    const char *comp_dir;
+};
+
+
+class SymbolizerAttrSpec
+{
+public:
+    uint32 name;
+    uint32 form;
+    uint64 implicit_const;
+};
+
+class SymbolizerAbbrev
+{
+public:
+    uint64 code;
+    uint32 tag;
+    bool children;
+    uint32 first_attr;
+    uint32 total_attrs;
+};
+
+// The abbreviations for a compile unit; every DIE points at one of these.
+class SymbolizerAbbrevTable
+{
+public:
+    SymbolizerAbbrevTable()
+        : offset((uint64) -1), abbrevs(NULL), total_abbrevs(0),
+          abbrevs_alloc(0), attrs(NULL), total_attrs(0), attrs_alloc(0) {}
+    ~SymbolizerAbbrevTable() { ::free(abbrevs); ::free(attrs); }
+
+    uint64 offset;  /* where in .debug_abbrev this was parsed from. */
+    SymbolizerAbbrev *abbrevs;
+    size_t total_abbrevs;
+    size_t abbrevs_alloc;
+    SymbolizerAttrSpec *attrs;
+    size_t total_attrs;
+    size_t attrs_alloc;
+
+    bool parse(const SymbolizerSection &sec, uint64 _offset, bool swap);
+
+    const SymbolizerAbbrev *get(uint64 code) const
+    {
+        // compilers number them 1..n, so try that first.
+        if ((code > 0) && (code <= total_abbrevs) &&
+            (abbrevs[code - 1].code == code))
+            return(&abbrevs[code - 1]);
+
+        for (size_t i = 0; i < total_abbrevs; i++)
+        {
+            if (abbrevs[i].code == code)
+                return(&abbrevs[i]);
+        } // for
+        return(NULL);
+    } // get
+
+private:
+    SymbolizerAbbrevTable(const SymbolizerAbbrevTable &);  // no copying.
+    SymbolizerAbbrevTable &operator =(const SymbolizerAbbrevTable &);
+};
+
+
+bool SymbolizerAbbrevTable::parse(const SymbolizerSection &sec,
+                                  uint64 _offset, bool swap)
+{
+    offset = (uint64) -1;
+    total_abbrevs = 0;
+    total_attrs = 0;
+    if (_offset >= sec.size)
+        return(false);
+
+    SymbolizerReader r(sec.data + ((size_t) _offset), sec.data + sec.size,
+                       swap);
+    while (!r.overflow)
+    {
+        const uint64 code = r.uleb();
+        if (code == 0)
+            break;
+
+        symbolizer_grow(abbrevs, abbrevs_alloc, total_abbrevs + 1);
+        SymbolizerAbbrev &abbrev = abbrevs[total_abbrevs++];
+        abbrev.code = code;
+        abbrev.tag = (uint32) r.uleb();
+        abbrev.children = (r.u8() != 0);
+        abbrev.first_attr = (uint32) total_attrs;
+        abbrev.total_attrs = 0;
+
+        while (!r.overflow)
+        {
+            const uint32 name = (uint32) r.uleb();
+            const uint32 form = (uint32) r.uleb();
+            if ((name == 0) && (form == 0))
+                break;
+
+            symbolizer_grow(attrs, attrs_alloc, total_attrs + 1);
+            SymbolizerAttrSpec &spec = attrs[total_attrs++];
+            spec.name = name;
+            spec.form = form;
+            spec.implicit_const = 0;
+            if (form == DW_FORM_implicit_const)
+                spec.implicit_const = r.sleb();
+            abbrev.total_attrs++;
+        } // while
+    } // while
+
+    if (r.overflow)
+        return(false);
+    offset = _offset;
+    return(true);
+} // SymbolizerAbbrevTable::parse
+
+
+class SymbolizerAttr
+{
+public:
+    uint32 name;
+    uint32 form;
+    uint64 value;
+    const uint8 *data;  /* for DW_FORM_string. */
+};
+
+static bool read_attr(SymbolizerReader &r, const SymbolizerUnit &unit,
+                      uint32 form, uint64 implicit, SymbolizerAttr &attr)
+{
+    attr.form = form;
+    attr.value = 0;
+    attr.data = NULL;
+
+    switch (form)
+    {
+        case DW_FORM_addr:
+            attr.value = r.uint(unit.addr_size);
+            break;
+
+        case DW_FORM_data1:
+        case DW_FORM_ref1:
+        case DW_FORM_flag:
+        case DW_FORM_strx1:
+        case DW_FORM_addrx1:
+            attr.value = r.u8();
+            break;
+
+        case DW_FORM_data2:
+        case DW_FORM_ref2:
+        case DW_FORM_strx2:
+        case DW_FORM_addrx2:
+            attr.value = r.u16();
+            break;
+
+        case DW_FORM_strx3:
+        case DW_FORM_addrx3:
+            attr.value = r.uint(3);
+            break;
+
+        case DW_FORM_data4:
+        case DW_FORM_ref4:
+        case DW_FORM_ref_sup4:
+        case DW_FORM_strx4:
+        case DW_FORM_addrx4:
+            attr.value = r.u32();
+            break;
+
+        case DW_FORM_data8:
+        case DW_FORM_ref8:
+        case DW_FORM_ref_sig8:
+        case DW_FORM_ref_sup8:
+            attr.value = r.u64();
+            break;
+
+        case DW_FORM_data16:
+            r.skip(16);
+            break;
+
+        case DW_FORM_sdata:
+            attr.value = r.sleb();
+            break;
+
+        case DW_FORM_udata:
+        case DW_FORM_ref_udata:
+        case DW_FORM_strx:
+        case DW_FORM_addrx:
+        case DW_FORM_loclistx:
+        case DW_FORM_rnglistx:
+        case DW_FORM_GNU_addr_index:
+        case DW_FORM_GNU_str_index:
+            attr.value = r.uleb();
+            break;
+
+        case DW_FORM_string:
+            attr.data = r.ptr;
+            r.str();
+            break;
+
+        case DW_FORM_strp:
+        case DW_FORM_line_strp:
+        case DW_FORM_sec_offset:
+        case DW_FORM_strp_sup:
+        case DW_FORM_GNU_ref_alt:
+        case DW_FORM_GNU_strp_alt:
+            attr.value = r.uint(unit.offset_size);
+            break;
+
+        case DW_FORM_ref_addr:
+            attr.value = r.uint((unit.version <= 2) ? unit.addr_size :
+                                                      unit.offset_size);
+            break;
+
+        case DW_FORM_exprloc:
+        case DW_FORM_block:
+            r.skip(r.uleb());
+            break;
+
+        case DW_FORM_block1:
+            r.skip(r.u8());
+            break;
+
+        case DW_FORM_block2:
+            r.skip(r.u16());
+            break;
+
+        case DW_FORM_block4:
+            r.skip(r.u32());
+            break;
+
+        case DW_FORM_flag_present:
+            attr.value = 1;
+            break;
+
+        case DW_FORM_implicit_const:
+            attr.value = implicit;
+            break;
+
+        case DW_FORM_indirect:
+            return(read_attr(r, unit, (uint32) r.uleb(), implicit, attr));
+
+        default:  // can't even skip it, so give up on this unit.
+            return(false);
+    } // switch
+
+    return(!r.overflow);
+} // read_attr
+
+static bool attr_is_constant(const SymbolizerAttr &attr)
+{
+    switch (attr.form)
+    {
+        case DW_FORM_data1:
+        case DW_FORM_data2:
+        case DW_FORM_data4:
+        case DW_FORM_data8:
+        case DW_FORM_sdata:
+        case DW_FORM_udata:
+        case DW_FORM_implicit_const:
+            return(true);
+    } // switch
+    return(false);
+} // attr_is_constant
+
+
+class SymbolizerRanges
+{
+public:
+    SymbolizerRanges() : pairs(NULL), total(0), alloc(0) {}
+    ~SymbolizerRanges() { ::free(pairs); }
+    void add(uint64 lo, uint64 hi)
+    {
+        if ((lo == 0) || (lo >= hi))
+            return;  // empty, or thrown away by the linker.
+        symbolizer_grow(pairs, alloc, (total + 1) * 2);
+        pairs[total * 2] = lo;
+        pairs[(total * 2) + 1] = hi;
+        total++;
+    } // add
+    uint64 *pairs;
+    size_t total;
+    size_t alloc;
+
+private:
+    SymbolizerRanges(const SymbolizerRanges &);  // no copying.
+    SymbolizerRanges &operator =(const SymbolizerRanges &);
+};
+
+
+/*
+ * One ELF file, and its debug info, which might be in another file.
+ */
+class SymbolizerModule
+{
+public:
+    SymbolizerModule(const char *_fname, dumpptr base) throw (const char *);
+    ~SymbolizerModule();
+
+    char *fname;
+    uint64 filesize;
+    uint64 mtime;
+    uint8 buildid[64];
+    size_t buildid_len;
+    dumpptr start;  /* where it was in the process... */
+    dumpptr end;
+    dumpptr bias;  /* ...and what to add to its addresses to get there. */
+    bool swap;
+
+    SymbolizerSection debug_info;
+    SymbolizerSection debug_abbrev;
+    SymbolizerSection debug_line;
+    SymbolizerSection debug_str;
+    SymbolizerSection debug_line_str;
+    SymbolizerSection debug_str_offsets;
+    SymbolizerSection debug_addr;
+    SymbolizerSection debug_ranges;
+    SymbolizerSection debug_rnglists;
+
+    SymbolizerSymbol *symbols;  /* sorted by address. */
+    size_t total_symbols;
+
+    SymbolizerUnit *units;  /* sorted by offset. */
+    size_t total_units;
+    SymbolizerRange *unit_ranges;
+    uint64 *unit_maxhi;
+    size_t total_unit_ranges;
+    bool indexed;
+
+    void index_units(SymbolizerAbbrevTable &abbrevs) throw (const char *);
+    const SymbolizerSymbol *find_symbol(uint64 pc) const;
+    size_t find_unit(uint64 pc) const;  /* total_units if there isn't one. */
+    size_t find_unit_by_offset(uint64 offset) const;
+
+    const char *string(const SymbolizerUnit &unit,
+                       const SymbolizerAttr &attr) const;
+    bool address(const SymbolizerUnit &unit, const SymbolizerAttr &attr,
+                 uint64 &addr) const;
+    bool ranges(const SymbolizerUnit &unit, const SymbolizerAttr &attr,
+                SymbolizerRanges &out) const throw (const char *);
+
+private:
+    void cleanup();
+    bool map_file(const char *fn, const uint8 *&ptr, size_t &size,
+                  struct stat *statbuf);
+    bool find_debug_file();
+    bool read_unit_header(SymbolizerReader &r, SymbolizerUnit &unit) const;
+    void read_unit_die(SymbolizerUnit &unit, SymbolizerAbbrevTable &abbrevs,
+                       SymbolizerRanges &out) throw (const char *);
+
+    const uint8 *map;
+    size_t map_size;
+    const uint8 *debug_map;  /* a separate debug file, if we found one. */
+    size_t debug_map_size;
+    size_t units_alloc;
+    size_t unit_ranges_alloc;
+    size_t symbols_alloc;
+    const char *debuglink;
+
+    SymbolizerModule(const SymbolizerModule &);  // no copying.
+    SymbolizerModule &operator =(const SymbolizerModule &);
+};
+
+
+/*
+ * Bits of ELF we need. See elf.h, which not everything we build on has.
+ */
+#define SYMBOLIZER_ELF_ET_EXEC 2
+#define SYMBOLIZER_ELF_ET_DYN 3
+#define SYMBOLIZER_ELF_PT_LOAD 1
+#define SYMBOLIZER_ELF_SHT_SYMTAB 2
+#define SYMBOLIZER_ELF_SHT_NOTE 7
+#define SYMBOLIZER_ELF_SHT_NOBITS 8
+#define SYMBOLIZER_ELF_SHT_DYNSYM 11
+#define SYMBOLIZER_ELF_SHF_COMPRESSED 0x800
+#define SYMBOLIZER_ELF_STT_FUNC 2
+#define SYMBOLIZER_ELF_STT_GNU_IFUNC 10
+#define SYMBOLIZER_ELF_NT_GNU_BUILD_ID 3
+
+// Where the sections of an ELF file are, and what we found in them.
+class SymbolizerElf
+{
+public:
+    SymbolizerElf(const uint8 *_map, size_t _size)
+        : map(_map), size(_size), is64(false), swap(false), type(0),
+          phoff(0), phnum(0), phentsize(0), shoff(0), shnum(0),
+          shentsize(0), shstrtab(NULL), shstrtab_size(0) {}
+    const uint8 *map;
+    size_t size;
+    bool is64;
+    bool swap;
+    uint16 type;
+    uint64 phoff;
+    uint64 phnum;
+    uint64 phentsize;
+    uint64 shoff;
+    uint64 shnum;
+    uint64 shentsize;
+    const char *shstrtab;
+    uint64 shstrtab_size;
+
+    bool parse();
+    SymbolizerReader at(uint64 offset, uint64 len) const
+    {
+        if ((offset > size) || (len > (size - offset)))
+        {
+            SymbolizerReader r(map, map, swap);
+            r.overflow = true;
+            return(r);
+        } // if
+        const uint8 *ptr = map + ((size_t) offset);
+        return(SymbolizerReader(ptr, ptr + ((size_t) len), swap));
+    } // at
+
+    // A section's header fields, in ELF64 order either way.
+    bool section(uint64 idx, uint32 &name, uint32 &type, uint64 &flags,
+                 uint64 &addr, uint64 &offset, uint64 &len,
+                 uint32 &link, uint64 &entsize) const
+    {
+        SymbolizerReader r(at(shoff + (idx * shentsize), shentsize));
+        name = r.u32();
+        type = r.u32();
+        flags = is64 ? r.u64() : r.u32();
+        addr = is64 ? r.u64() : r.u32();
+        offset = is64 ? r.u64() : r.u32();
+        len = is64 ? r.u64() : r.u32();
+        link = r.u32();
+        r.u32();  // sh_info
+        r.skip(is64 ? 8 : 4);  // sh_addralign
+        entsize = is64 ? r.u64() : r.u32();
+        return(!r.overflow);
+    } // section
+
+    const char *section_name(uint32 name) const
+    {
+        if ((shstrtab == NULL) || (name >= shstrtab_size))
+            return("");
+        const char *str = shstrtab + name;
+        if (memchr(str, '\0', (size_t) (shstrtab_size - name)) == NULL)
+            return("");
+        return(str);
+    } // section_name
+
+    bool section_data(uint64 offset, uint64 len, uint32 type,
+                      SymbolizerSection &sec) const
+    {
+        if ((type == SYMBOLIZER_ELF_SHT_NOBITS) || (offset > size) ||
+            (len > (size - offset)))
+            return(false);
+        sec.data = map + ((size_t) offset);
+        sec.size = (size_t) len;
+        return(true);
+    } // section_data
+};
+
+
+bool SymbolizerElf::parse()
+{
+    if ((size < 52) || (memcmp(map, "\177ELF", 4) != 0))
+        return(false);
+    else if ((map[4] != 1) && (map[4] != 2))
+        return(false);
+    else if ((map[5] != 1) && (map[5] != 2))
+        return(false);
+
+    is64 = (map[4] == 2);
+    static const uint16 one = 1;
+    const bool littleendian = (*((const uint8 *) &one) == 1);
+    swap = ((map[5] == 2) == littleendian);
+    if ((is64) && (size < 64))
+        return(false);
+
+    SymbolizerReader r(map + 16, map + size, swap);
+    type = r.u16();
+    r.u16();  // e_machine
+    r.u32();  // e_version
+    r.skip(is64 ? 8 : 4);  // e_entry
+    phoff = is64 ? r.u64() : r.u32();
+    shoff = is64 ? r.u64() : r.u32();
+    r.u32();  // e_flags
+    r.u16();  // e_ehsize
+    phentsize = r.u16();
+    phnum = r.u16();
+    shentsize = r.u16();
+    shnum = r.u16();
+    uint64 shstrndx = r.u16();
+    if ((r.overflow) || (shentsize < (is64 ? 64u : 40u)) ||
+        ((phnum > 0) && (phentsize < (is64 ? 56u : 32u))))
+        return(false);
+
+    uint32 name, stype, link;
+    uint64 flags, addr, offset, len, entsize;
+
+    // lots of sections? The real counts are in section zero.
+    if ((shoff != 0) && ((shnum == 0) || (shstrndx == 0xFFFF)))
+    {
+        if (!section(0, name, stype, flags, addr, offset, len, link, entsize))
+            return(false);
+        if (shnum == 0)
+            shnum = len;
+        if (shstrndx == 0xFFFF)
+            shstrndx = link;
+    } // if
+
+    if ((shoff == 0) || (shoff > size) ||
+        (shnum > ((size - shoff) / shentsize)))
+        shnum = 0;  // no sections we can use.
+
+    if ((shstrndx < shnum) &&
+        (section(shstrndx, name, stype, flags, addr, offset, len, link,
+                 entsize)) && (offset < size) && (len <= (size - offset)))
+    {
+        shstrtab = (const char *) (map + ((size_t) offset));
+        shstrtab_size = len;
+    } // if
+
+    return(true);
+} // SymbolizerElf::parse
+
+
+static int symbolizer_symbolcmp(const void *_a, const void *_b)
+{
+    const SymbolizerSymbol *a = (const SymbolizerSymbol *) _a;
+    const SymbolizerSymbol *b = (const SymbolizerSymbol *) _b;
+    if (a->addr != b->addr)
+        return((a->addr < b->addr) ? -1 : 1);
+    else if (a->size != b->size)
+        return((a->size > b->size) ? -1 : 1);  // sized ones first.
+    return(strcmp(a->name, b->name));
+} // symbolizer_symbolcmp
+
+
+// Pulls the function symbols out of a symbol table section.
+static void read_symbols(const SymbolizerElf &elf, uint64 offset, uint64 len,
+                         uint32 link, SymbolizerSymbol *&symbols,
+                         size_t &total, size_t &alloc) throw (const char *)
+{
+    uint32 name, type, strlink;
+    uint64 flags, addr, stroffset, strlen, entsize;
+    if (!elf.section(link, name, type, flags, addr, stroffset, strlen,
+                     strlink, entsize))
+        return;
+    else if ((stroffset > elf.size) || (strlen > (elf.size - stroffset)))
+        return;
+
+    SymbolizerSection strtab;
+    strtab.data = elf.map + ((size_t) stroffset);
+    strtab.size = (size_t) strlen;
+
+    const uint64 symsize = elf.is64 ? 24 : 16;
+    const uint64 count = len / symsize;
+    SymbolizerReader r(elf.at(offset, count * symsize));
+    if (r.overflow)
+        return;
+
+    for (uint64 i = 0; i < count; i++)
+    {
+        uint32 stname;
+        uint8 info;
+        uint16 shndx;
+        uint64 value, size;
+        if (elf.is64)
+        {
+            stname = r.u32();
+            info = r.u8();
+            r.u8();  // st_other
+            shndx = r.u16();
+            value = r.u64();
+            size = r.u64();
+        } // if
+        else
+        {
+            stname = r.u32();
+            value = r.u32();
+            size = r.u32();
+            info = r.u8();
+            r.u8();  // st_other
+            shndx = r.u16();
+        } // else
+
+        const uint8 stt = info & 0xF;
+        if ((shndx == 0) || (value == 0) ||
+            ((stt != SYMBOLIZER_ELF_STT_FUNC) &&
+             (stt != SYMBOLIZER_ELF_STT_GNU_IFUNC)))
+            continue;
+
+        const char *str = strtab.string(stname);
+        if ((str == NULL) || (*str == '\0'))
+            continue;
+
+        symbolizer_grow(symbols, alloc, total + 1);
+        SymbolizerSymbol &sym = symbols[total++];
+        sym.addr = value;
+        sym.size = size;
+        sym.name = str;
+    } // for
+} // read_symbols
+
+
+bool SymbolizerModule::map_file(const char *fn, const uint8 *&ptr,
+                                size_t &size, struct stat *statbuf)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd == -1)
+        return(false);
+
+    struct stat st;
+    if ((fstat(fd, &st) == -1) || (!S_ISREG(st.st_mode)) ||
+        (st.st_size == 0))
+    {
+        close(fd);
+        return(false);
+    } // if
+
+    size = (size_t) st.st_size;
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return(false);
+
+    ptr = (const uint8 *) mapped;
+    if (statbuf != NULL)
+        *statbuf = st;
+    return(true);
+} // SymbolizerModule::map_file
+
+
+// Fills in our debug sections from (elf), if it has any we can use.
+static bool read_debug_sections(const SymbolizerElf &elf,
+                                SymbolizerModule &module)
+{
+    SymbolizerSection *secs[9];
+    static const char *names[9] = {
+        ".debug_info", ".debug_abbrev", ".debug_line", ".debug_str",
+        ".debug_line_str", ".debug_str_offsets", ".debug_addr",
+        ".debug_ranges", ".debug_rnglists"
+    };
+    secs[0] = &module.debug_info;
+    secs[1] = &module.debug_abbrev;
+    secs[2] = &module.debug_line;
+    secs[3] = &module.debug_str;
+    secs[4] = &module.debug_line_str;
+    secs[5] = &module.debug_str_offsets;
+    secs[6] = &module.debug_addr;
+    secs[7] = &module.debug_ranges;
+    secs[8] = &module.debug_rnglists;
+
+    SymbolizerSection found[9];
+    for (uint64 i = 1; i < elf.shnum; i++)
+    {
+        uint32 name, type, link;
+        uint64 flags, addr, offset, len, entsize;
+        if (!elf.section(i, name, type, flags, addr, offset, len, link,
+                         entsize))
+            continue;
+
+        // !!! FIXME: compressed sections need zlib, which we don't link.
+        if (flags & SYMBOLIZER_ELF_SHF_COMPRESSED)
+            continue;
+
+        const char *str = elf.section_name(name);
+        for (int j = 0; j < 9; j++)
+        {
+            if (strcmp(str, names[j]) == 0)
+                elf.section_data(offset, len, type, found[j]);
+        } // for
+    } // for
+
+    // line info alone is still worth having, but we need both halves of
+    //  .debug_info for anything.
+    if ((found[2].data == NULL) &&
+        ((found[0].data == NULL) || (found[1].data == NULL)))
+        return(false);
+
+    for (int i = 0; i < 9; i++)
+        *secs[i] = found[i];
+    return(true);
+} // read_debug_sections
+
+
+SymbolizerModule::SymbolizerModule(const char *_fname, dumpptr base)
+    throw (const char *)
+    : fname(NULL), filesize(0), mtime(0), buildid_len(0), start(0), end(0),
+      bias(0), swap(false), symbols(NULL), total_symbols(0), units(NULL),
+      total_units(0), unit_ranges(NULL), unit_maxhi(NULL),
+      total_unit_ranges(0), indexed(false), map(NULL), map_size(0),
+      debug_map(NULL), debug_map_size(0), units_alloc(0),
+      unit_ranges_alloc(0), symbols_alloc(0), debuglink(NULL)
+{
+    struct stat statbuf;
+    if (!map_file(_fname, map, map_size, &statbuf))
+        throw((const char *) strerror(errno));
+
+    fname = new char[strlen(_fname) + 1];
+    strcpy(fname, _fname);
+    filesize = (uint64) statbuf.st_size;
+    mtime = (uint64) statbuf.st_mtime;
+
+    SymbolizerElf elf(map, map_size);
+    if (!elf.parse())
+    {
+        cleanup();
+        throw("Not an ELF file");
+    } // if
+    swap = elf.swap;
+
+    // where it goes in memory...
+    bool loadable = false;
+    uint64 lo = 0, hi = 0, linkbase = 0;
+    for (uint64 i = 0; i < elf.phnum; i++)
+    {
+        SymbolizerReader r(elf.at(elf.phoff + (i * elf.phentsize),
+                                  elf.phentsize));
+        const uint32 type = r.u32();
+        uint64 offset, vaddr, memsz;
+        if (elf.is64)
+        {
+            r.u32();  // p_flags
+            offset = r.u64();
+            vaddr = r.u64();
+            r.u64();  // p_paddr
+            r.u64();  // p_filesz
+            memsz = r.u64();
+        } // if
+        else
+        {
+            offset = r.u32();
+            vaddr = r.u32();
+            r.u32();  // p_paddr
+            r.u32();  // p_filesz
+            memsz = r.u32();
+        } // else
+
+        if ((r.overflow) || (type != SYMBOLIZER_ELF_PT_LOAD))
+            continue;
+        else if ((!loadable) || (vaddr < lo))
+        {
+            lo = vaddr;
+            linkbase = vaddr - offset;
+        } // else if
+        if ((!loadable) || ((vaddr + memsz) > hi))
+            hi = vaddr + memsz;
+        loadable = true;
+    } // for
+
+    if ((!loadable) || ((elf.type != SYMBOLIZER_ELF_ET_EXEC) &&
+                        (elf.type != SYMBOLIZER_ELF_ET_DYN)))
+    {
+        cleanup();
+        throw("Not an executable or shared library");
+    } // if
+
+    if (elf.type == SYMBOLIZER_ELF_ET_DYN)
+        bias = base - linkbase;
+    start = lo + bias;
+    end = hi + bias;
+
+    // ...its symbols, build id and debug info...
+    bool have_symtab = false;
+    uint64 dynsym[3] = { 0, 0, 0 };
+    for (uint64 i = 1; i < elf.shnum; i++)
+    {
+        uint32 name, type, link;
+        uint64 flags, addr, offset, len, entsize;
+        if (!elf.section(i, name, type, flags, addr, offset, len, link,
+                         entsize))
+            continue;
+
+        const char *str = elf.section_name(name);
+        if (type == SYMBOLIZER_ELF_SHT_SYMTAB)
+        {
+            read_symbols(elf, offset, len, link, symbols, total_symbols,
+                         symbols_alloc);
+            have_symtab = true;
+        } // if
+        else if (type == SYMBOLIZER_ELF_SHT_DYNSYM)
+        {
+            dynsym[0] = offset;
+            dynsym[1] = len;
+            dynsym[2] = link;
+        } // else if
+        else if ((type == SYMBOLIZER_ELF_SHT_NOTE) && (buildid_len == 0))
+        {
+            SymbolizerReader r(elf.at(offset, len));
+            while ((!r.overflow) && (r.ptr < r.end))
+            {
+                const uint32 namesz = r.u32();
+                const uint32 descsz = r.u32();
+                const uint32 notetype = r.u32();
+                const uint8 *notename = r.ptr;
+                r.skip((namesz + 3) & ~3);
+                const uint8 *desc = r.ptr;
+                r.skip((descsz + 3) & ~3);
+                if ((!r.overflow) && (notetype == SYMBOLIZER_ELF_NT_GNU_BUILD_ID)
+                    && (namesz == 4) && (memcmp(notename, "GNU", 4) == 0) &&
+                    (descsz > 0) && (descsz <= sizeof (buildid)))
+                {
+                    memcpy(buildid, desc, descsz);
+                    buildid_len = descsz;
+                } // if
+            } // while
+        } // else if
+        else if (strcmp(str, ".gnu_debuglink") == 0)
+        {
+            SymbolizerReader r(elf.at(offset, len));
+            debuglink = r.str();
+        } // else if
+    } // for
+
+    if ((!read_debug_sections(elf, *this)) && (find_debug_file()))
+    {
+        SymbolizerElf debugelf(debug_map, debug_map_size);
+        if ((debugelf.parse()) && (debugelf.swap == swap))
+        {
+            read_debug_sections(debugelf, *this);
+            if (!have_symtab)
+            {
+                for (uint64 i = 1; i < debugelf.shnum; i++)
+                {
+                    uint32 name, type, link;
+                    uint64 flags, addr, offset, len, entsize;
+                    if ((debugelf.section(i, name, type, flags, addr, offset,
+                                          len, link, entsize)) &&
+                        (type == SYMBOLIZER_ELF_SHT_SYMTAB))
+                    {
+                        read_symbols(debugelf, offset, len, link, symbols,
+                                     total_symbols, symbols_alloc);
+                        have_symtab = true;
+                    } // if
+                } // for
+            } // if
+        } // if
+    } // if
+
+    if ((!have_symtab) && (dynsym[1] > 0))
+    {
+        read_symbols(elf, dynsym[0], dynsym[1], (uint32) dynsym[2], symbols,
+                     total_symbols, symbols_alloc);
+    } // if
+
+    qsort(symbols, total_symbols, sizeof (SymbolizerSymbol),
+          symbolizer_symbolcmp);
+} // SymbolizerModule::SymbolizerModule
+
+
+SymbolizerModule::~SymbolizerModule()
+{
+    cleanup();
+} // SymbolizerModule::~SymbolizerModule
+
+
+void SymbolizerModule::cleanup()
+{
+    if (map != NULL)
+        munmap((void *) map, map_size);
+    if (debug_map != NULL)
+        munmap((void *) debug_map, debug_map_size);
+    delete[] fname;
+    ::free(symbols);
+    ::free(units);
+    ::free(unit_ranges);
+    ::free(unit_maxhi);
+    map = debug_map = NULL;
+    fname = NULL;
+    symbols = NULL;
+    units = NULL;
+    unit_ranges = NULL;
+    unit_maxhi = NULL;
+} // SymbolizerModule::cleanup
+
+
+// Stripped debug info goes in /usr/lib/debug/.build-id/xx/yyyy.debug,
+//  or wherever .gnu_debuglink says, relative to the module.
+bool SymbolizerModule::find_debug_file()
+{
+    static const char *hex = "0123456789abcdef";
+    static const char *debugdir = "/usr/lib/debug";
+    const char *slash = strrchr(fname, '/');
+    const size_t dirlen = (slash == NULL) ? 0 : ((slash - fname) + 1);
+    const size_t linklen = (debuglink == NULL) ? 0 : strlen(debuglink);
+    char *path = new char[strlen(debugdir) + (sizeof (buildid) * 2) +
+                          dirlen + linklen + 32];
+
+    bool found = false;
+    if (buildid_len > 1)
+    {
+        char *ptr = path + sprintf(path, "%s/.build-id/", debugdir);
+        for (size_t i = 0; i < buildid_len; i++)
+        {
+            *(ptr++) = hex[buildid[i] >> 4];
+            *(ptr++) = hex[buildid[i] & 0xF];
+            if (i == 0)
+                *(ptr++) = '/';
+        } // for
+        strcpy(ptr, ".debug");
+        found = map_file(path, debug_map, debug_map_size, NULL);
+    } // if
+
+    for (int i = 0; (!found) && (linklen > 0) && (i < 3); i++)
+    {
+        switch (i)
+        {
+            case 0:  // next to the module.
+                sprintf(path, "%.*s%s", (int) dirlen, fname, debuglink);
+                break;
+
+            case 1:
+                sprintf(path, "%.*s.debug/%s", (int) dirlen, fname,
+                        debuglink);
+                break;
+
+            case 2:
+                sprintf(path, "%s/%.*s%s", debugdir, (int) dirlen, fname,
+                        debuglink);
+                break;
+        } // switch
+
+        // don't map ourselves again if the link points back at us.
+        if (strcmp(path, fname) != 0)
+            found = map_file(path, debug_map, debug_map_size, NULL);
+    } // for
+
+    delete[] path;
+    return(found);
+} // SymbolizerModule::find_debug_file
+
+
+const SymbolizerSymbol *SymbolizerModule::find_symbol(uint64 pc) const
+{
+    size_t lo = 0;
+    size_t hi = total_symbols;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    if (lo == 0)
+        return(NULL);
+
+    // aliases all have the same address; the sized one sorts first.
+    size_t i = lo - 1;
+    while ((i > 0) && (symbols[i - 1].addr == symbols[i].addr))
+        i--;
+
+    const SymbolizerSymbol *sym = &symbols[i];
+    if ((sym->size != 0) && (pc >= (sym->addr + sym->size)))
+        return(NULL);
+    return(sym);
+} // SymbolizerModule::find_symbol
+
+
+size_t SymbolizerModule::find_unit(uint64 pc) const
+{
+    size_t i = find_ranges(unit_ranges, total_unit_ranges, pc);
+    while ((i > 0) && (unit_maxhi[i - 1] > pc))
+    {
+        i--;
+        if (pc < unit_ranges[i].hi)
+            return(unit_ranges[i].index);
+    } // while
+    return(total_units);
+} // SymbolizerModule::find_unit
+
+
+size_t SymbolizerModule::find_unit_by_offset(uint64 offset) const
+{
+    size_t lo = 0;
+    size_t hi = total_units;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (units[mid].offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    if ((lo == 0) ||
+        (offset >= (uint64) (units[lo - 1].end - debug_info.data)))
+        return(total_units);
+    return(lo - 1);
+} // SymbolizerModule::find_unit_by_offset
+
+
+const char *SymbolizerModule::string(const SymbolizerUnit &unit,
+                                     const SymbolizerAttr &attr) const
+{
+    switch (attr.form)
+    {
+        case DW_FORM_string:
+            return((const char *) attr.data);
+
+        case DW_FORM_strp:
+            return(debug_str.string(attr.value));
+
+        case DW_FORM_line_strp:
+            return(debug_line_str.string(attr.value));
+
+        case DW_FORM_strx:
+        case DW_FORM_strx1:
+        case DW_FORM_strx2:
+        case DW_FORM_strx3:
+        case DW_FORM_strx4:
+        case DW_FORM_GNU_str_index:
+        {
+            const uint64 pos = unit.str_offsets_base +
+                               (attr.value * unit.offset_size);
+            if (pos >= debug_str_offsets.size)
+                return(NULL);
+            SymbolizerReader r(debug_str_offsets.data + ((size_t) pos),
+                               debug_str_offsets.data +
+                                   debug_str_offsets.size, swap);
+            const uint64 offset = r.uint(unit.offset_size);
+            return(r.overflow ? NULL : debug_str.string(offset));
+        } // case
+    } // switch
+
+    return(NULL);  // not a string, or a supplementary file's string.
+} // SymbolizerModule::string
+
+
+bool SymbolizerModule::address(const SymbolizerUnit &unit,
+                               const SymbolizerAttr &attr,
+                               uint64 &addr) const
+{
+    switch (attr.form)
+    {
+        case DW_FORM_addr:
+            addr = attr.value;
+            return(true);
+
+        case DW_FORM_addrx:
+        case DW_FORM_addrx1:
+        case DW_FORM_addrx2:
+        case DW_FORM_addrx3:
+        case DW_FORM_addrx4:
+        case DW_FORM_GNU_addr_index:
+        {
+            const uint64 pos = unit.addr_base + (attr.value * unit.addr_size);
+            if (pos >= debug_addr.size)
+                return(false);
+            SymbolizerReader r(debug_addr.data + ((size_t) pos),
+                               debug_addr.data + debug_addr.size, swap);
+            addr = r.uint(unit.addr_size);
+            return(!r.overflow);
+        } // case
+    } // switch
+
+    return(false);
+} // SymbolizerModule::address
+
+
+bool SymbolizerModule::ranges(const SymbolizerUnit &unit,
+                              const SymbolizerAttr &attr,
+                              SymbolizerRanges &out) const
+    throw (const char *)
+{
+    const uint64 maxaddr = (unit.addr_size >= 8) ? ((uint64) -1) :
+                           ((((uint64) 1) << (unit.addr_size * 8)) - 1);
+    uint64 base = unit.base_address;
+
+    if (unit.version < 5)  // .debug_ranges: pairs of addresses.
+    {
+        if (attr.value >= debug_ranges.size)
+            return(false);
+        SymbolizerReader r(debug_ranges.data + ((size_t) attr.value),
+                           debug_ranges.data + debug_ranges.size, swap);
+        while (!r.overflow)
+        {
+            const uint64 lo = r.uint(unit.addr_size);
+            const uint64 hi = r.uint(unit.addr_size);
+            if ((lo == 0) && (hi == 0))
+                break;
+            else if (lo == maxaddr)
+                base = hi;
+            else
+                out.add(base + lo, base + hi);
+        } // while
+        return(!r.overflow);
+    } // if
+
+    uint64 offset = attr.value;
+    if (attr.form == DW_FORM_rnglistx)
+    {
+        const uint64 pos = unit.rnglists_base +
+                           (attr.value * unit.offset_size);
+        if (pos >= debug_rnglists.size)
+            return(false);
+        SymbolizerReader r(debug_rnglists.data + ((size_t) pos),
+                           debug_rnglists.data + debug_rnglists.size, swap);
+        offset = unit.rnglists_base + r.uint(unit.offset_size);
+    } // if
+
+    if (offset >= debug_rnglists.size)
+        return(false);
+
+    SymbolizerReader r(debug_rnglists.data + ((size_t) offset),
+                       debug_rnglists.data + debug_rnglists.size, swap);
+    SymbolizerAttr addrx;
+    addrx.form = DW_FORM_addrx;
+    addrx.data = NULL;
+    while (!r.overflow)
+    {
+        uint64 lo = 0, hi = 0;
+        const uint8 kind = r.u8();
+        switch (kind)
+        {
+            case DW_RLE_end_of_list:
+                return(true);
+
+            case DW_RLE_base_addressx:
+                addrx.value = r.uleb();
+                if (!address(unit, addrx, base))
+                    return(false);
+                break;
+
+            case DW_RLE_startx_endx:
+                addrx.value = r.uleb();
+                if (!address(unit, addrx, lo))
+                    return(false);
+                addrx.value = r.uleb();
+                if (!address(unit, addrx, hi))
+                    return(false);
+                out.add(lo, hi);
+                break;
+
+            case DW_RLE_startx_length:
+                addrx.value = r.uleb();
+                if (!address(unit, addrx, lo))
+                    return(false);
+                out.add(lo, lo + r.uleb());
+                break;
+
+            case DW_RLE_offset_pair:
+                lo = r.uleb();
+                hi = r.uleb();
+                out.add(base + lo, base + hi);
+                break;
+
+            case DW_RLE_base_address:
+                base = r.uint(unit.addr_size);
+                break;
+
+            case DW_RLE_start_end:
+                lo = r.uint(unit.addr_size);
+                hi = r.uint(unit.addr_size);
+                out.add(lo, hi);
+                break;
+
+            case DW_RLE_start_length:
+                lo = r.uint(unit.addr_size);
+                out.add(lo, lo + r.uleb());
+                break;
+
+            default:
+                return(false);
+        } // switch
+    } // while
+
+    return(false);
+} // SymbolizerModule::ranges
+
+
+bool SymbolizerModule::read_unit_header(SymbolizerReader &r,
+                                        SymbolizerUnit &unit) const
+{
+    unit.offset = (uint64) (r.ptr - debug_info.data);
+    uint64 len = r.u32();
+    unit.offset_size = 4;
+    if (len == 0xFFFFFFFF)
+    {
+        len = r.u64();
+        unit.offset_size = 8;
+    } // if
+
+    if ((r.overflow) || (len > (uint64) (r.end - r.ptr)))
+        return(false);
+
+    unit.end = r.ptr + ((size_t) len);
+    unit.version = r.u16();
+    uint8 unittype = 0;
+    if (unit.version >= 5)
+    {
+        unittype = r.u8();
+        unit.addr_size = r.u8();
+        unit.abbrev_offset = r.uint(unit.offset_size);
+        if ((unittype == DW_UT_skeleton) || (unittype == DW_UT_split_compile))
+            r.u64();  // dwo id.
+        else if ((unittype == DW_UT_type) || (unittype == DW_UT_split_type))
+        {
+            r.u64();  // type signature.
+            r.uint(unit.offset_size);  // type offset.
+        } // else if
+    } // if
+    else
+    {
+        unit.abbrev_offset = r.uint(unit.offset_size);
+        unit.addr_size = r.u8();
+    } // else
+
+    unit.dies = r.ptr;
+    unit.str_offsets_base = 0;
+    unit.addr_base = 0;
+    unit.rnglists_base = 0;
+    unit.base_address = 0;
+    unit.stmt_list = 0;
+    unit.has_lines = false;
+    unit.comp_dir = NULL;
+
+    if ((r.overflow) || (unit.version < 2) || (unit.version > 5) ||
+        ((unit.addr_size != 4) && (unit.addr_size != 8)))
+        return(false);
+    return((unittype != DW_UT_type) && (unittype != DW_UT_split_type));
+} // SymbolizerModule::read_unit_header
+
+
+// Reads the unit's top DIE, and puts where its code is into (out).
+void SymbolizerModule::read_unit_die(SymbolizerUnit &unit,
+                                     SymbolizerAbbrevTable &abbrevs,
+                                     SymbolizerRanges &out)
+    throw (const char *)
+{
+    if ((abbrevs.offset != unit.abbrev_offset) &&
+        (!abbrevs.parse(debug_abbrev, unit.abbrev_offset, swap)))
+        return;
+
+    SymbolizerReader r(unit.dies, unit.end, swap);
+    const SymbolizerAbbrev *abbrev = abbrevs.get(r.uleb());
+    if (abbrev == NULL)
+        return;
+
+    // the bases can come after the attributes that need them, so hold on
+    //  to those until we've seen everything.
+    SymbolizerAttr lowpc, highpc, ranges_attr, comp_dir;
+    lowpc.name = highpc.name = ranges_attr.name = comp_dir.name = 0;
+    for (uint32 i = 0; i < abbrev->total_attrs; i++)
+    {
+        const SymbolizerAttrSpec &spec = abbrevs.attrs[abbrev->first_attr + i];
+        SymbolizerAttr attr;
+        if (!read_attr(r, unit, spec.form, spec.implicit_const, attr))
+            return;
+        attr.name = spec.name;
+        switch (spec.name)
+        {
+            case DW_AT_low_pc: lowpc = attr; break;
+            case DW_AT_high_pc: highpc = attr; break;
+            case DW_AT_ranges: ranges_attr = attr; break;
+            case DW_AT_comp_dir: comp_dir = attr; break;
+            case DW_AT_str_offsets_base:
+                unit.str_offsets_base = attr.value;
+                break;
+            case DW_AT_addr_base:
+            case DW_AT_GNU_addr_base:
+                unit.addr_base = attr.value;
+                break;
+            case DW_AT_rnglists_base:
+            case DW_AT_GNU_ranges_base:
+                unit.rnglists_base = attr.value;
+                break;
+            case DW_AT_stmt_list:
+                unit.stmt_list = attr.value;
+                unit.has_lines = true;
+                break;
+        } // switch
+    } // for
+
+    if (comp_dir.name != 0)
+        unit.comp_dir = string(unit, comp_dir);
+
+    uint64 lo = 0;
+    if ((lowpc.name != 0) && (address(unit, lowpc, lo)))
+        unit.base_address = lo;
+
+    if (ranges_attr.name != 0)
+        ranges(unit, ranges_attr, out);
+    else if ((lowpc.name != 0) && (highpc.name != 0))
+    {
+        uint64 hi = 0;
+        if (attr_is_constant(highpc))
+            out.add(lo, lo + highpc.value);
+        else if (address(unit, highpc, hi))
+            out.add(lo, hi);
+    } // else if
+} // SymbolizerModule::read_unit_die
+
+
+// Finds every compile unit, and what code it covers. Only the first DIE
+//  of each gets read, so this is quick, but it's only done when we need
+//  it, since most modules in a process never show up in a callstack.
+void SymbolizerModule::index_units(SymbolizerAbbrevTable &abbrevs)
+    throw (const char *)
+{
+    if (indexed)
+        return;
+    indexed = true;
+
+    if ((debug_info.data == NULL) || (debug_abbrev.data == NULL))
+        return;
+
+    SymbolizerRanges found;
+    SymbolizerReader r(debug_info.data, debug_info.data + debug_info.size,
+                       swap);
+    while ((!r.overflow) && (r.ptr < r.end))
+    {
+        SymbolizerUnit unit;
+        const bool usable = read_unit_header(r, unit);
+        if (r.overflow)
+            break;  // we're lost; the units after this can't be found.
+
+        r.ptr = unit.end;
+        if (!usable)
+            continue;
+
+        found.total = 0;
+        read_unit_die(unit, abbrevs, found);
+        symbolizer_grow(units, units_alloc, total_units + 1);
+        units[total_units] = unit;
+
+        symbolizer_grow(unit_ranges, unit_ranges_alloc,
+                        total_unit_ranges + found.total);
+        for (size_t i = 0; i < found.total; i++)
+        {
+            SymbolizerRange &range = unit_ranges[total_unit_ranges++];
+            range.lo = found.pairs[i * 2];
+            range.hi = found.pairs[(i * 2) + 1];
+            range.index = (uint32) total_units;
+        } // for
+        total_units++;
+    } // while
+
+    unit_maxhi = (uint64 *) malloc((total_unit_ranges + 1) * sizeof (uint64));
+    if (unit_maxhi == NULL)
+        throw("Out of memory");
+    sort_ranges(unit_ranges, unit_maxhi, total_unit_ranges);
+} // SymbolizerModule::index_units
+
+
+/*
+ * Everything we pull out of a compile unit to symbolize addresses in it:
+ *  its line table, and every function and inlined call that has code.
+ *  A job only has one of these at a time, and reuses it.
+ */
+class SymbolizerLineRow
+{
+public:
+    uint64 addr;
+    uint32 file;
+    uint32 line;
+    uint32 end_sequence;
+    uint32 order;  /* so sorting keeps sequences in the order we read. */
+};
+
+class SymbolizerLineFile
+{
+public:
+    const char *name;
+    uint32 dir;
+    const char *path;  /* dir and name put together, when needed. */
+};
+
+class SymbolizerScope
+{
+public:
+    uint64 die;  /* offset in .debug_info, for finding its name later. */
+    const char *name;
+    bool named;  /* true if we've looked for (name) already. */
+    bool inlined;
+    uint32 depth;  /* how many functions out from the unit it is. */
+    uint32 call_file;
+    uint32 call_line;
+};
+
+static int symbolizer_rowcmp(const void *_a, const void *_b)
+{
+    const SymbolizerLineRow *a = (const SymbolizerLineRow *) _a;
+    const SymbolizerLineRow *b = (const SymbolizerLineRow *) _b;
+    if (a->addr != b->addr)
+        return((a->addr < b->addr) ? -1 : 1);
+    else if (a->end_sequence != b->end_sequence)  // ends go first.
+        return((a->end_sequence > b->end_sequence) ? -1 : 1);
+    else if (a->order != b->order)
+        return((a->order < b->order) ? -1 : 1);
+    return(0);
+} // symbolizer_rowcmp
+
+
+class SymbolizerJob;
+static void *symbolizer_thread(void *_job);
+
+// One compile unit's worth of addresses (or a module's addresses that
+//  aren't in any unit) for a job to look up.
+class SymbolizerWork
+{
+public:
+    const SymbolizerModule *module;
+    size_t unit;  /* module->total_units if there isn't one. */
+    size_t first;  /* range of addresses in SymbolizerJob::addrs. */
+    size_t end;
+};
+
+class SymbolizerJob
+{
+public:
+    SymbolizerJob()
+        : addrs(NULL), work(NULL), total_work(0), first(0), stride(1),
+          first_frame(NULL), total_frames(NULL), frames(NULL),
+          frames_len(0), frames_alloc(0), pn(NULL), threaded(false),
+          error(NULL),
+          module(NULL), unit(NULL), other_abbrevs_unit((size_t) -1),
+          rows(NULL), total_rows(0), rows_alloc(0), files(NULL),
+          total_files(0), files_alloc(0), dirs(NULL), total_dirs(0),
+          dirs_alloc(0), scopes(NULL), total_scopes(0), scopes_alloc(0),
+          scope_ranges(NULL), scope_maxhi(NULL), total_scope_ranges(0),
+          scope_ranges_alloc(0), scope_maxhi_alloc(0), levels(NULL),
+          levels_alloc(0), found(NULL), found_alloc(0) {}
+
+    ~SymbolizerJob()
+    {
+        ::free(frames);
+        ::free(rows);
+        ::free(files);
+        ::free(dirs);
+        ::free(scopes);
+        ::free(scope_ranges);
+        ::free(scope_maxhi);
+        ::free(levels);
+        ::free(found);
+    } // destructor
+
+    // what to do...
+    const dumpptr *addrs;
+    const SymbolizerWork *work;
+    size_t total_work;
+    size_t first;  /* this job does work (first), (first+stride), etc. */
+    size_t stride;
+
+    // ...and what came of it: each address gets a run of (frames).
+    uint32 *first_frame;
+    uint32 *total_frames;
+    SymbolizedFrame *frames;
+    size_t frames_len;
+    size_t frames_alloc;
+    SymbolizerArena arena;
+
+    ProgressNotify *pn;  /* only the job on the main thread gets one. */
+    pthread_t thread;
+    bool threaded;
+    const char *error;  /* what went wrong, since threads can't throw. */
+
+    void run() throw (const char *);
+
+private:
+    void do_work(const SymbolizerWork &w) throw (const char *);
+    void add_frame(const char *function, const char *file, uint32 line,
+                   bool inlined) throw (const char *);
+    bool parse_lines() throw (const char *);
+    bool parse_line_entries(SymbolizerReader &r, const SymbolizerUnit &u,
+                            bool dirs) throw (const char *);
+    bool parse_scopes() throw (const char *);
+    const SymbolizerLineRow *find_row(uint64 pc) const;
+    const char *file_path(uint32 file) throw (const char *);
+    const char *scope_name(SymbolizerScope &scope) throw (const char *);
+    const char *die_name(uint64 die, int depth) throw (const char *);
+    const char *demangle(const char *name) throw (const char *);
+    const char *symbol_name(uint64 pc) throw (const char *);
+
+    // the unit we're working on.
+    const SymbolizerModule *module;
+    const SymbolizerUnit *unit;
+    SymbolizerAbbrevTable abbrevs;
+    SymbolizerAbbrevTable other_abbrevs;  /* for names in other units. */
+    size_t other_abbrevs_unit;
+
+    SymbolizerLineRow *rows;
+    size_t total_rows;
+    size_t rows_alloc;
+    SymbolizerLineFile *files;
+    size_t total_files;
+    size_t files_alloc;
+    const char **dirs;
+    size_t total_dirs;
+    size_t dirs_alloc;
+
+    SymbolizerScope *scopes;
+    size_t total_scopes;
+    size_t scopes_alloc;
+    SymbolizerRange *scope_ranges;
+    uint64 *scope_maxhi;
+    size_t total_scope_ranges;
+    size_t scope_ranges_alloc;
+    size_t scope_maxhi_alloc;
+    uint32 *levels;  /* scope depth at each level of the DIE tree. */
+    size_t levels_alloc;
+    uint32 *found;  /* scopes that have the address we're looking up. */
+    size_t found_alloc;
+
+    SymbolizerJob(const SymbolizerJob &);  // no copying.
+    SymbolizerJob &operator =(const SymbolizerJob &);
+};
+
+
+static void *symbolizer_thread(void *_job)
+{
+    SymbolizerJob *job = (SymbolizerJob *) _job;
+
+    try
+    {
+        job->run();
+    } // try
+
+    catch (const char *e)
+    {
+        job->error = e;
+    } // catch
+
+    return(NULL);
+} // symbolizer_thread
+
+
+void SymbolizerJob::run() throw (const char *)
+{
+    const size_t mine = (total_work - first + stride - 1) / stride;
+    size_t done = 0;
+    for (size_t i = first; i < total_work; i += stride)
+    {
+        do_work(work[i]);
+        if (pn != NULL)
+        {
+            const double pct = ((double) ++done) / ((double) mine);
+            pn->update("Symbolizing", (int) (pct * 100.0));
+        } // if
+    } // for
+} // SymbolizerJob::run
+
+
+void SymbolizerJob::add_frame(const char *function, const char *file,
+                              uint32 line, bool inlined)
+    throw (const char *)
+{
+    symbolizer_grow(frames, frames_alloc, frames_len + 1);
+    SymbolizedFrame &frame = frames[frames_len++];
+    frame.function = function;
+    frame.file = file;
+    frame.line = line;
+    frame.inlined = inlined;
+} // SymbolizerJob::add_frame
+
+
+const char *SymbolizerJob::demangle(const char *name) throw (const char *)
+{
+    if ((name == NULL) || (strncmp(name, "_Z", 2) != 0))
+        return(name);
+
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(name, NULL, NULL, &status);
+    if (demangled == NULL)
+        return(name);
+
+    // "foo() [clone .cold]" is still foo(), as far as anyone cares.
+    char *clone = strstr(demangled, " [clone ");
+    if (clone != NULL)
+        *clone = '\0';
+
+    const char *retval = NULL;
+    try
+    {
+        retval = arena.copy(demangled);
+    } // try
+
+    catch (const char *e)
+    {
+        ::free(demangled);
+        throw(e);
+    } // catch
+
+    ::free(demangled);
+    return(retval);
+} // SymbolizerJob::demangle
+
+
+const char *SymbolizerJob::symbol_name(uint64 pc) throw (const char *)
+{
+    const SymbolizerSymbol *sym = module->find_symbol(pc);
+    return((sym == NULL) ? NULL : demangle(sym->name));
+} // SymbolizerJob::symbol_name
+
+
+// The function that an address is in, and everything inlined into it
+//  there, innermost first.
+void SymbolizerJob::do_work(const SymbolizerWork &w) throw (const char *)
+{
+    module = w.module;
+    unit = NULL;
+    total_rows = 0;
+    total_files = 0;
+    total_dirs = 0;
+    total_scopes = 0;
+    total_scope_ranges = 0;
+
+    if (w.unit < module->total_units)
+    {
+        unit = &module->units[w.unit];
+        if ((abbrevs.offset != unit->abbrev_offset) &&
+            (!abbrevs.parse(module->debug_abbrev, unit->abbrev_offset,
+                            module->swap)))
+            unit = NULL;
+    } // if
+
+    // if either of these fails, we just have less to go on.
+    if ((unit != NULL) && (unit->has_lines) && (!parse_lines()))
+        total_rows = 0;
+    if ((unit != NULL) && (!parse_scopes()))
+        total_scopes = total_scope_ranges = 0;
+
+    for (size_t i = w.first; i < w.end; i++)
+    {
+        // these are return addresses, so look at the call before them.
+        const uint64 pc = ((uint64) (addrs[i] - module->bias)) - 1;
+        first_frame[i] = (uint32) frames_len;
+
+        // every scope that has (pc), outermost first.
+        size_t total_found = 0;
+        size_t r = find_ranges(scope_ranges, total_scope_ranges, pc);
+        while ((r > 0) && (scope_maxhi[r - 1] > pc))
+        {
+            r--;
+            if (pc >= scope_ranges[r].hi)
+                continue;
+            symbolizer_grow(found, found_alloc, total_found + 1);
+            found[total_found++] = scope_ranges[r].index;
+        } // while
+
+        // insertion sort by depth; there are only ever a few.
+        for (size_t j = 1; j < total_found; j++)
+        {
+            const uint32 idx = found[j];
+            size_t k = j;
+            while ((k > 0) && (scopes[found[k - 1]].depth > scopes[idx].depth))
+            {
+                found[k] = found[k - 1];
+                k--;
+            } // while
+            found[k] = idx;
+        } // for
+
+        const SymbolizerLineRow *row = find_row(pc);
+        const char *file = NULL;
+        uint32 line = 0;
+        if ((row != NULL) && (row->line != 0))
+        {
+            file = file_path(row->file);
+            line = (file == NULL) ? 0 : row->line;
+        } // if
+
+        if (total_found == 0)
+        {
+            const char *function = symbol_name(pc);
+            if ((function != NULL) || (file != NULL))
+                add_frame(function, file, line, false);
+        } // if
+
+        // innermost first; each one's line is its call to the one before.
+        for (size_t j = total_found; j > 0; j--)
+        {
+            SymbolizerScope &scope = scopes[found[j - 1]];
+            const char *function = NULL;
+            if ((j == 1) && (!scope.inlined))
+            {
+                // DWARF only has mangled names for things with external
+                //  linkage, but the symbol table has them for statics too.
+                const SymbolizerSymbol *sym = module->find_symbol(pc);
+                if ((sym != NULL) && (strncmp(sym->name, "_Z", 2) == 0))
+                    function = demangle(sym->name);
+            } // if
+
+            if (function == NULL)
+                function = scope_name(scope);
+            if ((function == NULL) && (j == 1))
+                function = symbol_name(pc);
+            add_frame(function, file, line, scope.inlined);
+            file = file_path(scope.call_file);
+            line = (file == NULL) ? 0 : scope.call_line;
+        } // for
+
+        total_frames[i] = (uint32) (frames_len - first_frame[i]);
+    } // for
+} // SymbolizerJob::do_work
+
+
+const SymbolizerLineRow *SymbolizerJob::find_row(uint64 pc) const
+{
+    size_t lo = 0;
+    size_t hi = total_rows;
+    while (lo < hi)
+    {
+        const size_t mid = (lo + hi) / 2;
+        if (rows[mid].addr <= pc)
+            lo = mid + 1;
+        else
+            hi = mid;
+    } // while
+
+    if ((lo == 0) || (rows[lo - 1].end_sequence))
+        return(NULL);
+    return(&rows[lo - 1]);
+} // SymbolizerJob::find_row
+
+
+const char *SymbolizerJob::file_path(uint32 file) throw (const char *)
+{
+    if ((file >= total_files) || (files[file].name == NULL))
+        return(NULL);
+    else if (files[file].path != NULL)
+        return(files[file].path);
+
+    const char *name = files[file].name;
+    const char *dir = (files[file].dir < total_dirs) ?
+                        dirs[files[file].dir] : NULL;
+    const char *compdir = unit->comp_dir;
+    if (name[0] == '/')
+        dir = compdir = NULL;
+    else if ((dir != NULL) && (dir[0] == '/'))
+        compdir = NULL;
+    if ((dir != NULL) && (dir == compdir))
+        compdir = NULL;
+
+    size_t len = strlen(name) + 1;
+    if (dir != NULL)
+        len += strlen(dir) + 1;
+    if (compdir != NULL)
+        len += strlen(compdir) + 1;
+
+    char *path = arena.alloc(len);
+    path[0] = '\0';
+    if (compdir != NULL)
+    {
+        strcat(path, compdir);
+        strcat(path, "/");
+    } // if
+    if (dir != NULL)
+    {
+        strcat(path, dir);
+        strcat(path, "/");
+    } // if
+    strcat(path, name);
+
+    files[file].path = path;
+    return(path);
+} // SymbolizerJob::file_path
+
+
+// DWARF 5 describes its directory and file entries in the line table
+//  header, instead of having a fixed layout.
+bool SymbolizerJob::parse_line_entries(SymbolizerReader &r,
+                                       const SymbolizerUnit &u, bool isdir)
+    throw (const char *)
+{
+    uint32 format[32];
+    const uint8 total_format = r.u8();
+    if (total_format > 16)
+        return(false);
+    for (uint8 i = 0; i < total_format; i++)
+    {
+        format[i * 2] = (uint32) r.uleb();
+        format[(i * 2) + 1] = (uint32) r.uleb();
+    } // for
+
+    const uint64 count = r.uleb();
+    for (uint64 i = 0; (i < count) && (!r.overflow); i++)
+    {
+        const char *path = NULL;
+        uint32 dir = 0;
+        for (uint8 j = 0; j < total_format; j++)
+        {
+            SymbolizerAttr attr;
+            if (!read_attr(r, u, format[(j * 2) + 1], 0, attr))
+                return(false);
+            if (format[j * 2] == DW_LNCT_path)
+                path = module->string(u, attr);
+            else if (format[j * 2] == DW_LNCT_directory_index)
+                dir = (uint32) attr.value;
+        } // for
+
+        if (isdir)
+        {
+            symbolizer_grow(dirs, dirs_alloc, total_dirs + 1);
+            dirs[total_dirs++] = path;
+        } // if
+        else
+        {
+            symbolizer_grow(files, files_alloc, total_files + 1);
+            SymbolizerLineFile &f = files[total_files++];
+            f.name = path;
+            f.dir = dir;
+            f.path = NULL;
+        } // else
+    } // for
+
+    return(!r.overflow);
+} // SymbolizerJob::parse_line_entries
+
+
+bool SymbolizerJob::parse_lines() throw (const char *)
+{
+    const SymbolizerSection &sec = module->debug_line;
+    if (unit->stmt_list >= sec.size)
+        return(false);
+
+    SymbolizerReader r(sec.data + ((size_t) unit->stmt_list),
+                       sec.data + sec.size, module->swap);
+
+    // the line table has its own idea of offset and address sizes.
+    SymbolizerUnit u(*unit);
+    uint64 len = r.u32();
+    u.offset_size = 4;
+    if (len == 0xFFFFFFFF)
+    {
+        len = r.u64();
+        u.offset_size = 8;
+    } // if
+    if ((r.overflow) || (len > (uint64) (r.end - r.ptr)))
+        return(false);
+    r.end = r.ptr + ((size_t) len);
+
+    const uint16 version = r.u16();
+    if ((version < 2) || (version > 5))
+        return(false);
+    else if (version >= 5)
+    {
+        u.addr_size = r.u8();
+        r.u8();  // segment selector size.
+    } // else if
+
+    const uint64 header_len = r.uint(u.offset_size);
+    if ((r.overflow) || (header_len > (uint64) (r.end - r.ptr)))
+        return(false);
+    const uint8 *program = r.ptr + ((size_t) header_len);
+
+    const uint8 min_inst_len = r.u8();
+    if (version >= 4)
+        r.u8();  // max ops per instruction; we don't do VLIW.
+    const bool default_is_stmt = (r.u8() != 0);
+    const uint8 line_base_byte = r.u8();
+    const int line_base = (int) ((signed char) line_base_byte);
+    const uint8 line_range = r.u8();
+    const uint8 opcode_base = r.u8();
+    uint8 opcode_lengths[256];
+    memset(opcode_lengths, '\0', sizeof (opcode_lengths));
+    for (uint32 i = 1; i < opcode_base; i++)
+        opcode_lengths[i] = r.u8();
+
+    (void) default_is_stmt;  // rows that aren't statements are still lines.
+    if ((r.overflow) || (line_range == 0))
+        return(false);
+
+    if (version >= 5)
+    {
+        if ((!parse_line_entries(r, u, true)) ||
+            (!parse_line_entries(r, u, false)))
+            return(false);
+    } // if
+    else
+    {
+        // directory zero and file zero are implied by the unit.
+        symbolizer_grow(dirs, dirs_alloc, 1);
+        dirs[total_dirs++] = unit->comp_dir;
+        while (!r.overflow)
+        {
+            const char *dir = r.str();
+            if ((dir == NULL) || (*dir == '\0'))
+                break;
+            symbolizer_grow(dirs, dirs_alloc, total_dirs + 1);
+            dirs[total_dirs++] = dir;
+        } // while
+
+        symbolizer_grow(files, files_alloc, 1);
+        files[total_files].name = NULL;
+        files[total_files].dir = 0;
+        files[total_files++].path = NULL;
+        while (!r.overflow)
+        {
+            const char *name = r.str();
+            if ((name == NULL) || (*name == '\0'))
+                break;
+            const uint32 dir = (uint32) r.uleb();
+            r.uleb();  // modification time.
+            r.uleb();  // file size.
+            symbolizer_grow(files, files_alloc, total_files + 1);
+            SymbolizerLineFile &f = files[total_files++];
+            f.name = name;
+            f.dir = dir;
+            f.path = NULL;
+        } // while
+    } // else
+
+    if (r.overflow)
+        return(false);
+
+    // now run the line program...
+    r.ptr = program;
+    uint64 addr = 0;
+    uint32 file = 1;
+    uint32 line = 1;
+    size_t sequence = total_rows;  /* first row of this sequence. */
+    bool emit = false;
+    while ((!r.overflow) && (r.ptr < r.end))
+    {
+        bool end_sequence = false;
+        const uint8 opcode = r.u8();
+        if (opcode >= opcode_base)  // special opcode.
+        {
+            const uint32 adjusted = opcode - opcode_base;
+            addr += (adjusted / line_range) * min_inst_len;
+            line += line_base + (adjusted % line_range);
+            emit = true;
+        } // if
+        else if (opcode == 0)  // extended opcode.
+        {
+            const uint64 oplen = r.uleb();
+            const uint8 *next = r.ptr + ((size_t) oplen);
+            if ((oplen == 0) || (oplen > (uint64) (r.end - r.ptr)))
+                break;
+            const uint8 subop = r.u8();
+            if (subop == DW_LNE_end_sequence)
+                emit = end_sequence = true;
+            else if (subop == DW_LNE_set_address)
+                addr = r.uint((size_t) (oplen - 1));
+            r.ptr = next;
+        } // else if
+        else
+        {
+            switch (opcode)
+            {
+                case DW_LNS_copy:
+                    emit = true;
+                    break;
+
+                case DW_LNS_advance_pc:
+                    addr += r.uleb() * min_inst_len;
+                    break;
+
+                case DW_LNS_advance_line:
+                    line += (uint32) r.sleb();
+                    break;
+
+                case DW_LNS_set_file:
+                    file = (uint32) r.uleb();
+                    break;
+
+                case DW_LNS_const_add_pc:
+                    addr += ((255 - opcode_base) / line_range) * min_inst_len;
+                    break;
+
+                case DW_LNS_fixed_advance_pc:
+                    addr += r.u16();
+                    break;
+
+                default:  // everything else just has arguments to skip.
+                    for (uint8 i = 0; i < opcode_lengths[opcode]; i++)
+                        r.uleb();
+                    break;
+            } // switch
+        } // else
+
+        if (!emit)
+            continue;
+        emit = false;
+
+        symbolizer_grow(rows, rows_alloc, total_rows + 1);
+        SymbolizerLineRow &row = rows[total_rows];
+        row.addr = addr;
+        row.file = file;
+        row.line = line;
+        row.end_sequence = end_sequence ? 1 : 0;
+        row.order = (uint32) total_rows++;
+
+        if (end_sequence)
+        {
+            // a sequence at zero is a function the linker threw away.
+            if (rows[sequence].addr == 0)
+                total_rows = sequence;
+            sequence = total_rows;
+            addr = 0;
+            file = line = 1;
+        } // if
+    } // while
+
+    if (sequence != total_rows)  // no end_sequence? Toss the last bit.
+        total_rows = sequence;
+
+    qsort(rows, total_rows, sizeof (SymbolizerLineRow), symbolizer_rowcmp);
+    return(true);
+} // SymbolizerJob::parse_lines
+
+
+// Walks the unit's DIEs, noting every function and inlined call that has
+//  code, and how deeply they're nested.
+bool SymbolizerJob::parse_scopes() throw (const char *)
+{
+    SymbolizerRanges found_ranges;
+    SymbolizerReader r(unit->dies, unit->end, module->swap);
+    size_t level = 0;
+    while ((!r.overflow) && (r.ptr < r.end))
+    {
+        const uint64 die = (uint64) (r.ptr - module->debug_info.data);
+        const uint64 code = r.uleb();
+        if (code == 0)  // end of this level's siblings.
+        {
+            if (level == 0)
+                break;
+            level--;
+            continue;
+        } // if
+
+        const SymbolizerAbbrev *abbrev = abbrevs.get(code);
+        if (abbrev == NULL)
+            return(false);
+
+        const bool isscope = ((abbrev->tag == DW_TAG_subprogram) ||
+                              (abbrev->tag == DW_TAG_inlined_subroutine));
+        SymbolizerAttr lowpc, highpc, ranges_attr;
+        lowpc.name = highpc.name = ranges_attr.name = 0;
+        uint64 sibling = 0;
+        uint32 call_file = 0, call_line = 0;
+        for (uint32 i = 0; i < abbrev->total_attrs; i++)
+        {
+            const SymbolizerAttrSpec &spec =
+                abbrevs.attrs[abbrev->first_attr + i];
+            SymbolizerAttr attr;
+            if (!read_attr(r, *unit, spec.form, spec.implicit_const, attr))
+                return(false);
+            attr.name = spec.name;
+            switch (spec.name)
+            {
+                case DW_AT_low_pc: lowpc = attr; break;
+                case DW_AT_high_pc: highpc = attr; break;
+                case DW_AT_ranges: ranges_attr = attr; break;
+                case DW_AT_call_file: call_file = (uint32) attr.value; break;
+                case DW_AT_call_line: call_line = (uint32) attr.value; break;
+                case DW_AT_sibling:
+                    if (spec.form != DW_FORM_ref_addr)
+                        sibling = unit->offset + attr.value;
+                    break;
+            } // switch
+        } // for
+
+        const uint32 outer = (level == 0) ? 0 : levels[level - 1];
+        const uint32 depth = outer + (isscope ? 1 : 0);
+
+        if (isscope)
+        {
+            found_ranges.total = 0;
+            uint64 lo = 0, hi = 0;
+            if (ranges_attr.name != 0)
+                module->ranges(*unit, ranges_attr, found_ranges);
+            else if ((lowpc.name != 0) && (highpc.name != 0) &&
+                     (module->address(*unit, lowpc, lo)))
+            {
+                if (attr_is_constant(highpc))
+                    found_ranges.add(lo, lo + highpc.value);
+                else if (module->address(*unit, highpc, hi))
+                    found_ranges.add(lo, hi);
+            } // else if
+
+            if (found_ranges.total > 0)
+            {
+                symbolizer_grow(scopes, scopes_alloc, total_scopes + 1);
+                SymbolizerScope &scope = scopes[total_scopes];
+                scope.die = die;
+                scope.name = NULL;
+                scope.named = false;
+                scope.inlined = (abbrev->tag == DW_TAG_inlined_subroutine);
+                scope.depth = depth;
+                scope.call_file = call_file;
+                scope.call_line = call_line;
+
+                symbolizer_grow(scope_ranges, scope_ranges_alloc,
+                                total_scope_ranges + found_ranges.total);
+                for (size_t i = 0; i < found_ranges.total; i++)
+                {
+                    SymbolizerRange &range =
+                        scope_ranges[total_scope_ranges++];
+                    range.lo = found_ranges.pairs[i * 2];
+                    range.hi = found_ranges.pairs[(i * 2) + 1];
+                    range.index = (uint32) total_scopes;
+                } // for
+                total_scopes++;
+            } // if
+        } // if
+
+        if (!abbrev->children)
+            continue;
+
+        // types can't have code in them, so skip them if we know how.
+        const bool istype = ((abbrev->tag == DW_TAG_structure_type) ||
+                             (abbrev->tag == DW_TAG_class_type) ||
+                             (abbrev->tag == DW_TAG_union_type) ||
+                             (abbrev->tag == DW_TAG_enumeration_type));
+        const uint64 here = (uint64) (r.ptr - module->debug_info.data);
+        if ((istype) && (sibling > here) &&
+            (sibling < (uint64) (r.end - module->debug_info.data)))
+        {
+            r.ptr = module->debug_info.data + ((size_t) sibling);
+            continue;
+        } // if
+
+        symbolizer_grow(levels, levels_alloc, level + 1);
+        levels[level++] = depth;
+    } // while
+
+    symbolizer_grow(scope_maxhi, scope_maxhi_alloc, total_scope_ranges);
+    sort_ranges(scope_ranges, scope_maxhi, total_scope_ranges);
+    return(!r.overflow);
+} // SymbolizerJob::parse_scopes
+
+
+const char *SymbolizerJob::scope_name(SymbolizerScope &scope)
+    throw (const char *)
+{
+    if (!scope.named)
+    {
+        scope.name = die_name(scope.die, 0);
+        scope.named = true;
+    } // if
+    return(scope.name);
+} // SymbolizerJob::scope_name
+
+
+// A function's name, following abstract origins (for inlined calls and
+//  out-of-line copies of inline functions) and specifications (for
+//  methods defined outside their class). Mangled names are better, since
+//  they demangle to the whole thing, with namespaces and arguments.
+const char *SymbolizerJob::die_name(uint64 die, int depth)
+    throw (const char *)
+{
+    if (depth > 8)
+        return(NULL);  // that's not going anywhere.
+
+    const size_t idx = module->find_unit_by_offset(die);
+    if (idx >= module->total_units)
+        return(NULL);
+
+    const SymbolizerUnit &u = module->units[idx];
+    SymbolizerAbbrevTable *table = &abbrevs;
+    if (u.abbrev_offset != abbrevs.offset)
+    {
+        table = &other_abbrevs;
+        if ((other_abbrevs_unit != idx) &&
+            (other_abbrevs.offset != u.abbrev_offset))
+        {
+            other_abbrevs_unit = (size_t) -1;
+            if (!other_abbrevs.parse(module->debug_abbrev, u.abbrev_offset,
+                                     module->swap))
+                return(NULL);
+        } // if
+        other_abbrevs_unit = idx;
+    } // if
+
+    SymbolizerReader r(module->debug_info.data + ((size_t) die), u.end,
+                       module->swap);
+    const SymbolizerAbbrev *abbrev = table->get(r.uleb());
+    if (abbrev == NULL)
+        return(NULL);
+
+    const char *name = NULL;
+    uint64 origin = 0;
+    for (uint32 i = 0; i < abbrev->total_attrs; i++)
+    {
+        const SymbolizerAttrSpec &spec = table->attrs[abbrev->first_attr + i];
+        SymbolizerAttr attr;
+        if (!read_attr(r, u, spec.form, spec.implicit_const, attr))
+            return(name);
+
+        switch (spec.name)
+        {
+            case DW_AT_linkage_name:
+            case DW_AT_MIPS_linkage_name:
+            {
+                const char *linkage = module->string(u, attr);
+                if (linkage != NULL)
+                    return(demangle(linkage));
+                break;
+            } // case
+
+            case DW_AT_name:
+                name = module->string(u, attr);
+                break;
+
+            case DW_AT_abstract_origin:
+            case DW_AT_specification:
+                if (spec.form == DW_FORM_ref_addr)
+                    origin = attr.value;
+                else if ((spec.form != DW_FORM_ref_sig8) &&
+                         (spec.form != DW_FORM_ref_sup4) &&
+                         (spec.form != DW_FORM_ref_sup8) &&
+                         (spec.form != DW_FORM_GNU_ref_alt))
+                    origin = u.offset + attr.value;
+                break;
+        } // switch
+    } // for
+
+    if (origin != 0)
+    {
+        const char *retval = die_name(origin, depth + 1);
+        if (retval != NULL)
+            return(retval);
+    } // if
+
+    return(name);
+} // SymbolizerJob::die_name
+
+
+/*
+ * The Symbolizer itself...
+ */
+
+Symbolizer::Symbolizer(const char *cachefname)
+    : cache_fname(NULL), cache_loaded(false), dirty(false), modules(NULL),
+      total_modules(0), entries(NULL), total_entries(0), entries_alloc(0),
+      entry_table(NULL), entry_table_size(0), frames(NULL), total_frames(0),
+      frames_alloc(0), strings(NULL),
+      strings_len(0), strings_alloc(0), string_table(NULL),
+      string_table_size(0), total_strings(0)
+{
+    if (cachefname != NULL)
+    {
+        cache_fname = new char[strlen(cachefname) + 1];
+        strcpy(cache_fname, cachefname);
+    } // if
+
+    // offset zero is the empty string, which is also "no string at all."
+    symbolizer_grow(strings, strings_alloc, 1);
+    strings[strings_len++] = '\0';
+} // Symbolizer::Symbolizer
+
+
+Symbolizer::~Symbolizer()
+{
+    for (size_t i = 0; i < total_modules; i++)
+        delete modules[i];
+    ::free(modules);
+    ::free(entries);
+    ::free(entry_table);
+    ::free(frames);
+    ::free(strings);
+    ::free(string_table);
+    delete[] cache_fname;
+} // Symbolizer::~Symbolizer
+
+
+void Symbolizer::addModule(const char *fname, dumpptr base)
+    throw (const char *)
+{
+    SymbolizerModule *module = new SymbolizerModule(fname, base);
+    SymbolizerModule **ptr = (SymbolizerModule **) realloc(modules,
+                            (total_modules + 1) * sizeof (SymbolizerModule *));
+    if (ptr == NULL)
+    {
+        delete module;
+        throw("Out of memory");
+    } // if
+
+    modules = ptr;
+    modules[total_modules++] = module;
+} // Symbolizer::addModule
+
+
+const SymbolizerModule *Symbolizer::find_module(dumpptr addr) const
+{
+    for (size_t i = 0; i < total_modules; i++)
+    {
+        const SymbolizerModule *module = modules[i];
+        if ((addr > module->start) && (addr <= module->end))
+            return(module);  // return addresses can be right at the end.
+    } // for
+    return(NULL);
+} // Symbolizer::find_module
+
+
+static inline size_t symbolizer_addrhash(dumpptr addr)
+{
+    const uint64 hash = ((uint64) addr) * 0x9E3779B97F4A7C15ULL;
+    return((size_t) (hash >> 32));
+} // symbolizer_addrhash
+
+
+const Symbolizer::Entry *Symbolizer::find(dumpptr addr) const
+{
+    if (entry_table_size == 0)
+        return(NULL);
+
+    const size_t mask = entry_table_size - 1;
+    size_t i = symbolizer_addrhash(addr) & mask;
+    uint32 idx;
+    while ((idx = entry_table[i]) != 0)
+    {
+        if (entries[idx - 1].addr == addr)
+            return(&entries[idx - 1]);
+        i = (i + 1) & mask;
+    } // while
+    return(NULL);
+} // Symbolizer::find
+
+
+void Symbolizer::grow_entry_table()
+{
+    const size_t size = (entry_table_size == 0) ? 1024 :
+                                                  (entry_table_size * 2);
+    uint32 *table = (uint32 *) calloc(size, sizeof (uint32));
+    if (table == NULL)
+        throw("Out of memory");
+
+    ::free(entry_table);
+    entry_table = table;
+    entry_table_size = size;
+
+    const size_t mask = size - 1;
+    for (size_t idx = 0; idx < total_entries; idx++)
+    {
+        size_t i = symbolizer_addrhash(entries[idx].addr) & mask;
+        while (entry_table[i] != 0)
+            i = (i + 1) & mask;
+        entry_table[i] = (uint32) (idx + 1);
+    } // for
+} // Symbolizer::grow_entry_table
+
+
+void Symbolizer::add_entry(dumpptr addr, uint32 first_frame,
+                           uint32 _total_frames)
+{
+    symbolizer_grow(entries, entries_alloc, total_entries + 1);
+    Entry &entry = entries[total_entries++];
+    entry.addr = addr;
+    entry.first_frame = first_frame;
+    entry.total_frames = _total_frames;
+
+    if ((total_entries * 2) > entry_table_size)
+        grow_entry_table();  // puts the new one in, too.
+    else
+    {
+        const size_t mask = entry_table_size - 1;
+        size_t i = symbolizer_addrhash(addr) & mask;
+        while (entry_table[i] != 0)
+            i = (i + 1) & mask;
+        entry_table[i] = (uint32) total_entries;
+    } // else
+} // Symbolizer::add_entry
+
+
+static inline size_t symbolizer_strhash(const char *str)
+{
+    uint32 hash = 2166136261u;  // FNV-1a.
+    while (*str)
+    {
+        hash ^= (uint8) *(str++);
+        hash *= 16777619u;
+    } // while
+    return((size_t) hash);
+} // symbolizer_strhash
+
+
+void Symbolizer::grow_string_table()
+{
+    const size_t size = (string_table_size == 0) ? 1024 :
+                                                   (string_table_size * 2);
+    uint32 *table = (uint32 *) calloc(size, sizeof (uint32));
+    if (table == NULL)
+        throw("Out of memory");
+
+    const size_t mask = size - 1;
+    for (size_t j = 0; j < string_table_size; j++)
+    {
+        const uint32 offset = string_table[j];
+        if (offset == 0)
+            continue;
+        size_t i = symbolizer_strhash(strings + offset) & mask;
+        while (table[i] != 0)
+            i = (i + 1) & mask;
+        table[i] = offset;
+    } // for
+
+    ::free(string_table);
+    string_table = table;
+    string_table_size = size;
+} // Symbolizer::grow_string_table
+
+
+uint32 Symbolizer::intern(const char *str)
+{
+    if ((str == NULL) || (*str == '\0'))
+        return(0);
+
+    if (((total_strings + 1) * 2) > string_table_size)
+        grow_string_table();
+
+    const size_t mask = string_table_size - 1;
+    size_t i = symbolizer_strhash(str) & mask;
+    uint32 offset;
+    while ((offset = string_table[i]) != 0)
+    {
+        if (strcmp(strings + offset, str) == 0)
+            return(offset);
+        i = (i + 1) & mask;
+    } // while
+
+    const size_t len = strlen(str) + 1;
+    if ((strings_len + len) > 0xFFFFFFFF)
+        throw("Too many symbols");
+    symbolizer_grow(strings, strings_alloc, strings_len + len);
+    offset = (uint32) strings_len;
+    memcpy(strings + strings_len, str, len);
+    strings_len += len;
+    string_table[i] = offset;
+    total_strings++;
+    return(offset);
+} // Symbolizer::intern
+
+
+static int symbolizer_addrcmp(const void *_a, const void *_b)
+{
+    const dumpptr a = *((const dumpptr *) _a);
+    const dumpptr b = *((const dumpptr *) _b);
+    if (a != b)
+        return((a < b) ? -1 : 1);
+    return(0);
+} // symbolizer_addrcmp
+
+
+// What symbolize() sorts addresses by, to group them into work.
+class SymbolizerTodo
+{
+public:
+    size_t module;
+    size_t unit;
+    dumpptr addr;
+};
+
+static int symbolizer_todocmp(const void *_a, const void *_b)
+{
+    const SymbolizerTodo *a = (const SymbolizerTodo *) _a;
+    const SymbolizerTodo *b = (const SymbolizerTodo *) _b;
+    if (a->module != b->module)
+        return((a->module < b->module) ? -1 : 1);
+    else if (a->unit != b->unit)
+        return((a->unit < b->unit) ? -1 : 1);
+    else if (a->addr != b->addr)
+        return((a->addr < b->addr) ? -1 : 1);
+    return(0);
+} // symbolizer_todocmp
+
+
+void Symbolizer::symbolize(const CallstackManager &cm, ProgressNotify &pn,
+                           int threads) throw (const char *)
+{
+    // a frame's address is the same wherever it's called from, so there
+    //  are usually a lot fewer of those than callstack nodes.
+    const size_t total = cm.getUniqueCallstackFrames();
+    dumpptr *addrs = new dumpptr[total + 1];
+    for (size_t i = 0; i < total; i++)
+        addrs[i] = cm.leaf((CallstackManager::callstackid) (i + 1));
+
+    try
+    {
+        symbolize(addrs, total, pn, threads);
+    } // try
+
+    catch (const char *e)
+    {
+        delete[] addrs;
+        throw(e);
+    } // catch
+
+    delete[] addrs;
+} // Symbolizer::symbolize
+
+
+void Symbolizer::symbolize(const dumpptr *addrs, size_t count,
+                           ProgressNotify &pn, int threads)
+    throw (const char *)
+{
+    if (!cache_loaded)
+        load_cache();
+
+    // find what we haven't done, without duplicates...
+    dumpptr *sorted = new dumpptr[count + 1];
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (find(addrs[i]) == NULL)
+            sorted[total++] = addrs[i];
+    } // for
+    qsort(sorted, total, sizeof (dumpptr), symbolizer_addrcmp);
+
+    size_t unique = 0;
+    for (size_t i = 0; i < total; i++)
+    {
+        if ((unique == 0) || (sorted[i] != sorted[unique - 1]))
+            sorted[unique++] = sorted[i];
+    } // for
+
+    if (unique == 0)
+    {
+        delete[] sorted;
+        return;
+    } // if
+
+    // ...figure out which unit of which module each one is in...
+    SymbolizerTodo *todo = new SymbolizerTodo[unique];
+    SymbolizerAbbrevTable abbrevs;
+    size_t total_todo = 0;
+    try
+    {
+        for (size_t i = 0; i < unique; i++)
+        {
+            const SymbolizerModule *found = find_module(sorted[i]);
+            if (found == NULL)
+            {
+                add_entry(sorted[i], 0, 0);  // nothing we can do.
+                continue;
+            } // if
+
+            size_t m = 0;
+            while (modules[m] != found)
+                m++;
+
+            SymbolizerModule *module = modules[m];
+            if (!module->indexed)
+            {
+                pn.update("Indexing debug info", 0);
+                module->index_units(abbrevs);
+            } // if
+
+            SymbolizerTodo &t = todo[total_todo++];
+            t.module = m;
+            t.unit = module->find_unit(((uint64) (sorted[i] - module->bias))
+                                       - 1);
+            t.addr = sorted[i];
+        } // for
+    } // try
+
+    catch (const char *e)
+    {
+        delete[] sorted;
+        delete[] todo;
+        throw(e);
+    } // catch
+
+    qsort(todo, total_todo, sizeof (SymbolizerTodo), symbolizer_todocmp);
+
+    // ...and carve them up into work, a unit at a time.
+    size_t total_work = 0;
+    for (size_t i = 0; i < total_todo; i++)
+    {
+        sorted[i] = todo[i].addr;
+        if ((i == 0) || (todo[i].module != todo[i - 1].module) ||
+            (todo[i].unit != todo[i - 1].unit))
+            total_work++;
+    } // for
+
+    SymbolizerWork *work = new SymbolizerWork[total_work + 1];
+    total_work = 0;
+    for (size_t i = 0; i < total_todo; i++)
+    {
+        if ((i > 0) && (todo[i].module == todo[i - 1].module) &&
+            (todo[i].unit == todo[i - 1].unit))
+            continue;
+        SymbolizerWork &w = work[total_work++];
+        w.module = modules[todo[i].module];
+        w.unit = todo[i].unit;
+        w.first = i;
+        w.end = i + 1;
+        while ((w.end < total_todo) && (todo[w.end].module == todo[i].module)
+               && (todo[w.end].unit == todo[i].unit))
+            w.end++;
+    } // for
+    delete[] todo;
+
+    size_t total_threads = (threads > 0) ? ((size_t) threads) : 0;
+    if (total_threads == 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        total_threads = (cpus > 0) ? ((size_t) cpus) : 1;
+    } // if
+
+    const size_t total_jobs = (total_threads < total_work) ?
+                                total_threads : total_work;
+    uint32 *first_frame = new uint32[total_todo + 1];
+    uint32 *job_frames = new uint32[total_todo + 1];
+    SymbolizerJob *jobs = new SymbolizerJob[total_jobs + 1];
+
+    pn.update("Symbolizing", 0);
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        SymbolizerJob &job = jobs[i];
+        job.addrs = sorted;
+        job.work = work;
+        job.total_work = total_work;
+        job.first = i;
+        job.stride = total_jobs;
+        job.first_frame = first_frame;
+        job.total_frames = job_frames;
+        if (i == 0)  // the first one runs on this thread.
+            job.pn = &pn;
+        else
+        {
+            job.threaded = (pthread_create(&job.thread, NULL,
+                                           symbolizer_thread, &job) == 0);
+        } // else
+    } // for
+
+    for (size_t i = 0; i < total_jobs; i++)
+    {
+        SymbolizerJob &job = jobs[i];
+        if (job.threaded)
+            pthread_join(job.thread, NULL);
+        else
+            symbolizer_thread(&job);
+    } // for
+
+    const char *error = NULL;
+    for (size_t i = 0; (error == NULL) && (i < total_jobs); i++)
+        error = jobs[i].error;
+
+    // merge everyone's results, putting the strings together as we go.
+    try
+    {
+        for (size_t w = 0; (error == NULL) && (w < total_work); w++)
+        {
+            const SymbolizerJob &job = jobs[w % total_jobs];
+            for (size_t i = work[w].first; i < work[w].end; i++)
+            {
+                const size_t first = total_frames;
+                const size_t count = job_frames[i];
+                symbolizer_grow(frames, frames_alloc, total_frames + count);
+                for (size_t j = 0; j < count; j++)
+                {
+                    const SymbolizedFrame &src = job.frames[first_frame[i] + j];
+                    Frame &frame = frames[total_frames++];
+                    frame.function = intern(src.function);
+                    frame.file = intern(src.file);
+                    frame.line = src.line;
+                    frame.inlined = src.inlined ? 1 : 0;
+                } // for
+                add_entry(sorted[i], (uint32) first, (uint32) count);
+            } // for
+        } // for
+    } // try
+
+    catch (const char *e)
+    {
+        error = e;
+    } // catch
+
+    delete[] jobs;
+    delete[] work;
+    delete[] first_frame;
+    delete[] job_frames;
+    delete[] sorted;
+
+    if (error != NULL)
+        throw(error);
+
+    pn.update("Symbolizing", 100);
+    dirty = (dirty || (total_todo > 0));
+    save_cache();
+} // Symbolizer::symbolize
+
+
+size_t Symbolizer::lookup(dumpptr addr, SymbolizedFrame *_frames,
+                          size_t max) const
+{
+    const Entry *entry = find(addr);
+    if (entry == NULL)
+        return(0);
+
+    for (size_t i = 0; (i < max) && (i < entry->total_frames); i++)
+    {
+        const Frame &frame = frames[entry->first_frame + i];
+        SymbolizedFrame &out = _frames[i];
+        out.function = (frame.function == 0) ? NULL : strings + frame.function;
+        out.file = (frame.file == 0) ? NULL : strings + frame.file;
+        out.line = frame.line;
+        out.inlined = (frame.inlined != 0);
+    } // for
+
+    return(entry->total_frames);
+} // Symbolizer::lookup
+
+
+uint32 Symbolizer::getFunctionKey(dumpptr addr) const
+{
+    // function names are interned, so where one is in (strings) is as
+    //  good as the name itself.
+    const Entry *entry = find(addr);
+    if ((entry == NULL) || (entry->total_frames == 0))
+        return(0);
+    return(frames[entry->first_frame + entry->total_frames - 1].function);
+} // Symbolizer::getFunctionKey
+
+
+uint32 Symbolizer::getModuleKey(dumpptr addr) const
+{
+    const SymbolizerModule *module = find_module(addr);
+    for (size_t i = 0; (module != NULL) && (i < total_modules); i++)
+    {
+        if (modules[i] == module)
+            return((uint32) (i + 1));
+    } // for
+    return(0);
+} // Symbolizer::getModuleKey
+
+
+/*
+ * The cache...
+ *
+ * It's keyed on the modules, since a symbol is the same no matter which
+ *  dumpfile it came from. Addresses are stored relative to their module,
+ *  so they're still good if it gets loaded somewhere else:
+ *
+ *  - SYMBOLIZER_CACHE_SIGNATURE, padded to 24 bytes.
+ *  - ui64s: format version, sizeof (dumpptr), then how many modules,
+ *    string bytes, addresses and frames there are.
+ *  - each module: ui64 file size and modification time, ui32 filename
+ *    and build id lengths, then the filename and build id.
+ *  - the strings, end to end. The first one is empty.
+ *  - each address: ui32 module and frame count, ui64 offset in the module.
+ *  - each frame: ui32 function and file (offsets into the strings),
+ *    line, and whether it was inlined. An address's frames come one after
+ *    another, in the same order as the addresses.
+ *
+ * Everything is in this machine's byte order, just like a DumpFile cache.
+ */
+
+#define SYMBOLIZER_CACHE_SIGNATURE "Malloc Monitor Symbols"
+#define SYMBOLIZER_CACHE_SIGNATURE_SIZE 24
+#define SYMBOLIZER_CACHE_VERSION 1
+#define SYMBOLIZER_CACHE_HEADER_FIELDS 6
+
+void Symbolizer::load_cache()
+{
+    cache_loaded = true;
+    if (cache_fname == NULL)
+        return;
+
+    int fd = open(cache_fname, O_RDONLY);
+    if (fd == -1)
+        return;
+
+    struct stat statbuf;
+    if ((fstat(fd, &statbuf) == -1) ||
+        (statbuf.st_size < (off_t) (SYMBOLIZER_CACHE_SIGNATURE_SIZE +
+                                   (SYMBOLIZER_CACHE_HEADER_FIELDS * 8))))
+    {
+        close(fd);
+        return;
+    } // if
+
+    const size_t size = (size_t) statbuf.st_size;
+    void *ptr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED)
+        return;
+
+    const uint8 *map = (const uint8 *) ptr;
+    const uint8 *end = map + size;
+    const uint8 *data = map + SYMBOLIZER_CACHE_SIGNATURE_SIZE;
+    uint64 header[SYMBOLIZER_CACHE_HEADER_FIELDS];
+    memcpy(header, data, sizeof (header));
+    data += sizeof (header);
+
+    if ((memcmp(map, SYMBOLIZER_CACHE_SIGNATURE,
+                sizeof (SYMBOLIZER_CACHE_SIGNATURE)) != 0) ||
+        (header[0] != SYMBOLIZER_CACHE_VERSION) ||
+        (header[1] != sizeof (dumpptr)))
+    {
+        munmap(ptr, size);
+        return;
+    } // if
+
+    const uint64 cache_modules = header[2];
+    const uint64 cache_strings = header[3];
+    const uint64 cache_entries = header[4];
+    const uint64 cache_frames = header[5];
+
+    // which of our modules are the cache's modules, if any.
+    const SymbolizerModule **matched = NULL;
+    if (cache_modules < (size / 24))
+        matched = new const SymbolizerModule*[cache_modules + 1];
+
+    bool valid = (matched != NULL);
+    for (uint64 i = 0; (valid) && (i < cache_modules); i++)
+    {
+        uint64 info[2];
+        uint32 lens[2];
+        valid = ((size_t) (end - data) >= (sizeof (info) + sizeof (lens)));
+        if (!valid)
+            break;
+        memcpy(info, data, sizeof (info));
+        memcpy(lens, data + sizeof (info), sizeof (lens));
+        data += sizeof (info) + sizeof (lens);
+        valid = (((uint64) (end - data)) >= (((uint64) lens[0]) + lens[1]));
+        if (!valid)
+            break;
+
+        const char *fname = (const char *) data;
+        const uint8 *buildid = data + lens[0];
+        data += lens[0] + lens[1];
+
+        matched[i] = NULL;
+        for (size_t j = 0; j < total_modules; j++)
+        {
+            const SymbolizerModule *module = modules[j];
+            if ((module->filesize == info[0]) && (module->mtime == info[1]) &&
+                (strlen(module->fname) == lens[0]) &&
+                (memcmp(module->fname, fname, lens[0]) == 0) &&
+                (module->buildid_len == lens[1]) &&
+                (memcmp(module->buildid, buildid, lens[1]) == 0))
+            {
+                matched[i] = module;
+                break;
+            } // if
+        } // for
+    } // for
+
+    const uint64 entrysize = 16;
+    const uint64 framesize = 16;
+    const char *cached_strings = (const char *) data;
+    if (valid)
+    {
+        const uint64 avail = (uint64) (end - data);
+        valid = ((cache_strings > 0) && (cache_strings <= avail) &&
+                 (cached_strings[cache_strings - 1] == '\0') &&
+                 (cache_entries <= ((avail - cache_strings) / entrysize)) &&
+                 (cache_frames <= ((avail - cache_strings -
+                                    (cache_entries * entrysize)) / framesize)));
+    } // if
+
+    const uint8 *cached_entries = data + ((size_t) cache_strings);
+    const uint8 *cached_frames = cached_entries +
+                                 ((size_t) (cache_entries * entrysize));
+    uint64 frame = 0;
+
+    try
+    {
+        for (uint64 i = 0; (valid) && (i < cache_entries); i++)
+        {
+            uint32 info[2];
+            uint64 offset;
+            memcpy(info, cached_entries + (i * entrysize), sizeof (info));
+            memcpy(&offset, cached_entries + (i * entrysize) + 8, 8);
+            const uint64 first = frame;
+            frame += info[1];
+            if ((info[0] >= cache_modules) || (frame > cache_frames))
+                break;  // corrupted; keep what we have so far.
+
+            const SymbolizerModule *module = matched[info[0]];
+            if (module == NULL)
+                continue;
+            const dumpptr addr = (dumpptr) (offset + module->bias);
+            if (find(addr) != NULL)
+                continue;
+
+            symbolizer_grow(frames, frames_alloc, total_frames + info[1]);
+            const uint32 firstframe = (uint32) total_frames;
+            for (uint32 j = 0; j < info[1]; j++)
+            {
+                uint32 f[4];
+                memcpy(f, cached_frames + ((first + j) * framesize),
+                       sizeof (f));
+                if ((f[0] >= cache_strings) || (f[1] >= cache_strings))
+                    f[0] = f[1] = 0;
+                Frame &out = frames[total_frames++];
+                out.function = intern(cached_strings + f[0]);
+                out.file = intern(cached_strings + f[1]);
+                out.line = f[2];
+                out.inlined = f[3];
+            } // for
+            add_entry(addr, firstframe, info[1]);
+        } // for
+    } // try
+
+    catch (const char *)
+    {
+        // out of memory; just symbolize whatever we couldn't load.
+    } // catch
+
+    delete[] matched;
+    munmap(ptr, size);
+} // Symbolizer::load_cache
+
+
+// Writes to a temp file and renames it over the cache when it's done, so
+//  nobody ever sees half a cache. Not being able to write it isn't an
+//  error; we'll just do the work again next time.
+void Symbolizer::save_cache()
+{
+    if ((cache_fname == NULL) || (!dirty))
+        return;
+
+    char *tmpfn = new char[strlen(cache_fname) + 8];
+    sprintf(tmpfn, "%s-XXXXXX", cache_fname);
+    int fd = mkstemp(tmpfn);
+    FILE *out = (fd == -1) ? NULL : fdopen(fd, "wb");
+    if (out == NULL)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+            unlink(tmpfn);
+        } // if
+        delete[] tmpfn;
+        return;
+    } // if
+
+    // only addresses in modules can be saved; count those first.
+    uint64 header[SYMBOLIZER_CACHE_HEADER_FIELDS];
+    header[0] = SYMBOLIZER_CACHE_VERSION;
+    header[1] = sizeof (dumpptr);
+    header[2] = total_modules;
+    header[3] = strings_len;
+    header[4] = header[5] = 0;
+    for (size_t i = 0; i < total_entries; i++)
+    {
+        if (find_module(entries[i].addr) != NULL)
+        {
+            header[4]++;
+            header[5] += entries[i].total_frames;
+        } // if
+    } // for
+
+    char sig[SYMBOLIZER_CACHE_SIGNATURE_SIZE];
+    memset(sig, '\0', sizeof (sig));
+    strcpy(sig, SYMBOLIZER_CACHE_SIGNATURE);
+    fwrite(sig, sizeof (sig), 1, out);
+    fwrite(header, sizeof (header), 1, out);
+
+    for (size_t i = 0; i < total_modules; i++)
+    {
+        const SymbolizerModule *module = modules[i];
+        const uint64 info[2] = { module->filesize, module->mtime };
+        const uint32 lens[2] = {
+            (uint32) strlen(module->fname), (uint32) module->buildid_len
+        };
+        fwrite(info, sizeof (info), 1, out);
+        fwrite(lens, sizeof (lens), 1, out);
+        fwrite(module->fname, lens[0], 1, out);
+        if (lens[1] > 0)
+            fwrite(module->buildid, lens[1], 1, out);
+    } // for
+
+    fwrite(strings, strings_len, 1, out);
+
+    for (size_t i = 0; i < total_entries; i++)
+    {
+        const Entry &entry = entries[i];
+        const SymbolizerModule *module = find_module(entry.addr);
+        if (module == NULL)
+            continue;
+        size_t m = 0;
+        while (modules[m] != module)
+            m++;
+        const uint32 info[2] = { (uint32) m, entry.total_frames };
+        const uint64 offset = (uint64) (entry.addr - module->bias);
+        fwrite(info, sizeof (info), 1, out);
+        fwrite(&offset, sizeof (offset), 1, out);
+    } // for
+
+    for (size_t i = 0; i < total_entries; i++)
+    {
+        const Entry &entry = entries[i];
+        if ((entry.total_frames > 0) && (find_module(entry.addr) != NULL))
+        {
+            fwrite(frames + entry.first_frame, sizeof (Frame),
+                   entry.total_frames, out);
+        } // if
+    } // for
+
+    const bool failed = (ferror(out) != 0);
+    if ((fclose(out) != 0) || (failed) || (rename(tmpfn, cache_fname) == -1))
+        unlink(tmpfn);
+    else
+        dirty = false;
+    delete[] tmpfn;
+} // Symbolizer::save_cache
+
+// end of symbolizer.cpp ...
+
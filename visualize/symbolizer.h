@@ -0,0 +1,155 @@
+/*
+ * Interface to turning callstack addresses into functions, files and lines.
+ *
+ * Written by Ryan C. Gordon (icculus@icculus.org)
+ *
+ * Please see the file LICENSE in the source's root directory.
+ */
+
+#ifndef _INCL_SYMBOLIZER_H_
+#define _INCL_SYMBOLIZER_H_
+
+#include "dumpfile.h"
+
+/*
+ * What an address turned into. One address can be several frames, if
+ *  the compiler inlined calls there: the innermost inlined function comes
+ *  first, and the real, out-of-line function that it all ended up in comes
+ *  last, just like the frames of a callstack. Each frame's file and line
+ *  are where it was when it called the frame before it (or, for the first
+ *  frame, where the address itself is).
+ */
+class SymbolizedFrame
+{
+public:
+    const char *function;  /* NULL if we couldn't find one. */
+    const char *file;  /* NULL if there's no line info. */
+    uint32 line;  /* zero if there's no line info. */
+    bool inlined;  /* true if this frame was inlined into the next one. */
+};
+
+
+class SymbolizerModule;  // one ELF file (see symbolizer.cpp).
+
+/*
+ * The Symbolizer reads ELF symbol tables and DWARF line and inlining info
+ *  straight out of the dumped binary and its shared libraries, so there's
+ *  no need to run addr2line on anything. If a file's debug info was
+ *  stripped into a separate file, we look for it by build id and
+ *  .gnu_debuglink, the same places gdb does.
+ *
+ * Dumpfiles don't say where each module was loaded, so the app has to add
+ *  them with addModule(). Then symbolize() looks up a batch of addresses
+ *  on several threads at once, and lookup() hands the results back. Each
+ *  address is only ever looked up once, so feed it a CallstackManager and
+ *  it'll only do the unique frames.
+ *
+ * Given a cache filename, results are saved there after symbolize(), and
+ *  loaded back the next time, for as long as the modules haven't changed.
+ *  Nothing is thrown for a cache that's missing, stale or unwritable.
+ */
+class Symbolizer
+{
+public:
+    Symbolizer(const char *cachefname = NULL);
+    ~Symbolizer();
+
+    /*
+     * (fname) is an ELF file that was loaded at (base), which is where its
+     *  first byte was mapped, as /proc/<pid>/maps shows it. Executables
+     *  that aren't position independent are always where they were linked,
+     *  so their (base) doesn't matter. A (base) of zero for anything else
+     *  means the addresses are offsets into the module. Throws if (fname)
+     *  isn't an ELF file we can read.
+     */
+    void addModule(const char *fname, dumpptr base = 0) throw (const char *);
+
+    /*
+     * Looks up everything in (addrs) that we haven't already, using
+     *  (threads) threads; zero means one per CPU. Addresses are return
+     *  addresses, like the ones in callstacks, so each one's line is the
+     *  call before it. The second version does every unique frame that
+     *  (cm) has.
+     */
+    void symbolize(const dumpptr *addrs, size_t count, ProgressNotify &pn,
+                   int threads = 0) throw (const char *);
+    void symbolize(const CallstackManager &cm, ProgressNotify &pn,
+                   int threads = 0) throw (const char *);
+
+    /*
+     * Fills in up to (max) frames for (addr), and returns how many there
+     *  are, which might be more than (max). Zero means we don't know
+     *  anything about (addr), or it hasn't been symbolize()d. The strings
+     *  are good until the next call to symbolize().
+     */
+    size_t lookup(dumpptr addr, SymbolizedFrame *frames, size_t max) const;
+
+    /*
+     * Keys for CallingContextTree::collapse(). Addresses in the same
+     *  function (the real one, not whatever was inlined there) get the same
+     *  function key, and addresses in the same module get the same module
+     *  key. Zero means we don't know. Function keys need symbolize() first;
+     *  module keys don't.
+     */
+    uint32 getFunctionKey(dumpptr addr) const;
+    uint32 getModuleKey(dumpptr addr) const;
+
+private:
+    class Entry
+    {
+    public:
+        dumpptr addr;
+        uint32 first_frame;
+        uint32 total_frames;
+    };
+
+    class Frame
+    {
+    public:
+        uint32 function;  /* offsets into (strings); zero is none. */
+        uint32 file;
+        uint32 line;
+        uint32 inlined;
+    };
+
+    const Entry *find(dumpptr addr) const;
+    void add_entry(dumpptr addr, uint32 first_frame, uint32 total_frames);
+    void grow_entry_table();
+    uint32 intern(const char *str);
+    void grow_string_table();
+    const SymbolizerModule *find_module(dumpptr addr) const;
+    void load_cache();
+    void save_cache();
+
+    char *cache_fname;
+    bool cache_loaded;
+    bool dirty;  /* true if there's anything the cache doesn't have. */
+
+    SymbolizerModule **modules;
+    size_t total_modules;
+
+    Entry *entries;
+    size_t total_entries;
+    size_t entries_alloc;
+    uint32 *entry_table;  /* index+1 of entries, hashed by address. */
+    size_t entry_table_size;  /* always a power of two. */
+
+    Frame *frames;
+    size_t total_frames;
+    size_t frames_alloc;
+
+    char *strings;  /* every string, end to end; the first is empty. */
+    size_t strings_len;
+    size_t strings_alloc;
+    uint32 *string_table;  /* offsets into (strings), hashed. */
+    size_t string_table_size;  /* always a power of two. */
+    size_t total_strings;
+
+    Symbolizer(const Symbolizer &);  // no copying.
+    Symbolizer &operator =(const Symbolizer &);
+}; // Symbolizer
+
+#endif
+
+/* end of symbolizer.h ... */
+